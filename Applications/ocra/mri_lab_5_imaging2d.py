@@ -66,9 +66,10 @@ class MRI_2DImag_Widget(MRI_2DImag_Widget_Base, MRI_2DImag_Widget_Form):
                                'EPI', 'EPI (grad_y off)',
                                'Spiral'])
         # self.seqType.currentIndexChanged.connect(self.seq_type_customized_display)
-        self.etlComboBox.addItems(['2', '4', '8', '16', '32'])
+        self.etlComboBox.addItems(['2']) # longer echo trains do not fit the gradient memory of the server
         self.etlLabel.setVisible(False)
         self.etlComboBox.setVisible(False)
+        self.hwLoopCheckBox.setChecked(False)
         self.uploadSeqButton.clicked.connect(self.upload_seq)
 
         # setup imaging parameters
@@ -141,6 +142,7 @@ class MRI_2DImag_Widget(MRI_2DImag_Widget_Base, MRI_2DImag_Widget_Form):
         self.etl_idx = 0
         self.npe_idx = 0
         self.seqType_idx = 0
+        self.hw_loop = 0 # 1: the server runs the phase encoding loop of SE/GRE on the sequencer
         self.img = []
         self.kspace_full = [] # full data
         self.kspace = [] # for recon
@@ -300,6 +302,7 @@ class MRI_2DImag_Widget(MRI_2DImag_Widget_Base, MRI_2DImag_Widget_Form):
         self.seqType_idx = self.seqType.currentIndex()
         self.etl = int(self.etlComboBox.currentText())
         self.etl_idx = self.etlComboBox.currentIndex()
+        self.hw_loop = int(self.hwLoopCheckBox.isChecked())
 
         if self.seqType_idx != 4: # not tse
             self.num_TR = self.num_pe
@@ -320,7 +323,7 @@ class MRI_2DImag_Widget(MRI_2DImag_Widget_Base, MRI_2DImag_Widget_Form):
         # signal to the server and start acquisition
         if self.seqType_idx != 4: # not tse
             gsocket.write(
-                struct.pack('<I', 2 << 28 | 0 << 24 | self.npe_idx << 4 | self.seqType_idx))
+                struct.pack('<I', 2 << 28 | 0 << 24 | self.hw_loop << 12 | self.npe_idx << 4 | self.seqType_idx))
             print("Acquiring data = {} x {}".format(self.num_pe, self.num_pe))
 
         else:  # tse
@@ -332,6 +335,7 @@ class MRI_2DImag_Widget(MRI_2DImag_Widget_Base, MRI_2DImag_Widget_Form):
         self.seqType.setEnabled(False)
         self.npe.setEnabled(False)
         self.etlComboBox.setEnabled(False)
+        self.hwLoopCheckBox.setEnabled(False)
         self.startButton.setEnabled(False)
         self.stopButton.setEnabled(True)
         self.uploadSeqButton.setEnabled(False)
@@ -664,6 +668,7 @@ class MRI_2DImag_Widget(MRI_2DImag_Widget_Base, MRI_2DImag_Widget_Form):
             self.seqType.setEnabled(True)
             self.npe.setEnabled(True)
             self.etlComboBox.setEnabled(True)
+            self.hwLoopCheckBox.setEnabled(True)
             self.stopButton.setEnabled(True)
             self.uploadSeqButton.setEnabled(True)
             self.acquireButton.setEnabled(True)
@@ -0,0 +1,120 @@
+/*
+  Gradient DAC codes shared by the waveform designers.
+
+  A gradient BRAM word is a 24 bit AD5781 SPI command: 0x1 in bits 23:20
+  (write DAC register) and the 16 bit code of the amplitude in bits 19:4,
+  with fLSB = 10/(2^15-1) per step. The designers used to compute
+
+    ival = (int32_t)floor(f/fLSB)*16;
+    g[i] = 0x001fffff & (ival | 0x00100000);
+
+  with a float division per sample. The code here multiplies by 1/fLSB
+  instead and only falls back to the division when the product is within
+  GRAD_DAC_EDGE of an integer, where the two could round to different
+  codes. The result is bit exact with the formula above for every
+  amplitude in range; amplitudes outside of +-10 V saturate instead of
+  wrapping around into the command bits.
+*/
+#ifndef GRAD_DAC_H
+#define GRAD_DAC_H
+
+#include <stdint.h>
+#include <math.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define GRAD_DAC_LSB          ((float)(10.0/((1<<15)-1))) // the fLSB of the designers
+#define GRAD_DAC_INV_LSB      ((float)(((1<<15)-1)/10.0))
+#define GRAD_DAC_CODE_MIN     (-32768)
+#define GRAD_DAC_CODE_MAX     32767
+#define GRAD_DAC_EDGE         (1.0f/64)  // product and quotient differ by less than 2^-7 below 2^15
+#define GRAD_DAC_WRITE        0x00100000
+#define GRAD_DAC_MASK         0x001fffff
+
+/*
+  floor(f/fLSB)*16, saturated to the 16 bit DAC range
+*/
+static inline int32_t grad_dac_code(float f)
+{
+  float q = f * GRAD_DAC_INV_LSB;
+  float frac;
+  int32_t n;
+
+  if(q >= GRAD_DAC_CODE_MAX+1)
+    return GRAD_DAC_CODE_MAX*16;
+  if(q < GRAD_DAC_CODE_MIN)
+    return GRAD_DAC_CODE_MIN*16;
+  n = (int32_t)floorf(q);
+  frac = q - n;
+  if(frac < GRAD_DAC_EDGE || frac > 1.0f-GRAD_DAC_EDGE) {
+    n = (int32_t)floor(f/GRAD_DAC_LSB);
+    if(n > GRAD_DAC_CODE_MAX)
+      n = GRAD_DAC_CODE_MAX;
+    if(n < GRAD_DAC_CODE_MIN)
+      n = GRAD_DAC_CODE_MIN;
+  }
+  return n*16;
+}
+
+/*
+  BRAM word of a DAC code from grad_dac_code() (or a sum of them)
+*/
+static inline uint32_t grad_dac_pack(int32_t code)
+{
+  return GRAD_DAC_MASK & (code | GRAD_DAC_WRITE);
+}
+
+/*
+  BRAM word of an amplitude
+*/
+static inline uint32_t grad_dac_word(float f)
+{
+  return grad_dac_pack(grad_dac_code(f));
+}
+
+/*
+  Convert n amplitudes to BRAM words.
+  The NEON path converts four amplitudes per step. When one of them is close
+  to a code boundary (or flushed to zero by NEON) the four are done by
+  grad_dac_word() instead, so the result is the same as the scalar path.
+*/
+static inline void grad_dac_convert(const float *f, uint32_t *w, uint32_t n)
+{
+  uint32_t i = 0;
+#if defined(__ARM_NEON)
+  const float32x4_t lo = vdupq_n_f32(GRAD_DAC_CODE_MIN);
+  const float32x4_t hi = vdupq_n_f32(GRAD_DAC_CODE_MAX + 0.5f);
+  const float32x4_t edge_lo = vdupq_n_f32(GRAD_DAC_EDGE);
+  const float32x4_t edge_hi = vdupq_n_f32(1.0f - GRAD_DAC_EDGE);
+  const uint32x4_t write = vdupq_n_u32(GRAD_DAC_WRITE);
+  const uint32x4_t mask = vdupq_n_u32(GRAD_DAC_MASK);
+  float32x4_t q, frac;
+  int32x4_t t;
+  uint32x4_t edge;
+  uint32x2_t any;
+
+  for(; i+4 <= n; i += 4) {
+    q = vmulq_n_f32(vld1q_f32(f+i), GRAD_DAC_INV_LSB);
+    q = vmaxq_f32(vminq_f32(q, hi), lo);
+    // floor: truncate, then step down where that rounded up
+    t = vcvtq_s32_f32(q);
+    t = vaddq_s32(t, vreinterpretq_s32_u32(vcltq_f32(q, vcvtq_f32_s32(t))));
+    frac = vsubq_f32(q, vcvtq_f32_s32(t));
+    edge = vorrq_u32(vcltq_f32(frac, edge_lo), vcgtq_f32(frac, edge_hi));
+    any = vorr_u32(vget_low_u32(edge), vget_high_u32(edge));
+    if(vget_lane_u32(vpmax_u32(any, any), 0)) {
+      w[i] = grad_dac_word(f[i]);
+      w[i+1] = grad_dac_word(f[i+1]);
+      w[i+2] = grad_dac_word(f[i+2]);
+      w[i+3] = grad_dac_word(f[i+3]);
+      continue;
+    }
+    vst1q_u32(w+i, vandq_u32(vorrq_u32(vreinterpretq_u32_s32(vshlq_n_s32(t, 4)), write), mask));
+  }
+#endif
+  for(; i < n; i++)
+    w[i] = grad_dac_word(f[i]);
+}
+
+#endif
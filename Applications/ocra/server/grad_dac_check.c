@@ -0,0 +1,116 @@
+/*
+  Check of the gradient DAC codes of grad_dac.h against the old formula.
+
+  Runs every float amplitude (all bit patterns up to the infinities, both
+  signs) through grad_dac_word() and grad_dac_convert() and compares the
+  words with what the designers used to compute,
+
+    ival = (int32_t)floor(f/fLSB)*16;
+    g[i] = 0x001fffff & (ival | 0x00100000);
+
+  for the amplitudes within the DAC range, and with the saturated code for
+  those outside of it. grad_dac_convert() takes the NEON path when built for
+  ARM with NEON (the board) and the scalar path otherwise; a block of odd
+  length also runs the scalar tail. With -s N only every N-th bit pattern is
+  taken, the full run takes a while on the board.
+
+  e.g.  gcc -O2 -I. grad_dac_check.c -o grad_dac_check -lm && ./grad_dac_check
+        ./compile.sh grad_dac_check.c grad_dac_check && ./grad_dac_check -s 7
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "grad_dac.h"
+
+#define CHECK_BLOCK      4099  // not a multiple of 4: the NEON steps and the scalar tail
+#define CHECK_SHOW       8     // mismatches printed
+#define CHECK_INF_BITS   0x7f800000u
+
+static float fbits(uint32_t u)
+{
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+/*
+  The old per-sample code. 0 with *in_range cleared where its code does not
+  fit into 16 bits (it wrapped into the command bits there).
+*/
+static uint32_t old_word(float f, int *in_range)
+{
+  float fLSB = 10.0/((1<<15)-1);
+  double q = floor(f/fLSB);
+  int32_t ival;
+
+  *in_range = q >= GRAD_DAC_CODE_MIN && q <= GRAD_DAC_CODE_MAX;
+  if(!*in_range)
+    return 0;
+  ival = (int32_t)q*16;
+  return 0x001fffff & (ival | 0x00100000);
+}
+
+static uint32_t saturated_word(float f)
+{
+  return grad_dac_pack((f > 0 ? GRAD_DAC_CODE_MAX : GRAD_DAC_CODE_MIN)*16);
+}
+
+int main(int argc, char *argv[])
+{
+  static float f[CHECK_BLOCK];
+  static uint32_t w[CHECK_BLOCK];
+  uint64_t checked = 0, in_range = 0, errors = 0;
+  uint32_t step = 1, u, n, i, expect, word;
+  int opt, sign, ok;
+
+  while((opt = getopt(argc, argv, "s:")) != -1) {
+    switch(opt) {
+    case 's':
+      step = strtoul(optarg, NULL, 0);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-s step]\n", argv[0]);
+      return 1;
+    }
+  }
+  if(step == 0)
+    step = 1;
+
+#if defined(__ARM_NEON)
+  printf("grad_dac_convert: NEON path\n");
+#else
+  printf("grad_dac_convert: scalar path\n");
+#endif
+
+  for(sign = 0; sign < 2; sign++) {
+    u = 0;
+    while(u < CHECK_INF_BITS) {
+      for(n = 0; n < CHECK_BLOCK && u < CHECK_INF_BITS; n++, u += step)
+        f[n] = fbits(u | (sign ? 0x80000000u : 0));
+      grad_dac_convert(f, w, n);
+      for(i = 0; i < n; i++) {
+        expect = old_word(f[i], &ok);
+        if(ok)
+          in_range++;
+        else
+          expect = saturated_word(f[i]);
+        word = grad_dac_word(f[i]);
+        if(word != expect || w[i] != expect) {
+          if(errors < CHECK_SHOW)
+            printf("%.9g: expected 0x%06x, grad_dac_word 0x%06x, grad_dac_convert 0x%06x\n",
+                   f[i], expect, word, w[i]);
+          errors++;
+        }
+      }
+      checked += n;
+    }
+  }
+
+  printf("%llu amplitudes, %llu within the DAC range, %llu mismatches\n",
+         (unsigned long long)checked, (unsigned long long)in_range, (unsigned long long)errors);
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+/*
+  Rotation of logical gradient waveforms onto the physical gradient axes.
+
+  The readout (RO), phase encoding (PE) and slice (SS) waveforms are designed
+  around 0 (grad_shape.h, grad_shape_rasterize() with offset 0) and rotated
+  sample by sample with a 3x3 matrix,
+
+    gx            ro
+    gy = offset + M pe
+    gz            ss
+
+  then converted to BRAM words. A new orientation is a single pass over the
+  waveforms instead of a redesign, so it can change between two TRs.
+  Calibration factors of the axes go into M as well.
+*/
+#ifndef GRAD_ROTATE_H
+#define GRAD_ROTATE_H
+
+#include <stdint.h>
+#include <math.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "grad_dac.h"
+#include "grad_waveform.h"
+
+#define GRAD_ROTATE_BLOCK     64  // samples rotated and converted at a time
+
+typedef struct {
+  float m[3][3];            // m[physical][logical]
+} grad_rotation_t;
+
+static inline void grad_rotation_identity(grad_rotation_t *r)
+{
+  int i, j;
+  for(i = 0; i < 3; i++)
+    for(j = 0; j < 3; j++)
+      r->m[i][j] = (i == j) ? 1.0f : 0.0f;
+}
+
+/*
+  Rotation by angle (radians) about the x, y or z axis (axis 0, 1, 2)
+*/
+static inline void grad_rotation_axis(grad_rotation_t *r, int axis, float angle)
+{
+  int a = (axis+1) % 3, b = (axis+2) % 3;
+  float c = cos(angle), s = sin(angle);
+
+  grad_rotation_identity(r);
+  r->m[a][a] = c;
+  r->m[a][b] = -s;
+  r->m[b][a] = s;
+  r->m[b][b] = c;
+}
+
+/*
+  r = p*q, the rotation q followed by p (r may be p or q)
+*/
+static inline void grad_rotation_mul(grad_rotation_t *r, const grad_rotation_t *p, const grad_rotation_t *q)
+{
+  grad_rotation_t t;
+  int i, j;
+
+  for(i = 0; i < 3; i++)
+    for(j = 0; j < 3; j++)
+      t.m[i][j] = p->m[i][0]*q->m[0][j] + p->m[i][1]*q->m[1][j] + p->m[i][2]*q->m[2][j];
+  *r = t;
+}
+
+/*
+  Rotate words first..end-1 of the logical waveforms ro, pe and ss (amplitudes
+  indexed by word) and write them to gx, gy and gz around the offsets.
+*/
+static inline void grad_rotate(const grad_rotation_t *r, const float *ro, const float *pe, const float *ss,
+                               float offset_x, float offset_y, float offset_z,
+                               volatile uint32_t *gx, volatile uint32_t *gy, volatile uint32_t *gz,
+                               uint32_t first, uint32_t end)
+{
+  float p[3][GRAD_ROTATE_BLOCK];
+  uint32_t w[GRAD_ROTATE_BLOCK];
+  volatile uint32_t *g[3] = {gx, gy, gz};
+  const float offset[3] = {offset_x, offset_y, offset_z};
+  uint32_t i, k, n, c;
+
+  if(end > GRAD_BRAM_WORDS)
+    end = GRAD_BRAM_WORDS;
+  for(i = first; i < end; i += n) {
+    n = end - i;
+    if(n > GRAD_ROTATE_BLOCK)
+      n = GRAD_ROTATE_BLOCK;
+    k = 0;
+#if defined(__ARM_NEON)
+    for(; k+4 <= n; k += 4) {
+      float32x4_t l0 = vld1q_f32(ro+i+k), l1 = vld1q_f32(pe+i+k), l2 = vld1q_f32(ss+i+k);
+      for(c = 0; c < 3; c++) {
+        float32x4_t a = vdupq_n_f32(offset[c]);
+        a = vmlaq_n_f32(a, l0, r->m[c][0]);
+        a = vmlaq_n_f32(a, l1, r->m[c][1]);
+        a = vmlaq_n_f32(a, l2, r->m[c][2]);
+        vst1q_f32(p[c]+k, a);
+      }
+    }
+#endif
+    for(; k < n; k++)
+      for(c = 0; c < 3; c++)
+        p[c][k] = offset[c] + ro[i+k]*r->m[c][0] + pe[i+k]*r->m[c][1] + ss[i+k]*r->m[c][2];
+
+    for(c = 0; c < 3; c++) {
+      grad_dac_convert(p[c], w, n);
+      for(k = 0; k < n; k++)
+        g[c][i+k] = w[k];
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,182 @@
+/*
+  Gradient waveforms described as segments instead of ramp loops.
+
+  A shape is the waveform of one channel from word 2 on (word 0 and 1 are the
+  offset and output enable commands), given as a list of segments on the
+  10 us DAC grid in the order they play:
+
+    GRAD_SEG_TRAP      ramp samples up by step, flat samples held, ramp
+                       samples back down by step (flat 0 is a triangle)
+    GRAD_SEG_BASELINE  n samples at the offset, the level restarts from it
+    GRAD_SEG_ARB       n samples of given amplitudes
+
+  Before, between and after the segments the level is held. The level is
+  accumulated sample by sample (level += step) as the designers always did,
+  so a lobe returns to the offset with the rounding of its ramps, the same
+  as the loops it replaces. grad_shape_rasterize() produces the amplitudes in
+  one pass, grad_shape_compile() converts them with grad_dac_convert().
+*/
+#ifndef GRAD_SHAPE_H
+#define GRAD_SHAPE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "grad_dac.h"
+#include "grad_waveform.h"
+
+#define GRAD_SHAPE_FIRST          2   // first word of a shape
+#define GRAD_SHAPE_MAX_SEGMENTS   64
+
+typedef enum {
+  GRAD_SEG_TRAP = 0,
+  GRAD_SEG_BASELINE,
+  GRAD_SEG_ARB
+} grad_seg_type_t;
+
+typedef struct {
+  grad_seg_type_t type;
+  uint32_t start;           // first word
+  uint32_t ramp;            // samples per ramp
+  uint32_t n;               // flat samples of a trapezoid, samples of the others
+  float step;               // amplitude change per ramp sample
+  const float *amp;         // GRAD_SEG_ARB
+} grad_seg_t;
+
+typedef struct {
+  float offset;
+  uint32_t nseg;
+  grad_seg_t seg[GRAD_SHAPE_MAX_SEGMENTS];
+} grad_shape_t;
+
+static inline void grad_shape_init(grad_shape_t *s, float offset)
+{
+  s->offset = offset;
+  s->nseg = 0;
+}
+
+static inline grad_seg_t *grad_shape_add(grad_shape_t *s, grad_seg_type_t type, uint32_t start, uint32_t n)
+{
+  grad_seg_t *sg;
+
+  if(s->nseg == GRAD_SHAPE_MAX_SEGMENTS) {
+    printf("Gradient shape: more than %d segments\n", GRAD_SHAPE_MAX_SEGMENTS);
+    return NULL;
+  }
+  sg = &s->seg[s->nseg++];
+  sg->type = type;
+  sg->start = start;
+  sg->ramp = 0;
+  sg->n = n;
+  sg->step = 0;
+  sg->amp = NULL;
+  return sg;
+}
+
+/*
+  Trapezoid of amplitude amp (above the level it starts from) at word start.
+  The step is amp/ramp rounded once to float, like the amplitude/20.0 of the
+  designers; amp is a double so amplitudes computed in double keep that too.
+*/
+static inline void grad_shape_trap(grad_shape_t *s, uint32_t start, uint32_t ramp, uint32_t flat, double amp)
+{
+  grad_seg_t *sg = grad_shape_add(s, GRAD_SEG_TRAP, start, flat);
+
+  if(sg == NULL || ramp == 0)
+    return;
+  sg->ramp = ramp;
+  sg->step = (float)(amp/ramp);
+}
+
+static inline void grad_shape_baseline(grad_shape_t *s, uint32_t start, uint32_t n)
+{
+  grad_shape_add(s, GRAD_SEG_BASELINE, start, n);
+}
+
+/*
+  n amplitudes from amp at word start, amp has to stay valid until the compile
+*/
+static inline void grad_shape_arb(grad_shape_t *s, uint32_t start, uint32_t n, const float *amp)
+{
+  grad_seg_t *sg = grad_shape_add(s, GRAD_SEG_ARB, start, n);
+
+  if(sg != NULL)
+    sg->amp = amp;
+}
+
+/*
+  Amplitudes of words GRAD_SHAPE_FIRST..end-1 into f (indexed by word)
+*/
+static inline void grad_shape_rasterize(const grad_shape_t *s, float *f, uint32_t end)
+{
+  const grad_seg_t *sg;
+  float level = s->offset;
+  uint32_t i = GRAD_SHAPE_FIRST, j, k;
+
+  if(end > GRAD_BRAM_WORDS)
+    end = GRAD_BRAM_WORDS;
+  for(j = 0; j < s->nseg && i < end; j++) {
+    sg = &s->seg[j];
+    for(; i < sg->start && i < end; i++)
+      f[i] = level;
+    switch(sg->type) {
+    case GRAD_SEG_TRAP:
+      for(k = 0; k < sg->ramp && i < end; k++) {
+        level += sg->step;
+        f[i++] = level;
+      }
+      for(k = 0; k < sg->n && i < end; k++)
+        f[i++] = level;
+      for(k = 0; k < sg->ramp && i < end; k++) {
+        level -= sg->step;
+        f[i++] = level;
+      }
+      break;
+    case GRAD_SEG_BASELINE:
+      level = s->offset;
+      for(k = 0; k < sg->n && i < end; k++)
+        f[i++] = level;
+      break;
+    case GRAD_SEG_ARB:
+      for(k = 0; k < sg->n && i < end; k++) {
+        level = sg->amp[k];
+        f[i++] = level;
+      }
+      break;
+    }
+  }
+  for(; i < end; i++)
+    f[i] = level;
+}
+
+/*
+  Write words first..end-1 of the shape to g. The level is accumulated from
+  word GRAD_SHAPE_FIRST on whatever first is.
+*/
+static inline void grad_shape_compile_range(const grad_shape_t *s, volatile uint32_t *g, uint32_t first, uint32_t end)
+{
+  float f[GRAD_BRAM_WORDS];
+  uint32_t w[GRAD_BRAM_WORDS];
+  uint32_t i;
+
+  if(end > GRAD_BRAM_WORDS)
+    end = GRAD_BRAM_WORDS;
+  if(first < GRAD_SHAPE_FIRST)
+    first = GRAD_SHAPE_FIRST;
+  if(end <= first)
+    return;
+  grad_shape_rasterize(s, f, end);
+  grad_dac_convert(f+first, w+first, end-first);
+  for(i = first; i < end; i++)
+    g[i] = w[i];
+}
+
+/*
+  Write words GRAD_SHAPE_FIRST..end-1 of the shape to g
+*/
+static inline void grad_shape_compile(const grad_shape_t *s, volatile uint32_t *g, uint32_t end)
+{
+  grad_shape_compile_range(s, g, GRAD_SHAPE_FIRST, end);
+}
+
+#endif
@@ -0,0 +1,183 @@
+/*
+  Gradient waveform memory shared by the MRI servers.
+
+  Each gradient DAC channel has a BRAM of 2000 words (2048 words of physical
+  memory, the DAC sequencer addresses it with 11 bits and wraps at 2048).
+  While GRAD_PULSE is low the sequencer loads its start address from the
+  GRADOFFSET of the pulse program, then plays 2000 words from there at 10 us
+  per word. Word 0 and 1 of a waveform are the offset DAC code and the output
+  enable command.
+*/
+#ifndef GRAD_WAVEFORM_H
+#define GRAD_WAVEFORM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pulseq.h"
+#include "pulseq_mem.h"
+#include "pulseq_emu.h"
+#include "trace.h"
+
+#define GRAD_CHANNELS         3
+#define GRAD_BRAM_WORDS       2048
+#define GRAD_PLAY_WORDS       2000
+#define GRAD_HALF_WORDS       (GRAD_BRAM_WORDS/2)
+#define GRAD_WORD_US          10
+#define GRAD_HALF_US          (GRAD_HALF_WORDS*GRAD_WORD_US)
+
+/*
+  Ping-pong gradient buffer.
+
+  The BRAM is split in two halves at GRADOFFSET 0 and 1024. The next TR's
+  waveform is written into the half that is not playing while the current TR
+  runs, then the GRADOFFSET operands of the program are patched to that half
+  between the TRs. A waveform has to fit into 1024 words (10.24 ms).
+  The DAC sequencer plays up to 2000 words while GRAD_PULSE is high, so
+  from 10.24 ms after the gradient start it plays the other half, the
+  waveform of the next TR. grad_pingpong_start() takes a program whose
+  GRAD_PULSE falls before that, or whose TR has taken its last sample by
+  then; other scans write the gradient BRAMs directly instead. The shipped
+  se.txt and gre.txt keep GRAD_PULSE high through their 200 ms readout and
+  acquire the whole of it, se_short_grad.txt and gre_short_grad.txt drop it
+  at the end of the echo waveform.
+*/
+typedef struct {
+  volatile uint32_t *bram[GRAD_CHANNELS];
+  uint32_t design[GRAD_CHANNELS][GRAD_PLAY_WORDS]; // the waveform functions write into this
+  uint32_t shadow[GRAD_CHANNELS][GRAD_BRAM_WORDS]; // what the commits wrote to the BRAMs, 0xffffffff is unknown
+  uint32_t gradoffset[PULSEQ_MEMORY_WORDS/2];      // instructions with a GRADOFFSET
+  uint32_t prog[PULSEQ_MEMORY_WORDS];              // the program, to time its gradient start
+  uint32_t n_gradoffset;
+  uint32_t active;                                 // base of the half the next TR plays
+} grad_pingpong_t;
+
+static inline void grad_pingpong_init(grad_pingpong_t *pp, volatile uint32_t *gx, volatile uint32_t *gy, volatile uint32_t *gz)
+{
+  pp->bram[0] = gx;
+  pp->bram[1] = gy;
+  pp->bram[2] = gz;
+  pp->n_gradoffset = 0;
+  pp->active = 0;
+  memset(pp->shadow, 0xff, sizeof(pp->shadow));
+}
+
+/*
+  Forget what is in the BRAMs, they are written directly (gradient_memory_*)
+  between the scans
+*/
+static inline void grad_table_invalidate(grad_pingpong_t *pp)
+{
+  memset(pp->shadow, 0xff, sizeof(pp->shadow));
+}
+
+/*
+  Find the GRADOFFSET instructions of the loaded program. Ping-pong needs
+  at least one and all of them at offset 0 (a single waveform per TR), and
+  the DAC must not play into the other half while samples are taken: every
+  GRAD_PULSE of the program is at most GRAD_HALF_US long, or the last sample
+  of a TR, acquire_end_us after the program start (rx_acquire_end_us()),
+  comes before the crossing.
+  Returns 0 when the program can run in ping-pong mode.
+*/
+static inline int grad_pingpong_start(grad_pingpong_t *pp, pulseq_mem_t *seq_mem, uint32_t acquire_end_us)
+{
+  uint32_t k, lo, hi;
+  int64_t rise, high;
+
+  pp->n_gradoffset = 0;
+  for(k = 0; k < PULSEQ_MEMORY_WORDS/2; k++) {
+    lo = pp->prog[2*k] = pulseq_mem_read(seq_mem, 2*k);
+    hi = pp->prog[2*k+1] = pulseq_mem_read(seq_mem, 2*k+1);
+    if(PULSEQ_OP(hi) != PULSEQ_GRADOFFSET)
+      continue;
+    if(lo != 0) {
+      pp->n_gradoffset = 0;
+      return -1;
+    }
+    pp->gradoffset[pp->n_gradoffset++] = k;
+  }
+  if(pp->n_gradoffset == 0)
+    return -1;
+  // a GRAD_PULSE that falls within the half never plays the other one
+  high = pulseq_emu_longest_high(pp->prog, PULSEQ_MEMORY_WORDS, PULSEQ_GRAD_PULSE);
+  // otherwise the DAC plays from the first GRAD_PULSE, later starts only cross over later
+  rise = pulseq_emu_first_rise(pp->prog, PULSEQ_MEMORY_WORDS, PULSEQ_GRAD_PULSE);
+  if((high < 0 || pulseq_cycles_to_us(high) > GRAD_HALF_US) &&
+     (rise == -2 || (rise >= 0 && acquire_end_us > pulseq_cycles_to_us(rise) + GRAD_HALF_US))) {
+    printf("No ping-pong gradients: samples until %u us, the other half plays from %.0f us\n",
+           acquire_end_us, rise < 0 ? 0.0 : pulseq_cycles_to_us(rise) + GRAD_HALF_US);
+    pp->n_gradoffset = 0;
+    return -1;
+  }
+  pp->active = 0;
+  grad_table_invalidate(pp);
+  return 0;
+}
+
+/*
+  Clear the design buffers, the waveform functions only write the words they use
+*/
+static inline void grad_pingpong_clear(grad_pingpong_t *pp)
+{
+  memset(pp->design, 0, sizeof(pp->design));
+}
+
+/*
+  Copy the first nwords of the designed waveform to base in the BRAMs.
+  Only the words that differ from what the BRAM holds are written, from one
+  phase encoding step to the next that is just the phase encoding lobe.
+  Returns the number of words written.
+*/
+static inline uint32_t grad_table_commit(grad_pingpong_t *pp, uint32_t base, uint32_t nwords)
+{
+  uint32_t c, i, written = 0;
+  uint64_t start = trace_time_us();
+
+  for(c = 0; c < GRAD_CHANNELS; c++)
+    for(i = 0; i < nwords; i++)
+      if(pp->shadow[c][base+i] != pp->design[c][i]) {
+        pp->bram[c][base+i] = pp->design[c][i];
+        pp->shadow[c][base+i] = pp->design[c][i];
+        written++;
+      }
+  trace_log(TRACE_GRAD_COMMIT, written, base, (int32_t)(trace_time_us() - start), 0);
+  return written;
+}
+
+/*
+  Copy the designed waveform into the half that is not played by the next TR
+*/
+static inline void grad_pingpong_commit(grad_pingpong_t *pp)
+{
+  grad_table_commit(pp, pp->active ^ GRAD_HALF_WORDS, GRAD_HALF_WORDS);
+}
+
+/*
+  Point the program at the half written by the last commit.
+  The sequencer has to be halted.
+*/
+static inline void grad_pingpong_swap(grad_pingpong_t *pp, pulseq_mem_t *seq_mem)
+{
+  uint32_t k;
+
+  pp->active ^= GRAD_HALF_WORDS;
+  for(k = 0; k < pp->n_gradoffset; k++)
+    pulseq_mem_write(seq_mem, 2*pp->gradoffset[k], pp->active);
+}
+
+/*
+  Put the GRADOFFSET operands back to 0 at the end of the scan
+*/
+static inline void grad_pingpong_stop(grad_pingpong_t *pp, pulseq_mem_t *seq_mem)
+{
+  uint32_t k;
+
+  for(k = 0; k < pp->n_gradoffset; k++)
+    pulseq_mem_write(seq_mem, 2*pp->gradoffset[k], 0);
+  pp->n_gradoffset = 0;
+  pp->active = 0;
+}
+
+#endif
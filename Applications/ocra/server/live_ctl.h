@@ -0,0 +1,154 @@
+/*
+  Live parameter changes during a scan.
+
+  The command loops only read the socket between scans, so a frequency,
+  shim or rotation change had to wait for the end of the scan. A live
+  command can be sent at any time: it is two words, 11<<28 | op<<24 | arg
+  and a uint32 value (two COMMAND messages in version 2 of the protocol,
+  proto.h), with
+
+    LIVE_OP_ABORT     stop the scan after the running TR
+    LIVE_OP_FREQ      value = center frequency in Hz
+    LIVE_OP_OFFSET    arg = axis (0 x, 1 y, 2 z), value = offset in mA (int32)
+    LIVE_OP_ROTATION  value = in-plane angle in millidegrees (int32)
+
+  At every TR boundary the RX engine takes the live commands that are
+  already waiting on the socket, without blocking (live_poll()), and
+  leaves the first other command for the command loop. The changes are
+  pending until a loop takes them (live_take()): the engine applies the
+  frequency itself, a loop that can rewrite its gradients takes the offsets
+  and the rotation, an abort ends the loops that check rx_aborted(). So a
+  change takes effect at most one TR after it arrived; what a loop does
+  not take waits for the next scan.
+*/
+#ifndef LIVE_CTL_H
+#define LIVE_CTL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <sys/socket.h>
+
+#include "proto.h"
+
+#define LIVE_COMMAND          11          // command >> 28
+#define LIVE_MAX_FREQ_HZ      60000000
+
+enum {
+  LIVE_OP_ABORT = 0,
+  LIVE_OP_FREQ,
+  LIVE_OP_OFFSET,
+  LIVE_OP_ROTATION
+};
+
+#define LIVE_ABORT            (1 << LIVE_OP_ABORT)
+#define LIVE_FREQ             (1 << LIVE_OP_FREQ)
+#define LIVE_OFFSET           (1 << LIVE_OP_OFFSET)
+#define LIVE_ROTATION         (1 << LIVE_OP_ROTATION)
+
+typedef struct {
+  uint32_t pending;         // LIVE_* not taken yet
+  uint32_t freq_hz;
+  int32_t offset_ma[3];     // valid for the axes in offset_mask
+  uint32_t offset_mask;
+  float theta;              // rad
+} live_ctl_t;
+
+static inline void live_init(live_ctl_t *l)
+{
+  memset(l, 0, sizeof(*l));
+}
+
+static inline int live_is_command(uint32_t command)
+{
+  return (command >> 28) == LIVE_COMMAND;
+}
+
+/*
+  Record the live command and its value
+*/
+static inline void live_set(live_ctl_t *l, uint32_t command, uint32_t value)
+{
+  uint32_t op = (command >> 24) & 0xf, arg = command & 0xffffff;
+
+  switch(op) {
+  case LIVE_OP_ABORT:
+    break;
+  case LIVE_OP_FREQ:
+    if(value > LIVE_MAX_FREQ_HZ) {
+      printf("Live: frequency %u Hz out of range\n", value);
+      return;
+    }
+    l->freq_hz = value;
+    break;
+  case LIVE_OP_OFFSET:
+    if(arg > 2) {
+      printf("Live: no gradient axis %u\n", arg);
+      return;
+    }
+    l->offset_ma[arg] = (int32_t)value;
+    l->offset_mask |= 1 << arg;
+    break;
+  case LIVE_OP_ROTATION:
+    l->theta = (int32_t)value * (float)(M_PI/180000.0);
+    break;
+  default:
+    printf("Live: unknown operation %u\n", op);
+    return;
+  }
+  l->pending |= 1 << op;
+}
+
+/*
+  Take the live commands that are waiting on sock, without blocking. Stops
+  at the first other command, which stays for the command loop.
+  Returns -1 when the connection is gone.
+*/
+static inline int live_poll(live_ctl_t *l, int sock, int version)
+{
+  uint8_t msg[2*(sizeof(proto_hdr_t) + 4)];
+  uint32_t word[2], need, k;
+  proto_hdr_t h;
+  ssize_t n;
+
+  need = version >= PROTO_VERSION_2 ? sizeof(msg) : sizeof(word);
+  while(1) {
+    n = recv(sock, msg, need, MSG_PEEK | MSG_DONTWAIT);
+    if(n == 0)
+      return -1;
+    if(n < (ssize_t)need)
+      return 0;  // nothing, a shorter command, or the rest is on its way
+    if(version >= PROTO_VERSION_2) {
+      for(k = 0; k < 2; k++) {
+        memcpy(&h, msg + k*(sizeof(h) + 4), sizeof(h));
+        if(h.magic != PROTO_MAGIC || h.type != PROTO_MSG_COMMAND || h.length != 4)
+          return 0;
+        memcpy(&word[k], msg + k*(sizeof(h) + 4) + sizeof(h), 4);
+      }
+    }
+    else {
+      memcpy(word, msg, sizeof(word));
+    }
+    if(!live_is_command(word[0]))
+      return 0;
+    if(recv(sock, msg, need, MSG_WAITALL) <= 0)
+      return -1;
+    live_set(l, word[0], word[1]);
+  }
+}
+
+/*
+  The pending changes of mask, they are no longer pending
+*/
+static inline uint32_t live_take(live_ctl_t *l, uint32_t mask)
+{
+  uint32_t taken = l->pending & mask;
+
+  l->pending &= ~taken;
+  if(taken & LIVE_OFFSET)
+    l->offset_mask = 0;
+  return taken;
+}
+
+#endif
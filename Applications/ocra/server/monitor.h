@@ -0,0 +1,428 @@
+/*
+  Read-only monitor clients.
+
+  The control client (the GUI) connects to the server port and drives the
+  scans. Up to MONITOR_MAX_CLIENTS viewers can connect to MONITOR_PORT at the
+  same time and get a copy of the RX data: a proto_hello_t, then the data messages of
+  version 2 of the protocol (proto.h), whatever version the control client
+  speaks. A viewer never sends commands; a uint32 it sends selects its drop
+  policy (MONITOR_DROP_*). One more viewer gets a REPLY with the uint32
+  MONITOR_MAX_CLIENTS instead of the hello and is closed.
+
+  Every viewer has its own bounded queue. monitor_publish() copies a message
+  into the queue of every viewer and returns, it never waits for a socket;
+  a message that does not fit is dropped by the policy of that viewer, so a
+  slow viewer loses data instead of holding up the acquisition. A thread
+  waiting in epoll accepts the viewers and sends their queues with
+  non-blocking send()s, woken by an eventfd when a queue was empty.
+
+  The queue pointers are under one mutex, held only to move them: the
+  thread takes the span to send under it and calls send() without it. The
+  span stays put meanwhile, a publisher writes past head and drops only
+  messages that were not started. A publisher likewise makes room under
+  it, copies the message past head without it and then moves head, so the
+  thread never sees a message half copied. Publishers take hub->publish one
+  at a time; closing a viewer takes it just to mark the slot free, so its
+  queue is not freed under a copy. Accepting and closing a viewer happen
+  outside both, so the scan thread never waits for a socket, malloc() or
+  printf() of the thread. A viewer gets at most MONITOR_SEND_BYTES per
+  wakeup, so one fast viewer does not starve the others.
+*/
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "trace.h"
+#include "proto.h"
+#include "tr_sched.h"
+
+#define MONITOR_PORT          1002
+#define MONITOR_MAX_CLIENTS   8
+#define MONITOR_QUEUE_BYTES   (1 << 20)   // power of 2, 2.5 TRs of float32 samples
+#define MONITOR_SEND_BYTES    65536       // sent to a viewer per wakeup
+
+enum {
+  MONITOR_DROP_NEWEST = 0,  // a message that does not fit is not queued
+  MONITOR_DROP_OLDEST       // the queued messages that were not started make room
+};
+
+typedef struct {
+  int fd;                   // -1 for a free slot
+  uint8_t *queue;           // MONITOR_QUEUE_BYTES
+  uint32_t head;            // bytes queued so far
+  uint32_t tail;            // bytes sent so far, tail <= head
+  uint32_t msg_end;         // end of the message being sent, tail when none is;
+                            // tail <= msg_end <= head
+  uint32_t policy;          // MONITOR_DROP_*
+  uint32_t dropped;         // messages dropped
+  int armed;                // EPOLLOUT is set
+} monitor_client_t;
+
+typedef struct {
+  monitor_client_t client[MONITOR_MAX_CLIENTS];
+  proto_hello_t hello;      // sent to every viewer first
+  int sock_server;
+  int epfd;
+  int wake;                 // eventfd
+  int nclients;
+  int quit;
+  pthread_mutex_t lock;
+  pthread_mutex_t publish;  // one publisher at a time
+  pthread_t thread;
+  int running;
+} monitor_hub_t;
+
+static inline uint32_t monitor_queued(const monitor_client_t *c)
+{
+  return c->head - c->tail;
+}
+
+static inline void monitor_close(monitor_hub_t *hub, monitor_client_t *c)
+{
+  int fd = c->fd;
+
+  pthread_mutex_lock(&hub->publish);
+  pthread_mutex_lock(&hub->lock);
+  c->fd = -1;               // publishers leave the queue alone from here on
+  hub->nclients--;
+  pthread_mutex_unlock(&hub->lock);
+  pthread_mutex_unlock(&hub->publish);
+  printf("Monitor %d closed, %u messages dropped\n", fd, c->dropped);
+  epoll_ctl(hub->epfd, EPOLL_CTL_DEL, fd, NULL);
+  close(fd);
+  free(c->queue);
+  c->queue = NULL;
+}
+
+/*
+  Copy n bytes to the queue at offset pos, the caller made room
+*/
+static inline void monitor_copy(monitor_client_t *c, uint32_t pos, const void *src, uint32_t n)
+{
+  uint32_t at = pos & (MONITOR_QUEUE_BYTES-1);
+  uint32_t first = MONITOR_QUEUE_BYTES - at < n ? MONITOR_QUEUE_BYTES - at : n;
+
+  memcpy(c->queue + at, src, first);
+  memcpy(c->queue, (const uint8_t *)src + first, n - first);
+}
+
+static inline void monitor_put(monitor_client_t *c, const void *src, uint32_t n)
+{
+  monitor_copy(c, c->head, src, n);
+  c->head += n;
+}
+
+/*
+  Length of the queued message at offset pos, header included
+*/
+static inline uint32_t monitor_msg_bytes(const monitor_client_t *c, uint32_t pos)
+{
+  proto_hdr_t h;
+  uint32_t at = pos & (MONITOR_QUEUE_BYTES-1), k;
+
+  for(k = 0; k < sizeof(h); k++)
+    ((uint8_t *)&h)[k] = c->queue[(at + k) & (MONITOR_QUEUE_BYTES-1)];
+  return sizeof(h) + h.length;
+}
+
+/*
+  Drop the queued messages that were not started, the one being sent goes
+  out whole. Returns -1 when n bytes do not fit even then.
+*/
+static inline int monitor_make_room(monitor_client_t *c, uint32_t n)
+{
+  uint32_t pos;
+
+  for(pos = c->msg_end; pos != c->head; pos += monitor_msg_bytes(c, pos))
+    c->dropped++;
+  c->head = c->msg_end;
+  return MONITOR_QUEUE_BYTES - monitor_queued(c) < n ? -1 : 0;
+}
+
+/*
+  Queue the message a, b (a starts with a proto_hdr_t) for every viewer.
+  The room is made under hub->lock, the copies are done without it.
+*/
+static inline void monitor_publish(monitor_hub_t *hub, const void *a, uint32_t na, const void *b, uint32_t nb)
+{
+  monitor_client_t *c;
+  uint64_t one = 1;
+  int i, wake = 0, take[MONITOR_MAX_CLIENTS];
+
+  if(__atomic_load_n(&hub->nclients, __ATOMIC_RELAXED) == 0)
+    return;
+  pthread_mutex_lock(&hub->publish);
+  pthread_mutex_lock(&hub->lock);
+  for(i = 0; i < MONITOR_MAX_CLIENTS; i++) {
+    c = &hub->client[i];
+    take[i] = 0;
+    if(c->fd < 0)
+      continue;
+    if(MONITOR_QUEUE_BYTES - monitor_queued(c) < na + nb &&
+       (c->policy != MONITOR_DROP_OLDEST || monitor_make_room(c, na + nb) < 0)) {
+      c->dropped++;
+      trace_log(TRACE_MONITOR_DROP, c->fd, na + nb, monitor_queued(c), c->dropped);
+      continue;
+    }
+    take[i] = 1;
+  }
+  pthread_mutex_unlock(&hub->lock);
+
+  // only publishers move head, the thread sends no further than it
+  for(i = 0; i < MONITOR_MAX_CLIENTS; i++) {
+    if(!take[i])
+      continue;
+    c = &hub->client[i];
+    monitor_copy(c, c->head, a, na);
+    monitor_copy(c, c->head + na, b, nb);
+  }
+
+  pthread_mutex_lock(&hub->lock);
+  for(i = 0; i < MONITOR_MAX_CLIENTS; i++) {
+    if(!take[i])
+      continue;
+    c = &hub->client[i];
+    if(monitor_queued(c) == 0)
+      wake = 1;
+    c->head += na + nb;
+  }
+  pthread_mutex_unlock(&hub->lock);
+  pthread_mutex_unlock(&hub->publish);
+  if(wake)
+    write(hub->wake, &one, sizeof(one));
+}
+
+/*
+  Send up to MONITOR_SEND_BYTES of the queue; the rest goes out on the next
+  EPOLLOUT. A send stops at the end of a message: the header of the next one
+  is read while it is still queued, sent bytes may be overwritten. hub->lock
+  is taken only to read and move the pointers.
+  Returns -1 when the viewer is gone.
+*/
+static inline int monitor_flush(monitor_hub_t *hub, monitor_client_t *c)
+{
+  struct epoll_event ev;
+  uint32_t at, n, budget = MONITOR_SEND_BYTES;
+  ssize_t sent;
+  int queued;
+
+  while(budget > 0) {
+    pthread_mutex_lock(&hub->lock);
+    if(monitor_queued(c) > 0 && c->tail == c->msg_end)
+      c->msg_end = c->tail + monitor_msg_bytes(c, c->tail);
+    at = c->tail & (MONITOR_QUEUE_BYTES-1);
+    n = c->msg_end - c->tail;
+    pthread_mutex_unlock(&hub->lock);
+    if(n == 0)
+      break;
+    if(n > MONITOR_QUEUE_BYTES - at)
+      n = MONITOR_QUEUE_BYTES - at;
+    if(n > budget)
+      n = budget;
+    sent = send(c->fd, c->queue + at, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if(sent < 0) {
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      return -1;
+    }
+    pthread_mutex_lock(&hub->lock);
+    c->tail += sent;
+    pthread_mutex_unlock(&hub->lock);
+    budget -= sent;
+  }
+  pthread_mutex_lock(&hub->lock);
+  queued = monitor_queued(c) > 0;
+  pthread_mutex_unlock(&hub->lock);
+  // wait for room in the socket only while something is queued
+  if(queued != c->armed) {
+    c->armed = queued;
+    ev.events = EPOLLIN | (c->armed ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(hub->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+  }
+  return 0;
+}
+
+/*
+  Tell a viewer that cannot be served why, then close it
+*/
+static inline void monitor_refuse(int fd, const char *why)
+{
+  uint32_t limit = MONITOR_MAX_CLIENTS;
+
+  proto_send(fd, PROTO_VERSION_2, PROTO_MSG_REPLY, &limit, sizeof(limit), NULL, 0);
+  printf("Monitor %d refused: %s\n", fd, why);
+  close(fd);
+}
+
+// only this thread fills and frees the slots, publishers see a viewer once its fd is set
+static inline void monitor_accept(monitor_hub_t *hub)
+{
+  struct epoll_event ev;
+  monitor_client_t *c = NULL;
+  int fd, i;
+
+  if((fd = accept(hub->sock_server, NULL, NULL)) < 0)
+    return;
+  for(i = 0; i < MONITOR_MAX_CLIENTS && c == NULL; i++)
+    if(hub->client[i].fd < 0)
+      c = &hub->client[i];
+  if(c == NULL) {
+    monitor_refuse(fd, "all MONITOR_MAX_CLIENTS viewers connected");
+    return;
+  }
+  if((c->queue = (uint8_t *)malloc(MONITOR_QUEUE_BYTES)) == NULL) {
+    monitor_refuse(fd, "no memory for its queue");
+    return;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  c->head = c->tail = c->msg_end = 0;
+  c->policy = MONITOR_DROP_NEWEST;
+  c->dropped = 0;
+  c->armed = 0;
+  monitor_put(c, &hub->hello, sizeof(hub->hello));
+  ev.events = EPOLLIN;
+  ev.data.ptr = c;
+  epoll_ctl(hub->epfd, EPOLL_CTL_ADD, fd, &ev);
+  pthread_mutex_lock(&hub->lock);
+  c->fd = fd;
+  hub->nclients++;
+  pthread_mutex_unlock(&hub->lock);
+  printf("Monitor %d accepted\n", fd);
+  if(monitor_flush(hub, c) < 0)
+    monitor_close(hub, c);
+}
+
+/*
+  Input of a viewer: drop policies, or the end of the connection
+*/
+static inline int monitor_read(monitor_hub_t *hub, monitor_client_t *c)
+{
+  uint32_t policy;
+  ssize_t n;
+
+  while((n = recv(c->fd, &policy, sizeof(policy), MSG_DONTWAIT)) == sizeof(policy)) {
+    if(policy <= MONITOR_DROP_OLDEST) {
+      pthread_mutex_lock(&hub->lock);
+      c->policy = policy;
+      pthread_mutex_unlock(&hub->lock);
+    }
+  }
+  if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+    return -1;
+  return 0;
+}
+
+static void *monitor_thread(void *arg)
+{
+  monitor_hub_t *hub = (monitor_hub_t *)arg;
+  struct epoll_event ev[MONITOR_MAX_CLIENTS + 2];
+  monitor_client_t *c;
+  uint64_t count;
+  int i, n;
+
+  while(!__atomic_load_n(&hub->quit, __ATOMIC_ACQUIRE)) {
+    n = epoll_wait(hub->epfd, ev, MONITOR_MAX_CLIENTS + 2, -1);
+    for(i = 0; i < n; i++) {
+      if(ev[i].data.ptr == &hub->sock_server) {
+        monitor_accept(hub);
+      }
+      else if(ev[i].data.ptr == &hub->wake) {
+        read(hub->wake, &count, sizeof(count));
+        for(c = hub->client; c < hub->client + MONITOR_MAX_CLIENTS; c++)
+          if(c->fd >= 0 && !c->armed && monitor_flush(hub, c) < 0)
+            monitor_close(hub, c);
+      }
+      else {
+        c = (monitor_client_t *)ev[i].data.ptr;
+        if(c->fd < 0)
+          continue;  // closed by an earlier event of this round
+        if(((ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && monitor_read(hub, c) < 0) ||
+           ((ev[i].events & EPOLLOUT) && monitor_flush(hub, c) < 0))
+          monitor_close(hub, c);
+      }
+    }
+  }
+  return NULL;
+}
+
+/*
+  Listen for viewers on port and start the thread that serves them.
+  Returns 0 on success; without it the server runs without monitors.
+*/
+static inline int monitor_start(monitor_hub_t *hub, uint16_t port, const proto_hello_t *hello)
+{
+  struct sockaddr_in addr;
+  struct epoll_event ev;
+  int yes = 1, i;
+
+  memset(hub, 0, sizeof(*hub));
+  for(i = 0; i < MONITOR_MAX_CLIENTS; i++)
+    hub->client[i].fd = -1;
+  hub->hello = *hello;
+  hub->epfd = hub->wake = -1;
+  if((hub->sock_server = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    return -1;
+  setsockopt(hub->sock_server, SOL_SOCKET, SO_REUSEADDR, (void *)&yes, sizeof(yes));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if(bind(hub->sock_server, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+     listen(hub->sock_server, MONITOR_MAX_CLIENTS) < 0 ||
+     (hub->epfd = epoll_create1(0)) < 0 ||
+     (hub->wake = eventfd(0, EFD_NONBLOCK)) < 0)
+    goto fail;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &hub->sock_server;
+  epoll_ctl(hub->epfd, EPOLL_CTL_ADD, hub->sock_server, &ev);
+  ev.data.ptr = &hub->wake;
+  epoll_ctl(hub->epfd, EPOLL_CTL_ADD, hub->wake, &ev);
+  pthread_mutex_init(&hub->lock, NULL);
+  pthread_mutex_init(&hub->publish, NULL);
+  if(tr_sched_spawn(&hub->thread, monitor_thread, hub) != 0)
+    goto fail;
+  hub->running = 1;
+  printf("Monitor clients on port %d\n", port);
+  return 0;
+
+fail:
+  perror("monitor");
+  if(hub->wake >= 0) close(hub->wake);
+  if(hub->epfd >= 0) close(hub->epfd);
+  close(hub->sock_server);
+  return -1;
+}
+
+static inline void monitor_stop(monitor_hub_t *hub)
+{
+  uint64_t one = 1;
+  int i;
+
+  if(!hub->running)
+    return;
+  __atomic_store_n(&hub->quit, 1, __ATOMIC_RELEASE);
+  write(hub->wake, &one, sizeof(one));
+  pthread_join(hub->thread, NULL);
+  for(i = 0; i < MONITOR_MAX_CLIENTS; i++)
+    if(hub->client[i].fd >= 0)
+      monitor_close(hub, &hub->client[i]);
+  close(hub->wake);
+  close(hub->epfd);
+  close(hub->sock_server);
+  hub->running = 0;
+}
+
+#endif
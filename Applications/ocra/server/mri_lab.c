@@ -10,6 +10,15 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "trace.h"
+#include "rx_acquire.h"
+#include "grad_waveform.h"
+#include "grad_dac.h"
+#include "grad_shape.h"
+#include "scan_loop.h"
+#include "scan_desc.h"
+#include "tr_sched.h"
+
 typedef union {
   int32_t le_value;
   unsigned char b[4];
@@ -39,6 +48,16 @@ typedef enum {
 	GRAD_AXIS_Z
 } gradient_axis_t;
 
+// SE/GRE gradient timing in 10 us DAC words
+#define ECHO_PREPHASER_START  2
+#define ECHO_RAMP             20   // 200 us rise time
+#define ECHO_PREPHASER_FLAT   60
+#define ECHO_READOUT_START    102
+#define ECHO_READOUT_FLAT     300
+#define ECHO_WAVEFORM_WORDS   442  // words used by update_gradient_waveforms_echo
+#define TSE_LOBE_WORDS        (2*ECHO_RAMP + ECHO_PREPHASER_FLAT)  // a phase encoding lobe of the TSE
+#define TSE_ETL               2    // (etl+1) partitions of 1000 words, longer trains do not fit the BRAM
+
 
 // Function 1
 /* generate a gradient waveform that just changes a state 
@@ -47,18 +66,13 @@ typedef enum {
 */
 void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz,gradient_state_t state, gradient_offset_t offset)
 { 
-	uint32_t i;
-	int32_t ival;
-  
-	float fLSB = 10.0/((1<<15)-1);
-	
 	switch(state) {
 		default:
 		case GRAD_ZERO_DISABLED_OUTPUT:
 			// set the DAC register to zero
-			gx[0] = 0x001fffff & (0 | 0x00100000);
-			gy[0] = 0x001fffff & (0 | 0x00100000);
-			gz[0] = 0x001fffff & (0 | 0x00100000);
+			gx[0] = grad_dac_pack(0);
+			gy[0] = grad_dac_pack(0);
+			gz[0] = grad_dac_pack(0);
 			// disable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0000;
 			gx[1] = 0x00200000;
@@ -66,9 +80,9 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 			gz[1] = 0x00200000;
 			break;
 		case GRAD_ZERO_ENABLED_OUTPUT:
-			gx[0] = 0x001fffff & (0 | 0x00100000);
-			gy[0] = 0x001fffff & (0 | 0x00100000);
-			gz[0] = 0x001fffff & (0 | 0x00100000);
+			gx[0] = grad_dac_pack(0);
+			gy[0] = grad_dac_pack(0);
+			gz[0] = grad_dac_pack(0);
 			// enable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0010;
 			gx[1] = 0x00200002;
@@ -76,12 +90,9 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 			gz[1] = 0x00200002;			
 			break;
 		case GRAD_OFFSET_ENABLED_OUTPUT:
-			ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-			gx[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-			gy[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-			gz[0] = 0x001fffff & (ival | 0x00100000);
+			gx[0] = grad_dac_word(offset.gradient_x);
+			gy[0] = grad_dac_word(offset.gradient_y);
+			gz[0] = grad_dac_word(offset.gradient_z);
 			// enable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0010;
 			gx[1] = 0x00200002;
@@ -106,42 +117,30 @@ void clear_gradient_waveforms( volatile uint32_t *gx,volatile uint32_t *gy, vola
 	}	
 }
 
+// Function 2.1
+/* Readout of the SE/GRE waveforms: the prephaser (twice the readout amplitude,
+   200 us rise time) and the readout lobe, back to the offset at word 442.
+ */
+void gradient_shape_echo_readout(grad_shape_t *ro, float ROamp)
+{
+  grad_shape_trap(ro, ECHO_PREPHASER_START, ECHO_RAMP, ECHO_PREPHASER_FLAT, ROamp*2);
+  grad_shape_trap(ro, ECHO_READOUT_START, ECHO_RAMP, ECHO_READOUT_FLAT, -ROamp);
+}
+
+
 // Function 3
 // just generate a projection along one dimension
 void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, gradient_axis_t axis, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- projection !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- projection !\n");
+
+  grad_shape_t x, y, z;
+  grad_shape_t *readout = &x;
 
-  uint32_t i;
-  int32_t ival;
-	
-  volatile uint32_t *waveform;
-  float offset_val = 0.0;
-  
-  switch(axis) {
-	case GRAD_AXIS_X:
-		waveform = gx;
-		offset_val = offset.gradient_x;
-		break;
-	case GRAD_AXIS_Y:
-		waveform = gy;
-		offset_val = offset.gradient_y;
-		break;
-	case GRAD_AXIS_Z:
-		waveform = gz;
-		offset_val = offset.gradient_z;
-		break;
-  }
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -149,53 +148,43 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
   gy[1] = 0x00200002;
   gz[1] = 0x00200002;
   
-  // set the offset current for all 3 axis
-  for(int k=2; k<2000; k++)
-  {
-	  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-	  gx[k] = 0x001fffff & (ival | 0x00100000);
-	  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-	  gy[k] = 0x001fffff & (ival | 0x00100000);
-	  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-	  gz[k] = 0x001fffff & (ival | 0x00100000);
+  // the offset current on all 3 axis, the readout on one of them
+  grad_shape_init(&x, offset.gradient_x);
+  grad_shape_init(&y, offset.gradient_y);
+  grad_shape_init(&z, offset.gradient_z);
+  switch(axis) {
+	case GRAD_AXIS_X:
+		readout = &x;
+		break;
+	case GRAD_AXIS_Y:
+		readout = &y;
+		break;
+	case GRAD_AXIS_Z:
+		readout = &z;
+		break;
   }
+  gradient_shape_echo_readout(readout, ROamp);
+  grad_shape_baseline(readout, ECHO_WAVEFORM_WORDS, 2000-ECHO_WAVEFORM_WORDS);
 
-  float fROamplitude = ROamp;
-  float fROpreamplitude = ROamp*2;
-  float fROstep = fROamplitude/20.0;
-  float fROprestep = fROpreamplitude/20.0;
-  float fRO = offset_val;
-  
-  // Design the X gradient
-  // prephaser 200 us rise time, 3V amplitude
-  for(i=2; i<22; i++) {
-    fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<122; i++) {
-    fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=422; i<442; i++) {
-    fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_compile(&x, gx, 2000);
+  grad_shape_compile(&y, gy, 2000);
+  grad_shape_compile(&z, gz, 2000);
+}
+
+
+// Function 4.0
+/* Phase encoding lobe of the SE/GRE waveforms on one channel, words 2..441.
+   These are the only words that change from one phase encoding step to the
+   next, so between TRs only this is rewritten (the hold after the ramp down
+   keeps the rounding of the ramp, so it is rewritten too).
+ */
+void update_gradient_waveform_pe(volatile uint32_t *g, float PEamp, float offset)
+{
+  grad_shape_t pe;
+
+  grad_shape_init(&pe, offset);
+  grad_shape_trap(&pe, ECHO_PREPHASER_START, ECHO_RAMP, ECHO_PREPHASER_FLAT, PEamp);
+  grad_shape_compile(&pe, g, ECHO_WAVEFORM_WORDS);
 }
 
 
@@ -208,21 +197,14 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
  */
 void update_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- 2D SE/GRE !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- 2D SE/GRE !\n");
  
-  uint32_t i;
-  int32_t ival;
-  
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
+  grad_shape_t x, y;
   
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -230,96 +212,32 @@ void update_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy,
   gy[1] = 0x00200002;
   gz[1] = 0x00200002;
 
-  float fROamplitude = ROamp;
-  float fROpreamplitude = ROamp*2;
-  float fROstep = fROamplitude/20.0;
-  float fROprestep = fROpreamplitude/20.0;
-  float fRO = offset.gradient_x;
-  
   // Design the X gradient
-  // prephaser 200 us rise time, 3V amplitude
-  for(i=2; i<22; i++) {
-    fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<122; i++) {
-    fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=422; i<442; i++) {
-    fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_init(&x, offset.gradient_x);
+  gradient_shape_echo_readout(&x, ROamp);
+  grad_shape_baseline(&x, ECHO_WAVEFORM_WORDS, 2000-ECHO_WAVEFORM_WORDS);
+  grad_shape_compile(&x, gx, 2000);
   
   // Design the Y gradient
   // prephaser 200 us rise time, 3V amplitude
-  float fPEamplitude = PEamp;
-  float fPEstep = PEamp/20.0;
-  float fPE = offset.gradient_y;
-  
-  for(i=2; i<22; i++) {
-    fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  // clear the rest of the buffer
-  for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_init(&y, offset.gradient_y);
+  grad_shape_trap(&y, ECHO_PREPHASER_START, ECHO_RAMP, ECHO_PREPHASER_FLAT, PEamp);
+  grad_shape_baseline(&y, ECHO_WAVEFORM_WORDS, 2000-ECHO_WAVEFORM_WORDS);
+  grad_shape_compile(&y, gy, 2000);
 }
 
 // Function 4.2
 // This function makes gradient waveforms for the slice selective SE or GRE sequences
 void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, float PE2amp, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- Slice-selective SE/GRE!\n"); fflush(stdout);
-  
-  uint32_t i;
-  int32_t ival;
+  trace_printf("Designing a gradient waveform -- Slice-selective SE/GRE!\n");
   
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n");
+  grad_shape_t x, y, z;
   
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -327,122 +245,54 @@ void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy
   gy[1] = 0x00200002;
   gz[1] = 0x00200002;
 
-  float fROamplitude = ROamp;
-  float fROpreamplitude = ROamp*2;
-  float fROstep = fROamplitude/20.0;
-  float fROprestep = fROpreamplitude/20.0;
-  float fRO = offset.gradient_x;
-
   // Design the X gradient
-  // prephaser 200 us rise time, 3V amplitude
-  for(i=2; i<22; i++) {
-    fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<122; i++) {
-    fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=422; i<442; i++) {
-    fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_init(&x, offset.gradient_x);
+  gradient_shape_echo_readout(&x, ROamp);
+  grad_shape_baseline(&x, ECHO_WAVEFORM_WORDS, 2000-ECHO_WAVEFORM_WORDS);
+  grad_shape_compile(&x, gx, 2000);
   
   // Design the Y gradient
   // prephaser 200 us rise time, 3V amplitude
-  float fPEamplitude = PEamp;
-  float fPEstep = PEamp/20.0;
-  float fPE = offset.gradient_y;
-  
-  for(i=2; i<22; i++) {
-    fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  // clear the rest of the buffer
-  for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=512; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-
-  // slice-selective gradient
-  int gz_offset = 1000; //  gz_offset + 
-  fPEamplitude = PE2amp;
-  fPEstep = PE2amp/6.0;
-  fPE = offset.gradient_z;
+  grad_shape_init(&y, offset.gradient_y);
+  grad_shape_trap(&y, ECHO_PREPHASER_START, ECHO_RAMP, ECHO_PREPHASER_FLAT, PEamp);
+  grad_shape_baseline(&y, ECHO_WAVEFORM_WORDS, 2000-ECHO_WAVEFORM_WORDS);
+  grad_shape_compile(&y, gy, 2000);
 
+  // slice-selective gradient (60 us ramps) and its rephaser
+  int gz_offset = 1000;
   int delay = 6;
   int delay2 = delay/2;
-  
-  for(i=gz_offset + 2; i<gz_offset + 2 + delay; i++) {
-    fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i= gz_offset + 2 + delay; i< gz_offset + 2 + delay + 40; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i= gz_offset + 2 + delay + 40; i< gz_offset + 2 + delay + 40 + delay; i++) {
-    fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  int gz_end = gz_offset + 2 + delay + 40 + delay + delay2 + 20 + delay2;
 
-  fPEstep = PE2amp/3;
-  for(i= gz_offset + 2 + delay + 40 + delay; i< gz_offset + 2 + delay + 40 + delay + delay2; i++) {
-    fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_init(&z, offset.gradient_z);
+  grad_shape_trap(&z, gz_offset + 2, delay, 40, PE2amp);
+  grad_shape_trap(&z, gz_offset + 2 + delay + 40 + delay, delay2, 20, -PE2amp);
+  grad_shape_baseline(&z, gz_end, 2000-gz_end);
+  grad_shape_compile(&z, gz, 2000);
+}
 
-  for(i= gz_offset + 2 + delay + 40 + delay + delay2; i< gz_offset + 2 + delay + 40 + delay + delay2 + 20; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
-  }
 
-  for(i = gz_offset + 2 + delay + 40 + delay + delay2 + 20; i< gz_offset + 2 + delay + 40 + delay + delay2 + 20 + delay2; i++) {
-    fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
-  }
+// Function 4.3.0
+/* One phase encoding lobe (or rewinder) of the TSE waveform, TSE_LOBE_WORDS
+   words of g from start on. The words around the lobes stay at the offset,
+   so only the lobes are rewritten between TRs. */
+void update_gradient_waveform_lobe(volatile uint32_t *g, uint32_t start, float amp, float offset)
+{
+  grad_shape_t lobe;
+
+  grad_shape_init(&lobe, offset);
+  grad_shape_trap(&lobe, GRAD_SHAPE_FIRST, ECHO_RAMP, ECHO_PREPHASER_FLAT, amp);
+  grad_shape_compile(&lobe, g + start - GRAD_SHAPE_FIRST, GRAD_SHAPE_FIRST + TSE_LOBE_WORDS);
+}
+
+// Phase encoding part of the TSE waveform (etl = 2): every echo has the phase
+// encoding lobe before the readout and its rewinder after it, 4 lobes of gy
+void update_gradient_waveforms_tse_2_pe(volatile uint32_t *gy, float PEamp[], float offset)
+{
+  update_gradient_waveform_lobe(gy, 2, PEamp[0], offset);
+  update_gradient_waveform_lobe(gy, 442, -PEamp[0], offset);
+  update_gradient_waveform_lobe(gy, 1002, PEamp[1], offset);
+  update_gradient_waveform_lobe(gy, 1442, -PEamp[1], offset);
 }
 
 
@@ -451,23 +301,15 @@ void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy
 void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, \
                               float ROamp, float PEamp[], gradient_offset_t offset)  // ETL echo train length
 {
-  printf("Designing a gradient waveform -- CPMG echo train (etl = 2) !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- CPMG echo train (etl = 2) !\n");
  
-  uint32_t i, k;
-  int32_t ival;
-  uint32_t etl = 2;
+  grad_shape_t x, y;
   uint32_t partition_size = 1000;
   
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -475,165 +317,38 @@ void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy
   gy[1] = 0x00200002;
   gz[1] = 0x00200002;
 
-  float fROamplitude = ROamp;
-  float fROpreamplitude = ROamp*2;
-  float fROstep = fROamplitude/20.0;
-  float fROprestep = fROpreamplitude/20.0;
-  float fRO = offset.gradient_x;
-  
   // Design the X gradient
+  // prephaser 200 us rise time, 3V amplitude, then one readout per echo
+  grad_shape_init(&x, offset.gradient_x);
+  gradient_shape_echo_readout(&x, ROamp);
+  grad_shape_trap(&x, partition_size + ECHO_READOUT_START, ECHO_RAMP, ECHO_READOUT_FLAT, -ROamp);
+  grad_shape_baseline(&x, 1542, 2048-1542);
+  grad_shape_compile(&x, gx, 2048);
+
+  // Design the Y gradient: the offset, then the phase encoding lobes
   // prephaser 200 us rise time, 3V amplitude
-  // Echo 1
-  for(i=2; i<22; i++) {
-    fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<122; i++) {
-    fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=422; i<442; i++) {
-    fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=442; i<542; i++) { //442+660
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=542; i<1002; i++) { //442+660
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  // Echo 2
-  for(i=1002; i<1102; i++) { //442+660
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=1102; i<1122; i++) {
-    fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=1122; i<1422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=1422; i<1442; i++) {
-    fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=1442; i<1542; i++) { //442+660
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  
-
-  // Design the Y gradient
-  // prephaser 200 us rise time, 3V amplitude
-  float fPEamplitude, fPEstep;
-  float fPE = offset.gradient_y;
-  // Echo 1
-  fPEamplitude = PEamp[0];
-  fPEstep = PEamp[0]/20.0;
-  for(i=2; i<22; i++) {
-    fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=442; i<462; i++) {
-    fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=462; i<522; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=522; i<542; i++) {
-    fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=542; i<1002; i++) { //442+660
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_init(&y, offset.gradient_y);
+  grad_shape_compile(&y, gy, 2048);
+  update_gradient_waveforms_tse_2_pe(gy, PEamp, offset.gradient_y);
+}
 
-  // Echo 2
-  fPEamplitude = PEamp[1];
-  fPEstep = PEamp[1]/20.0;
-  for(i=1002; i<1022; i++) {
-    fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=1022; i<1082; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=1082; i<1102; i++) {
-    fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=1102; i<1442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=1442; i<1462; i++) {
-    fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=1462; i<1522; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=1522; i<1542; i++) {
-    fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
 
+// Function 4.3.0.1
+// Phase encoding part of the general TSE waveform, gy of every echo partition
+void update_gradient_waveforms_tse_pe(volatile uint32_t *gy, uint32_t echo_train_length, float PEamp[], float offset)
+{
+  grad_shape_t pe;
+  uint32_t etl = echo_train_length;
+  uint32_t partition_size = 1000;
+  uint32_t part_num;
 
-  // clear the rest of the buffer
-  for(i=1542; i<2048; i++) {//for(i=1542; i<2000; i++) {  // fail 4095 2049 succeed 2000 2048
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+  // Echo 1~4
+  grad_shape_init(&pe, offset);
+  for (part_num=0; part_num<=etl; part_num++) {
+    grad_shape_trap(&pe, part_num*partition_size+2, 20, 60, PEamp[part_num]);
+    grad_shape_trap(&pe, part_num*partition_size+442, 20, 60, -PEamp[part_num]);
   }
+  grad_shape_compile(&pe, gy, (etl+1)*partition_size+2);
 }
 
 
@@ -642,26 +357,17 @@ void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy
 void update_gradient_waveforms_tse(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, \
                       float ROamp, uint32_t echo_train_length, float PEamp[], gradient_offset_t offset)  // ETL echo train length
 {
-  printf("Designing a gradient waveform -- CPMG echo train !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- CPMG echo train !\n");
 
-  uint32_t i;
-  int32_t ival;
-
-  uint32_t k;
+  grad_shape_t x, y;
   uint32_t etl = echo_train_length;
   uint32_t partition_size = 1000;
-  uint32_t part_num = 0;
-  
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
+  uint32_t part_num;
   
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -669,135 +375,24 @@ void update_gradient_waveforms_tse(volatile uint32_t *gx,volatile uint32_t *gy,
   gy[1] = 0x00200002;
   gz[1] = 0x00200002;
 
-  float fROamplitude = ROamp;
-  float fROpreamplitude = ROamp*2;
-  float fROstep = fROamplitude/20.0;
-  float fROprestep = fROpreamplitude/20.0;
-  float fRO = offset.gradient_x;
-  
   // Design the X gradient
   // prephaser 200 us rise time, 3V amplitude
-  // Echo 1~4
-
-  for (;part_num<=etl;) {
-    part_num += 1;
-    if (part_num == 1){ // only first gradient has the prephaser
-      for(i=(part_num-1)*partition_size+2; i<(part_num-1)*partition_size+22; i++) {
-        fRO += fROprestep;
-        ival = (int32_t)floor(fRO/fLSB)*16;
-        gx[i] = 0x001fffff & (ival | 0x00100000);
-      }
-      for(i=(part_num-1)*partition_size+22; i<(part_num-1)*partition_size+82; i++) {
-        ival = (int32_t)floor(fRO/fLSB)*16;
-        gx[i] = 0x001fffff & (ival | 0x00100000);
-      }
-      for(i=(part_num-1)*partition_size+82; i<(part_num-1)*partition_size+102; i++) {
-        fRO -= fROprestep;
-        ival = (int32_t)floor(fRO/fLSB)*16;
-        gx[i] = 0x001fffff & (ival | 0x00100000);
-      }
-    }
-    else {
-      for(i=(part_num-1)*partition_size+2; i<(part_num-1)*partition_size+102; i++) {
-        ival = (int32_t)floor(fRO/fLSB)*16;
-        printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-        gx[i] = 0x001fffff & (ival | 0x00100000);
-      }
-    }
-
-    for(i=(part_num-1)*partition_size+102; i<(part_num-1)*partition_size+122; i++) {
-      fRO -= fROstep;
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=(part_num-1)*partition_size+122; i<(part_num-1)*partition_size+422; i++) {
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=(part_num-1)*partition_size+422; i<(part_num-1)*partition_size+442; i++) {
-      fRO += fROstep;
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=(part_num-1)*partition_size+442; i<(part_num-1)*partition_size+542; i++) {
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=(part_num-1)*partition_size+542; i<(part_num-1)*partition_size+1002; i++) { //442+660
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
-    }
+  // Echo 1~4, only first gradient has the prephaser
+  grad_shape_init(&x, offset.gradient_x);
+  gradient_shape_echo_readout(&x, ROamp);
+  for (part_num=1; part_num<=etl; part_num++) {
+    grad_shape_trap(&x, part_num*partition_size+ECHO_READOUT_START, ECHO_RAMP, ECHO_READOUT_FLAT, -ROamp);
   }
+  grad_shape_baseline(&x, (etl+1)*partition_size+2, 2048-((etl+1)*partition_size+2));
+  grad_shape_compile(&x, gx, 2048);
 
-
-  part_num = 0;
   // Design the Y gradient
   // prephaser 200 us rise time, 3V amplitude
-  float fPEamplitude, fPEstep;
-  float fPE = offset.gradient_y;
-  
-    // Echo 1~4
-  for (;part_num<=etl;) {
-    part_num += 1;
-
-    fPEamplitude = PEamp[part_num-1];
-    fPEstep = fPEamplitude/20.0;
-
-    for(i=(part_num-1)*partition_size+2; i<(part_num-1)*partition_size+22; i++) {
-      fPE += fPEstep;
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=(part_num-1)*partition_size+22; i<(part_num-1)*partition_size+82; i++) {
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=(part_num-1)*partition_size+82; i<(part_num-1)*partition_size+102; i++) {
-      fPE -= fPEstep;
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=(part_num-1)*partition_size+102; i<(part_num-1)*partition_size+442; i++) {
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=(part_num-1)*partition_size+442; i<(part_num-1)*partition_size+462; i++) {
-      fPE -= fPEstep;
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=(part_num-1)*partition_size+462; i<(part_num-1)*partition_size+522; i++) {
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=(part_num-1)*partition_size+522; i<(part_num-1)*partition_size+542; i++) {
-      fPE += fPEstep;
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=(part_num-1)*partition_size+542; i<(part_num-1)*partition_size+1002; i++) { //442+660
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
-    }
-  }
-
-  printf("Gx\n");
-  for (i=0;i<(part_num-1)*partition_size+1002;i++) {
-    printf("\t%f\n", gx[i]);
-  }
+  update_gradient_waveforms_tse_pe(gy, etl, PEamp, offset.gradient_y);
 
-  printf("Gy\n");
-  for (i=0;i<(part_num-1)*partition_size+1002;i++) {
-    printf("\t%f\n", gy[i]);
-  }
-  
   // clear the rest of the buffer
-  for(i=part_num*partition_size+2; i<2048; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_init(&y, offset.gradient_y);
+  grad_shape_compile_range(&y, gy, (etl+1)*partition_size+2, 2048);
 }
 
 
@@ -806,314 +401,82 @@ void update_gradient_waveforms_tse(volatile uint32_t *gx,volatile uint32_t *gy,
 void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, \
                                     float amp_x, float amp_y, gradient_offset_t offset, uint32_t y_grad_off)
 {
-  printf("Designing a gradient waveform -- EPI !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- EPI !\n");
  
-  uint32_t i, k;
-  int32_t ival;
+  uint32_t k;
+  grad_shape_t x, y;
 
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
   gx[1] = 0x00200002;
   gy[1] = 0x00200002;
   gz[1] = 0x00200002;  
-  
-  float offset_x = offset.gradient_x;
-  float offset_y = offset.gradient_y;
-  
-  float grad_x, grad_y;
-  float grad_x_amp = amp_x;
-  float grad_x_step = amp_x/5;
-  float grad_y_amp = amp_y;
-  float grad_y_step = amp_y/5;
 
   // ***
   // float pe_step = 2.936/44.53/2;  //* delta_ky = 800.0 * pe_step *//
   // amp_x = 800.0 * pe_step * 64.0 / 300.0;
   // amp_y = 800.0 * pe_step / 50.0;
 
-  grad_x = offset_x;
-  grad_y = offset_y;
+  grad_shape_init(&x, offset.gradient_x);
+  grad_shape_init(&y, offset.gradient_y);
 
+  // echo train: 32 readouts of alternating sign (50 us ramps, 300 us flat)
+  // every 500 us, with a y blip (triangle, 50 us ramps) between them
   uint32_t interval = 50;
-  uint32_t mem_offset = 0;
-
   for (k=0;k<32;k++){
-  
-    mem_offset = k*interval;
-
-    // Design the X gradient
-    for(i=2+mem_offset; i<7+mem_offset; i++) {
-      if (k%2==0) {
-        grad_x += grad_x_step;
-      }
-      else {
-        grad_x -= grad_x_step;
-      }
-      ival = (int32_t)floor(grad_x/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=7+mem_offset; i<37+mem_offset; i++) {
-      ival = (int32_t)floor(grad_x/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=37+mem_offset; i<42+mem_offset; i++) {
-      if (k%2==0) {
-        grad_x -= grad_x_step;
-      }
-      else {
-        grad_x += grad_x_step;
-      }
-      ival = (int32_t)floor(grad_x/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=42+mem_offset; i<52+mem_offset; i++) {
-      ival = (int32_t)floor(grad_x/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
-    }
-
-    // Design the Y gradient
-    for(i=2+mem_offset; i<42+mem_offset; i++) {
-      ival = (int32_t)floor(grad_y/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=42+mem_offset; i<47+mem_offset; i++) {
-      grad_y += grad_y_step;
-      ival = (int32_t)floor(grad_y/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
-    }
-    for(i=47+mem_offset; i<52+mem_offset; i++) {
-      grad_y -= grad_y_step;
-      ival = (int32_t)floor(grad_y/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
-    }
+    grad_shape_trap(&x, 2+k*interval, 5, 30, (k%2==0) ? amp_x : -amp_x);
+    grad_shape_trap(&y, 42+k*interval, 5, 0, amp_y);
   }
+  grad_shape_baseline(&x, 1602, 100);
+  grad_shape_baseline(&y, 1602, 100);
 
-  // set to baseline/offset
-  for (i=1602;i<1702;i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-
+  // prephasers of the single shot sequences, each followed by 200 us at the offset
   //#####  single shot 32  #####//
   // prephaser 1: 32 single shot Spin Echo
-  uint32_t mem_offset2 = 1700;
-  grad_x = offset_x;
-  grad_y = offset_y;
-  float grad_x_step2 = grad_x_step/2.0;
-  float grad_y_step2 = amp_y * 50.0 * 15.0 / 200.0 /20;
-
-  for(i=2+mem_offset2; i<7+mem_offset2; i++) {
-    grad_x += grad_x_step2;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=37+mem_offset2; i<42+mem_offset2; i++) {
-    grad_x -= grad_x_step2;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  for(i=2+mem_offset2; i<22+mem_offset2; i++) {
-    grad_y += grad_y_step2;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22+mem_offset2; i<42+mem_offset2; i++) {
-    grad_y -= grad_y_step2;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  // set to baseline/offset
-  for(i=1742; i<1762; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_trap(&x, 1702, 5, 30, amp_x/2);
+  grad_shape_trap(&y, 1702, 20, 0, amp_y * 50.0 * 15.0 / 200.0);
+  grad_shape_baseline(&x, 1742, 20);
+  grad_shape_baseline(&y, 1742, 20);
 
   // prephaser 2: 32 single shot Gradient Echo
-  mem_offset2 = 1760;
-  grad_x = offset_x;
-  grad_y = offset_y;
-  for(i=2+mem_offset2; i<7+mem_offset2; i++) {
-    grad_x -= grad_x_step2;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=37+mem_offset2; i<42+mem_offset2; i++) {
-    grad_x += grad_x_step2;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  for(i=2+mem_offset2; i<22+mem_offset2; i++) {
-    grad_y -= grad_y_step2;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22+mem_offset2; i<42+mem_offset2; i++) {
-    grad_y += grad_y_step2;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  // set to baseline/offset
-  for(i=1802; i<1822; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_trap(&x, 1762, 5, 30, -amp_x/2);
+  grad_shape_trap(&y, 1762, 20, 0, -(amp_y * 50.0 * 15.0 / 200.0));
+  grad_shape_baseline(&x, 1802, 20);
+  grad_shape_baseline(&y, 1802, 20);
 
   //#####  single shot 64  #####// only y prephaser needs to be changed
   // prephaser 3: 64 single shot Spin Echo
-  mem_offset2 = 1820;
-  grad_x = offset_x;
-  grad_y = offset_y;
-  float grad_x_step3 = grad_x_step/2.0;
-  float grad_y_step3 = amp_y * 50.0 * 31.0 / 200.0 /20;
-
-  for(i=2+mem_offset2; i<7+mem_offset2; i++) {
-    grad_x += grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=37+mem_offset2; i<42+mem_offset2; i++) {
-    grad_x -= grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  for(i=2+mem_offset2; i<22+mem_offset2; i++) {
-    grad_y += grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22+mem_offset2; i<42+mem_offset2; i++) {
-    grad_y -= grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  // set to baseline/offset
-  for(i=1862; i<1882; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_trap(&x, 1822, 5, 30, amp_x/2);
+  grad_shape_trap(&y, 1822, 20, 0, amp_y * 50.0 * 31.0 / 200.0);
+  grad_shape_baseline(&x, 1862, 20);
+  grad_shape_baseline(&y, 1862, 20);
 
   // prephaser 4: 64 single shot Gradient Echo
-  mem_offset2 = 1880;
-  grad_x = offset_x;
-  grad_y = offset_y;
-  for(i=2+mem_offset2; i<7+mem_offset2; i++) {
-    grad_x -= grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=37+mem_offset2; i<42+mem_offset2; i++) {
-    grad_x += grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  for(i=2+mem_offset2; i<22+mem_offset2; i++) {
-    grad_y -= grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22+mem_offset2; i<42+mem_offset2; i++) {
-    grad_y += grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  // set to baseline/offset
-  for(i=1922; i<1942; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_trap(&x, 1882, 5, 30, -amp_x/2);
+  grad_shape_trap(&y, 1882, 20, 0, -(amp_y * 50.0 * 31.0 / 200.0));
+  grad_shape_baseline(&x, 1922, 20);
+  grad_shape_baseline(&y, 1922, 20);
 
   // prephaser 5: 64 single shot Gradient Echo with Partial K-space sampling
-  mem_offset2 = 1940;
-  grad_x = offset_x;
-  grad_y = offset_y;
-  grad_y_step3 = amp_y * 50.0 * 4.0 / 200.0 /20; // collect 4 extra lines across k center
-  for(i=2+mem_offset2; i<7+mem_offset2; i++) {
-    grad_x -= grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=37+mem_offset2; i<42+mem_offset2; i++) {
-    grad_x += grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  for(i=2+mem_offset2; i<22+mem_offset2; i++) {
-    grad_y -= grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22+mem_offset2; i<42+mem_offset2; i++) {
-    grad_y += grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  // set to baseline/offset
-  for(i=1982; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  // collect 4 extra lines across k center
+  grad_shape_trap(&x, 1942, 5, 30, -amp_x/2);
+  grad_shape_trap(&y, 1942, 20, 0, -(amp_y * 50.0 * 4.0 / 200.0));
+  grad_shape_baseline(&x, 1982, 18);
+  grad_shape_baseline(&y, 1982, 18);
 
   // turning off all the y gradient, for phase aligning
   if (y_grad_off) {
-    for(i=0; i<2000; i++) {
-      ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
-    }
+    grad_shape_init(&y, offset.gradient_y);
+    gy[1] = grad_dac_word(offset.gradient_y);
   }
+
+  grad_shape_compile(&x, gx, 2000);
+  grad_shape_compile(&y, gy, 2000);
 }
 
 
@@ -1122,21 +485,16 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
 void update_gradient_waveforms_spiral(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, \
                                     float lamda0, float omega0, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- spiral !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- spiral !\n");
  
   uint32_t i;
-  int32_t ival;
+  grad_shape_t x, y;
+  float ax[1994], ay[1994];
 
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -1147,54 +505,38 @@ void update_gradient_waveforms_spiral(volatile uint32_t *gx,volatile uint32_t *g
   
   float offset_x = offset.gradient_x;
   float offset_y = offset.gradient_y;
-  float grad_x, grad_y;
   float t;
   float gamma_ratio = 1;//2*3.14159/267500000;
   
-  // Design the X gradient
-  for(i=2; i<1996; i++) {
-    t = (i-2) * 10;
-    grad_x = offset_x + lamda0 * omega0 * (cos(omega0 * t) - omega0 * t * sin(omega0 * t));
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  
-
-  // Design the Y gradient
-  for(i=2; i<1996; i++) {
-    t = (i-2) * 10;
-    grad_y = offset_y + lamda0 * omega0 * (sin(omega0 * t) + omega0 * t * cos(omega0 * t));
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  for(i=1996; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  // Design the X and Y gradient
+  for(i=0; i<1994; i++) {
+    t = i * 10;
+    ax[i] = offset_x + lamda0 * omega0 * (cos(omega0 * t) - omega0 * t * sin(omega0 * t));
+    ay[i] = offset_y + lamda0 * omega0 * (sin(omega0 * t) + omega0 * t * cos(omega0 * t));
+  }
+  grad_shape_init(&x, offset.gradient_x);
+  grad_shape_arb(&x, 2, 1994, ax);
+  grad_shape_baseline(&x, 1996, 4);
+  grad_shape_compile(&x, gx, 2000);
+
+  grad_shape_init(&y, offset.gradient_y);
+  grad_shape_arb(&y, 2, 1994, ay);
+  grad_shape_baseline(&y, 1996, 4);
+  grad_shape_compile(&y, gy, 2000);
 }
 
 
 // Function 5
 void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, float PE2amp, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- 3D SE/GRE!\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- 3D SE/GRE!\n");
 
-  uint32_t i;
-  int32_t ival;
+  grad_shape_t x, y, z;
 
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -1202,102 +544,23 @@ void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *g
   gy[1] = 0x00200002;
   gz[1] = 0x00200002;
   
-  float fROamplitude = ROamp;
-  float fROpreamplitude = ROamp*2;
-  float fROstep = fROamplitude/20.0;
-  float fROprestep = fROpreamplitude/20.0;
-  float fRO = offset.gradient_x;
-  
   // Design the X gradient
-  // prephaser 200 us rise time, 3V amplitude
-  for(i=2; i<22; i++) {
-    fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<122; i++) {
-    fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=422; i<442; i++) {
-    fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_init(&x, offset.gradient_x);
+  gradient_shape_echo_readout(&x, ROamp);
+  grad_shape_baseline(&x, ECHO_WAVEFORM_WORDS, 2000-ECHO_WAVEFORM_WORDS);
+  grad_shape_compile(&x, gx, 2000);
   
-  // Design the Y gradient
-  // prephaser 200 us rise time, 3V amplitude
-  float fPEamplitude = PEamp;
-  float fPEstep = PEamp/20.0;
-  float fPE = offset.gradient_y;
-  
-  for(i=2; i<22; i++) {
-    fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  // Design the Z gradient
+  // Design the Y and Z gradient
   // prephaser 200 us rise time, 3V amplitude
-  fPEamplitude = PE2amp;
-  fPEstep = PE2amp/20.0;
-  fPE = offset.gradient_z;
-  
-  for(i=2; i<22; i++) {
-    fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  // clear the rest of the buffer
-  for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_shape_init(&y, offset.gradient_y);
+  grad_shape_trap(&y, ECHO_PREPHASER_START, ECHO_RAMP, ECHO_PREPHASER_FLAT, PEamp);
+  grad_shape_baseline(&y, ECHO_WAVEFORM_WORDS, 2000-ECHO_WAVEFORM_WORDS);
+  grad_shape_compile(&y, gy, 2000);
+
+  grad_shape_init(&z, offset.gradient_z);
+  grad_shape_trap(&z, ECHO_PREPHASER_START, ECHO_RAMP, ECHO_PREPHASER_FLAT, PE2amp);
+  grad_shape_baseline(&z, ECHO_WAVEFORM_WORDS, 2000-ECHO_WAVEFORM_WORDS);
+  grad_shape_compile(&z, gz, 2000);
 }
 
 
@@ -1305,8 +568,11 @@ void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *g
 /*
 	This function updates the pulse sequence in the memory with a chosen one through index
 */
-void update_pulse_sequence(uint32_t seq_idx, volatile uint32_t *pulseq_memory)
+void update_pulse_sequence(uint32_t seq_idx, pulseq_mem_t *seq_mem)
 {
+ volatile uint32_t *pulseq_memory = seq_mem->bram;
+
+ pulseq_mem_invalidate(seq_mem); // written past the shadow, the next upload is written in full
  switch(seq_idx) {
 
   case 1:
@@ -1740,13 +1006,146 @@ void update_pulse_sequence(uint32_t seq_idx, volatile uint32_t *pulseq_memory)
 /*
   This function updates the pulse sequence in the memory with the uploaded sequence
 */
-void update_pulse_sequence_from_upload(uint32_t *pulseq_memory_upload, volatile uint32_t *pulseq_memory)
+void update_pulse_sequence_from_upload(uint32_t *pulseq_memory_upload, pulseq_mem_t *seq_mem)
+{
+  // only the words that changed since the last load are written
+  pulseq_mem_load(seq_mem, pulseq_memory_upload, PULSEQ_UPLOAD_WORDS);
+  printf("Sequence memory: %d words written\n", seq_mem->written);
+}
+
+// Function 7.1
+/*
+  Next command of the client (proto.h, either protocol version). The data
+  of the TRs it runs belongs to a new scan. A failed receive ends the session.
+  Live commands (live_ctl.h) that arrive between scans are recorded here,
+  they take effect at the next TR.
+*/
+int recv_command(rx_engine_t *rx, uint32_t *command)
+{
+  uint32_t value;
+  int n = proto_recv_command(rx->sock_client, rx->proto, command);
+  while(n > 0 && live_is_command(*command)) {
+    if((n = proto_recv_command(rx->sock_client, rx->proto, &value)) <= 0)
+      break;
+    live_set(rx->live, *command, value);
+    n = proto_recv_command(rx->sock_client, rx->proto, command);
+  }
+  if(n > 0)
+    rx_scan_next(rx);
+  else
+    shutdown(rx->sock_client, SHUT_RDWR);  // the loop of main sees the end as well
+  return n;
+}
+
+// Function 7.2
+/*
+  Receive the scan descriptor announced by command (scan_desc.h) and run the
+  checks that do not depend on the imaging loop.
+  Returns SCAN_DESC_OK, the failed check, or -1 when the connection is gone.
+*/
+int recv_scan_desc(rx_engine_t *rx, uint32_t command, scan_desc_t *desc)
 {
-  int i;
-  int length = 200;
-  for(i=0; i<length; i++){
-    pulseq_memory[i] = pulseq_memory_upload[i];
+  int status = scan_desc_recv(rx->sock_client, rx->proto, command & 0xfffffff, desc);
+  if(status != SCAN_DESC_OK)
+    return status;
+  status = scan_desc_check(desc, RX_SAMPLES_PER_TR);
+  if(status == SCAN_DESC_OK && desc->averages > 1)
+    status = SCAN_DESC_E_AVERAGES;  // the imaging loops run one average, NEX is averaged by the client
+  return status;
+}
+
+// Function 7.3
+/*
+  Answer a scan descriptor, before the samples of its scan
+*/
+void send_scan_desc_status(rx_engine_t *rx, uint32_t status)
+{
+  if(status != SCAN_DESC_OK)
+    printf("Scan descriptor rejected: %d\n", status);
+  if(rx->stream)
+    rx_stream_flush(rx->stream);
+  proto_send(rx->sock_client, rx->proto, PROTO_MSG_REPLY, &status, sizeof(status), NULL, 0);
+}
+
+// Function 7.4
+/*
+  Gradient offsets pushed by live commands. The imaging loops take them when
+  a scan starts, the lines of one image share the offsets.
+*/
+void take_live_offsets(rx_engine_t *rx, gradient_offset_t *offset)
+{
+  live_ctl_t *l = rx->live;
+  uint32_t mask = l->offset_mask;
+
+  if(!live_take(l, LIVE_OFFSET))
+    return;
+  if(mask & 1)
+    offset->gradient_x = (float)l->offset_ma[0]/1000.0; // these offsets are in Ampere
+  if(mask & 2)
+    offset->gradient_y = (float)l->offset_ma[1]/1000.0;
+  if(mask & 4)
+    offset->gradient_z = (float)l->offset_ma[2]/1000.0;
+}
+
+// Function 8
+/*
+  2D SE/GRE with the phase encoding loop run by the sequencer (scan_loop.h).
+  The echo waveforms of several lines are written to the gradient BRAMs at once
+  and the sequencer loops the uploaded program over them, so the lines of a
+  block run without the CPU in the loop. The table of the next block is
+  written while the last line of a block recovers.
+  Returns -1 before the first TR if the uploaded program can not be looped
+  or its GRAD_PULSE is too long for two lines per table (se_short_grad.txt
+  and gre_short_grad.txt fit four).
+*/
+int acquire_echo_hw_loop(scan_loop_t *scan, grad_pingpong_t *pp, rx_engine_t *rx, uint64_t *buffer, uint32_t *pulseq_memory_upload,
+                         int32_t npe, uint32_t tr_samples, float ro, float pe, float pe_step, gradient_offset_t offset)
+{
+  int32_t done, next, lines;
+  uint32_t j;
+
+  if(scan_loop_setup(scan, pulseq_memory_upload, ECHO_WAVEFORM_WORDS) < 0)
+    return -1;
+  lines = npe < (int32_t)scan->max_lines ? npe : (int32_t)scan->max_lines;
+  if(scan_loop_program(scan, lines, SCAN_LOOP_RECOVERY_US) < 0)
+    return -1;
+  printf("Hardware-looped scan: %d lines per gradient table, %d ms per block\n", lines, (int)(scan->end_us/1000));
+  if(tr_samples == RX_SAMPLES_WINDOW)
+    tr_samples = rx_window_samples(&scan->win[0], *rx->rx_rate);  // the same window on every line
+  grad_table_invalidate(pp);
+
+  // gradient table of the first block, the lines differ in the phase encoding lobe only
+  grad_pingpong_clear(pp);
+  update_gradient_waveforms_echo(pp->design[0],pp->design[1],pp->design[2], ro, pe, offset);
+  next = 0;
+  for(j = 0; j < scan->max_lines && next < npe; j++, next++) {
+    update_gradient_waveform_pe(pp->design[1], pe, offset.gradient_y);
+    scan_loop_commit(scan, pp, j);
+    pe = pe+pe_step;
+  }
+
+  for(done = 0; done < npe && !rx_aborted(rx); done += lines) {
+    lines = npe-done < (int32_t)scan->max_lines ? npe-done : (int32_t)scan->max_lines;
+    if(lines != (int32_t)scan->lines && scan_loop_program(scan, lines, SCAN_LOOP_RECOVERY_US) < 0) {
+      // the client still expects the rest of the scan
+      printf("Hardware-looped scan: no program for %d lines\n", lines);
+      rx_drain_samples(rx, buffer, 0, (npe-done)*tr_samples);
+      break;
+    }
+    trace_log(TRACE_SCAN_BLOCK, done, done+lines-1, 0, 0);
+    scan_loop_start(scan, rx);
+    scan_loop_drain(scan, rx, buffer, tr_samples);
+
+    // the last line of the block is in its recovery, the DAC is idle
+    for(j = 0; j < scan->max_lines && next < npe; j++, next++) {
+      update_gradient_waveform_pe(pp->design[1], pe, offset.gradient_y);
+      scan_loop_commit(scan, pp, j);
+      pe = pe+pe_step;
+    }
+    scan_loop_stop(scan, rx);
+    trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
   }
+  return 0;
 }
 
  
@@ -1759,6 +1158,16 @@ int main(int argc, char *argv[])
 	volatile uint16_t *rx_cntr, *tx_size;
 	//volatile uint8_t *rx_rst, *tx_rst;
 	volatile uint64_t *rx_data; 
+	rx_engine_t rx;
+	rx_stream_t rx_stream;
+	static monitor_hub_t monitor;
+	static pulseq_mem_t seq_mem; // shadow of the sequence BRAM
+	proto_hello_t hello;
+	live_ctl_t live;
+	tr_sched_t sched;
+	static rx_decimator_t rx_decim;
+	static trace_event_t trace_snap[TRACE_EVENTS];
+	uint32_t trace_count;
 	void *tx_data;
 	float tx_freq;
 	struct sockaddr_in addr;
@@ -1770,6 +1179,11 @@ int main(int argc, char *argv[])
 	volatile uint32_t *gradient_memory_x;
 	volatile uint32_t *gradient_memory_y;
 	volatile uint32_t *gradient_memory_z;
+	static grad_pingpong_t grad_pp;
+	static scan_loop_t scan;
+	static scan_desc_t desc;
+	int desc_status;
+	uint32_t tr_samples = RX_SAMPLES_PER_TR;  // per TR of the imaging loops
   gradient_offset_t gradient_offset;  // these offsets are in Ampere
   gradient_offset.gradient_x =  0.120;
   gradient_offset.gradient_y =  0.045;
@@ -1793,10 +1207,10 @@ int main(int argc, char *argv[])
 
   // sequence type
   uint32_t seqType_idx; // used in GUI 3 and 5
-  uint32_t pulseq_memory_upload_temp[200]; // record uploaded sequence
-  unsigned char *b; // for sequence upload
-  unsigned int cmd; // for sequence upload
-  uint32_t mem_counter, nbytes, size_of_seq; // for sequence upload
+  uint32_t hw_loop;     // used in GUI 5: 1 = phase encoding loop run by the sequencer (SE/GRE)
+  uint32_t pulseq_memory_upload_temp[PULSEQ_UPLOAD_WORDS] = {0}; // record uploaded sequence
+  uint32_t nbytes, size_of_seq; // for sequence upload
+  int uploaded;                 // GUI 5: the last upload was taken, GUI 6: a descriptor brought a sequence
   
   // signal from the client
   uint32_t trig;    // Highest 4 bits of command            (trig==1)  Change center frequency
@@ -1808,11 +1222,13 @@ int main(int argc, char *argv[])
   
   
 
-  if(argc != 3) {
-    fprintf(stderr,"parameters: RF duration, RF amplitude\n");
+  if(argc != 3 && !(argc == 4 && strcmp(argv[3], "-v") == 0)) {
+    fprintf(stderr,"parameters: RF duration, RF amplitude [-v]\n");
     fprintf(stderr,"e.g.\t./mri_lab 60 32200\n");
+    fprintf(stderr,"-v prints the per-TR trace events and console lines\n");
     return -1;
   }
+  trace_set_verbose(argc == 4);
 
 	if((fd = open("/dev/mem", O_RDWR)) < 0) {
   	perror("open");
@@ -1837,6 +1253,7 @@ int main(int argc, char *argv[])
 	gradient_memory_x = mmap(NULL, 2*sysconf(_SC_PAGESIZE), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0x40002000);
 	gradient_memory_y = mmap(NULL, 2*sysconf(_SC_PAGESIZE), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0x40004000);
 	gradient_memory_z = mmap(NULL, 2*sysconf(_SC_PAGESIZE), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0x40006000);
+	grad_pingpong_init(&grad_pp, gradient_memory_x, gradient_memory_y, gradient_memory_z);
 
 	printf("Setup standard memory maps !\n"); fflush(stdout);
  
@@ -1846,6 +1263,13 @@ int main(int argc, char *argv[])
 	rx_freq = ((uint32_t *)(cfg + 4));
 	rx_rate = ((uint32_t *)(cfg + 8));
 	rx_cntr = ((uint16_t *)(sts + 0));
+	rx_engine_init(&rx, seq_config, pulseq_memory, rx_cntr, rx_data, rx_rate);
+	pulseq_mem_init(&seq_mem, pulseq_memory);
+	rx.mem = &seq_mem;
+	rx.live = &live;
+	rx.rx_freq = rx_freq;
+	rx_decimator_init(&rx_decim);
+	tr_sched_init(&sched);
 
 	//tx_rst = ((uint8_t *)(cfg + 1));
 	tx_size = ((uint16_t *)(cfg + 12));
@@ -1957,16 +1381,42 @@ int main(int argc, char *argv[])
 	printf("%s \n", "Listening...");
 	listen(sock_server, 1024);
 
-  if((sock_client = accept(sock_server, NULL, NULL)) < 0) {
-    perror("accept");
-    return EXIT_FAILURE;
-  }
-  printf("%s \n", "Accepted client!");
+  // TRs are timed by the scheduler, this thread runs them at its priority
+  tr_sched_realtime(TR_SCHED_PRIORITY);
 
-  
+  // viewers get a copy of the RX data on MONITOR_PORT (monitor.h)
+  rx_hello(&hello);
+  if(monitor_start(&monitor, MONITOR_PORT, &hello) == 0)
+    rx.monitor = &monitor;
+
+  sock_client = -1;
 	while(1) {
-    if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
-      break;
+    // a control client at a time, the next one is accepted when it is gone
+    if(sock_client < 0) {
+      if((sock_client = accept(sock_server, NULL, NULL)) < 0) {
+        perror("accept");
+        break;
+      }
+      printf("%s \n", "Accepted client!");
+      rx.sock_client = sock_client;
+      rx.proto = PROTO_VERSION_1;
+      rx.format = RX_FORMAT_FLOAT32;
+      rx.decim = NULL;
+      live_init(&live);
+      if(rx_stream_start(&rx_stream, sock_client) == 0)
+        rx.stream = &rx_stream;
+      else
+        printf("RX stream not started, sending from the scan thread\n");
+    }
+
+    if(recv_command(&rx, &command) <= 0) {
+      printf("Client disconnected, listening...\n");
+      if(rx.stream)
+        rx_stream_stop(rx.stream);
+      rx.stream = NULL;
+      close(sock_client);
+      sock_client = -1;
+      continue;
     }
 
     // Change center frequency when client status is idle (not start yet)
@@ -1981,38 +1431,103 @@ int main(int argc, char *argv[])
       continue;       
     }
 
+    // RX decimation factor of the following scans when client status is idle,
+    // 1 sends every sample, otherwise a TR is RX_SAMPLES_PER_TR/factor samples
+    if ((command>>28) == 14) {
+      value = command & 0xff;
+      if(rx_decimator_select(&rx_decim, value) == 0) {
+        rx.decim = value > 1 ? &rx_decim : NULL;
+        printf("RX decimation by %d\n", rx_decimator_factor(&rx_decim));
+      }
+      continue;
+    }
+
+    // Protocol version when client status is idle (proto.h): 2 frames the
+    // messages from the answer on, 1 goes back to bare commands
+    if ((command>>28) == 12) {
+      value = command & 0xff;
+      if(rx.stream)
+        rx_stream_flush(rx.stream);
+      if(value == PROTO_VERSION_1 || value == PROTO_VERSION_2)
+        rx.proto = value;
+      printf("Protocol version %d\n", rx.proto);
+      if(rx.proto >= PROTO_VERSION_2) {
+        send(sock_client, &hello, sizeof(hello), MSG_NOSIGNAL);
+      }
+      else {
+        send(sock_client, &rx.proto, sizeof(rx.proto), MSG_NOSIGNAL);
+      }
+      continue;
+    }
+
+    // RX sample encoding of the following scans when client status is idle
+    // (RX_FORMAT_*, rx_format.h), answered with the encoding in use as uint32
+    if ((command>>28) == 13) {
+      value = command & 0xf;
+      if(value < RX_NUM_FORMATS)
+        rx.format = value;
+      else
+        printf("RX format %d not supported\n", value);
+      printf("RX format %d\n", rx.format);
+      if(rx.stream)
+        rx_stream_flush(rx.stream);
+      proto_send(sock_client, rx.proto, PROTO_MSG_REPLY, &rx.format, sizeof(rx.format), NULL, 0);
+      continue;
+    }
+
+    // Trace ring when client status is idle: 0 send it, 1 quiet, 2 verbose, 3 clear
+    if ((command>>28) == 15) {
+      switch(command & 0xf) {
+      case 0:
+        if(rx.stream)
+          rx_stream_flush(rx.stream);
+        trace_count = trace_snapshot(trace_snap);
+        proto_send(sock_client, rx.proto, PROTO_MSG_REPLY, &trace_count, sizeof(trace_count),
+                   trace_snap, trace_count*sizeof(trace_event_t));
+        break;
+      case 1:
+      case 2:
+        trace_set_verbose((command & 0xf) == 2);
+        printf("Trace printing %s\n", (command & 0xf) == 2 ? "on" : "off");
+        break;
+      case 3:
+        trace_clear();
+        break;
+      }
+      continue;
+    }
+
     switch( command & 0x0000ffff ) {
     case 1: 
       /* GUI 1 */
       /********************* FID with frequency modification and shimming *********************/
       printf("*** MRI Lab *** -- FID\n");
-      // update_pulse_sequence(1, pulseq_memory); the old built-in seq, no longer in use
+      // update_pulse_sequence(1, &seq_mem); the old built-in seq, no longer in use
       // receive pulse sequence from the frontend
       printf("%s \n", "Receiving pulse sequence");
-      if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+      if(recv_command(&rx, &command) <= 0) {
          break;
       }
       size_of_seq = command; // number of bytes (4*num of int_32)
-      if(recv(sock_client, &buffer, size_of_seq, MSG_WAITALL) <= 0) {
-         break;
+      if(size_of_seq > sizeof(buffer)) {
+         // too long to be a sequence, drop the bytes to stay in step with the client
+         if(proto_discard_bulk(sock_client, rx.proto, size_of_seq) < 0) {
+            break;
+         }
+         printf("Sequence of %u bytes too long, the last sequence stays loaded\n", size_of_seq);
       }
-      b = (unsigned char*) buffer; 
-      mem_counter = size_of_seq/4 - 1;
-      for (i=size_of_seq-1; i>=0; i-=4) {
-        cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-        pulseq_memory_upload_temp[mem_counter] = cmd;
-        mem_counter -= 1;
+      else if(proto_recv_bulk(sock_client, rx.proto, buffer, size_of_seq) <= 0) {
+         break;
       }
-      mem_counter = 0;
-      for (i=0; i<size_of_seq; i+=4) {
-        printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-        mem_counter += 1;
+      else if(pulseq_upload_words(pulseq_memory_upload_temp, buffer, size_of_seq) < 0)
+        printf("The last sequence stays loaded\n");
+      else {
+        printf("%s \n", "Pulse sequence loaded");
+        update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
       }
-      printf("%s \n", "Pulse sequence loaded");
-      update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
       
       while(1) {
-        if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+        if(recv_command(&rx, &command) <= 0) {
           break;
         }
         if (command == 0) break; // Stop command
@@ -2035,10 +1550,10 @@ int main(int argc, char *argv[])
           value3 = (int)(command & 0x000fffff);   
           if (value2)
             value3 = -value3;
-          printf("%s %d %d %d\n", "Received values", value1, value2, value3);
+          trace_printf("%s %d %d %d\n", "Received values", value1, value2, value3);
           switch(value1) {
           case 0: 
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1: 
             printf("Set gradient offsets X %d\n", value3);
@@ -2055,25 +1570,25 @@ int main(int argc, char *argv[])
           case 4:
             printf("Load gradient offsets\n");
             gradient_offset.gradient_x = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20;
             value3 = (int)(command & 0x000fffff);
             if (value2)
               value3 = -value3;
-            printf("%s %d %d %d\n", "Received values", value1, value2, value3);
+            trace_printf("%s %d %d %d\n", "Received values", value1, value2, value3);
             gradient_offset.gradient_y = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20;
             value3 = (int)(command & 0x000fffff);
             if (value2)
               value3 = -value3;
-            printf("%s %d %d %d\n", "Received values", value1, value2, value3);
+            trace_printf("%s %d %d %d\n", "Received values", value1, value2, value3);
             gradient_offset.gradient_z = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20;
@@ -2088,10 +1603,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
         } 
 
         else {
@@ -2101,21 +1616,13 @@ int main(int argc, char *argv[])
         // turn on gradients with offset currents
         update_gradient_waveform_state(gradient_memory_x,gradient_memory_y,gradient_memory_z,GRAD_OFFSET_ENABLED_OUTPUT,gradient_offset);
         // take spin-echoes with offset currents enabled
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second  
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
-        usleep(500000);
-        //usleep(2000000);
+        trace_printf("Aquiring data\n");
+        // a recovery time after the TR before (tr_sched.h)
+        tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+        tr_sched_wait(&sched);
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+        trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
       }
       break;
       /********************* End Case 1: FID with frequency modification and shimming *********************/
@@ -2124,34 +1631,32 @@ int main(int argc, char *argv[])
       /* GUI 2 */
       /********************* Spin Echo with frequency modification and shimming *********************/
       printf("*** MRI Lab *** -- Spin Echo\n");
-      //update_pulse_sequence(2, pulseq_memory); // Spin echo, the old built-in seq, no longer in use
+      //update_pulse_sequence(2, &seq_mem); // Spin echo, the old built-in seq, no longer in use
       // receive pulse sequence from the frontend
       printf("%s \n", "Receiving pulse sequence");
-      if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+      if(recv_command(&rx, &command) <= 0) {
          break;
       }
       size_of_seq = command; // number of bytes (4*num of int_32)
-      if(recv(sock_client, &buffer, size_of_seq, MSG_WAITALL) <= 0) {
-         break;
+      if(size_of_seq > sizeof(buffer)) {
+         // too long to be a sequence, drop the bytes to stay in step with the client
+         if(proto_discard_bulk(sock_client, rx.proto, size_of_seq) < 0) {
+            break;
+         }
+         printf("Sequence of %u bytes too long, the last sequence stays loaded\n", size_of_seq);
       }
-      b = (unsigned char*) buffer; 
-      mem_counter = size_of_seq/4 - 1;
-      for (i=size_of_seq-1; i>=0; i-=4)
-      {
-        cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-        pulseq_memory_upload_temp[mem_counter] = cmd;
-        mem_counter -= 1;
+      else if(proto_recv_bulk(sock_client, rx.proto, buffer, size_of_seq) <= 0) {
+         break;
       }
-      mem_counter = 0;
-      for (i=0; i<size_of_seq; i+=4) {
-        printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-        mem_counter += 1;
+      else if(pulseq_upload_words(pulseq_memory_upload_temp, buffer, size_of_seq) < 0)
+        printf("The last sequence stays loaded\n");
+      else {
+        printf("%s \n", "Pulse sequence loaded");
+        update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
       }
-      printf("%s \n", "Pulse sequence loaded");
-      update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
 
       while(1) {
-        if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+        if(recv_command(&rx, &command) <= 0) {
           break;
         }
         if (command == 0) break; // Stop command
@@ -2174,10 +1679,10 @@ int main(int argc, char *argv[])
           value3 = (int)(command & 0x000fffff);   
           if (value2)
             value3 = -value3;
-          printf("%s %d %d %d\n", "Received values", value1, value2, value3);
+          trace_printf("%s %d %d %d\n", "Received values", value1, value2, value3);
           switch(value1) {
           case 0: 
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1: 
             printf("Set gradient offsets X %d\n", value3);
@@ -2194,25 +1699,25 @@ int main(int argc, char *argv[])
           case 4:
             printf("Load gradient offsets\n");
             gradient_offset.gradient_x = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20;
             value3 = (int)(command & 0x000fffff);
             if (value2)
               value3 = -value3;
-            printf("%s %d %d %d\n", "Received values", value1, value2, value3);
+            trace_printf("%s %d %d %d\n", "Received values", value1, value2, value3);
             gradient_offset.gradient_y = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20;
             value3 = (int)(command & 0x000fffff);
             if (value2)
               value3 = -value3;
-            printf("%s %d %d %d\n", "Received values", value1, value2, value3);
+            trace_printf("%s %d %d %d\n", "Received values", value1, value2, value3);
             gradient_offset.gradient_z = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20;
@@ -2227,10 +1732,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
         } 
 
         else {
@@ -2240,20 +1745,13 @@ int main(int argc, char *argv[])
         // turn on gradients with offset currents
         update_gradient_waveform_state(gradient_memory_x,gradient_memory_y,gradient_memory_z,GRAD_OFFSET_ENABLED_OUTPUT,gradient_offset);
         // take spin-echoes with offset currents enabled
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second  
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
-        usleep(500000);
+        trace_printf("Aquiring data\n");
+        // a recovery time after the TR before (tr_sched.h)
+        tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+        tr_sched_wait(&sched);
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+        trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
       }
       break;
       /********************* End Case 2: Spin Echo with frequency modification and shimming *********************/
@@ -2264,7 +1762,7 @@ int main(int argc, char *argv[])
       printf("*** MRI Lab *** -- MRI Signals\n");
 
       while(1) {
-        if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+        if(recv_command(&rx, &command) <= 0) {
           break;
         }
         if (command == 0) break; // Stop command
@@ -2287,10 +1785,10 @@ int main(int argc, char *argv[])
           value3 = (int)(command & 0x000fffff);   
           if (value2)
             value3 = -value3;
-          printf("%s %d %d %d\n", "Received values", value1, value2, value3);
+          trace_printf("%s %d %d %d\n", "Received values", value1, value2, value3);
           switch(value1) {
           case 0: 
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1: 
             printf("Set gradient offsets X %d\n", value3);
@@ -2310,25 +1808,25 @@ int main(int argc, char *argv[])
           case 4:
             printf("Load gradient offsets\n");
             gradient_offset.gradient_x = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20;
             value3 = (int)(command & 0x000fffff);
             if (value2)
               value3 = -value3;
-            printf("%s %d %d %d\n", "Received values", value1, value2, value3);
+            trace_printf("%s %d %d %d\n", "Received values", value1, value2, value3);
             gradient_offset.gradient_y = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20;
             value3 = (int)(command & 0x000fffff);
             if (value2)
               value3 = -value3;
-            printf("%s %d %d %d\n", "Received values", value1, value2, value3);
+            trace_printf("%s %d %d %d\n", "Received values", value1, value2, value3);
             gradient_offset.gradient_z = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20;
@@ -2343,10 +1841,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("hahahahaha Acquiring\n");
+            trace_printf("hahahahaha Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
         } 
 
         else if( trig == 3 ) { // receive pulse sequence from frontend
@@ -2355,22 +1853,11 @@ int main(int argc, char *argv[])
           printf("%s \n", "Receiving pulse sequence");
           nbytes = read(sock_client, &buffer, sizeof(buffer));
           printf("%s %d \n", "Num bytes received = ", nbytes);
-          b = (unsigned char*) buffer; 
-          mem_counter = nbytes/4 - 1;
-          for (i=nbytes-1; i>=0; i-=4)
-          {
-            cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-            pulseq_memory_upload_temp[mem_counter] = cmd;
-            mem_counter -= 1;
-          }
-
-          mem_counter = 0;
-          for (i=0; i<nbytes; i+=4) {
-            printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-            mem_counter += 1;
-          }
-          
-          printf("%s \n", "Pulse sequence loaded");
+          uploaded = pulseq_upload_words(pulseq_memory_upload_temp, buffer, nbytes) >= 0;
+          if(!uploaded)
+            printf("The last sequence stays loaded\n");
+          else
+            printf("%s \n", "Pulse sequence loaded");
 
           printf("%s %d\n", "seqType_idx", seqType_idx);
           if (seqType_idx == 0 | seqType_idx == 1 | seqType_idx == 3) {
@@ -2381,7 +1868,8 @@ int main(int argc, char *argv[])
           }
           printf("is_gradient_on: %d\n", is_gradient_on);
 
-          update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+          if(uploaded)
+            update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
 
           continue;  // wait for acquire command
         }
@@ -2398,20 +1886,13 @@ int main(int argc, char *argv[])
           ro = 1.865/2;
           update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , 0, gradient_offset);
         }
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second  
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
-        usleep(500000);
+        trace_printf("Aquiring data\n");
+        // a recovery time after the TR before (tr_sched.h)
+        tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+        tr_sched_wait(&sched);
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+        trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
       }
       break;
       /********************* End Case 3: MRI Signals GUI with frequency modification and shimming *********************/
@@ -2422,10 +1903,10 @@ int main(int argc, char *argv[])
       /********************* 1 D Projection with frequency modification *********************/
       printf("*** MRI Lab *** -- Projection\n");
 
-      update_pulse_sequence(2, pulseq_memory); // Spin echo
+      update_pulse_sequence(2, &seq_mem); // Spin echo
 
       while(1) {
-        if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+        if(recv_command(&rx, &command) <= 0) {
           break;
         }
         if (command == 0) break; // Stop command
@@ -2448,10 +1929,10 @@ int main(int argc, char *argv[])
           value3 = (int)(command & 0x000fffff);   
           if (value2)
             value3 = -value3;
-          printf("%s %d %d %d\n", "Received values", value1, value2, value3);     
+          trace_printf("%s %d %d %d\n", "Received values", value1, value2, value3);     
           switch(value1) {
           case 0: 
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1:
             printf("Set projection axis to X\n");
@@ -2468,7 +1949,7 @@ int main(int argc, char *argv[])
           case 4:
             printf("Load gradient offsets\n");
             gradient_offset.gradient_x = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20 ; 
@@ -2476,7 +1957,7 @@ int main(int argc, char *argv[])
             if (value2)
               value3 = -value3;
             gradient_offset.gradient_y = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20 ; 
@@ -2484,7 +1965,7 @@ int main(int argc, char *argv[])
             if (value2)
               value3 = -value3;
             gradient_offset.gradient_z = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20;
@@ -2499,63 +1980,36 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
         } 
 
         else if ( trig == 3 ) { // Acquire all three projections
+          tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
 
           generate_gradient_waveforms_se_proj(gradient_memory_x,gradient_memory_y,gradient_memory_z,1.0,GRAD_AXIS_X,gradient_offset);
-          printf("Aquiring x data\n");
-          seq_config[0] = 0x00000007;
-          usleep(1000000); // sleep 1 second  
-          printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-          // Transfer the data to the client
-          // transfer 10 * 5k = 50k samples
-          for(i = 0; i < 10; ++i) {
-            while(*rx_cntr < 10000) usleep(500);
-            for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-            send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-          }
-          printf("stop !!\n");
-          seq_config[0] = 0x00000000;
-          usleep(500000);
-          //usleep(2000000);
+          trace_printf("Aquiring x data\n");
+          tr_sched_wait(&sched);
+          // start the sequence and send the samples to the client as they arrive
+          rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+          trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
 
           generate_gradient_waveforms_se_proj(gradient_memory_x,gradient_memory_y,gradient_memory_z,1.0,GRAD_AXIS_Y,gradient_offset);
-          printf("Aquiring y data\n");
-          seq_config[0] = 0x00000007;
-          usleep(1000000); // sleep 1 second  
-          printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-          // Transfer the data to the client
-          // transfer 10 * 5k = 50k samples
-          for(i = 0; i < 10; ++i) {
-            while(*rx_cntr < 10000) usleep(500);
-            for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-            send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-          }
-          printf("stop !!\n");
-          seq_config[0] = 0x00000000;
-          usleep(500000);
-          //usleep(2000000);
+          trace_printf("Aquiring y data\n");
+          tr_sched_wait(&sched);
+          // start the sequence and send the samples to the client as they arrive
+          rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+          trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
 
           generate_gradient_waveforms_se_proj(gradient_memory_x,gradient_memory_y,gradient_memory_z,1.0,GRAD_AXIS_Z,gradient_offset);
-          printf("Aquiring z data\n");
-          seq_config[0] = 0x00000007;
-          usleep(1000000); // sleep 1 second  
-          printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-          // Transfer the data to the client
-          // transfer 10 * 5k = 50k samples
-          for(i = 0; i < 10; ++i) {
-            while(*rx_cntr < 10000) usleep(500);
-            for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-            send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-          }
-          printf("stop !!\n");
-          seq_config[0] = 0x00000000;
-          usleep(500000);
+          trace_printf("Aquiring z data\n");
+          tr_sched_wait(&sched);
+          // start the sequence and send the samples to the client as they arrive
+          rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+          trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
+          tr_sched_end(&sched);
           continue;
         }
 
@@ -2576,20 +2030,13 @@ int main(int argc, char *argv[])
           break;
         }
 
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second  
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
-        usleep(500000);
+        trace_printf("Aquiring data\n");
+        // a recovery time after the TR before (tr_sched.h)
+        tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+        tr_sched_wait(&sched);
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+        trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
       }
       break;
       /********************* End Case 4: 1 D Projection with frequency modification *********************/
@@ -2608,15 +2055,52 @@ int main(int argc, char *argv[])
       printf("*** MRI Lab *** -- 2D Imaging\n");
 
       while(1) {
-        if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+        rx_scan_abort_reply(&rx);  // after the samples of an aborted scan
+        if(recv_command(&rx, &command) <= 0) {
           break;
         }
         
         if (command == 0) break; // Stop command
 
         trig = command >> 28;
-        printf("Command: %d \n", command);
-        printf("Trig: %d \n", trig);
+        trace_log(TRACE_COMMAND, command, trig, 0, 0);
+        tr_samples = RX_SAMPLES_PER_TR;
+        take_live_offsets(&rx, &gradient_offset);
+
+        if ( trig == 4 ) { // Scan descriptor (scan_desc.h): set up and acquire in one message
+          desc_status = recv_scan_desc(&rx, command, &desc);
+          if(desc_status < 0)
+            break;
+          npe_idx = scan_desc_index(npe_list, sizeof(npe_list)/sizeof(npe_list[0]), desc.npe);
+          etl_idx = scan_desc_index((const int32_t *)etl_list, sizeof(etl_list)/sizeof(etl_list[0]), desc.etl);
+          if(desc_status == SCAN_DESC_OK && desc.seq_type > 7)
+            desc_status = SCAN_DESC_E_SEQ_TYPE;
+          if(desc_status == SCAN_DESC_OK && ((int)npe_idx < 0 || (desc.seq_type == 4 && desc.etl != TSE_ETL)))
+            desc_status = SCAN_DESC_E_NPE;
+          send_scan_desc_status(&rx, desc_status);
+          if(desc_status != SCAN_DESC_OK)
+            continue;
+          if(desc.freq_hz) {
+            *rx_freq = (uint32_t)floor(desc.freq_hz / 125.0e6 * (1<<30) + 0.5);
+            printf("Setting frequency to %.4f MHz\n",desc.freq_hz/1e6f);
+          }
+          gradient_offset.gradient_x = (float)desc.offset_ma[0]/1000.0; // these offsets are in Ampere
+          gradient_offset.gradient_y = (float)desc.offset_ma[1]/1000.0;
+          gradient_offset.gradient_z = (float)desc.offset_ma[2]/1000.0;
+          if(desc.nwords) {
+            memset(pulseq_memory_upload_temp, 0, sizeof(pulseq_memory_upload_temp));
+            memcpy(pulseq_memory_upload_temp, desc.words, 4*desc.nwords);
+            printf("%s %d \n", "Pulse sequence loaded, words =", desc.nwords);
+          }
+          if(desc.flags & SCAN_DESC_RX_WINDOW)
+            tr_samples = RX_SAMPLES_WINDOW;
+          else
+            tr_samples = desc.rx_samples ? desc.rx_samples : RX_SAMPLES_PER_TR;
+          // the acquire command of the descriptor
+          command = 2 << 28 | 0 << 24 | (desc.flags & SCAN_DESC_HW_LOOP) << 12 |
+                    ((int)etl_idx < 0 ? 0 : etl_idx) << 8 | npe_idx << 4 | desc.seq_type;
+          trig = 2;
+        }
 
         if ( trig == 1 ) { // Change center frequency
           value = command & 0xfffffff;
@@ -2634,24 +2118,11 @@ int main(int argc, char *argv[])
           // Note that read() returns the number of bytes read
           nbytes = read(sock_client, &buffer, sizeof(buffer));
           printf("%s %d \n", "Num bytes received = ", nbytes);
-          
-          // Loop over the number of bytes received
-          // This makes b point to the first elt of buffer and recasts buffer to unsigned char
-          b = (unsigned char*) buffer; 
-          mem_counter = nbytes/4 - 1;
-          for (i=nbytes-1; i>=0; i-=4) {
-            cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-            pulseq_memory_upload_temp[mem_counter] = cmd;
-            mem_counter -= 1;
-          }
-
-          mem_counter = 0;
-          for (i=0; i<nbytes; i+=4) {
-            printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-            mem_counter += 1;
-          }
 
-          printf("%s \n", "Pulse sequence loaded\n");
+          if(pulseq_upload_words(pulseq_memory_upload_temp, buffer, nbytes) < 0)
+            printf("The last sequence stays loaded\n");
+          else
+            printf("%s \n", "Pulse sequence loaded\n");
         }
 
         else if ( trig == 2 ) { // Change projection axis/load or zero shim
@@ -2660,7 +2131,7 @@ int main(int argc, char *argv[])
           value3 = (int)(command & 0x000fffff);   
           if (value2)
             value3 = -value3;
-          printf("%s %d %d %d\n", "Received values", value1, value2, value3);     
+          trace_printf("%s %d %d %d\n", "Received values", value1, value2, value3);     
           switch(value1) {
           case 0:  // Acquire 2D image
             etl_idx = (command & 0x00000fff) >> 8;
@@ -2670,82 +2141,122 @@ int main(int argc, char *argv[])
             npe = npe_list[npe_idx];
 
             seqType_idx = (command & 0x0000000f);
+            hw_loop = (command >> 12) & 0x1;
 
             switch(seqType_idx) {
             case 0: // Spin Echo
-              // update_pulse_sequence(2, pulseq_memory); // Spin echo
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              // update_pulse_sequence(2, &seq_mem); // Spin echo
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Spin Echo -- npe = %d\n", npe);
-              usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               // Phase encoding gradient loop
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
               ro = 1.865/2;
-              clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
-              update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, gradient_offset);
-              for(int reps=0; reps<npe; reps++) { 
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
+              if(hw_loop && acquire_echo_hw_loop(&scan, &grad_pp, &rx, buffer, pulseq_memory_upload_temp, npe, tr_samples, ro, pe, pe_step, gradient_offset) == 0) {
+                // phase encoding loop run by the sequencer, see Function 8
+              }
+              else if(grad_pingpong_start(&grad_pp, &seq_mem, rx_acquire_end_us(&rx, tr_samples)) == 0) {
+                // ping-pong gradient buffer: the next PE step is written while the current TR plays
+                grad_pingpong_clear(&grad_pp);
+                update_gradient_waveforms_echo(grad_pp.design[0],grad_pp.design[1],grad_pp.design[2], ro , pe, gradient_offset);
+                grad_pingpong_commit(&grad_pp);
+                tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+                for(int reps=0; reps<npe && !rx_aborted(&rx); reps++) { 
+                  tr_sched_wait(&sched);
+                  grad_pingpong_swap(&grad_pp, &seq_mem);
+                  trace_log(TRACE_TR_START, reps, 0, 0, 0);
+                  rx_tr_start(&rx);
+                  if(reps+1 < npe) {
+                    pe = pe+pe_step;
+                    update_gradient_waveform_pe(grad_pp.design[1], pe, gradient_offset.gradient_y);
+                    grad_pingpong_commit(&grad_pp);
+                  }
+                  rx_tr_drain(&rx, buffer, tr_samples);
+                  rx_tr_stop(&rx);
+                  trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
                 }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
-                pe = pe+pe_step;
-                update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro, pe, gradient_offset);
-                usleep(500000);
+                tr_sched_end(&sched);
+                grad_pingpong_stop(&grad_pp, &seq_mem);
+              }
+              else {
+                clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
+                update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, gradient_offset);
+                tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+                for(int reps=0; reps<npe && !rx_aborted(&rx); reps++) { 
+                  tr_sched_wait(&sched);
+                  trace_log(TRACE_TR_START, reps, 0, 0, 0);
+                  // start the sequence and send the samples to the client as they arrive
+                  rx_acquire_tr(&rx, buffer, tr_samples);
+                  trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
+                  pe = pe+pe_step;
+                  update_gradient_waveform_pe(gradient_memory_y, pe, gradient_offset.gradient_y);
+                }
+                tr_sched_end(&sched);
               }
               printf("*********************************************\n");
               break;
 
             case 1: // Gradient Echo
-              // update_pulse_sequence(3, pulseq_memory); // Gradient echo
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              // update_pulse_sequence(3, &seq_mem); // Gradient echo
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Gradient Echo -- npe = %d\n", npe);
-              usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               // Phase encoding gradient loop
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
               ro = 1.865/2;
-              clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
-              update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, gradient_offset);
-              for(int reps=0; reps<npe; reps++) { 
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
+              if(hw_loop && acquire_echo_hw_loop(&scan, &grad_pp, &rx, buffer, pulseq_memory_upload_temp, npe, tr_samples, ro, pe, pe_step, gradient_offset) == 0) {
+                // phase encoding loop run by the sequencer, see Function 8
+              }
+              else if(grad_pingpong_start(&grad_pp, &seq_mem, rx_acquire_end_us(&rx, tr_samples)) == 0) {
+                // ping-pong gradient buffer: the next PE step is written while the current TR plays
+                grad_pingpong_clear(&grad_pp);
+                update_gradient_waveforms_echo(grad_pp.design[0],grad_pp.design[1],grad_pp.design[2], ro , pe, gradient_offset);
+                grad_pingpong_commit(&grad_pp);
+                tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+                for(int reps=0; reps<npe && !rx_aborted(&rx); reps++) { 
+                  tr_sched_wait(&sched);
+                  grad_pingpong_swap(&grad_pp, &seq_mem);
+                  trace_log(TRACE_TR_START, reps, 0, 0, 0);
+                  rx_tr_start(&rx);
+                  if(reps+1 < npe) {
+                    pe = pe+pe_step;
+                    update_gradient_waveform_pe(grad_pp.design[1], pe, gradient_offset.gradient_y);
+                    grad_pingpong_commit(&grad_pp);
+                  }
+                  rx_tr_drain(&rx, buffer, tr_samples);
+                  rx_tr_stop(&rx);
+                  trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
                 }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
-                pe = pe+pe_step;
-                update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro, pe, gradient_offset);
-                usleep(500000);
+                tr_sched_end(&sched);
+                grad_pingpong_stop(&grad_pp, &seq_mem);
+              }
+              else {
+                clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
+                update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, gradient_offset);
+                tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+                for(int reps=0; reps<npe && !rx_aborted(&rx); reps++) { 
+                  tr_sched_wait(&sched);
+                  trace_log(TRACE_TR_START, reps, 0, 0, 0);
+                  // start the sequence and send the samples to the client as they arrive
+                  rx_acquire_tr(&rx, buffer, tr_samples);
+                  trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
+                  pe = pe+pe_step;
+                  update_gradient_waveform_pe(gradient_memory_y, pe, gradient_offset.gradient_y);
+                }
+                tr_sched_end(&sched);
               }
               printf("*********************************************\n");
               break;
 
             case 2:
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging SE (Slice-selective) -- npe = %d\n", npe);
-              usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               // Phase encoding gradient loop
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
@@ -2753,33 +2264,25 @@ int main(int argc, char *argv[])
               ro = 1.865/2;
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_slice(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, pe2, gradient_offset);
-              for(int reps=0; reps<npe; reps++) { 
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+              tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+              for(int reps=0; reps<npe && !rx_aborted(&rx); reps++) { 
+                tr_sched_wait(&sched);
+                trace_log(TRACE_TR_START, reps, 0, 0, 0);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, tr_samples);
+                trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
                 pe = pe+pe_step;
-                update_gradient_waveforms_slice(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, pe2, gradient_offset);
-                usleep(500000);
+                update_gradient_waveform_pe(gradient_memory_y, pe, gradient_offset.gradient_y);
               }
+              tr_sched_end(&sched);
               printf("*********************************************\n");
               break;
 
             case 3: // Slice-selective GRE
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging GRE (Slice-selective) -- npe = %d\n", npe);
-              usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               // Phase encoding gradient loop
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
@@ -2787,34 +2290,29 @@ int main(int argc, char *argv[])
               ro = 1.865/2;
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_slice(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, pe2, gradient_offset);
-              for(int reps=0; reps<npe; reps++) { 
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+              tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+              for(int reps=0; reps<npe && !rx_aborted(&rx); reps++) { 
+                tr_sched_wait(&sched);
+                trace_log(TRACE_TR_START, reps, 0, 0, 0);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, tr_samples);
+                trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
                 pe = pe+pe_step;
-                update_gradient_waveforms_slice(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, pe2, gradient_offset);
-                usleep(500000);
+                update_gradient_waveform_pe(gradient_memory_y, pe, gradient_offset.gradient_y);
               }
+              tr_sched_end(&sched);
               printf("*********************************************\n");
               break;
 
             case 4: // TSE
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Uploaded Turbo Spin Echo -- npe = %d\n", npe);
-              usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
-              etl = 2;
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+              if(etl != TSE_ETL) {
+                printf("ETL %d does not fit the gradient BRAM, running ETL %d\n", etl, TSE_ETL);
+                etl = TSE_ETL;
+              }
               int k = 0;
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
@@ -2822,109 +2320,75 @@ int main(int argc, char *argv[])
               float pes[] = {pe, pe+pe_step};
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_tse_2(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pes, gradient_offset);
-              for(int reps=0; reps<npe/etl; reps++) { 
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+              tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+              for(int reps=0; reps<npe/etl && !rx_aborted(&rx); reps++) { 
+                tr_sched_wait(&sched);
+                trace_log(TRACE_TR_START, reps, 0, 0, 0);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, tr_samples);
+                trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
                 for(k=0;k<etl;k++) {
                   pes[k] += pe_step*etl;
                 }
-                update_gradient_waveforms_tse_2(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pes, gradient_offset);
-                usleep(500000);
+                update_gradient_waveforms_tse_2_pe(gradient_memory_y, pes, gradient_offset.gradient_y);
               }
+              tr_sched_end(&sched);
               printf("*********************************************\n");
               break;
 
             case 5: //epi
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Uploaded EPI Sequence\n");
-              usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               pe_step = 2.936/44.53/2;  //* delta_ky = 800.0 * pe_step *//
               amp_x = 800.0 * pe_step * 64.0 / 300.0;
               amp_y = 800.0 * pe_step / 50.0;
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_epi(gradient_memory_x,gradient_memory_y,gradient_memory_z, amp_x, amp_y, gradient_offset, 0);
               printf("EPI TR[0]: go!!\n");
-              seq_config[0] = 0x00000007;
-              usleep(1000000); // sleep 1 second
-              printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-              // Transfer the data to the client
-              // transfer 10 * 5k = 50k samples
-              for(i = 0; i < 10; ++i) {
-                while(*rx_cntr < 10000) usleep(500);
-                for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-              }
-              printf("stop !!\n");
-              seq_config[0] = 0x00000000;
-              usleep(500000);
+              tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+              tr_sched_wait(&sched);
+              // start the sequence and send the samples to the client as they arrive
+              rx_acquire_tr(&rx, buffer, tr_samples);
+              trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
               printf("*********************************************\n");
               break;
 
             case 6: // epi without y gradients
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Uploaded EPI Sequence Disabling Grad_y\n");
-              usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               pe_step = 2.936/44.53/2;  //* delta_ky = 800.0 * pe_step *//
               amp_x = 800.0 * pe_step * 64.0 / 300.0;
               amp_y = 800.0 * pe_step / 50.0;
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_epi(gradient_memory_x,gradient_memory_y,gradient_memory_z, amp_x, amp_y, gradient_offset, 1);
               printf("EPI TR[0]: go!!\n");
-              seq_config[0] = 0x00000007;
-              usleep(1000000); // sleep 1 second
-              printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-              // Transfer the data to the client
-              // transfer 10 * 5k = 50k samples
-              for(i = 0; i < 10; ++i) {
-                while(*rx_cntr < 10000) usleep(500);
-                for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-              }
-              printf("stop !!\n");
-              seq_config[0] = 0x00000000;
-              usleep(500000);
+              tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+              tr_sched_wait(&sched);
+              // start the sequence and send the samples to the client as they arrive
+              rx_acquire_tr(&rx, buffer, tr_samples);
+              trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
               printf("*********************************************\n");
               break;
             
             case 7: // spiral
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Uploaded Spiral Sequence\n");
-              usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               a0 = 2.936/44.53/2 * 800 /2/3.14159;
               w0 = 0.01;
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_spiral(gradient_memory_x,gradient_memory_y,gradient_memory_z, a0, w0, gradient_offset);
               printf("SPIRAL TR[0]: go!!\n");
-              seq_config[0] = 0x00000007;
-              usleep(1000000); // sleep 1 second
-              printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-              // Transfer the data to the client
-              // transfer 10 * 5k = 50k samples
-              for(i = 0; i < 10; ++i) {
-                while(*rx_cntr < 10000) usleep(500);
-                for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-              }
-              printf("stop !!\n");
-              seq_config[0] = 0x00000000;
-              usleep(500000);
+              tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+              tr_sched_wait(&sched);
+              // start the sequence and send the samples to the client as they arrive
+              rx_acquire_tr(&rx, buffer, tr_samples);
+              trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
               printf("*********************************************\n");
               break;
 
@@ -2933,13 +2397,13 @@ int main(int argc, char *argv[])
             }
             
 
-            printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+            trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
             break;
             
           case 4:
             printf("Load gradient offsets\n");
             gradient_offset.gradient_x = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20 ; 
@@ -2947,7 +2411,7 @@ int main(int argc, char *argv[])
             if (value2)
               value3 = -value3;
             gradient_offset.gradient_y = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20 ; 
@@ -2955,7 +2419,7 @@ int main(int argc, char *argv[])
             if (value2)
               value3 = -value3;
             gradient_offset.gradient_z = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20;
@@ -2970,10 +2434,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
         } 
 
         else {
@@ -2995,14 +2459,53 @@ int main(int argc, char *argv[])
       // self.seqType_idx   0/1/2     Spin Echo/Turbo Spin Echo/Gradient Echo
 
       printf("*** MRI Lab *** -- 3D Imaging\n");
+      uploaded = 0;  // the built-in sequences until a descriptor brings one
 
       while(1) {
-        if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+        rx_scan_abort_reply(&rx);  // after the samples of an aborted scan
+        if(recv_command(&rx, &command) <= 0) {
           break;
         }
         if (command == 0) break; // Stop command
 
         trig = command >> 28;
+        tr_samples = RX_SAMPLES_PER_TR;
+        take_live_offsets(&rx, &gradient_offset);
+
+        if ( trig == 4 ) { // Scan descriptor (scan_desc.h): set up and acquire in one message
+          desc_status = recv_scan_desc(&rx, command, &desc);
+          if(desc_status < 0)
+            break;
+          npe_idx = scan_desc_index(npe_list, sizeof(npe_list)/sizeof(npe_list[0]), desc.npe);
+          npe2_idx = scan_desc_index(npe2_list, sizeof(npe2_list)/sizeof(npe2_list[0]), desc.npe2);
+          if(desc_status == SCAN_DESC_OK && desc.seq_type > 2)
+            desc_status = SCAN_DESC_E_SEQ_TYPE;
+          if(desc_status == SCAN_DESC_OK && ((int)npe_idx < 0 || (int)npe2_idx < 0))
+            desc_status = SCAN_DESC_E_NPE;
+          send_scan_desc_status(&rx, desc_status);
+          if(desc_status != SCAN_DESC_OK)
+            continue;
+          if(desc.freq_hz) {
+            *rx_freq = (uint32_t)floor(desc.freq_hz / 125.0e6 * (1<<30) + 0.5);
+            printf("Setting frequency to %.4f MHz\n",desc.freq_hz/1e6f);
+          }
+          gradient_offset.gradient_x = (float)desc.offset_ma[0]/1000.0; // these offsets are in Ampere
+          gradient_offset.gradient_y = (float)desc.offset_ma[1]/1000.0;
+          gradient_offset.gradient_z = (float)desc.offset_ma[2]/1000.0;
+          if(desc.nwords) {
+            memset(pulseq_memory_upload_temp, 0, sizeof(pulseq_memory_upload_temp));
+            memcpy(pulseq_memory_upload_temp, desc.words, 4*desc.nwords);
+            printf("%s %d \n", "Pulse sequence loaded, words =", desc.nwords);
+            uploaded = 1;
+          }
+          if(desc.flags & SCAN_DESC_RX_WINDOW)
+            tr_samples = RX_SAMPLES_WINDOW;
+          else
+            tr_samples = desc.rx_samples ? desc.rx_samples : RX_SAMPLES_PER_TR;
+          // the acquire command of the descriptor
+          command = 2 << 28 | 0 << 24 | npe2_idx << 8 | npe_idx << 4 | desc.seq_type;
+          trig = 2;
+        }
 
         if ( trig == 1 ) { // Change center frequency
           value = command & 0xfffffff;
@@ -3020,7 +2523,7 @@ int main(int argc, char *argv[])
           value3 = (int)(command & 0x000fffff);   
           if (value2)
             value3 = -value3;
-          printf("%s %d %d %d\n", "Received values", value1, value2, value3);     
+          trace_printf("%s %d %d %d\n", "Received values", value1, value2, value3);     
           switch(value1) {
           case 0:  // Acquire 3D image
 
@@ -3032,61 +2535,93 @@ int main(int argc, char *argv[])
             seqType_idx = (command & 0x0000000f);
             switch(seqType_idx) {
             case 0:
-              update_pulse_sequence(2, pulseq_memory); // Spin echo
+              if(uploaded)
+                update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
+              else
+                update_pulse_sequence(2, &seq_mem); // Spin echo
               printf("*** MRI Lab *** -- 3D Spin Echo Imaging -- npe = %d, npe2 = %d\n", npe, npe2);
               break;
             case 1:
-              update_pulse_sequence(3, pulseq_memory); // Gradient echo
+              if(uploaded)
+                update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
+              else
+                update_pulse_sequence(3, &seq_mem); // Gradient echo
               printf("*** MRI Lab *** -- 3D Gradient Echo Imaging -- npe = %d, npe2 = %d\n", npe, npe2);
               break;
             case 2:
-              //update_pulse_sequence(2, pulseq_memory); // Turbo Spin echo
+              //update_pulse_sequence(2, &seq_mem); // Turbo Spin echo
+              if(uploaded)
+                update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 3D Turbo Spin Echo Imaging -- npe = %d, npe2 = %d\n", npe, npe2);
               break;
             default:
               break;
             }
-            usleep(2000000); // sleep 2 second  give enough time to monitor the printout
 
-            printf("Acquiring\n");
-            printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+            trace_printf("Acquiring\n");
+            trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
             // Phase encoding gradient loop
             pe_step = 2.936/44.53/2; //[A]
             pe_step2 = 2.349/44.53;  //[A]
             pe = -(npe/2-1)*pe_step;
             pe2 = -(npe2/2-1)*pe_step2;
             ro = 1.865/2;
-            for(int parts = 0; parts<npe2; parts++) { // Phase encoding 2 gradient loop
-              update_gradient_waveforms_echo3d(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, pe2, gradient_offset);
-              for(int reps=0; reps<npe; reps++) { // Phase encoding 1 gradient loop
-                printf("TR[%d]: go!!\n",parts*64+reps);  
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second 
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                } 
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
-                pe = pe+pe_step;
-                update_gradient_waveforms_echo3d(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro, pe, pe2, gradient_offset);
-                usleep(500000);
+            if(grad_pingpong_start(&grad_pp, &seq_mem, rx_acquire_end_us(&rx, tr_samples)) == 0) {
+              // ping-pong gradient buffer: the next PE step is written while the current TR plays
+              grad_pingpong_clear(&grad_pp);
+              update_gradient_waveforms_echo3d(grad_pp.design[0],grad_pp.design[1],grad_pp.design[2], ro , pe, pe2, gradient_offset);
+              grad_pingpong_commit(&grad_pp);
+              tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+              for(int parts = 0; parts<npe2 && !rx_aborted(&rx); parts++) { // Phase encoding 2 gradient loop
+                for(int reps=0; reps<npe && !rx_aborted(&rx); reps++) { // Phase encoding 1 gradient loop
+                  tr_sched_wait(&sched);
+                  grad_pingpong_swap(&grad_pp, &seq_mem);
+                  trace_log(TRACE_TR_START, parts*64+reps, 0, 0, 0);  
+                  rx_tr_start(&rx);
+                  if(reps+1 < npe || parts+1 < npe2) {
+                    pe = pe+pe_step;
+                    if(reps+1 == npe) {
+                      pe = -(npe/2-1)*pe_step;
+                      pe2 = pe2+pe_step2;
+                      update_gradient_waveform_pe(grad_pp.design[2], pe2, gradient_offset.gradient_z);
+                    }
+                    update_gradient_waveform_pe(grad_pp.design[1], pe, gradient_offset.gradient_y);
+                    grad_pingpong_commit(&grad_pp);
+                  }
+                  rx_tr_drain(&rx, buffer, tr_samples);
+                  rx_tr_stop(&rx);
+                  trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
+                }
               }
-              pe = -(npe/2-1)*pe_step;
-              pe2 = pe2+pe_step2;
+              tr_sched_end(&sched);
+              grad_pingpong_stop(&grad_pp, &seq_mem);
+            }
+            else {
+              tr_sched_begin(&sched, rx_tr_period_us(&rx, TR_SCHED_RECOVERY_US));
+              for(int parts = 0; parts<npe2 && !rx_aborted(&rx); parts++) { // Phase encoding 2 gradient loop
+                update_gradient_waveforms_echo3d(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, pe2, gradient_offset);
+                for(int reps=0; reps<npe && !rx_aborted(&rx); reps++) { // Phase encoding 1 gradient loop
+                  tr_sched_wait(&sched);
+                  trace_log(TRACE_TR_START, parts*64+reps, 0, 0, 0);  
+                  // start the sequence and send the samples to the client as they arrive
+                  rx_acquire_tr(&rx, buffer, tr_samples);
+                  trace_log(TRACE_TR_STOP, 0, 0, 0, 0);
+                  pe = pe+pe_step;
+                  update_gradient_waveform_pe(gradient_memory_y, pe, gradient_offset.gradient_y);
+                }
+                pe = -(npe/2-1)*pe_step;
+                pe2 = pe2+pe_step2;
+              }
+              tr_sched_end(&sched);
             }
             printf("*********************************************\n");
-            printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+            trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
             break;
 
           case 4:
             printf("Load gradient offsets\n");
             gradient_offset.gradient_x = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20 ; 
@@ -3094,7 +2629,7 @@ int main(int argc, char *argv[])
             if (value2)
               value3 = -value3;
             gradient_offset.gradient_y = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20 ; 
@@ -3102,7 +2637,7 @@ int main(int argc, char *argv[])
             if (value2)
               value3 = -value3;
             gradient_offset.gradient_z = (float)value3/1000.0;
-            if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
+            if(recv_command(&rx, &command) <= 0) {
                break;
             }
             value2 = (command & 0x00ffffff) >> 20;
@@ -3117,10 +2652,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
         } 
 
         else {
@@ -3139,16 +2674,18 @@ int main(int argc, char *argv[])
 		// kill the gradients
 		update_gradient_waveform_state(gradient_memory_x,gradient_memory_y,gradient_memory_z,GRAD_ZERO_DISABLED_OUTPUT,gradient_offset);
 		// the gradient state sequence
-		update_pulse_sequence(100, pulseq_memory);	
+		update_pulse_sequence(100, &seq_mem);	
 		printf("disabling gradients with service sequence 100\n");
-		seq_config[0] = 0x00000007;
-		usleep(1000000); // sleep 1 second	
-		// stop the FPGA again
+		// run it to its HALT, then stop the FPGA again
+		rx_seq_run(&rx);
 		printf("stop !!\n");
-		seq_config[0] = 0x00000000;
     
 	} // End while loop
 
+	if(rx.stream)
+		rx_stream_stop(rx.stream);
+	monitor_stop(&monitor);
+
 	// Close the socket connection
 	close(sock_server);
 	return EXIT_SUCCESS;
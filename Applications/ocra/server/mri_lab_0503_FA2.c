@@ -9,6 +9,11 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+
+#include "rx_acquire.h"
+#include "grad_dac.h"
+#include "grad_shape.h"
+#include "grad_rotate.h"
 #define PI 3.14159265
 
 typedef union {
@@ -45,8 +50,6 @@ typedef struct {
   float val;
 } angle_t;
 
-// TODO: add a function for matrix multiplication and rotation matrix generation
-
 // Function 1
 /* generate a gradient waveform that just changes a state 
 
@@ -58,18 +61,14 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 	int32_t vmax_val_1v = vmax_val/10; // Assume a translation of 1A/V
  
 	int32_t ramp_accum;
-	uint32_t i;
-	int32_t ival;
   
-	float fLSB = 10.0/((1<<15)-1);
-	
 	switch(state) {
 		default:
 		case GRAD_ZERO_DISABLED_OUTPUT:
 			// set the DAC register to zero
-			gx[0] = 0x001fffff & (0 | 0x00100000);
-			gy[0] = 0x001fffff & (0 | 0x00100000);
-			gz[0] = 0x001fffff & (0 | 0x00100000);
+			gx[0] = grad_dac_pack(0);
+			gy[0] = grad_dac_pack(0);
+			gz[0] = grad_dac_pack(0);
 			// disable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0000;
 			gx[1] = 0x00200000;
@@ -77,9 +76,9 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 			gz[1] = 0x00200000;
 			break;
 		case GRAD_ZERO_ENABLED_OUTPUT:
-			gx[0] = 0x001fffff & (0 | 0x00100000);
-			gy[0] = 0x001fffff & (0 | 0x00100000);
-			gz[0] = 0x001fffff & (0 | 0x00100000);
+			gx[0] = grad_dac_pack(0);
+			gy[0] = grad_dac_pack(0);
+			gz[0] = grad_dac_pack(0);
 			// enable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0010;
 			gx[1] = 0x00200002;
@@ -87,12 +86,9 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 			gz[1] = 0x00200002;			
 			break;
 		case GRAD_OFFSET_ENABLED_OUTPUT:
-			ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-			gx[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-			gy[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-			gz[0] = 0x001fffff & (ival | 0x00100000);
+			gx[0] = grad_dac_word(offset.gradient_x);
+			gy[0] = grad_dac_word(offset.gradient_y);
+			gz[0] = grad_dac_word(offset.gradient_z);
 			// enable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0010;
 			gx[1] = 0x00200002;
@@ -118,427 +114,68 @@ void clear_gradient_waveforms( volatile uint32_t *gx,volatile uint32_t *gy, vola
 }
 
 
-// 2D Gradient waveforms for spin echo with rotation
-void generate_gradient_waveforms_se_rot_2d(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, gradient_offset_t offset, float theta)
-{
-  // printf("Designing a gradient waveform !\n"); fflush(stdout);
-  int32_t vmax_val = (1<<19)-1;
-  // printf("Vmax val 10V = %d\n", vmax_val);
-  int32_t vmax_val_1v = vmax_val/10;
-  int32_t vmax_val_3v = vmax_val/10;
- 
-  int32_t ramp_accum;
-  uint32_t i;
-  int32_t ivalx, ivaly, ival;
-  float fval; // try this for intermediate computation
-  
-  ramp_accum = 0;
-  // volatile uint32_t *waveform;
-  float offset_val = 0.0;
-  float fLSB = 10.0/((1<<15)-1);
-  // printf("fLSB = %g Volts\n",fLSB);
-  
-  // enable the gradients with the prescribed offset current
-  ivalx = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ivalx | 0x00100000);
-  ivaly = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ivaly | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
-  
-  // enable the outputs with 2's completment coding
-  // 24'b0010 0000 0000 0000 0000 0010;
-  gx[1] = 0x00200002;
-  gy[1] = 0x00200002;
-  gz[1] = 0x00200002;
-
-
-  float fROamplitude = ROamp;
-  float fRO_half_moment = 2.8*fROamplitude/2.0; // [ms]*Volts crazy moment
-  float fROpreamplitude = fRO_half_moment/0.8;  // Volts
-  // printf("fROprepamplitude = %f V\n",fROpreamplitude);
-  float fROprestep = fROpreamplitude/20.0;
-  float fROstep = fROamplitude/20.0;
-  float fRO = 0.0;
-  // float fRO = offset_val;
-  // float fRO = ROamp;
-
-  // float fPE = PEamp;
-  float fPE = 0.0;
-  float fPEstep = PEamp/20.0;
-
-  // Design the X and Y gradients
-  // prephaser 200 us rise time, 3V amplitude
-  for(i=2; i<22; i++) {
-    fRO += fROprestep;
-    fPE += fPEstep;
-    // ival = (int32_t)floor(fRO/fLSB)*16;
-    ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
-
-    ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;
-
-    // printf("i: %d fRO= %f dec= %d\n",i,fRO,ivalx);
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-     // ival = (int32_t)floor(fRO/fLSB)*16;
-    ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
-
-    ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;
-
-    // printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fRO -= fROprestep;
-    fPE -= fPEstep;
-
-    // ival = (int32_t)floor(fRO/fLSB)*16;
-    ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
-
-    ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;    
-
-    // printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
-  }
-  for(i=102; i<122; i++) {
-    fRO -= fROstep;
-
-    // ival = (int32_t)floor(fRO/fLSB)*16;
-    ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
-
-    ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;  
-
-    // printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
-  }
-  for(i=122; i<422; i++) {
-     // ival = (int32_t)floor(fRO/fLSB)*16;
-    ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
-
-    ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;  
-
-    // printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
-
-  }
-  for(i=422; i<442; i++) {
-    fRO += fROstep;
-    ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
-
-    ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;  
-
-    // printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
-  }
-
-  // Design the Y gradient
-  // prephaser 200 us rise time, 3V amplitude
-
-
-  //  for(i=2; i<22; i++) {
-  //   fPE += fPEstep;
-  //   ival = (int32_t)floor(fPE/fLSB)*16;
-  //   printf("i: %d fPE = %f dec= %d\n",i,fPE,ival);
-  //   gy[i] = 0x001fffff & (ival | 0x00100000);
-  // }
-  // for(i=22; i<82; i++) {
-  //   ival = (int32_t)floor(fPE/fLSB)*16;
-  //   printf("i: %d fPE = %f dec= %d\n",i,fPE,ival);
-  //   gy[i] = 0x001fffff & (ival | 0x00100000);
-  // }
-  // for(i=82; i<102; i++) {
-  //   fPE -= fPEstep;
-  //   ival = (int32_t)floor(fPE/fLSB)*16;
-  //   printf("i: %d fPE = %f dec= %d\n",i,fPE,ival);
-  //   gy[i] = 0x001fffff & (ival | 0x00100000);
-  // }
-  // for(i=102; i<442; i++) {
-  //   ival = (int32_t)floor(fPE/fLSB)*16;
-  //   printf("i: %d fPE = %f dec= %d\n",i,fPE,ival);
-  //   gy[i] = 0x001fffff & (ival | 0x00100000);
-  // }
-
-
-  // for(i=2; i<22; i++) {
-  //   fPE += fPEstep;
-  //   ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-  //   // ival = (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-  //   // ival = (int32_t)floor(fPE/fLSB)*16 * sin(theta) + (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-  //   ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-  //   printf("i: %d fPE = %f dec= %d\n",i,fPE,ival);
-  //   gy[i] = 0x001fffff & (ival | 0x00100000);
-  // }
-  // for(i=22; i<82; i++) {
-  //   ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-  //   // ival = (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-  //   // ival = (int32_t)floor(fPE/fLSB)*16 * sin(theta) + (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-  //   ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-  //   printf("i: %d fPE = %f dec= %d\n",i,fPE,ival);
-  //   gy[i] = 0x001fffff & (ival | 0x00100000);
-  // }
-  // for(i=82; i<102; i++) {
-  //   fPE -= fPEstep;
-  //   ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-  //   // ival = (int32_t)floor(fPE/fLSB)*16 * sin(theta) + (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-  //   // ival = (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-  //   ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-  //   printf("i: %d fPE = %f dec= %d\n",i,fPE,ival);
-  //   gy[i] = 0x001fffff & (ival | 0x00100000);
-  // }
-  // for(i=102; i<442; i++) {
-  //   ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-  //   // ival = (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-  //   // ival = (int32_t)floor(fPE/fLSB)*16 * sin(theta) + (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-  //   ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-  //   printf("i: %d fPE = %f dec= %d\n",i,fPE,ival);
-  //   gy[i] = 0x001fffff & (ival | 0x00100000);
-  // }
-
-  // Clear the rest of the buffer
-  for(int k=442; k<2000; k++)
-  {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[k] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[k] = 0x001fffff & (ival | 0x00100000);
-
-  }
-
-  // Z shim
-  for(int k=2; k<2000; k++)
-  {
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[k] = 0x001fffff & (ival | 0x00100000);
-  }
+// Rotated SE gradient timing in 10 us DAC words
+#define ROT_PREPHASER_START   2
+#define ROT_RAMP              20   // 200 us rise time
+#define ROT_PREPHASER_FLAT    60
+#define ROT_READOUT_START     102
+#define ROT_READOUT_FLAT      300
+#define ROT_WAVEFORM_WORDS    442  // words used by the rotated waveforms
 
+// Function 2.1
+/* readout of the rotated spin echo waveforms around 0: a prephaser of the
+   half moment 2.8*ROamp/2 over 0.8 ms, then the readout lobe at -ROamp */
+void gradient_shape_rot_readout(grad_shape_t *ro, float ROamp)
+{
+  grad_shape_init(ro, 0.0);
+  grad_shape_trap(ro, ROT_PREPHASER_START, ROT_RAMP, ROT_PREPHASER_FLAT, 2.8*ROamp/2.0/0.8);
+  grad_shape_trap(ro, ROT_READOUT_START, ROT_RAMP, ROT_READOUT_FLAT, -ROamp);
+  grad_shape_baseline(ro, ROT_WAVEFORM_WORDS, 2000-ROT_WAVEFORM_WORDS);
 }
 
-void generate_gradient_waveforms_se_rot(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, gradient_axis_t axis, gradient_offset_t offset, float theta)
+// Function 2.2
+/* the logical readout and phase encoding waveforms rotated by theta about z
+   onto gx and gy (grad_rotate.h), gz is just the z shim */
+void rotate_gradient_waveforms_se(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, gradient_offset_t offset, float theta)
 {
-  // printf("Designing a gradient waveform !\n"); fflush(stdout);
-  int32_t vmax_val = (1<<19)-1;
-  // printf("Vmax val 10V = %d\n", vmax_val);
-  int32_t vmax_val_1v = vmax_val/10;
-  int32_t vmax_val_3v = vmax_val/10;
- 
-  int32_t ramp_accum;
-  uint32_t i;
-  int32_t ival;
-  float fval; // try this for intermediate computation
-  
-  ramp_accum = 0;
-  // volatile uint32_t *waveform;
-  float offset_val = 0.0;
-  
+  grad_shape_t ro, pe;
+  grad_rotation_t rot;
+  static float fro[GRAD_BRAM_WORDS], fpe[GRAD_BRAM_WORDS], fzero[GRAD_BRAM_WORDS];
 
-  float fLSB = 10.0/((1<<15)-1);
-  // printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
-
-  // // set the DAC register to zero
-  // gx[0] = 0x00100000;
-  // gy[0] = 0x00100000;
-  // gz[0] = 0x00100000;
-  
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
+
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
   gx[1] = 0x00200002;
   gy[1] = 0x00200002;
   gz[1] = 0x00200002;
 
-  // // set the offset current for all 3 axis
-  // for(int k=2; k<2000; k++)
-  // {
-  //   ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  //   gx[k] = 0x001fffff & (ival | 0x00100000);
-  //   ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  //   gy[k] = 0x001fffff & (ival | 0x00100000);
-  //   ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  //   gz[k] = 0x001fffff & (ival | 0x00100000);
-  // }
+  gradient_shape_rot_readout(&ro, ROamp);
+  grad_shape_rasterize(&ro, fro, 2000);
 
-  float fROamplitude = ROamp;
-  float fRO_half_moment = 2.8*fROamplitude/2.0; // [ms]*Volts crazy moment
-  float fROpreamplitude = fRO_half_moment/0.8;  // Volts
-  // printf("fROprepamplitude = %f V\n",fROpreamplitude);
-  float fROprestep = fROpreamplitude/20.0;
-  float fROstep = fROamplitude/20.0;
-  float fRO = offset_val;
+  // phase encoding during the prephaser
+  grad_shape_init(&pe, 0.0);
+  grad_shape_trap(&pe, ROT_PREPHASER_START, ROT_RAMP, ROT_PREPHASER_FLAT, PEamp);
+  grad_shape_baseline(&pe, ROT_WAVEFORM_WORDS, 2000-ROT_WAVEFORM_WORDS);
+  grad_shape_rasterize(&pe, fpe, 2000);
 
-  // float fPEamplitude = PEamp;
-  // float fPEstep = PEamp/20.0;
-  // float fPE = offset.gradient_y;
-  
-    // Design the X gradient
-  // prephaser 200 us rise time, 3V amplitude
-  for(i=2; i<22; i++) {
-    fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    // ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    // printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-     // ival = (int32_t)floor(fRO/fLSB)*16;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fRO -= fROprestep;
-    // ival = (int32_t)floor(fRO/fLSB)*16;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<122; i++) {
-    fRO -= fROstep;
-    // ival = (int32_t)floor(fRO/fLSB)*16;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=122; i<422; i++) {
-     // ival = (int32_t)floor(fRO/fLSB)*16;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=422; i<442; i++) {
-    fRO += fROstep;
-    // ival = (int32_t)floor(fRO/fLSB)*16;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-
-  
-  // Design the Y gradient
-  // prephaser 200 us rise time, 3V amplitude
-  // Design the Y gradient
-  // prephaser 200 us rise time, 3V amplitude
-  for(i=2; i<22; i++) {
-    fRO += fROprestep;
-    // ival = (int32_t)floor(fRO/fLSB)*16;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    // printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    // ival = (int32_t)floor(fRO/fLSB)*16;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fRO -= fROprestep;
-    // ival = (int32_t)floor(fRO/fLSB)*16;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<122; i++) {
-    fRO -= fROstep;
-    // ival = (int32_t)floor(fRO/fLSB)*16;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=122; i<422; i++) {
-    // ival = (int32_t)floor(fRO/fLSB)*16;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=422; i<442; i++) {
-    fRO += fROstep;
-    // ival = (int32_t)floor(fRO/fLSB)*16;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-
-
-  // clear the rest of the buffer
-  for(int k=442; k<2000; k++)
-  {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[k] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[k] = 0x001fffff & (ival | 0x00100000);
-
-  }
-
-  // Z gradient is just the z shim
-  for(int k=2; k<2000; k++)
-  {
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[k] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  // // // Why doesn't this work? It just makes the red pitaya crash, even when computing fval...
-  // // // set the offset current for all 3 axes
-  // for(int k=2; k<2000; k++)
-  // {
-  //   fval = (float)(gx[k] + offset.gradient_x);
-  //   printf("fval x = %f\n", fval);
-  //   // ival = (int32_t)floor(fval/fLSB)*16;
-  //   // printf("ival x = %d\n", ival);
-  //   // gx[k] = 0x001fffff & (ival | 0x00100000);
-
-  //   fval = (float)(gy[k] + offset.gradient_y);
-  //   printf("fval y = %f\n", fval);
-  //   // ival = (int32_t)floor(fval/fLSB)*16;
-  //   // printf("ival y = %d\n", ival);
-  //   // gy[k] = 0x001fffff & (ival | 0x00100000);
-
-  //   ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  //   printf("ival z = %d\n", ival);
-  //   // gz[k] = 0x001fffff & (ival | 0x00100000);
-  // }
-
-  // TEST FOR DEBUGGING
-  // for(int k=2; k<2000; k++)
-  // {
-  //   ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  //   gx[k] = 0x001fffff & (ival | 0x00100000);
-  //   ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  //   gy[k] = 0x001fffff & (ival | 0x00100000);
-  //   ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  //   gz[k] = 0x001fffff & (ival | 0x00100000);
-  // }
+  grad_rotation_axis(&rot, GRAD_AXIS_Z, theta);
+  grad_rotate(&rot, fro, fpe, fzero, offset.gradient_x, offset.gradient_y, offset.gradient_z, gx, gy, gz, 2, 2000);
+}
 
+// 2D Gradient waveforms for spin echo with rotation
+void generate_gradient_waveforms_se_rot_2d(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, gradient_offset_t offset, float theta)
+{
+  rotate_gradient_waveforms_se(gx, gy, gz, ROamp, PEamp, offset, theta);
+}
 
+// 1D projection for spin echo with rotation, the axis is set by theta
+void generate_gradient_waveforms_se_rot(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, gradient_axis_t axis, gradient_offset_t offset, float theta)
+{
+  rotate_gradient_waveforms_se(gx, gy, gz, ROamp, 0.0, offset, theta);
 }
 
 
@@ -555,7 +192,6 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
  
   int32_t ramp_accum;
   uint32_t i;
-  int32_t ival;
 	
   ramp_accum = 0;
   volatile uint32_t *waveform;
@@ -579,12 +215,9 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
   printf("fLSB = %g Volts\n",fLSB);
   
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -595,12 +228,9 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
   // set the offset current for all 3 axis
   for(int k=2; k<2000; k++)
   {
-	  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-	  gx[k] = 0x001fffff & (ival | 0x00100000);
-	  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-	  gy[k] = 0x001fffff & (ival | 0x00100000);
-	  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-	  gz[k] = 0x001fffff & (ival | 0x00100000);
+	  gx[k] = grad_dac_word(offset.gradient_x);
+	  gy[k] = grad_dac_word(offset.gradient_y);
+	  gz[k] = grad_dac_word(offset.gradient_z);
   }
   
   float fROamplitude = ROamp;
@@ -616,32 +246,25 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
 }
 
@@ -671,12 +294,9 @@ void update_gradient_waveforms_se(volatile uint32_t *gx,volatile uint32_t *gy, v
   printf("fLSB = %g Volts\n",fLSB);
   
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
 
 
   // enable the outputs with 2's completment coding
@@ -697,32 +317,27 @@ void update_gradient_waveforms_se(volatile uint32_t *gx,volatile uint32_t *gy, v
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
+    ival = grad_dac_code(fRO);
     // printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_pack(ival);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   
   // Design the Y gradient
@@ -733,33 +348,31 @@ void update_gradient_waveforms_se(volatile uint32_t *gx,volatile uint32_t *gy, v
   
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
+    ival = grad_dac_code(fPE);
     // printf("i: %d fPE = %f dec= %d\n",i,fPE,ival);
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_pack(ival);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
+    ival = grad_dac_code(fPE);
     // printf("i: %d fPE = %f dec= %d\n",i,fPE,ival);
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_pack(ival);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
+    ival = grad_dac_code(fPE);
     // printf("i: %d fPE = %f dec= %d\n",i,fPE,ival);
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_pack(ival);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
+    ival = grad_dac_code(fPE);
     // printf("i: %d fPE = %f dec= %d\n",i,fPE,ival);
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_pack(ival);
   }
 
   // clear the rest of the buffer
   for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 }
 
@@ -775,7 +388,6 @@ void update_gradient_waveforms_se3d(volatile uint32_t *gx,volatile uint32_t *gy,
  
   int32_t ramp_accum;
   uint32_t i;
-  int32_t ival;
 
   ramp_accum = 0;
   
@@ -783,12 +395,9 @@ void update_gradient_waveforms_se3d(volatile uint32_t *gx,volatile uint32_t *gy,
   printf("fLSB = %g Volts\n",fLSB);
   
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -808,32 +417,25 @@ void update_gradient_waveforms_se3d(volatile uint32_t *gx,volatile uint32_t *gy,
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   
   // Design the Y gradient
@@ -844,21 +446,17 @@ void update_gradient_waveforms_se3d(volatile uint32_t *gx,volatile uint32_t *gy,
   
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
   // Design the Z gradient
@@ -869,31 +467,24 @@ void update_gradient_waveforms_se3d(volatile uint32_t *gx,volatile uint32_t *gy,
   
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
 
   // clear the rest of the buffer
   for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
+    gz[i] = grad_dac_word(offset.gradient_z);
   }
 }
 
@@ -902,8 +493,11 @@ void update_gradient_waveforms_se3d(volatile uint32_t *gx,volatile uint32_t *gy,
 /*
 	This function updates the pulse sequence in the memory with a chosen one through index
 */
-void update_pulse_sequence(uint32_t seq_idx, volatile uint32_t *pulseq_memory)
+void update_pulse_sequence(uint32_t seq_idx, pulseq_mem_t *seq_mem)
 {
+ volatile uint32_t *pulseq_memory = seq_mem->bram;
+
+ pulseq_mem_invalidate(seq_mem); // written past the shadow, the next upload is written in full
  switch(seq_idx) {
 
   case 1:
@@ -1400,13 +994,15 @@ int main(int argc, char *argv[])
 	volatile uint16_t *rx_cntr, *tx_size;
 	//volatile uint8_t *rx_rst, *tx_rst;
 	volatile uint64_t *rx_data; 
+	rx_engine_t rx;
+	static pulseq_mem_t seq_mem; // shadow of the sequence BRAM
 	void *tx_data;
 	float tx_freq, angle_rad;
 	struct sockaddr_in addr;
 	uint32_t command;
 	int16_t pulse[32768];
 	uint64_t buffer[8192];
-	int i, j, size, yes = 1, num_avgs;
+	int i, size, yes = 1, num_avgs;
 	swappable_int32_t lv,bv;
 	volatile uint32_t *gradient_memory_x;
 	volatile uint32_t *gradient_memory_y;
@@ -1477,6 +1073,9 @@ int main(int argc, char *argv[])
 	rx_freq = ((uint32_t *)(cfg + 4));
 	rx_rate = ((uint32_t *)(cfg + 8));
 	rx_cntr = ((uint16_t *)(sts + 0));
+	rx_engine_init(&rx, seq_config, pulseq_memory, rx_cntr, rx_data, rx_rate);
+	pulseq_mem_init(&seq_mem, pulseq_memory);
+	rx.mem = &seq_mem;
 
 	//tx_rst = ((uint8_t *)(cfg + 1));
 	tx_size = ((uint16_t *)(cfg + 12));
@@ -1593,6 +1192,7 @@ int main(int argc, char *argv[])
     return EXIT_FAILURE;
   }
   printf("%s \n", "Accepted client!");
+  rx.sock_client = sock_client;
 
   
 	while(1) {
@@ -1637,7 +1237,7 @@ int main(int argc, char *argv[])
       /********************* FID with frequency modification and shimming *********************/
       printf("*** MRI Lab *** -- FID\n");
       
-      update_pulse_sequence(1, pulseq_memory);
+      update_pulse_sequence(1, &seq_mem);
 
       while(1) {
         if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
@@ -1723,18 +1323,9 @@ int main(int argc, char *argv[])
         update_gradient_waveform_state(gradient_memory_x,gradient_memory_y,gradient_memory_z,GRAD_OFFSET_ENABLED_OUTPUT,gradient_offset);
         // take spin-echoes with offset currents enabled
         printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second  
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
         printf("stop !!\n");
-        seq_config[0] = 0x00000000;
         // usleep(2000000);
       }
       break;
@@ -1745,7 +1336,7 @@ int main(int argc, char *argv[])
       /********************* Spin Echo with frequency modification and shimming *********************/
       printf("*** MRI Lab *** -- Spin Echo\n");
       
-      update_pulse_sequence(2, pulseq_memory); // Spin echo
+      update_pulse_sequence(2, &seq_mem); // Spin echo
 
       while(1) {
         if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
@@ -1831,18 +1422,9 @@ int main(int argc, char *argv[])
         update_gradient_waveform_state(gradient_memory_x,gradient_memory_y,gradient_memory_z,GRAD_OFFSET_ENABLED_OUTPUT,gradient_offset);
         // take spin-echoes with offset currents enabled
         printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        // usleep(1000000); // sleep 1 second  
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
         printf("stop !!\n");
-        seq_config[0] = 0x00000000;
         // usleep(2000000);
       }
       break;
@@ -1856,7 +1438,7 @@ int main(int argc, char *argv[])
 
       char pAxis; // projection axis: x/y/z
 
-      update_pulse_sequence(2, pulseq_memory); // Spin echo
+      update_pulse_sequence(2, &seq_mem); // Spin echo
 
       while(1) {
         if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
@@ -1950,18 +1532,9 @@ int main(int argc, char *argv[])
         }
 
         printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second  
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
         printf("stop !!\n");
-        seq_config[0] = 0x00000000;
         // usleep(2000000);
         usleep(1000000);
       }
@@ -2015,15 +1588,15 @@ int main(int argc, char *argv[])
             seqType_idx = (command & 0x0000000f);
             switch(seqType_idx) {
             case 0:
-              update_pulse_sequence(2, pulseq_memory); // Spin echo
+              update_pulse_sequence(2, &seq_mem); // Spin echo
               printf("*** MRI Lab *** -- 2D Spin Echo Imaging -- npe = %d\n", npe);
               break;
             case 1:
-              update_pulse_sequence(3, pulseq_memory); // Gradient echo
+              update_pulse_sequence(3, &seq_mem); // Gradient echo
               printf("*** MRI Lab *** -- 2D Gradient Echo Imaging -- npe = %d\n", npe);
               break;
             case 2:
-              //update_pulse_sequence(2, pulseq_memory); // Turbo Spin echo
+              //update_pulse_sequence(2, &seq_mem); // Turbo Spin echo
               printf("*** MRI Lab *** -- 2D Turbo Spin Echo Imaging -- npe = %d\n", npe);
               break;
             default:
@@ -2040,18 +1613,9 @@ int main(int argc, char *argv[])
             update_gradient_waveforms_se(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, gradient_offset);
             for(int reps=0; reps<npe; reps++) { 
               printf("TR[%d]: go!!\n",reps);
-              seq_config[0] = 0x00000007;
-              usleep(1000000); // sleep 1 second
-              printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-              // Transfer the data to the client
-              // transfer 10 * 5k = 50k samples
-              for(i = 0; i < 10; ++i) {
-                while(*rx_cntr < 10000) usleep(500);
-                for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-              }
+              // start the sequence and send the samples to the client as they arrive
+              rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
               printf("stop !!\n");
-              seq_config[0] = 0x00000000;
               pe = pe+pe_step;
               update_gradient_waveforms_se(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro, pe, gradient_offset);
               usleep(500000);
@@ -2148,15 +1712,15 @@ int main(int argc, char *argv[])
             seqType_idx = (command & 0x0000000f);
             switch(seqType_idx) {
             case 0:
-              update_pulse_sequence(2, pulseq_memory); // Spin echo
+              update_pulse_sequence(2, &seq_mem); // Spin echo
               printf("*** MRI Lab *** -- 3D Spin Echo Imaging -- npe = %d, npe2 = %d\n", npe, npe2);
               break;
             case 1:
-              update_pulse_sequence(3, pulseq_memory); // Gradient echo
+              update_pulse_sequence(3, &seq_mem); // Gradient echo
               printf("*** MRI Lab *** -- 3D Gradient Echo Imaging -- npe = %d, npe2 = %d\n", npe, npe2);
               break;
             case 2:
-              //update_pulse_sequence(2, pulseq_memory); // Turbo Spin echo
+              //update_pulse_sequence(2, &seq_mem); // Turbo Spin echo
               printf("*** MRI Lab *** -- 3D Turbo Spin Echo Imaging -- npe = %d, npe2 = %d\n", npe, npe2);
               break;
             default:
@@ -2179,18 +1743,9 @@ int main(int argc, char *argv[])
               update_gradient_waveforms_se3d(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, pe2, gradient_offset);
               for(int reps=0; reps<npe; reps++) { 
                 printf("TR[%d]: go!!\n",parts*64+reps);  
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second 
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                } 
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
                 printf("stop !!\n");
-                seq_config[0] = 0x00000000;
                 pe = pe+pe_step;
                 update_gradient_waveforms_se3d(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro, pe, pe2, gradient_offset);
                 usleep(2000000);
@@ -2251,9 +1806,9 @@ int main(int argc, char *argv[])
 
       // char pAxis; // projection axis: x/y/z
 
-      update_pulse_sequence(2, pulseq_memory); // Spin echo
+      update_pulse_sequence(2, &seq_mem); // Spin echo
       // try gradient echo
-      // update_pulse_sequence(3, pulseq_memory); // Gradient echo
+      // update_pulse_sequence(3, &seq_mem); // Gradient echo
 
       while(1) {
         if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
@@ -2343,21 +1898,9 @@ int main(int argc, char *argv[])
             generate_gradient_waveforms_se_rot(gradient_memory_x, gradient_memory_y, gradient_memory_z, 1.0, GRAD_AXIS_X, gradient_offset, theta.val);
             // printf("Aquiring data\n");
             printf("Acquiring shot %d\n", avg);
-            seq_config[0] = 0x00000007;
-            // usleep(50000);
-            usleep(800000); // sleep 1 second  
-            // printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-
-            // Transfer the data to the client
-            // transfer 10 * 5k = 50k samples
-            for(i = 0; i < 10; ++i) {
-              while(*rx_cntr < 10000) usleep(500);
-              for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-              send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-            } // End data transfer loop
-
+            // start the sequence and send the samples to the client as they arrive
+            rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
             printf("stop !!\n");
-            seq_config[0] = 0x00000000;
             // usleep(2000000);
 
           } // End averaging loop
@@ -2389,18 +1932,9 @@ int main(int argc, char *argv[])
           for(int reps=0; reps<npe; reps++) { 
             printf("Pe = %f\n", pe);
             printf("TR[%d]: go!!\n",reps);
-            seq_config[0] = 0x00000007;
-            usleep(1000000); // sleep 1 second
-            // printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-            // Transfer the data to the client
-            // transfer 10 * 5k = 50k samples
-            for(i = 0; i < 10; ++i) {
-              while(*rx_cntr < 10000) usleep(500);
-              for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-              send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-            }
+            // start the sequence and send the samples to the client as they arrive
+            rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
           printf("stop !!\n");
-          seq_config[0] = 0x00000000;
           pe = pe+pe_step;
           generate_gradient_waveforms_se_rot_2d(gradient_memory_x,gradient_memory_y, gradient_memory_z, ro, pe, gradient_offset, theta.val);
           usleep(300000);
@@ -2464,7 +1998,7 @@ int main(int argc, char *argv[])
 		// kill the gradients
 		update_gradient_waveform_state(gradient_memory_x,gradient_memory_y,gradient_memory_z,GRAD_ZERO_DISABLED_OUTPUT,gradient_offset);
 		// the gradient state sequence
-		update_pulse_sequence(100, pulseq_memory);	
+		update_pulse_sequence(100, &seq_mem);	
 		printf("disabling gradients with service sequence 100\n");
 		seq_config[0] = 0x00000007;
 		usleep(1000000); // sleep 1 second	
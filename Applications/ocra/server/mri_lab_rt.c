@@ -10,6 +10,11 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "rx_acquire.h"
+#include "grad_dac.h"
+#include "grad_shape.h"
+#include "grad_rotate.h"
+
 #define PI 3.14159265
 
 typedef union {
@@ -45,6 +50,13 @@ typedef struct {
   float val;
 } angle_t;
 
+// SE/GRE gradient timing in 10 us DAC words
+#define ECHO_PREPHASER_START  2
+#define ECHO_RAMP             20   // 200 us rise time
+#define ECHO_PREPHASER_FLAT   60
+#define ECHO_READOUT_START    102
+#define ECHO_READOUT_FLAT     300
+#define ECHO_WAVEFORM_WORDS   442  // words used by update_gradient_waveforms_echo
 
 // Function 1
 /* generate a gradient waveform that just changes a state 
@@ -53,18 +65,13 @@ typedef struct {
 */
 void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz,gradient_state_t state, gradient_offset_t offset)
 { 
-	uint32_t i;
-	int32_t ival;
-  
-	float fLSB = 10.0/((1<<15)-1);
-	
 	switch(state) {
 		default:
 		case GRAD_ZERO_DISABLED_OUTPUT:
 			// set the DAC register to zero
-			gx[0] = 0x001fffff & (0 | 0x00100000);
-			gy[0] = 0x001fffff & (0 | 0x00100000);
-			gz[0] = 0x001fffff & (0 | 0x00100000);
+			gx[0] = grad_dac_pack(0);
+			gy[0] = grad_dac_pack(0);
+			gz[0] = grad_dac_pack(0);
 			// disable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0000;
 			gx[1] = 0x00200000;
@@ -72,9 +79,9 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 			gz[1] = 0x00200000;
 			break;
 		case GRAD_ZERO_ENABLED_OUTPUT:
-			gx[0] = 0x001fffff & (0 | 0x00100000);
-			gy[0] = 0x001fffff & (0 | 0x00100000);
-			gz[0] = 0x001fffff & (0 | 0x00100000);
+			gx[0] = grad_dac_pack(0);
+			gy[0] = grad_dac_pack(0);
+			gz[0] = grad_dac_pack(0);
 			// enable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0010;
 			gx[1] = 0x00200002;
@@ -82,12 +89,9 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 			gz[1] = 0x00200002;			
 			break;
 		case GRAD_OFFSET_ENABLED_OUTPUT:
-			ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-			gx[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-			gy[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-			gz[0] = 0x001fffff & (ival | 0x00100000);
+			gx[0] = grad_dac_word(offset.gradient_x);
+			gy[0] = grad_dac_word(offset.gradient_y);
+			gz[0] = grad_dac_word(offset.gradient_z);
 			// enable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0010;
 			gx[1] = 0x00200002;
@@ -112,14 +116,23 @@ void clear_gradient_waveforms( volatile uint32_t *gx,volatile uint32_t *gy, vola
 	}	
 }
 
+// Function 2.1
+/* Readout of the SE/GRE waveforms: the prephaser (twice the readout amplitude,
+   200 us rise time) and the readout lobe, back to the level it started from at word 442.
+ */
+void gradient_shape_echo_readout(grad_shape_t *ro, float ROamp)
+{
+  grad_shape_trap(ro, ECHO_PREPHASER_START, ECHO_RAMP, ECHO_PREPHASER_FLAT, ROamp*2);
+  grad_shape_trap(ro, ECHO_READOUT_START, ECHO_RAMP, ECHO_READOUT_FLAT, -ROamp);
+}
+
 // Function 3.1
 // just generate a projection along one dimension
 void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, gradient_axis_t axis, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- projection !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- projection !\n");
 
   uint32_t i;
-  int32_t ival;
 	
   volatile uint32_t *waveform;
   float offset_val = 0.0;
@@ -138,16 +151,10 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
 		offset_val = offset.gradient_z;
 		break;
   }
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -158,12 +165,9 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
   // set the offset current for all 3 axis
   for(int k=2; k<2000; k++)
   {
-	  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-	  gx[k] = 0x001fffff & (ival | 0x00100000);
-	  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-	  gy[k] = 0x001fffff & (ival | 0x00100000);
-	  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-	  gz[k] = 0x001fffff & (ival | 0x00100000);
+	  gx[k] = grad_dac_word(offset.gradient_x);
+	  gy[k] = grad_dac_word(offset.gradient_y);
+	  gz[k] = grad_dac_word(offset.gradient_z);
   }
 
   float fROamplitude = ROamp;
@@ -176,31 +180,25 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
 }
 
@@ -209,23 +207,16 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
 // just generate a projection along one dimension (rotated)
 void generate_gradient_waveforms_se_proj_rot(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, gradient_axis_t axis, gradient_offset_t offset, float theta)
 {//generate_gradient_waveforms_se_rot
-  printf("Designing a gradient waveform -- Rotated projection !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- Rotated projection !\n");
+
+  grad_shape_t ro, zero;
+  grad_rotation_t rot;
+  static float fro[GRAD_BRAM_WORDS], fzero[GRAD_BRAM_WORDS];
 
-  uint32_t i;
-  int32_t ival;
-  
-  float offset_val = 0.0;
-  
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -233,103 +224,16 @@ void generate_gradient_waveforms_se_proj_rot(volatile uint32_t *gx,volatile uint
   gy[1] = 0x00200002;
   gz[1] = 0x00200002;
 
-  float fROamplitude = ROamp;
-  float fROpreamplitude = ROamp*2;
-  float fROstep = fROamplitude/20.0;
-  float fROprestep = fROpreamplitude/20.0;
-  float fRO = offset_val;
-  
-  // Design the X gradient
-  // prephaser 200 us rise time, 3V amplitude
-  for(i=2; i<22; i++) {
-    fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<122; i++) {
-    fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=422; i<442; i++) {
-    fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-
-  // Design the Y gradient
-  // prephaser 200 us rise time, 3V amplitude
-  for(i=2; i<22; i++) {
-    fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=102; i<122; i++) {
-    fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-  for(i=422; i<442; i++) {
-    fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-  }
-
-  // clear the rest of the buffer
-  for(int k=442; k<2000; k++)
-  {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[k] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[k] = 0x001fffff & (ival | 0x00100000);
-
-  }
+  // the readout in the x-y plane, Z gradient is just the z shim
+  grad_shape_init(&ro, 0.0);
+  gradient_shape_echo_readout(&ro, ROamp);
+  grad_shape_baseline(&ro, ECHO_WAVEFORM_WORDS, 2000-ECHO_WAVEFORM_WORDS);
+  grad_shape_rasterize(&ro, fro, 2000);
+  grad_shape_init(&zero, 0.0);
+  grad_shape_rasterize(&zero, fzero, 2000);
 
-  // Z gradient is just the z shim
-  for(int k=2; k<2000; k++)
-  {
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[k] = 0x001fffff & (ival | 0x00100000);
-  }
+  grad_rotation_axis(&rot, GRAD_AXIS_Z, theta);
+  grad_rotate(&rot, fro, fzero, fzero, offset.gradient_x, offset.gradient_y, offset.gradient_z, gx, gy, gz, 2, 2000);
 }
 
 
@@ -342,21 +246,14 @@ void generate_gradient_waveforms_se_proj_rot(volatile uint32_t *gx,volatile uint
  */
 void update_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- 2D SE/GRE !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- 2D SE/GRE !\n");
  
   uint32_t i;
-  int32_t ival;
-  
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
   
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -374,31 +271,25 @@ void update_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy,
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   
   // Design the Y gradient
@@ -409,45 +300,32 @@ void update_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy,
   
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
   // clear the rest of the buffer
   for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 }
 
 // Function 4.1.1
-// gradient waveforms for the SE/GRE (rotated)
-void update_gradient_waveforms_echo_rot(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, gradient_offset_t offset, float theta)
-{//generate_gradient_waveforms_se_rot_2d
-  printf("Designing a gradient waveform -- Rotated 2D SE/GRE !\n"); fflush(stdout);
-
-  uint32_t i;
-  int32_t ivalx, ivaly, ival;
-  
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
-  float offset_val = 0.0;
+/* In-plane rotation of the SE/GRE waveforms by theta, with the calibration
+   of the off-diagonal terms (PE on x, RO on y) that was measured for the rotated images.
+ */
+void gradient_rotation_echo(grad_rotation_t *rot, float theta)
+{
   // float gx_correction = 0.7;
   // float gx_correction = 1.0;
   // float gx_correction = 0.85;
@@ -467,150 +345,60 @@ void update_gradient_waveforms_echo_rot(volatile uint32_t *gx,volatile uint32_t
   // float gy_correction = 2.5;
   // float gy_correction = 4.0;
 
+  grad_rotation_axis(rot, GRAD_AXIS_Z, theta);
+  rot->m[0][1] *= gy_correction;
+  rot->m[1][0] *= gx_correction;
+}
 
-  // enable the gradients with the prescribed offset current
-  ivalx = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ivalx | 0x00100000);
-  ivaly = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ivaly | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
-  
-  // enable the outputs with 2's completment coding
-  // 24'b0010 0000 0000 0000 0000 0010;
-  gx[1] = 0x00200002;
-  gy[1] = 0x00200002;
-  gz[1] = 0x00200002;
+// Function 4.1.2
+/* Rotated SE/GRE waveforms, words 2..end-1. The readout and the phase encoding
+   lobe are designed on the logical axes and rotated onto gx, gy and gz in one pass.
+   Between phase encoding steps only words 2..ECHO_WAVEFORM_WORDS-1 change.
+ */
+void rotate_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, gradient_offset_t offset, const grad_rotation_t *rot, uint32_t end)
+{
+  grad_shape_t ro, pe, zero;
+  static float fro[GRAD_BRAM_WORDS], fpe[GRAD_BRAM_WORDS], fzero[GRAD_BRAM_WORDS];
 
-  float fROamplitude = ROamp;
-  float fROpreamplitude = ROamp*2;
-  float fROstep = fROamplitude/20.0;
-  float fROprestep = fROpreamplitude/20.0;
-  float fRO = 0.0;
- 
-  float fPE = 0.0;
-  float fPEstep = PEamp/20.0;
+  grad_shape_init(&ro, 0.0);
+  gradient_shape_echo_readout(&ro, ROamp);
+  grad_shape_baseline(&ro, ECHO_WAVEFORM_WORDS, 2000-ECHO_WAVEFORM_WORDS);
+  grad_shape_rasterize(&ro, fro, end);
 
-  // Design the X and Y gradients
   // prephaser 200 us rise time, 3V amplitude
-  for(i=2; i<22; i++) {
-    fRO += fROprestep;
-    fPE += fPEstep;
-    // ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta) * gy_correction;
-    ivalx = (int32_t)ivalx;
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
+  grad_shape_init(&pe, 0.0);
+  grad_shape_trap(&pe, ECHO_PREPHASER_START, ECHO_RAMP, ECHO_PREPHASER_FLAT, PEamp);
+  grad_shape_baseline(&pe, ECHO_WAVEFORM_WORDS, 2000-ECHO_WAVEFORM_WORDS);
+  grad_shape_rasterize(&pe, fpe, end);
 
-    ivaly = floor(fRO/fLSB)*16 * sin(theta) * gx_correction + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = (int32_t)ivaly;
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;
+  grad_shape_init(&zero, 0.0);
+  grad_shape_rasterize(&zero, fzero, end);
 
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
-  }
-  for(i=22; i<82; i++) {
-    // ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    // ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta) * gy_correction;
-    ivalx = (int32_t)ivalx;
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
-
-    // ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
-    // ivaly = floor(fRO/fLSB)*16 * sin(theta) + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = floor(fRO/fLSB)*16 * sin(theta) * gx_correction + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = (int32_t)ivaly;
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;
-
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
-  }
-  for(i=82; i<102; i++) {
-    fRO -= fROprestep;
-    fPE -= fPEstep;
-
-    // ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    // ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta) * gy_correction;
-    ivalx = (int32_t)ivalx;
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
-
-    // ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
-    // ivaly = floor(fRO/fLSB)*16 * sin(theta) + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = floor(fRO/fLSB)*16 * sin(theta) * gx_correction + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = (int32_t)ivaly;
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;    
-
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
-  }
-  for(i=102; i<122; i++) {
-    fRO -= fROstep;
-    // ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    // ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta) * gy_correction;
-    ivalx = (int32_t)ivalx;
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
-
-    // ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
-    // ivaly = floor(fRO/fLSB)*16 * sin(theta) + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = floor(fRO/fLSB)*16 * sin(theta) * gx_correction + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = (int32_t)ivaly;
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;  
-
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
-  }
-  for(i=122; i<422; i++) {
-    // ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    // ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta) * gy_correction;
-    ivalx = (int32_t)ivalx;
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
-
-    // ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
-    // ivaly = floor(fRO/fLSB)*16 * sin(theta) + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = floor(fRO/fLSB)*16 * sin(theta) * gx_correction + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = (int32_t)ivaly;
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;  
-
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
-
-  }
-  for(i=422; i<442; i++) {
-    fRO += fROstep;
-    // ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    // ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta) * gy_correction;
-    ivalx = (int32_t)ivalx;
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
-
-    // ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
-    // ivaly = floor(fRO/fLSB)*16 * sin(theta) + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = floor(fRO/fLSB)*16 * sin(theta) * gx_correction + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = (int32_t)ivaly;
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;  
+  grad_rotate(rot, fro, fpe, fzero, offset.gradient_x, offset.gradient_y, offset.gradient_z, gx, gy, gz, 2, end);
+}
 
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
-  }
+// Function 4.1.3
+// gradient waveforms for the SE/GRE (rotated)
+void update_gradient_waveforms_echo_rot(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, gradient_offset_t offset, float theta)
+{//generate_gradient_waveforms_se_rot_2d
+  trace_printf("Designing a gradient waveform -- Rotated 2D SE/GRE !\n");
 
-  // Clear the rest of the buffer
-  for(int k=442; k<2000; k++)
-  {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[k] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[k] = 0x001fffff & (ival | 0x00100000);
+  grad_rotation_t rot;
 
-  }
+  // enable the gradients with the prescribed offset current
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
+  
+  // enable the outputs with 2's completment coding
+  // 24'b0010 0000 0000 0000 0000 0010;
+  gx[1] = 0x00200002;
+  gy[1] = 0x00200002;
+  gz[1] = 0x00200002;
 
-  // Z shim
-  for(int k=2; k<2000; k++)
-  {
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[k] = 0x001fffff & (ival | 0x00100000);
-  }
+  // Design the X and Y gradients, Z shim
+  gradient_rotation_echo(&rot, theta);
+  rotate_gradient_waveforms_echo(gx, gy, gz, ROamp, PEamp, offset, &rot, 2000);
 }
 
 
@@ -618,21 +406,14 @@ void update_gradient_waveforms_echo_rot(volatile uint32_t *gx,volatile uint32_t
 // This function makes gradient waveforms for the slice selective SE or GRE sequences
 void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, float PE2amp, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- Slice-selective SE/GRE!\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- Slice-selective SE/GRE!\n");
   
   uint32_t i;
-  int32_t ival;
-  
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n");
   
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -650,31 +431,25 @@ void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   
   // Design the Y gradient
@@ -685,33 +460,26 @@ void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy
   
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
   // clear the rest of the buffer
   for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
   for(i=512; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(offset.gradient_z);
   }
 
 
@@ -726,35 +494,29 @@ void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy
   
   for(i=gz_offset + 2; i<gz_offset + 2 + delay; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i= gz_offset + 2 + delay; i< gz_offset + 2 + delay + 40; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i= gz_offset + 2 + delay + 40; i< gz_offset + 2 + delay + 40 + delay; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
 
   fPEstep = PE2amp/3;
   for(i= gz_offset + 2 + delay + 40 + delay; i< gz_offset + 2 + delay + 40 + delay + delay2; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
 
   for(i= gz_offset + 2 + delay + 40 + delay + delay2; i< gz_offset + 2 + delay + 40 + delay + delay2 + 20; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
 
   for(i = gz_offset + 2 + delay + 40 + delay + delay2 + 20; i< gz_offset + 2 + delay + 40 + delay + delay2 + 20 + delay2; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
 }
 
@@ -764,23 +526,16 @@ void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy
 void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, \
                               float ROamp, float PEamp[], gradient_offset_t offset)  // ETL echo train length
 {
-  printf("Designing a gradient waveform -- CPMG echo train (etl = 2) !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- CPMG echo train (etl = 2) !\n");
  
   uint32_t i, k;
-  int32_t ival;
   uint32_t etl = 2;
   uint32_t partition_size = 1000;
   
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -799,63 +554,50 @@ void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy
   // Echo 1
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=442; i<542; i++) { //442+660
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=542; i<1002; i++) { //442+660
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
 
   // Echo 2
   for(i=1002; i<1102; i++) { //442+660
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=1102; i<1122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=1122; i<1422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=1422; i<1442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=1442; i<1542; i++) { //442+660
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   
 
@@ -868,39 +610,31 @@ void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy
   fPEstep = PEamp[0]/20.0;
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=442; i<462; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=462; i<522; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=522; i<542; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=542; i<1002; i++) { //442+660
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
   // Echo 2
@@ -908,44 +642,35 @@ void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy
   fPEstep = PEamp[1]/20.0;
   for(i=1002; i<1022; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=1022; i<1082; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=1082; i<1102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=1102; i<1442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=1442; i<1462; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=1462; i<1522; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=1522; i<1542; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
 
   // clear the rest of the buffer
   for(i=1542; i<2048; i++) {//for(i=1542; i<2000; i++) {  // fail 4095 2049 succeed 2000 2048
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 }
 
@@ -955,26 +680,19 @@ void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy
 void update_gradient_waveforms_tse(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, \
                       float ROamp, uint32_t echo_train_length, float PEamp[], gradient_offset_t offset)  // ETL echo train length
 {
-  printf("Designing a gradient waveform -- CPMG echo train !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- CPMG echo train !\n");
 
   uint32_t i;
-  int32_t ival;
 
   uint32_t k;
   uint32_t etl = echo_train_length;
   uint32_t partition_size = 1000;
   uint32_t part_num = 0;
   
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -997,48 +715,38 @@ void update_gradient_waveforms_tse(volatile uint32_t *gx,volatile uint32_t *gy,
     if (part_num == 1){ // only first gradient has the prephaser
       for(i=(part_num-1)*partition_size+2; i<(part_num-1)*partition_size+22; i++) {
         fRO += fROprestep;
-        ival = (int32_t)floor(fRO/fLSB)*16;
-        gx[i] = 0x001fffff & (ival | 0x00100000);
+        gx[i] = grad_dac_word(fRO);
       }
       for(i=(part_num-1)*partition_size+22; i<(part_num-1)*partition_size+82; i++) {
-        ival = (int32_t)floor(fRO/fLSB)*16;
-        gx[i] = 0x001fffff & (ival | 0x00100000);
+        gx[i] = grad_dac_word(fRO);
       }
       for(i=(part_num-1)*partition_size+82; i<(part_num-1)*partition_size+102; i++) {
         fRO -= fROprestep;
-        ival = (int32_t)floor(fRO/fLSB)*16;
-        gx[i] = 0x001fffff & (ival | 0x00100000);
+        gx[i] = grad_dac_word(fRO);
       }
     }
     else {
       for(i=(part_num-1)*partition_size+2; i<(part_num-1)*partition_size+102; i++) {
-        ival = (int32_t)floor(fRO/fLSB)*16;
-        printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-        gx[i] = 0x001fffff & (ival | 0x00100000);
+        gx[i] = grad_dac_word(fRO);
       }
     }
 
     for(i=(part_num-1)*partition_size+102; i<(part_num-1)*partition_size+122; i++) {
       fRO -= fROstep;
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(fRO);
     }
     for(i=(part_num-1)*partition_size+122; i<(part_num-1)*partition_size+422; i++) {
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(fRO);
     }
     for(i=(part_num-1)*partition_size+422; i<(part_num-1)*partition_size+442; i++) {
       fRO += fROstep;
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(fRO);
     }
     for(i=(part_num-1)*partition_size+442; i<(part_num-1)*partition_size+542; i++) {
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(fRO);
     }
     for(i=(part_num-1)*partition_size+542; i<(part_num-1)*partition_size+1002; i++) { //442+660
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(fRO);
     }
   }
 
@@ -1058,58 +766,38 @@ void update_gradient_waveforms_tse(volatile uint32_t *gx,volatile uint32_t *gy,
 
     for(i=(part_num-1)*partition_size+2; i<(part_num-1)*partition_size+22; i++) {
       fPE += fPEstep;
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+22; i<(part_num-1)*partition_size+82; i++) {
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+82; i<(part_num-1)*partition_size+102; i++) {
       fPE -= fPEstep;
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+102; i<(part_num-1)*partition_size+442; i++) {
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+442; i<(part_num-1)*partition_size+462; i++) {
       fPE -= fPEstep;
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+462; i<(part_num-1)*partition_size+522; i++) {
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+522; i<(part_num-1)*partition_size+542; i++) {
       fPE += fPEstep;
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+542; i<(part_num-1)*partition_size+1002; i++) { //442+660
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
   }
 
-  printf("Gx\n");
-  for (i=0;i<(part_num-1)*partition_size+1002;i++) {
-    printf("\t%f\n", gx[i]);
-  }
-
-  printf("Gy\n");
-  for (i=0;i<(part_num-1)*partition_size+1002;i++) {
-    printf("\t%f\n", gy[i]);
-  }
-  
   // clear the rest of the buffer
   for(i=part_num*partition_size+2; i<2048; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 }
 
@@ -1119,21 +807,14 @@ void update_gradient_waveforms_tse(volatile uint32_t *gx,volatile uint32_t *gy,
 void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, \
                                     float amp_x, float amp_y, gradient_offset_t offset, uint32_t y_grad_off)
 {
-  printf("Designing a gradient waveform -- EPI !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- EPI !\n");
  
   uint32_t i, k;
-  int32_t ival;
 
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -1173,12 +854,10 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
       else {
         grad_x -= grad_x_step;
       }
-      ival = (int32_t)floor(grad_x/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(grad_x);
     }
     for(i=7+mem_offset; i<37+mem_offset; i++) {
-      ival = (int32_t)floor(grad_x/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(grad_x);
     }
     for(i=37+mem_offset; i<42+mem_offset; i++) {
       if (k%2==0) {
@@ -1187,37 +866,30 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
       else {
         grad_x += grad_x_step;
       }
-      ival = (int32_t)floor(grad_x/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(grad_x);
     }
     for(i=42+mem_offset; i<52+mem_offset; i++) {
-      ival = (int32_t)floor(grad_x/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(grad_x);
     }
 
     // Design the Y gradient
     for(i=2+mem_offset; i<42+mem_offset; i++) {
-      ival = (int32_t)floor(grad_y/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(grad_y);
     }
     for(i=42+mem_offset; i<47+mem_offset; i++) {
       grad_y += grad_y_step;
-      ival = (int32_t)floor(grad_y/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(grad_y);
     }
     for(i=47+mem_offset; i<52+mem_offset; i++) {
       grad_y -= grad_y_step;
-      ival = (int32_t)floor(grad_y/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(grad_y);
     }
   }
 
   // set to baseline/offset
   for (i=1602;i<1702;i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
 
@@ -1231,36 +903,29 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
 
   for(i=2+mem_offset2; i<7+mem_offset2; i++) {
     grad_x += grad_x_step2;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=37+mem_offset2; i<42+mem_offset2; i++) {
     grad_x -= grad_x_step2;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
 
   for(i=2+mem_offset2; i<22+mem_offset2; i++) {
     grad_y += grad_y_step2;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
   for(i=22+mem_offset2; i<42+mem_offset2; i++) {
     grad_y -= grad_y_step2;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
 
   // set to baseline/offset
   for(i=1742; i<1762; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
   // prephaser 2: 32 single shot Gradient Echo
@@ -1269,36 +934,29 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
   grad_y = offset_y;
   for(i=2+mem_offset2; i<7+mem_offset2; i++) {
     grad_x -= grad_x_step2;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=37+mem_offset2; i<42+mem_offset2; i++) {
     grad_x += grad_x_step2;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
 
   for(i=2+mem_offset2; i<22+mem_offset2; i++) {
     grad_y -= grad_y_step2;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
   for(i=22+mem_offset2; i<42+mem_offset2; i++) {
     grad_y += grad_y_step2;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
 
   // set to baseline/offset
   for(i=1802; i<1822; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
   //#####  single shot 64  #####// only y prephaser needs to be changed
@@ -1311,36 +969,29 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
 
   for(i=2+mem_offset2; i<7+mem_offset2; i++) {
     grad_x += grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=37+mem_offset2; i<42+mem_offset2; i++) {
     grad_x -= grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
 
   for(i=2+mem_offset2; i<22+mem_offset2; i++) {
     grad_y += grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
   for(i=22+mem_offset2; i<42+mem_offset2; i++) {
     grad_y -= grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
 
   // set to baseline/offset
   for(i=1862; i<1882; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
   // prephaser 4: 64 single shot Gradient Echo
@@ -1349,36 +1000,29 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
   grad_y = offset_y;
   for(i=2+mem_offset2; i<7+mem_offset2; i++) {
     grad_x -= grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=37+mem_offset2; i<42+mem_offset2; i++) {
     grad_x += grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
 
   for(i=2+mem_offset2; i<22+mem_offset2; i++) {
     grad_y -= grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
   for(i=22+mem_offset2; i<42+mem_offset2; i++) {
     grad_y += grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
 
   // set to baseline/offset
   for(i=1922; i<1942; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
   // prephaser 5: 64 single shot Gradient Echo with Partial K-space sampling
@@ -1388,43 +1032,35 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
   grad_y_step3 = amp_y * 50.0 * 4.0 / 200.0 /20; // collect 4 extra lines across k center
   for(i=2+mem_offset2; i<7+mem_offset2; i++) {
     grad_x -= grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=37+mem_offset2; i<42+mem_offset2; i++) {
     grad_x += grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
 
   for(i=2+mem_offset2; i<22+mem_offset2; i++) {
     grad_y -= grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
   for(i=22+mem_offset2; i<42+mem_offset2; i++) {
     grad_y += grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
 
   // set to baseline/offset
   for(i=1982; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
   // turning off all the y gradient, for phase aligning
   if (y_grad_off) {
     for(i=0; i<2000; i++) {
-      ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(offset.gradient_y);
     }
   }
 }
@@ -1435,21 +1071,14 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
 void update_gradient_waveforms_spiral(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, \
                                     float lamda0, float omega0, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- spiral !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- spiral !\n");
  
   uint32_t i;
-  int32_t ival;
 
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -1468,8 +1097,7 @@ void update_gradient_waveforms_spiral(volatile uint32_t *gx,volatile uint32_t *g
   for(i=2; i<1996; i++) {
     t = (i-2) * 10;
     grad_x = offset_x + lamda0 * omega0 * (cos(omega0 * t) - omega0 * t * sin(omega0 * t));
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   
 
@@ -1477,15 +1105,12 @@ void update_gradient_waveforms_spiral(volatile uint32_t *gx,volatile uint32_t *g
   for(i=2; i<1996; i++) {
     t = (i-2) * 10;
     grad_y = offset_y + lamda0 * omega0 * (sin(omega0 * t) + omega0 * t * cos(omega0 * t));
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
 
   for(i=1996; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 }
 
@@ -1493,21 +1118,14 @@ void update_gradient_waveforms_spiral(volatile uint32_t *gx,volatile uint32_t *g
 // Function 5
 void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, float PE2amp, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- 3D SE/GRE!\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- 3D SE/GRE!\n");
 
   uint32_t i;
-  int32_t ival;
 
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-  
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -1525,31 +1143,25 @@ void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *g
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   
   // Design the Y gradient
@@ -1560,21 +1172,17 @@ void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *g
   
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
   // Design the Z gradient
@@ -1585,31 +1193,24 @@ void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *g
   
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
 
   // clear the rest of the buffer
   for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
+    gz[i] = grad_dac_word(offset.gradient_z);
   }
 }
 
@@ -1618,8 +1219,11 @@ void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *g
 /*
 	This function updates the pulse sequence in the memory with a chosen one through index
 */
-void update_pulse_sequence(uint32_t seq_idx, volatile uint32_t *pulseq_memory)
+void update_pulse_sequence(uint32_t seq_idx, pulseq_mem_t *seq_mem)
 {
+ volatile uint32_t *pulseq_memory = seq_mem->bram;
+
+ pulseq_mem_invalidate(seq_mem); // written past the shadow, the next upload is written in full
  switch(seq_idx) {
 
   case 1:
@@ -2053,13 +1657,39 @@ void update_pulse_sequence(uint32_t seq_idx, volatile uint32_t *pulseq_memory)
 /*
   This function updates the pulse sequence in the memory with the uploaded sequence
 */
-void update_pulse_sequence_from_upload(uint32_t *pulseq_memory_upload, volatile uint32_t *pulseq_memory)
+void update_pulse_sequence_from_upload(uint32_t *pulseq_memory_upload, pulseq_mem_t *seq_mem)
 {
-  int i;
-  int length = 200;
-  for(i=0; i<length; i++){
-    pulseq_memory[i] = pulseq_memory_upload[i];
-  }
+  // only the words that changed since the last load are written
+  pulseq_mem_load(seq_mem, pulseq_memory_upload, PULSEQ_UPLOAD_WORDS);
+  printf("Sequence memory: %d words written\n", seq_mem->written);
+}
+
+// Function 7.1
+/*
+  Gradient offsets and rotation pushed by live commands (live_ctl.h).
+  Returns the LIVE_* that were taken, the gradients have to be generated
+  again for them.
+*/
+uint32_t take_live_rotation(rx_engine_t *rx, gradient_offset_t *offset, angle_t *theta)
+{
+  live_ctl_t *l = rx->live;
+  uint32_t mask = l->offset_mask, taken;
+
+  taken = live_take(l, LIVE_OFFSET | LIVE_ROTATION);
+  if(taken & LIVE_OFFSET) {
+    if(mask & 1)
+      offset->gradient_x = (float)l->offset_ma[0]/1000.0; // these offsets are in Ampere
+    if(mask & 2)
+      offset->gradient_y = (float)l->offset_ma[1]/1000.0;
+    if(mask & 4)
+      offset->gradient_z = (float)l->offset_ma[2]/1000.0;
+  }
+  if(taken & LIVE_ROTATION)
+    theta->val = l->theta;
+  if(taken)
+    printf("Live: offsets(mA) X %d, Y %d, Z %d, angle %f rad\n", (int)(offset->gradient_x*1000),
+           (int)(offset->gradient_y*1000), (int)(offset->gradient_z*1000), theta->val);
+  return taken;
 }
 
  
@@ -2072,6 +1702,9 @@ int main(int argc, char *argv[])
 	volatile uint16_t *rx_cntr, *tx_size;
 	//volatile uint8_t *rx_rst, *tx_rst;
 	volatile uint64_t *rx_data; 
+	rx_engine_t rx;
+	live_ctl_t live;
+	static pulseq_mem_t seq_mem; // shadow of the sequence BRAM
 	void *tx_data;
 	float tx_freq;
 	struct sockaddr_in addr;
@@ -2111,10 +1744,9 @@ int main(int argc, char *argv[])
 
   // sequence type
   uint32_t seqType_idx; // used in GUI 3 and 5
-  uint32_t pulseq_memory_upload_temp[200]; // record uploaded sequence
-  unsigned char *b; // for sequence upload
-  unsigned int cmd; // for sequence upload
-  uint32_t mem_counter, nbytes, size_of_seq; // for sequence upload
+  uint32_t pulseq_memory_upload_temp[PULSEQ_UPLOAD_WORDS] = {0}; // record uploaded sequence
+  uint32_t nbytes, size_of_seq; // for sequence upload
+  int uploaded;                 // the last upload was taken
   
   // signal from the client
   uint32_t trig;    // Highest 4 bits of command            (trig==1)  Change center frequency
@@ -2126,11 +1758,13 @@ int main(int argc, char *argv[])
   
   
 
-  if(argc != 3) {
-    fprintf(stderr,"parameters: RF duration, RF amplitude\n");
+  if(argc != 3 && !(argc == 4 && strcmp(argv[3], "-v") == 0)) {
+    fprintf(stderr,"parameters: RF duration, RF amplitude [-v]\n");
     fprintf(stderr,"e.g.\t./mri_lab 60 32200\n");
+    fprintf(stderr,"-v prints the per-TR console lines\n");
     return -1;
   }
+  trace_set_verbose(argc == 4);
 
 	if((fd = open("/dev/mem", O_RDWR)) < 0) {
   	perror("open");
@@ -2164,6 +1798,12 @@ int main(int argc, char *argv[])
 	rx_freq = ((uint32_t *)(cfg + 4));
 	rx_rate = ((uint32_t *)(cfg + 8));
 	rx_cntr = ((uint16_t *)(sts + 0));
+	rx_engine_init(&rx, seq_config, pulseq_memory, rx_cntr, rx_data, rx_rate);
+	pulseq_mem_init(&seq_mem, pulseq_memory);
+	rx.mem = &seq_mem;
+	live_init(&live);
+	rx.live = &live;
+	rx.rx_freq = rx_freq;
 
 	//tx_rst = ((uint8_t *)(cfg + 1));
 	tx_size = ((uint16_t *)(cfg + 12));
@@ -2280,6 +1920,7 @@ int main(int argc, char *argv[])
     return EXIT_FAILURE;
   }
   printf("%s \n", "Accepted client!");
+  rx.sock_client = sock_client;
 
   
 	while(1) {
@@ -2304,30 +1945,29 @@ int main(int argc, char *argv[])
       /* GUI 1 */
       /********************* FID with frequency modification and shimming *********************/
       printf("*** MRI Lab *** -- FID\n");
-      // update_pulse_sequence(1, pulseq_memory); the old built-in seq, no longer in use
+      // update_pulse_sequence(1, &seq_mem); the old built-in seq, no longer in use
       // receive pulse sequence from the frontend
       printf("%s \n", "Receiving pulse sequence");
       if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
          break;
       }
       size_of_seq = command; // number of bytes (4*num of int_32)
-      if(recv(sock_client, &buffer, size_of_seq, MSG_WAITALL) <= 0) {
-         break;
+      if(size_of_seq > sizeof(buffer)) {
+         // too long to be a sequence, drop the bytes to stay in step with the client
+         if(proto_discard_bulk(sock_client, PROTO_VERSION_1, size_of_seq) < 0) {
+            break;
+         }
+         printf("Sequence of %u bytes too long, the last sequence stays loaded\n", size_of_seq);
       }
-      b = (unsigned char*) buffer; 
-      mem_counter = size_of_seq/4 - 1;
-      for (i=size_of_seq-1; i>=0; i-=4) {
-        cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-        pulseq_memory_upload_temp[mem_counter] = cmd;
-        mem_counter -= 1;
+      else if(recv(sock_client, &buffer, size_of_seq, MSG_WAITALL) <= 0) {
+         break;
       }
-      mem_counter = 0;
-      for (i=0; i<size_of_seq; i+=4) {
-        printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-        mem_counter += 1;
+      else if(pulseq_upload_words(pulseq_memory_upload_temp, buffer, size_of_seq) < 0)
+        printf("The last sequence stays loaded\n");
+      else {
+        printf("%s \n", "Pulse sequence loaded");
+        update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
       }
-      printf("%s \n", "Pulse sequence loaded");
-      update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
       
       while(1) {
         if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
@@ -2356,7 +1996,7 @@ int main(int argc, char *argv[])
           printf("%s %d %d %d\n", "Received values", value1, value2, value3);
           switch(value1) {
           case 0: 
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1: 
             printf("Set gradient offsets X %d\n", value3);
@@ -2406,10 +2046,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
         } 
 
         else {
@@ -2419,19 +2059,10 @@ int main(int argc, char *argv[])
         // turn on gradients with offset currents
         update_gradient_waveform_state(gradient_memory_x,gradient_memory_y,gradient_memory_z,GRAD_OFFSET_ENABLED_OUTPUT,gradient_offset);
         // take spin-echoes with offset currents enabled
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second  
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
+        trace_printf("Aquiring data\n");
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+        trace_printf("stop !!\n");
         usleep(500000);
         //usleep(2000000);
       }
@@ -2442,31 +2073,29 @@ int main(int argc, char *argv[])
       /* GUI 2 */
       /********************* Spin Echo with frequency modification and shimming *********************/
       printf("*** MRI Lab *** -- Spin Echo\n");
-      //update_pulse_sequence(2, pulseq_memory); // Spin echo, the old built-in seq, no longer in use
+      //update_pulse_sequence(2, &seq_mem); // Spin echo, the old built-in seq, no longer in use
       // receive pulse sequence from the frontend
       printf("%s \n", "Receiving pulse sequence");
       if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
          break;
       }
       size_of_seq = command; // number of bytes (4*num of int_32)
-      if(recv(sock_client, &buffer, size_of_seq, MSG_WAITALL) <= 0) {
-         break;
+      if(size_of_seq > sizeof(buffer)) {
+         // too long to be a sequence, drop the bytes to stay in step with the client
+         if(proto_discard_bulk(sock_client, PROTO_VERSION_1, size_of_seq) < 0) {
+            break;
+         }
+         printf("Sequence of %u bytes too long, the last sequence stays loaded\n", size_of_seq);
       }
-      b = (unsigned char*) buffer; 
-      mem_counter = size_of_seq/4 - 1;
-      for (i=size_of_seq-1; i>=0; i-=4)
-      {
-        cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-        pulseq_memory_upload_temp[mem_counter] = cmd;
-        mem_counter -= 1;
+      else if(recv(sock_client, &buffer, size_of_seq, MSG_WAITALL) <= 0) {
+         break;
       }
-      mem_counter = 0;
-      for (i=0; i<size_of_seq; i+=4) {
-        printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-        mem_counter += 1;
+      else if(pulseq_upload_words(pulseq_memory_upload_temp, buffer, size_of_seq) < 0)
+        printf("The last sequence stays loaded\n");
+      else {
+        printf("%s \n", "Pulse sequence loaded");
+        update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
       }
-      printf("%s \n", "Pulse sequence loaded");
-      update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
 
       while(1) {
         if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
@@ -2495,7 +2124,7 @@ int main(int argc, char *argv[])
           printf("%s %d %d %d\n", "Received values", value1, value2, value3);
           switch(value1) {
           case 0: 
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1: 
             printf("Set gradient offsets X %d\n", value3);
@@ -2545,10 +2174,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
         } 
 
         else {
@@ -2558,19 +2187,10 @@ int main(int argc, char *argv[])
         // turn on gradients with offset currents
         update_gradient_waveform_state(gradient_memory_x,gradient_memory_y,gradient_memory_z,GRAD_OFFSET_ENABLED_OUTPUT,gradient_offset);
         // take spin-echoes with offset currents enabled
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second  
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
+        trace_printf("Aquiring data\n");
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+        trace_printf("stop !!\n");
         usleep(500000);
       }
       break;
@@ -2608,7 +2228,7 @@ int main(int argc, char *argv[])
           printf("%s %d %d %d\n", "Received values", value1, value2, value3);
           switch(value1) {
           case 0: 
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1: 
             printf("Set gradient offsets X %d\n", value3);
@@ -2661,10 +2281,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("hahahahaha Acquiring\n");
+            trace_printf("hahahahaha Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
         } 
 
         else if( trig == 3 ) { // receive pulse sequence from frontend
@@ -2673,22 +2293,11 @@ int main(int argc, char *argv[])
           printf("%s \n", "Receiving pulse sequence");
           nbytes = read(sock_client, &buffer, sizeof(buffer));
           printf("%s %d \n", "Num bytes received = ", nbytes);
-          b = (unsigned char*) buffer; 
-          mem_counter = nbytes/4 - 1;
-          for (i=nbytes-1; i>=0; i-=4)
-          {
-            cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-            pulseq_memory_upload_temp[mem_counter] = cmd;
-            mem_counter -= 1;
-          }
-
-          mem_counter = 0;
-          for (i=0; i<nbytes; i+=4) {
-            printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-            mem_counter += 1;
-          }
-          
-          printf("%s \n", "Pulse sequence loaded");
+          uploaded = pulseq_upload_words(pulseq_memory_upload_temp, buffer, nbytes) >= 0;
+          if(!uploaded)
+            printf("The last sequence stays loaded\n");
+          else
+            printf("%s \n", "Pulse sequence loaded");
 
           printf("%s %d\n", "seqType_idx", seqType_idx);
           if (seqType_idx == 0 | seqType_idx == 1 | seqType_idx == 3) {
@@ -2699,7 +2308,8 @@ int main(int argc, char *argv[])
           }
           printf("is_gradient_on: %d\n", is_gradient_on);
 
-          update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+          if(uploaded)
+            update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
 
           continue;  // wait for acquire command
         }
@@ -2716,19 +2326,10 @@ int main(int argc, char *argv[])
           ro = 1.865/2;
           update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , 0, gradient_offset);
         }
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second  
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
+        trace_printf("Aquiring data\n");
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+        trace_printf("stop !!\n");
         usleep(500000);
       }
       break;
@@ -2740,7 +2341,7 @@ int main(int argc, char *argv[])
       /********************* 1 D Projection with frequency modification *********************/
       printf("*** MRI Lab *** -- Projection\n");
 
-      update_pulse_sequence(2, pulseq_memory); // Spin echo
+      update_pulse_sequence(2, &seq_mem); // Spin echo
 
       while(1) {
         if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
@@ -2769,7 +2370,7 @@ int main(int argc, char *argv[])
           printf("%s %d %d %d\n", "Received values", value1, value2, value3);     
           switch(value1) {
           case 0: 
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1:
             printf("Set projection axis to X\n");
@@ -2817,62 +2418,35 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
         } 
 
         else if ( trig == 3 ) { // Acquire all three projections
 
           generate_gradient_waveforms_se_proj(gradient_memory_x,gradient_memory_y,gradient_memory_z,1.0,GRAD_AXIS_X,gradient_offset);
-          printf("Aquiring x data\n");
-          seq_config[0] = 0x00000007;
-          usleep(1000000); // sleep 1 second  
-          printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-          // Transfer the data to the client
-          // transfer 10 * 5k = 50k samples
-          for(i = 0; i < 10; ++i) {
-            while(*rx_cntr < 10000) usleep(500);
-            for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-            send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-          }
-          printf("stop !!\n");
-          seq_config[0] = 0x00000000;
+          trace_printf("Aquiring x data\n");
+          // start the sequence and send the samples to the client as they arrive
+          rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+          trace_printf("stop !!\n");
           usleep(500000);
           //usleep(2000000);
 
           generate_gradient_waveforms_se_proj(gradient_memory_x,gradient_memory_y,gradient_memory_z,1.0,GRAD_AXIS_Y,gradient_offset);
-          printf("Aquiring y data\n");
-          seq_config[0] = 0x00000007;
-          usleep(1000000); // sleep 1 second  
-          printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-          // Transfer the data to the client
-          // transfer 10 * 5k = 50k samples
-          for(i = 0; i < 10; ++i) {
-            while(*rx_cntr < 10000) usleep(500);
-            for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-            send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-          }
-          printf("stop !!\n");
-          seq_config[0] = 0x00000000;
+          trace_printf("Aquiring y data\n");
+          // start the sequence and send the samples to the client as they arrive
+          rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+          trace_printf("stop !!\n");
           usleep(500000);
           //usleep(2000000);
 
           generate_gradient_waveforms_se_proj(gradient_memory_x,gradient_memory_y,gradient_memory_z,1.0,GRAD_AXIS_Z,gradient_offset);
-          printf("Aquiring z data\n");
-          seq_config[0] = 0x00000007;
-          usleep(1000000); // sleep 1 second  
-          printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-          // Transfer the data to the client
-          // transfer 10 * 5k = 50k samples
-          for(i = 0; i < 10; ++i) {
-            while(*rx_cntr < 10000) usleep(500);
-            for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-            send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-          }
-          printf("stop !!\n");
-          seq_config[0] = 0x00000000;
+          trace_printf("Aquiring z data\n");
+          // start the sequence and send the samples to the client as they arrive
+          rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+          trace_printf("stop !!\n");
           usleep(500000);
           continue;
         }
@@ -2894,19 +2468,10 @@ int main(int argc, char *argv[])
           break;
         }
 
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second  
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
+        trace_printf("Aquiring data\n");
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+        trace_printf("stop !!\n");
         usleep(500000);
       }
       break;
@@ -2933,8 +2498,8 @@ int main(int argc, char *argv[])
         if (command == 0) break; // Stop command
 
         trig = command >> 28;
-        printf("Command: %d \n", command);
-        printf("Trig: %d \n", trig);
+        trace_printf("Command: %d \n", command);
+        trace_printf("Trig: %d \n", trig);
 
         if ( trig == 1 ) { // Change center frequency
           value = command & 0xfffffff;
@@ -2952,24 +2517,11 @@ int main(int argc, char *argv[])
           // Note that read() returns the number of bytes read
           nbytes = read(sock_client, &buffer, sizeof(buffer));
           printf("%s %d \n", "Num bytes received = ", nbytes);
-          
-          // Loop over the number of bytes received
-          // This makes b point to the first elt of buffer and recasts buffer to unsigned char
-          b = (unsigned char*) buffer; 
-          mem_counter = nbytes/4 - 1;
-          for (i=nbytes-1; i>=0; i-=4) {
-            cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-            pulseq_memory_upload_temp[mem_counter] = cmd;
-            mem_counter -= 1;
-          }
 
-          mem_counter = 0;
-          for (i=0; i<nbytes; i+=4) {
-            printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-            mem_counter += 1;
-          }
-
-          printf("%s \n", "Pulse sequence loaded\n");
+          if(pulseq_upload_words(pulseq_memory_upload_temp, buffer, nbytes) < 0)
+            printf("The last sequence stays loaded\n");
+          else
+            printf("%s \n", "Pulse sequence loaded\n");
         }
 
         else if ( trig == 2 ) { // Change projection axis/load or zero shim
@@ -2991,12 +2543,12 @@ int main(int argc, char *argv[])
 
             switch(seqType_idx) {
             case 0: // Spin Echo
-              // update_pulse_sequence(2, pulseq_memory); // Spin echo
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              // update_pulse_sequence(2, &seq_mem); // Spin echo
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Spin Echo -- npe = %d\n", npe);
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               // Phase encoding gradient loop
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
@@ -3004,19 +2556,10 @@ int main(int argc, char *argv[])
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, gradient_offset);
               for(int reps=0; reps<npe; reps++) { 
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+                trace_printf("TR[%d]: go!!\n",reps);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+                trace_printf("stop !!\n");
                 pe = pe+pe_step;
                 update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro, pe, gradient_offset);
                 usleep(500000);
@@ -3025,12 +2568,12 @@ int main(int argc, char *argv[])
               break;
 
             case 1: // Gradient Echo
-              // update_pulse_sequence(3, pulseq_memory); // Gradient echo
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              // update_pulse_sequence(3, &seq_mem); // Gradient echo
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Gradient Echo -- npe = %d\n", npe);
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               // Phase encoding gradient loop
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
@@ -3038,19 +2581,10 @@ int main(int argc, char *argv[])
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, gradient_offset);
               for(int reps=0; reps<npe; reps++) { 
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+                trace_printf("TR[%d]: go!!\n",reps);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+                trace_printf("stop !!\n");
                 pe = pe+pe_step;
                 update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro, pe, gradient_offset);
                 usleep(500000);
@@ -3059,11 +2593,11 @@ int main(int argc, char *argv[])
               break;
 
             case 2:
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging SE (Slice-selective) -- npe = %d\n", npe);
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               // Phase encoding gradient loop
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
@@ -3072,19 +2606,10 @@ int main(int argc, char *argv[])
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_slice(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, pe2, gradient_offset);
               for(int reps=0; reps<npe; reps++) { 
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+                trace_printf("TR[%d]: go!!\n",reps);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+                trace_printf("stop !!\n");
                 pe = pe+pe_step;
                 update_gradient_waveforms_slice(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, pe2, gradient_offset);
                 usleep(500000);
@@ -3093,11 +2618,11 @@ int main(int argc, char *argv[])
               break;
 
             case 3: // Slice-selective GRE
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging GRE (Slice-selective) -- npe = %d\n", npe);
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               // Phase encoding gradient loop
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
@@ -3106,19 +2631,10 @@ int main(int argc, char *argv[])
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_slice(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, pe2, gradient_offset);
               for(int reps=0; reps<npe; reps++) { 
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+                trace_printf("TR[%d]: go!!\n",reps);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+                trace_printf("stop !!\n");
                 pe = pe+pe_step;
                 update_gradient_waveforms_slice(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, pe2, gradient_offset);
                 usleep(500000);
@@ -3127,11 +2643,11 @@ int main(int argc, char *argv[])
               break;
 
             case 4: // TSE
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Uploaded Turbo Spin Echo -- npe = %d\n", npe);
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
               etl = 2;
               int k = 0;
               pe_step = 2.936/44.53/2; //[A]
@@ -3141,19 +2657,10 @@ int main(int argc, char *argv[])
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_tse_2(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pes, gradient_offset);
               for(int reps=0; reps<npe/etl; reps++) { 
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+                trace_printf("TR[%d]: go!!\n",reps);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+                trace_printf("stop !!\n");
                 for(k=0;k<etl;k++) {
                   pes[k] += pe_step*etl;
                 }
@@ -3164,84 +2671,57 @@ int main(int argc, char *argv[])
               break;
 
             case 5: //epi
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Uploaded EPI Sequence\n");
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               pe_step = 2.936/44.53/2;  //* delta_ky = 800.0 * pe_step *//
               amp_x = 800.0 * pe_step * 64.0 / 300.0;
               amp_y = 800.0 * pe_step / 50.0;
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_epi(gradient_memory_x,gradient_memory_y,gradient_memory_z, amp_x, amp_y, gradient_offset, 0);
-              printf("EPI TR[0]: go!!\n");
-              seq_config[0] = 0x00000007;
-              usleep(1000000); // sleep 1 second
-              printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-              // Transfer the data to the client
-              // transfer 10 * 5k = 50k samples
-              for(i = 0; i < 10; ++i) {
-                while(*rx_cntr < 10000) usleep(500);
-                for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-              }
-              printf("stop !!\n");
-              seq_config[0] = 0x00000000;
+              trace_printf("EPI TR[0]: go!!\n");
+              // start the sequence and send the samples to the client as they arrive
+              rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+              trace_printf("stop !!\n");
               usleep(500000);
               printf("*********************************************\n");
               break;
 
             case 6: // epi without y gradients
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Uploaded EPI Sequence Disabling Grad_y\n");
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               pe_step = 2.936/44.53/2;  //* delta_ky = 800.0 * pe_step *//
               amp_x = 800.0 * pe_step * 64.0 / 300.0;
               amp_y = 800.0 * pe_step / 50.0;
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_epi(gradient_memory_x,gradient_memory_y,gradient_memory_z, amp_x, amp_y, gradient_offset, 1);
-              printf("EPI TR[0]: go!!\n");
-              seq_config[0] = 0x00000007;
-              usleep(1000000); // sleep 1 second
-              printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-              // Transfer the data to the client
-              // transfer 10 * 5k = 50k samples
-              for(i = 0; i < 10; ++i) {
-                while(*rx_cntr < 10000) usleep(500);
-                for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-              }
-              printf("stop !!\n");
-              seq_config[0] = 0x00000000;
+              trace_printf("EPI TR[0]: go!!\n");
+              // start the sequence and send the samples to the client as they arrive
+              rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+              trace_printf("stop !!\n");
               usleep(500000);
               printf("*********************************************\n");
               break;
             
             case 7: // spiral
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Uploaded Spiral Sequence\n");
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
               a0 = 2.936/44.53/2 * 800 /2/3.14159;
               w0 = 0.01;
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z);
               update_gradient_waveforms_spiral(gradient_memory_x,gradient_memory_y,gradient_memory_z, a0, w0, gradient_offset);
-              printf("SPIRAL TR[0]: go!!\n");
-              seq_config[0] = 0x00000007;
-              usleep(1000000); // sleep 1 second
-              printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-              // Transfer the data to the client
-              // transfer 10 * 5k = 50k samples
-              for(i = 0; i < 10; ++i) {
-                while(*rx_cntr < 10000) usleep(500);
-                for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-              }
-              printf("stop !!\n");
-              seq_config[0] = 0x00000000;
+              trace_printf("SPIRAL TR[0]: go!!\n");
+              // start the sequence and send the samples to the client as they arrive
+              rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+              trace_printf("stop !!\n");
               usleep(500000);
               printf("*********************************************\n");
               break;
@@ -3251,7 +2731,7 @@ int main(int argc, char *argv[])
             }
             
 
-            printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+            trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
             break;
             
           case 4:
@@ -3288,10 +2768,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
         } 
 
         else {
@@ -3350,15 +2830,15 @@ int main(int argc, char *argv[])
             seqType_idx = (command & 0x0000000f);
             switch(seqType_idx) {
             case 0:
-              update_pulse_sequence(2, pulseq_memory); // Spin echo
+              update_pulse_sequence(2, &seq_mem); // Spin echo
               printf("*** MRI Lab *** -- 3D Spin Echo Imaging -- npe = %d, npe2 = %d\n", npe, npe2);
               break;
             case 1:
-              update_pulse_sequence(3, pulseq_memory); // Gradient echo
+              update_pulse_sequence(3, &seq_mem); // Gradient echo
               printf("*** MRI Lab *** -- 3D Gradient Echo Imaging -- npe = %d, npe2 = %d\n", npe, npe2);
               break;
             case 2:
-              //update_pulse_sequence(2, pulseq_memory); // Turbo Spin echo
+              //update_pulse_sequence(2, &seq_mem); // Turbo Spin echo
               printf("*** MRI Lab *** -- 3D Turbo Spin Echo Imaging -- npe = %d, npe2 = %d\n", npe, npe2);
               break;
             default:
@@ -3366,8 +2846,8 @@ int main(int argc, char *argv[])
             }
             usleep(2000000); // sleep 2 second  give enough time to monitor the printout
 
-            printf("Acquiring\n");
-            printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+            trace_printf("Acquiring\n");
+            trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
             // Phase encoding gradient loop
             pe_step = 2.936/44.53/2; //[A]
             pe_step2 = 2.349/44.53;  //[A]
@@ -3377,19 +2857,10 @@ int main(int argc, char *argv[])
             for(int parts = 0; parts<npe2; parts++) { // Phase encoding 2 gradient loop
               update_gradient_waveforms_echo3d(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pe, pe2, gradient_offset);
               for(int reps=0; reps<npe; reps++) { // Phase encoding 1 gradient loop
-                printf("TR[%d]: go!!\n",parts*64+reps);  
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second 
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                } 
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+                trace_printf("TR[%d]: go!!\n",parts*64+reps);  
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+                trace_printf("stop !!\n");
                 pe = pe+pe_step;
                 update_gradient_waveforms_echo3d(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro, pe, pe2, gradient_offset);
                 usleep(500000);
@@ -3398,7 +2869,7 @@ int main(int argc, char *argv[])
               pe2 = pe2+pe_step2;
             }
             printf("*********************************************\n");
-            printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+            trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
             break;
 
           case 4:
@@ -3435,10 +2906,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
         } 
 
         else {
@@ -3454,8 +2925,8 @@ int main(int argc, char *argv[])
       /********************* 1 D Projection with real-time rotations *********************/
       printf("*** MRI Lab *** -- Real-Time Rotated Projections\n");
 
-      update_pulse_sequence(2, pulseq_memory); // Spin echo
-      // update_pulse_sequence(3, pulseq_memory); // Gradient echo
+      update_pulse_sequence(2, &seq_mem); // Spin echo
+      // update_pulse_sequence(3, &seq_mem); // Gradient echo
 
       while(1) {
         if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
@@ -3486,7 +2957,7 @@ int main(int argc, char *argv[])
           printf("%s %d %d %d\n", "Received values", value1, value2, value3);     
           switch(value1) {
           case 0: 
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1: 
             printf("Set gradient offsets X %d\n", value3);
@@ -3527,13 +2998,22 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;          
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
 
         } 
 
+        else if ( trig == LIVE_COMMAND ) { // Live change (live_ctl.h), nothing is running
+          if(recv(sock_client, (char *)&value, 4, MSG_WAITALL) <= 0) {
+            break;
+          }
+          live_set(&live, command, value);
+          live_take(&live, LIVE_ABORT);
+          take_live_rotation(&rx, &gradient_offset, &theta);
+        }
+
         else if ( trig == 3 ) { // Set the angle of rotation
           angle_rad = (command & 0x00ffffff) * PI/180.0;
           theta.val = angle_rad;
@@ -3541,29 +3021,25 @@ int main(int argc, char *argv[])
           printf("%s %f \n", "Angle in radians = ", theta.val);
 
           int avg;
+          // the orientation is the same for all averages
+          generate_gradient_waveforms_se_proj_rot(gradient_memory_x, gradient_memory_y, gradient_memory_z, 1.0, GRAD_AXIS_X, gradient_offset, theta.val);
           for (avg = 0; avg < num_avgs; ++avg) {
-            generate_gradient_waveforms_se_proj_rot(gradient_memory_x, gradient_memory_y, gradient_memory_z, 1.0, GRAD_AXIS_X, gradient_offset, theta.val);
+            // live changes of the client take effect from the next shot on
+            rx_live_poll(&rx);
+            if(rx_aborted(&rx))
+              break;
+            if(take_live_rotation(&rx, &gradient_offset, &theta))
+              generate_gradient_waveforms_se_proj_rot(gradient_memory_x, gradient_memory_y, gradient_memory_z, 1.0, GRAD_AXIS_X, gradient_offset, theta.val);
             // generate_gradient_waveforms_se_rot(gradient_memory_x, gradient_memory_y, gradient_memory_z, 1.0, GRAD_AXIS_X, gradient_offset, theta.val);
             // printf("Aquiring data\n");
-            printf("Acquiring shot %d\n", avg);
-            seq_config[0] = 0x00000007;
-            // usleep(50000);
-            usleep(800000); // sleep 1 second  
-            // printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-
-            // Transfer the data to the client
-            // transfer 10 * 5k = 50k samples
-            for(i = 0; i < 10; ++i) {
-              while(*rx_cntr < 10000) usleep(500);
-              for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-              send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-            } // End data transfer loop
-
-            printf("stop !!\n");
-            seq_config[0] = 0x00000000;
+            trace_printf("Acquiring shot %d\n", avg);
+            // start the sequence and send the samples to the client as they arrive
+            rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+            trace_printf("stop !!\n");
             // usleep(2000000);
 
           } // End averaging loop
+          rx_scan_abort_reply(&rx);
         }
 
         else if ( trig == 4 ) { // Set the number of averages
@@ -3574,42 +3050,43 @@ int main(int argc, char *argv[])
 
         else if ( trig == 5 ) { // Take a rotated 2D image
           // num_avgs = (command & 0x00ffffff); 
-          printf("Angle = %d\n", (command & 0x00ffffff));
+          trace_printf("Angle = %d\n", (command & 0x00ffffff));
           angle_rad = (command & 0x00ffffff) * PI/180.0;
           theta.val = angle_rad;
 
 
-          printf("Acquiring\n");
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
+          trace_printf("Acquiring\n");
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000)); 
           // // Phase encoding gradient loop
           npe = 64;
           float pe_step = 2.936/44.53/2; //[A]
           float pe = -(npe/2-1)*pe_step;
           float ro = 1.865/2;
           // printf("Pe = %f\n", pe);
-          printf("Pe step  = %f\n", pe_step);
+          trace_printf("Pe step  = %f\n", pe_step);
           update_gradient_waveforms_echo_rot(gradient_memory_x,gradient_memory_y, gradient_memory_z, ro, pe, gradient_offset, theta.val);
           // generate_gradient_waveforms_se_rot_2d(gradient_memory_x,gradient_memory_y, gradient_memory_z, ro, pe, gradient_offset, theta.val);
+          grad_rotation_t rot;
+          gradient_rotation_echo(&rot, theta.val);
           for(int reps=0; reps<npe; reps++) { 
-            printf("Pe = %f\n", pe);
-            printf("TR[%d]: go!!\n",reps);
-            seq_config[0] = 0x00000007;
-            usleep(1000000); // sleep 1 second
-            // printf("Number of RX samples in FIFO: %d\n",*rx_cntr); 
-            // Transfer the data to the client
-            // transfer 10 * 5k = 50k samples
-            for(i = 0; i < 10; ++i) {
-              while(*rx_cntr < 10000) usleep(500);
-              for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-              send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
+            // live changes of the client take effect from the next line on
+            rx_live_poll(&rx);
+            if(rx_aborted(&rx))
+              break;
+            if(take_live_rotation(&rx, &gradient_offset, &theta)) {
+              gradient_rotation_echo(&rot, theta.val);
+              update_gradient_waveforms_echo_rot(gradient_memory_x,gradient_memory_y, gradient_memory_z, ro, pe, gradient_offset, theta.val);
             }
-          printf("stop !!\n");
-          seq_config[0] = 0x00000000;
+            trace_printf("Pe = %f\n", pe);
+            trace_printf("TR[%d]: go!!\n",reps);
+            // start the sequence and send the samples to the client as they arrive
+            rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+          trace_printf("stop !!\n");
           pe = pe+pe_step;
-          update_gradient_waveforms_echo_rot(gradient_memory_x,gradient_memory_y, gradient_memory_z, ro, pe, gradient_offset, theta.val);
-          // generate_gradient_waveforms_se_rot_2d(gradient_memory_x,gradient_memory_y, gradient_memory_z, ro, pe, gradient_offset, theta.val);
-          usleep(300000);
+          // only the phase encoding lobe changes, rotated in place before the next TR
+          rotate_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y, gradient_memory_z, ro, pe, gradient_offset, &rot, ECHO_WAVEFORM_WORDS);
           }
+          rx_scan_abort_reply(&rx);
 
 
           // printf("%s %d \n", "Number of averages = ", command & 0x00ffffff);
@@ -3670,12 +3147,12 @@ int main(int argc, char *argv[])
 		// kill the gradients
 		update_gradient_waveform_state(gradient_memory_x,gradient_memory_y,gradient_memory_z,GRAD_ZERO_DISABLED_OUTPUT,gradient_offset);
 		// the gradient state sequence
-		update_pulse_sequence(100, pulseq_memory);	
+		update_pulse_sequence(100, &seq_mem);	
 		printf("disabling gradients with service sequence 100\n");
 		seq_config[0] = 0x00000007;
 		usleep(1000000); // sleep 1 second	
 		// stop the FPGA again
-		printf("stop !!\n");
+		trace_printf("stop !!\n");
 		seq_config[0] = 0x00000000;
     
 	} // End while loop
@@ -10,6 +10,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "rx_acquire.h"
+#include "grad_dac.h"
+
 #define PI 3.14159265
 
 typedef union {
@@ -61,19 +64,14 @@ typedef struct {
 */
 void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz,volatile uint32_t *gz2,gradient_state_t state, gradient_offset_t offset)
 {
-	uint32_t i;
-	int32_t ival;
-
-	float fLSB = 10.0/((1<<15)-1);
-
 	switch(state) {
 		default:
 		case GRAD_ZERO_DISABLED_OUTPUT:
 			// set the DAC register to zero
-			gx[0] = 0x001fffff & (0 | 0x00100000);
-			gy[0] = 0x001fffff & (0 | 0x00100000);
-			gz[0] = 0x001fffff & (0 | 0x00100000);
-			gz2[0] = 0x001fffff & (0 | 0x00100000);
+			gx[0] = grad_dac_pack(0);
+			gy[0] = grad_dac_pack(0);
+			gz[0] = grad_dac_pack(0);
+			gz2[0] = grad_dac_pack(0);
 			// disable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 1110;
 			gx[1] = 0x0020000e;
@@ -82,10 +80,10 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 			gz2[1] = 0x0020000e;
 			break;
 		case GRAD_ZERO_ENABLED_OUTPUT:
-			gx[0] = 0x001fffff & (0 | 0x00100000);
-			gy[0] = 0x001fffff & (0 | 0x00100000);
-			gz[0] = 0x001fffff & (0 | 0x00100000);
-			gz2[0] = 0x001fffff & (0 | 0x00100000);
+			gx[0] = grad_dac_pack(0);
+			gy[0] = grad_dac_pack(0);
+			gz[0] = grad_dac_pack(0);
+			gz2[0] = grad_dac_pack(0);
 			// enable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0010;
 			gx[1] = 0x00200002;
@@ -94,14 +92,10 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 			gz2[1] = 0x00200002;
 			break;
 		case GRAD_OFFSET_ENABLED_OUTPUT:
-			ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-			gx[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-			gy[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-			gz[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
-			gz2[0] = 0x001fffff & (ival | 0x00100000);
+			gx[0] = grad_dac_word(offset.gradient_x);
+			gy[0] = grad_dac_word(offset.gradient_y);
+			gz[0] = grad_dac_word(offset.gradient_z);
+			gz2[0] = grad_dac_word(offset.gradient_z2);
 			// enable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0010;
 			gx[1] = 0x00200002;
@@ -133,10 +127,9 @@ void clear_gradient_waveforms( volatile uint32_t *gx,volatile uint32_t *gy, vola
 // just generate a projection along one dimension
 void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, volatile uint32_t *gz2, float ROamp, gradient_axis_t axis, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- projection !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- projection !\n");
 
   uint32_t i;
-  int32_t ival;
 
   volatile uint32_t *waveform;
   float offset_val = 0.0;
@@ -159,18 +152,11 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
 		offset_val = offset.gradient_z2;
 		break;
   }
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
-  gz2[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
+  gz2[0] = grad_dac_word(offset.gradient_z2);
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
   gx[1] = 0x00200002;
@@ -181,14 +167,10 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
   // set the offset current for all 3 axis
   for(int k=2; k<2000; k++)
   {
-	  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-	  gx[k] = 0x001fffff & (ival | 0x00100000);
-	  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-	  gy[k] = 0x001fffff & (ival | 0x00100000);
-	  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-	  gz[k] = 0x001fffff & (ival | 0x00100000);
-	  ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
-	  gz2[k] = 0x001fffff & (ival | 0x00100000);
+	  gx[k] = grad_dac_word(offset.gradient_x);
+	  gy[k] = grad_dac_word(offset.gradient_y);
+	  gz[k] = grad_dac_word(offset.gradient_z);
+	  gz2[k] = grad_dac_word(offset.gradient_z2);
   }
 
   float fROamplitude = ROamp;
@@ -201,31 +183,25 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
 }
 
@@ -234,23 +210,17 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
 // just generate a projection along one dimension (rotated)
 void generate_gradient_waveforms_se_proj_rot(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, gradient_axis_t axis, gradient_offset_t offset, float theta)
 {//generate_gradient_waveforms_se_rot
-  printf("Designing a gradient waveform -- Rotated projection !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- Rotated projection !\n");
 
   uint32_t i;
   int32_t ival;
 
   float offset_val = 0.0;
 
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -268,37 +238,37 @@ void generate_gradient_waveforms_se_proj_rot(volatile uint32_t *gx,volatile uint
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    ival = grad_dac_code(fRO) * cos(theta);
+    ival = ival + grad_dac_code(offset.gradient_x);
+    gx[i] = grad_dac_pack(ival);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    ival = grad_dac_code(fRO) * cos(theta);
+    ival = ival + grad_dac_code(offset.gradient_x);
+    gx[i] = grad_dac_pack(ival);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    ival = grad_dac_code(fRO) * cos(theta);
+    ival = ival + grad_dac_code(offset.gradient_x);
+    gx[i] = grad_dac_pack(ival);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    ival = grad_dac_code(fRO) * cos(theta);
+    ival = ival + grad_dac_code(offset.gradient_x);
+    gx[i] = grad_dac_pack(ival);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    ival = grad_dac_code(fRO) * cos(theta);
+    ival = ival + grad_dac_code(offset.gradient_x);
+    gx[i] = grad_dac_pack(ival);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * cos(theta);
-    ival = ival + (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    ival = grad_dac_code(fRO) * cos(theta);
+    ival = ival + grad_dac_code(offset.gradient_x);
+    gx[i] = grad_dac_pack(ival);
   }
 
 
@@ -306,54 +276,51 @@ void generate_gradient_waveforms_se_proj_rot(volatile uint32_t *gx,volatile uint
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    ival = grad_dac_code(fRO) * sin(theta);
+    ival = ival + grad_dac_code(offset.gradient_y);
+    gy[i] = grad_dac_pack(ival);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    ival = grad_dac_code(fRO) * sin(theta);
+    ival = ival + grad_dac_code(offset.gradient_y);
+    gy[i] = grad_dac_pack(ival);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    ival = grad_dac_code(fRO) * sin(theta);
+    ival = ival + grad_dac_code(offset.gradient_y);
+    gy[i] = grad_dac_pack(ival);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    ival = grad_dac_code(fRO) * sin(theta);
+    ival = ival + grad_dac_code(offset.gradient_y);
+    gy[i] = grad_dac_pack(ival);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    ival = grad_dac_code(fRO) * sin(theta);
+    ival = ival + grad_dac_code(offset.gradient_y);
+    gy[i] = grad_dac_pack(ival);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16 * sin(theta);
-    ival = ival + (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    ival = grad_dac_code(fRO) * sin(theta);
+    ival = ival + grad_dac_code(offset.gradient_y);
+    gy[i] = grad_dac_pack(ival);
   }
 
   // clear the rest of the buffer
   for(int k=442; k<2000; k++)
   {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[k] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[k] = 0x001fffff & (ival | 0x00100000);
+    gx[k] = grad_dac_word(offset.gradient_x);
+    gy[k] = grad_dac_word(offset.gradient_y);
 
   }
 
   // Z gradient is just the z shim
   for(int k=2; k<2000; k++)
   {
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[k] = 0x001fffff & (ival | 0x00100000);
+    gz[k] = grad_dac_word(offset.gradient_z);
   }
 }
 
@@ -367,23 +334,15 @@ void generate_gradient_waveforms_se_proj_rot(volatile uint32_t *gx,volatile uint
  */
 void update_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, volatile uint32_t *gz2, float ROamp, float PEamp, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- 2D SE/GRE !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- 2D SE/GRE !\n");
 
   uint32_t i;
-  int32_t ival;
-
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
 
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
-  gz2[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
+  gz2[0] = grad_dac_word(offset.gradient_z2);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -402,31 +361,25 @@ void update_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy,
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
 
   // Design the Y gradient
@@ -437,38 +390,30 @@ void update_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy,
 
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
   // clear the rest of the buffer
   for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
   // Z,Z2 shim
   for(int k=2; k<2000; k++)
   {
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[k] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
-    gz2[k] = 0x001fffff & (ival | 0x00100000);
+    gz[k] = grad_dac_word(offset.gradient_z);
+    gz2[k] = grad_dac_word(offset.gradient_z2);
   }
 
 }
@@ -477,13 +422,10 @@ void update_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy,
 // gradient waveforms for the SE/GRE (rotated)
 void update_gradient_waveforms_echo_rot(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, float ROamp, float PEamp, gradient_offset_t offset, float theta)
 {//generate_gradient_waveforms_se_rot_2d
-  printf("Designing a gradient waveform -- Rotated 2D SE/GRE !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- Rotated 2D SE/GRE !\n");
 
   uint32_t i;
-  int32_t ivalx, ivaly, ival;
-
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
+  int32_t ivalx, ivaly;
 
   float offset_val = 0.0;
   // float gx_correction = 0.7;
@@ -507,12 +449,11 @@ void update_gradient_waveforms_echo_rot(volatile uint32_t *gx,volatile uint32_t
 
 
   // enable the gradients with the prescribed offset current
-  ivalx = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ivalx | 0x00100000);
-  ivaly = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ivaly | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  ivalx = grad_dac_code(offset.gradient_x);
+  gx[0] = grad_dac_pack(ivalx);
+  ivaly = grad_dac_code(offset.gradient_y);
+  gy[0] = grad_dac_pack(ivaly);
+  gz[0] = grad_dac_word(offset.gradient_z);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -535,32 +476,32 @@ void update_gradient_waveforms_echo_rot(volatile uint32_t *gx,volatile uint32_t
     fRO += fROprestep;
     fPE += fPEstep;
     // ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta) * gy_correction;
+    ivalx = grad_dac_code(fRO) * cos(theta) - grad_dac_code(fPE) * sin(theta) * gy_correction;
     ivalx = (int32_t)ivalx;
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
+    ivalx = ivalx + grad_dac_code(offset.gradient_x);
 
-    ivaly = floor(fRO/fLSB)*16 * sin(theta) * gx_correction + floor(fPE/fLSB)*16 * cos(theta);
+    ivaly = grad_dac_code(fRO) * sin(theta) * gx_correction + grad_dac_code(fPE) * cos(theta);
     ivaly = (int32_t)ivaly;
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;
+    ivaly = ivaly + grad_dac_code(offset.gradient_y);
 
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
+    gx[i] = grad_dac_pack(ivalx);
+    gy[i] = grad_dac_pack(ivaly);
   }
   for(i=22; i<82; i++) {
     // ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
     // ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta) * gy_correction;
+    ivalx = grad_dac_code(fRO) * cos(theta) - grad_dac_code(fPE) * sin(theta) * gy_correction;
     ivalx = (int32_t)ivalx;
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
+    ivalx = ivalx + grad_dac_code(offset.gradient_x);
 
     // ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
     // ivaly = floor(fRO/fLSB)*16 * sin(theta) + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = floor(fRO/fLSB)*16 * sin(theta) * gx_correction + floor(fPE/fLSB)*16 * cos(theta);
+    ivaly = grad_dac_code(fRO) * sin(theta) * gx_correction + grad_dac_code(fPE) * cos(theta);
     ivaly = (int32_t)ivaly;
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;
+    ivaly = ivaly + grad_dac_code(offset.gradient_y);
 
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
+    gx[i] = grad_dac_pack(ivalx);
+    gy[i] = grad_dac_pack(ivaly);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
@@ -568,86 +509,83 @@ void update_gradient_waveforms_echo_rot(volatile uint32_t *gx,volatile uint32_t
 
     // ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
     // ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta) * gy_correction;
+    ivalx = grad_dac_code(fRO) * cos(theta) - grad_dac_code(fPE) * sin(theta) * gy_correction;
     ivalx = (int32_t)ivalx;
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
+    ivalx = ivalx + grad_dac_code(offset.gradient_x);
 
     // ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
     // ivaly = floor(fRO/fLSB)*16 * sin(theta) + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = floor(fRO/fLSB)*16 * sin(theta) * gx_correction + floor(fPE/fLSB)*16 * cos(theta);
+    ivaly = grad_dac_code(fRO) * sin(theta) * gx_correction + grad_dac_code(fPE) * cos(theta);
     ivaly = (int32_t)ivaly;
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;
+    ivaly = ivaly + grad_dac_code(offset.gradient_y);
 
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
+    gx[i] = grad_dac_pack(ivalx);
+    gy[i] = grad_dac_pack(ivaly);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
     // ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
     // ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta) * gy_correction;
+    ivalx = grad_dac_code(fRO) * cos(theta) - grad_dac_code(fPE) * sin(theta) * gy_correction;
     ivalx = (int32_t)ivalx;
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
+    ivalx = ivalx + grad_dac_code(offset.gradient_x);
 
     // ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
     // ivaly = floor(fRO/fLSB)*16 * sin(theta) + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = floor(fRO/fLSB)*16 * sin(theta) * gx_correction + floor(fPE/fLSB)*16 * cos(theta);
+    ivaly = grad_dac_code(fRO) * sin(theta) * gx_correction + grad_dac_code(fPE) * cos(theta);
     ivaly = (int32_t)ivaly;
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;
+    ivaly = ivaly + grad_dac_code(offset.gradient_y);
 
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
+    gx[i] = grad_dac_pack(ivalx);
+    gy[i] = grad_dac_pack(ivaly);
   }
   for(i=122; i<422; i++) {
     // ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
     // ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta) * gy_correction;
+    ivalx = grad_dac_code(fRO) * cos(theta) - grad_dac_code(fPE) * sin(theta) * gy_correction;
     ivalx = (int32_t)ivalx;
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
+    ivalx = ivalx + grad_dac_code(offset.gradient_x);
 
     // ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
     // ivaly = floor(fRO/fLSB)*16 * sin(theta) + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = floor(fRO/fLSB)*16 * sin(theta) * gx_correction + floor(fPE/fLSB)*16 * cos(theta);
+    ivaly = grad_dac_code(fRO) * sin(theta) * gx_correction + grad_dac_code(fPE) * cos(theta);
     ivaly = (int32_t)ivaly;
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;
+    ivaly = ivaly + grad_dac_code(offset.gradient_y);
 
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
+    gx[i] = grad_dac_pack(ivalx);
+    gy[i] = grad_dac_pack(ivaly);
 
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
     // ivalx = (int32_t)floor(fRO/fLSB)*16 * cos(theta) - (int32_t)floor(fPE/fLSB)*16 * sin(theta);
     // ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta);
-    ivalx = floor(fRO/fLSB)*16 * cos(theta) - floor(fPE/fLSB)*16 * sin(theta) * gy_correction;
+    ivalx = grad_dac_code(fRO) * cos(theta) - grad_dac_code(fPE) * sin(theta) * gy_correction;
     ivalx = (int32_t)ivalx;
-    ivalx = ivalx + (int32_t)floor(offset.gradient_x/fLSB)*16;
+    ivalx = ivalx + grad_dac_code(offset.gradient_x);
 
     // ivaly = (int32_t)floor(fRO/fLSB)*16 * sin(theta) + (int32_t)floor(fPE/fLSB)*16 * cos(theta);
     // ivaly = floor(fRO/fLSB)*16 * sin(theta) + floor(fPE/fLSB)*16 * cos(theta);
-    ivaly = floor(fRO/fLSB)*16 * sin(theta) * gx_correction + floor(fPE/fLSB)*16 * cos(theta);
+    ivaly = grad_dac_code(fRO) * sin(theta) * gx_correction + grad_dac_code(fPE) * cos(theta);
     ivaly = (int32_t)ivaly;
-    ivaly = ivaly + (int32_t)floor(offset.gradient_y/fLSB)*16;
+    ivaly = ivaly + grad_dac_code(offset.gradient_y);
 
-    gx[i] = 0x001fffff & (ivalx | 0x00100000);
-    gy[i] = 0x001fffff & (ivaly | 0x00100000);
+    gx[i] = grad_dac_pack(ivalx);
+    gy[i] = grad_dac_pack(ivaly);
   }
 
   // Clear the rest of the buffer
   for(int k=442; k<2000; k++)
   {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[k] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[k] = 0x001fffff & (ival | 0x00100000);
+    gx[k] = grad_dac_word(offset.gradient_x);
+    gy[k] = grad_dac_word(offset.gradient_y);
 
   }
 
   // Z,Z2 shim
   for(int k=2; k<2000; k++)
   {
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[k] = 0x001fffff & (ival | 0x00100000);
+    gz[k] = grad_dac_word(offset.gradient_z);
     //ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
     //gz2[k] = 0x001fffff & (ival | 0x00100000);
   }
@@ -658,23 +596,15 @@ void update_gradient_waveforms_echo_rot(volatile uint32_t *gx,volatile uint32_t
 // This function makes gradient waveforms for the slice selective SE or GRE sequences
 void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, volatile uint32_t *gz2, float ROamp, float PEamp, float PE2amp, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- Slice-selective SE/GRE!\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- Slice-selective SE/GRE!\n");
 
   uint32_t i;
-  int32_t ival;
-
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n");
 
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
-  gz2[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
+  gz2[0] = grad_dac_word(offset.gradient_z2);
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
   gx[1] = 0x00200002;
@@ -692,31 +622,25 @@ void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
 
   // Design the Y gradient
@@ -727,39 +651,31 @@ void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy
 
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
   // clear the rest of the buffer
   for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
   for(i=512; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(offset.gradient_z);
 
   }
 
   for(i=2; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
-    gz2[i] = 0x001fffff & (ival | 0x00100000);
+    gz2[i] = grad_dac_word(offset.gradient_z2);
   }
 
 
@@ -774,35 +690,29 @@ void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy
 
   for(i=gz_offset + 2; i<gz_offset + 2 + delay; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i= gz_offset + 2 + delay; i< gz_offset + 2 + delay + 40; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i= gz_offset + 2 + delay + 40; i< gz_offset + 2 + delay + 40 + delay; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
 
   fPEstep = PE2amp/3;
   for(i= gz_offset + 2 + delay + 40 + delay; i< gz_offset + 2 + delay + 40 + delay + delay2; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
 
   for(i= gz_offset + 2 + delay + 40 + delay + delay2; i< gz_offset + 2 + delay + 40 + delay + delay2 + 20; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
 
   for(i = gz_offset + 2 + delay + 40 + delay + delay2 + 20; i< gz_offset + 2 + delay + 40 + delay + delay2 + 20 + delay2; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
 }
 
@@ -812,23 +722,16 @@ void update_gradient_waveforms_slice(volatile uint32_t *gx,volatile uint32_t *gy
 void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, \
                               float ROamp, float PEamp[], gradient_offset_t offset)  // ETL echo train length
 {
-  printf("Designing a gradient waveform -- CPMG echo train (etl = 2) !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- CPMG echo train (etl = 2) !\n");
 
   uint32_t i, k;
-  int32_t ival;
   uint32_t etl = 2;
   uint32_t partition_size = 1000;
 
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -847,63 +750,50 @@ void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy
   // Echo 1
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=442; i<542; i++) { //442+660
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=542; i<1002; i++) { //442+660
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
 
   // Echo 2
   for(i=1002; i<1102; i++) { //442+660
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=1102; i<1122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=1122; i<1422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=1422; i<1442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=1442; i<1542; i++) { //442+660
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
 
 
@@ -916,39 +806,31 @@ void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy
   fPEstep = PEamp[0]/20.0;
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=442; i<462; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=462; i<522; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=522; i<542; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=542; i<1002; i++) { //442+660
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
   // Echo 2
@@ -956,44 +838,35 @@ void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy
   fPEstep = PEamp[1]/20.0;
   for(i=1002; i<1022; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=1022; i<1082; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=1082; i<1102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=1102; i<1442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=1442; i<1462; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=1462; i<1522; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=1522; i<1542; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
 
   // clear the rest of the buffer
   for(i=1542; i<2048; i++) {//for(i=1542; i<2000; i++) {  // fail 4095 2049 succeed 2000 2048
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 }
 
@@ -1003,26 +876,19 @@ void update_gradient_waveforms_tse_2(volatile uint32_t *gx,volatile uint32_t *gy
 void update_gradient_waveforms_tse(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, \
                       float ROamp, uint32_t echo_train_length, float PEamp[], gradient_offset_t offset)  // ETL echo train length
 {
-  printf("Designing a gradient waveform -- CPMG echo train !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- CPMG echo train !\n");
 
   uint32_t i;
-  int32_t ival;
 
   uint32_t k;
   uint32_t etl = echo_train_length;
   uint32_t partition_size = 1000;
   uint32_t part_num = 0;
 
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
-
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -1045,48 +911,38 @@ void update_gradient_waveforms_tse(volatile uint32_t *gx,volatile uint32_t *gy,
     if (part_num == 1){ // only first gradient has the prephaser
       for(i=(part_num-1)*partition_size+2; i<(part_num-1)*partition_size+22; i++) {
         fRO += fROprestep;
-        ival = (int32_t)floor(fRO/fLSB)*16;
-        gx[i] = 0x001fffff & (ival | 0x00100000);
+        gx[i] = grad_dac_word(fRO);
       }
       for(i=(part_num-1)*partition_size+22; i<(part_num-1)*partition_size+82; i++) {
-        ival = (int32_t)floor(fRO/fLSB)*16;
-        gx[i] = 0x001fffff & (ival | 0x00100000);
+        gx[i] = grad_dac_word(fRO);
       }
       for(i=(part_num-1)*partition_size+82; i<(part_num-1)*partition_size+102; i++) {
         fRO -= fROprestep;
-        ival = (int32_t)floor(fRO/fLSB)*16;
-        gx[i] = 0x001fffff & (ival | 0x00100000);
+        gx[i] = grad_dac_word(fRO);
       }
     }
     else {
       for(i=(part_num-1)*partition_size+2; i<(part_num-1)*partition_size+102; i++) {
-        ival = (int32_t)floor(fRO/fLSB)*16;
-        printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-        gx[i] = 0x001fffff & (ival | 0x00100000);
+        gx[i] = grad_dac_word(fRO);
       }
     }
 
     for(i=(part_num-1)*partition_size+102; i<(part_num-1)*partition_size+122; i++) {
       fRO -= fROstep;
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(fRO);
     }
     for(i=(part_num-1)*partition_size+122; i<(part_num-1)*partition_size+422; i++) {
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(fRO);
     }
     for(i=(part_num-1)*partition_size+422; i<(part_num-1)*partition_size+442; i++) {
       fRO += fROstep;
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(fRO);
     }
     for(i=(part_num-1)*partition_size+442; i<(part_num-1)*partition_size+542; i++) {
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(fRO);
     }
     for(i=(part_num-1)*partition_size+542; i<(part_num-1)*partition_size+1002; i++) { //442+660
-      ival = (int32_t)floor(fRO/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(fRO);
     }
   }
 
@@ -1106,58 +962,38 @@ void update_gradient_waveforms_tse(volatile uint32_t *gx,volatile uint32_t *gy,
 
     for(i=(part_num-1)*partition_size+2; i<(part_num-1)*partition_size+22; i++) {
       fPE += fPEstep;
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+22; i<(part_num-1)*partition_size+82; i++) {
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+82; i<(part_num-1)*partition_size+102; i++) {
       fPE -= fPEstep;
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+102; i<(part_num-1)*partition_size+442; i++) {
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+442; i<(part_num-1)*partition_size+462; i++) {
       fPE -= fPEstep;
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+462; i<(part_num-1)*partition_size+522; i++) {
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+522; i<(part_num-1)*partition_size+542; i++) {
       fPE += fPEstep;
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
     for(i=(part_num-1)*partition_size+542; i<(part_num-1)*partition_size+1002; i++) { //442+660
-      ival = (int32_t)floor(fPE/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(fPE);
     }
   }
 
-  printf("Gx\n");
-  for (i=0;i<(part_num-1)*partition_size+1002;i++) {
-    printf("\t%f\n", gx[i]);
-  }
-
-  printf("Gy\n");
-  for (i=0;i<(part_num-1)*partition_size+1002;i++) {
-    printf("\t%f\n", gy[i]);
-  }
-
   // clear the rest of the buffer
   for(i=part_num*partition_size+2; i<2048; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 }
 
@@ -1167,21 +1003,14 @@ void update_gradient_waveforms_tse(volatile uint32_t *gx,volatile uint32_t *gy,
 void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, \
                                     float amp_x, float amp_y, gradient_offset_t offset, uint32_t y_grad_off)
 {
-  printf("Designing a gradient waveform -- EPI !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- EPI !\n");
 
   uint32_t i, k;
-  int32_t ival;
-
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
 
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -1221,12 +1050,10 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
       else {
         grad_x -= grad_x_step;
       }
-      ival = (int32_t)floor(grad_x/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(grad_x);
     }
     for(i=7+mem_offset; i<37+mem_offset; i++) {
-      ival = (int32_t)floor(grad_x/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(grad_x);
     }
     for(i=37+mem_offset; i<42+mem_offset; i++) {
       if (k%2==0) {
@@ -1235,37 +1062,30 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
       else {
         grad_x += grad_x_step;
       }
-      ival = (int32_t)floor(grad_x/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(grad_x);
     }
     for(i=42+mem_offset; i<52+mem_offset; i++) {
-      ival = (int32_t)floor(grad_x/fLSB)*16;
-      gx[i] = 0x001fffff & (ival | 0x00100000);
+      gx[i] = grad_dac_word(grad_x);
     }
 
     // Design the Y gradient
     for(i=2+mem_offset; i<42+mem_offset; i++) {
-      ival = (int32_t)floor(grad_y/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(grad_y);
     }
     for(i=42+mem_offset; i<47+mem_offset; i++) {
       grad_y += grad_y_step;
-      ival = (int32_t)floor(grad_y/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(grad_y);
     }
     for(i=47+mem_offset; i<52+mem_offset; i++) {
       grad_y -= grad_y_step;
-      ival = (int32_t)floor(grad_y/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(grad_y);
     }
   }
 
   // set to baseline/offset
   for (i=1602;i<1702;i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
 
@@ -1279,36 +1099,29 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
 
   for(i=2+mem_offset2; i<7+mem_offset2; i++) {
     grad_x += grad_x_step2;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=37+mem_offset2; i<42+mem_offset2; i++) {
     grad_x -= grad_x_step2;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
 
   for(i=2+mem_offset2; i<22+mem_offset2; i++) {
     grad_y += grad_y_step2;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
   for(i=22+mem_offset2; i<42+mem_offset2; i++) {
     grad_y -= grad_y_step2;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
 
   // set to baseline/offset
   for(i=1742; i<1762; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
   // prephaser 2: 32 single shot Gradient Echo
@@ -1317,36 +1130,29 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
   grad_y = offset_y;
   for(i=2+mem_offset2; i<7+mem_offset2; i++) {
     grad_x -= grad_x_step2;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=37+mem_offset2; i<42+mem_offset2; i++) {
     grad_x += grad_x_step2;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
 
   for(i=2+mem_offset2; i<22+mem_offset2; i++) {
     grad_y -= grad_y_step2;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
   for(i=22+mem_offset2; i<42+mem_offset2; i++) {
     grad_y += grad_y_step2;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
 
   // set to baseline/offset
   for(i=1802; i<1822; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
   //#####  single shot 64  #####// only y prephaser needs to be changed
@@ -1359,36 +1165,29 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
 
   for(i=2+mem_offset2; i<7+mem_offset2; i++) {
     grad_x += grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=37+mem_offset2; i<42+mem_offset2; i++) {
     grad_x -= grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
 
   for(i=2+mem_offset2; i<22+mem_offset2; i++) {
     grad_y += grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
   for(i=22+mem_offset2; i<42+mem_offset2; i++) {
     grad_y -= grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
 
   // set to baseline/offset
   for(i=1862; i<1882; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
   // prephaser 4: 64 single shot Gradient Echo
@@ -1397,36 +1196,29 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
   grad_y = offset_y;
   for(i=2+mem_offset2; i<7+mem_offset2; i++) {
     grad_x -= grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=37+mem_offset2; i<42+mem_offset2; i++) {
     grad_x += grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
 
   for(i=2+mem_offset2; i<22+mem_offset2; i++) {
     grad_y -= grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
   for(i=22+mem_offset2; i<42+mem_offset2; i++) {
     grad_y += grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
 
   // set to baseline/offset
   for(i=1922; i<1942; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
   // prephaser 5: 64 single shot Gradient Echo with Partial K-space sampling
@@ -1436,43 +1228,35 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
   grad_y_step3 = amp_y * 50.0 * 4.0 / 200.0 /20; // collect 4 extra lines across k center
   for(i=2+mem_offset2; i<7+mem_offset2; i++) {
     grad_x -= grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=7+mem_offset2; i<37+mem_offset2; i++) {
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
   for(i=37+mem_offset2; i<42+mem_offset2; i++) {
     grad_x += grad_x_step3;
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
 
   for(i=2+mem_offset2; i<22+mem_offset2; i++) {
     grad_y -= grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
   for(i=22+mem_offset2; i<42+mem_offset2; i++) {
     grad_y += grad_y_step3;
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
 
   // set to baseline/offset
   for(i=1982; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
   // turning off all the y gradient, for phase aligning
   if (y_grad_off) {
     for(i=0; i<2000; i++) {
-      ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-      gy[i] = 0x001fffff & (ival | 0x00100000);
+      gy[i] = grad_dac_word(offset.gradient_y);
     }
   }
 }
@@ -1483,21 +1267,14 @@ void update_gradient_waveforms_epi(volatile uint32_t *gx,volatile uint32_t *gy,
 void update_gradient_waveforms_spiral(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, \
                                     float lamda0, float omega0, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- spiral !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- spiral !\n");
 
   uint32_t i;
-  int32_t ival;
-
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
 
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -1516,8 +1293,7 @@ void update_gradient_waveforms_spiral(volatile uint32_t *gx,volatile uint32_t *g
   for(i=2; i<1996; i++) {
     t = (i-2) * 10;
     grad_x = offset_x + lamda0 * omega0 * (cos(omega0 * t) - omega0 * t * sin(omega0 * t));
-    ival = (int32_t)floor(grad_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(grad_x);
   }
 
 
@@ -1525,15 +1301,12 @@ void update_gradient_waveforms_spiral(volatile uint32_t *gx,volatile uint32_t *g
   for(i=2; i<1996; i++) {
     t = (i-2) * 10;
     grad_y = offset_y + lamda0 * omega0 * (sin(omega0 * t) + omega0 * t * cos(omega0 * t));
-    ival = (int32_t)floor(grad_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(grad_y);
   }
 
   for(i=1996; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 }
 
@@ -1541,23 +1314,15 @@ void update_gradient_waveforms_spiral(volatile uint32_t *gx,volatile uint32_t *g
 // Function 5
 void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, volatile uint32_t *gz2, float ROamp, float PEamp, float PE2amp, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- 3D SE/GRE!\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- 3D SE/GRE!\n");
 
   uint32_t i;
-  int32_t ival;
-
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
 
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
-  gz2[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
+  gz2[0] = grad_dac_word(offset.gradient_z2);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -1576,31 +1341,25 @@ void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *g
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
 
   // Design the Y gradient
@@ -1611,21 +1370,17 @@ void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *g
 
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
   // Design the Z gradient
@@ -1636,37 +1391,29 @@ void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *g
 
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
 
   // clear the rest of the buffer
   for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
+    gz[i] = grad_dac_word(offset.gradient_z);
   }
 
   // Z2 shim
   for(i=2; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
-    gz2[i] = 0x001fffff & (ival | 0x00100000);
+    gz2[i] = grad_dac_word(offset.gradient_z2);
   }
 }
 
@@ -1675,8 +1422,11 @@ void update_gradient_waveforms_echo3d(volatile uint32_t *gx,volatile uint32_t *g
 /*
 	This function updates the pulse sequence in the memory with a chosen one through index
 */
-void update_pulse_sequence(uint32_t seq_idx, volatile uint32_t *pulseq_memory)
+void update_pulse_sequence(uint32_t seq_idx, pulseq_mem_t *seq_mem)
 {
+ volatile uint32_t *pulseq_memory = seq_mem->bram;
+
+ pulseq_mem_invalidate(seq_mem); // written past the shadow, the next upload is written in full
  switch(seq_idx) {
 
   case 1:
@@ -2110,13 +1860,11 @@ void update_pulse_sequence(uint32_t seq_idx, volatile uint32_t *pulseq_memory)
 /*
   This function updates the pulse sequence in the memory with the uploaded sequence
 */
-void update_pulse_sequence_from_upload(uint32_t *pulseq_memory_upload, volatile uint32_t *pulseq_memory)
+void update_pulse_sequence_from_upload(uint32_t *pulseq_memory_upload, pulseq_mem_t *seq_mem)
 {
-  int i;
-  int length = 200;
-  for(i=0; i<length; i++){
-    pulseq_memory[i] = pulseq_memory_upload[i];
-  }
+  // only the words that changed since the last load are written
+  pulseq_mem_load(seq_mem, pulseq_memory_upload, PULSEQ_UPLOAD_WORDS);
+  printf("Sequence memory: %d words written\n", seq_mem->written);
 }
 
 
@@ -2129,6 +1877,8 @@ int main(int argc, char *argv[])
 	volatile uint16_t *rx_cntr, *tx_size;
 	//volatile uint8_t *rx_rst, *tx_rst;
 	volatile uint64_t *rx_data;
+	rx_engine_t rx;
+	static pulseq_mem_t seq_mem; // shadow of the sequence BRAM
 	void *tx_data;
 	float tx_freq;
 	struct sockaddr_in addr;
@@ -2172,10 +1922,9 @@ int main(int argc, char *argv[])
 
   // sequence type
   uint32_t seqType_idx; // used in GUI 3 and 5
-  uint32_t pulseq_memory_upload_temp[200]; // record uploaded sequence
-  unsigned char *b; // for sequence upload
-  unsigned int cmd; // for sequence upload
-  uint32_t mem_counter, nbytes, size_of_seq; // for sequence upload
+  uint32_t pulseq_memory_upload_temp[PULSEQ_UPLOAD_WORDS] = {0}; // record uploaded sequence
+  uint32_t nbytes, size_of_seq; // for sequence upload
+  int uploaded;                 // the last upload was taken
 
   // signal from the client
   uint32_t trig;    // Highest 4 bits of command            (trig==1)  Change center frequency
@@ -2187,11 +1936,13 @@ int main(int argc, char *argv[])
 
 
 
-  if(argc != 4) {
-    fprintf(stderr,"parameters: RF duration, RF amplitude Attenuation (0-31.75dB)\n");
+  if(argc != 4 && !(argc == 5 && strcmp(argv[4], "-v") == 0)) {
+    fprintf(stderr,"parameters: RF duration, RF amplitude Attenuation (0-31.75dB) [-v]\n");
     fprintf(stderr,"e.g.\t./mri_lab 60 32200 2.0\n");
+    fprintf(stderr,"-v prints the per-TR console lines\n");
     return -1;
   }
+  trace_set_verbose(argc == 5);
 
 	if((fd = open("/dev/mem", O_RDWR)) < 0) {
   	perror("open");
@@ -2243,6 +1994,9 @@ int main(int argc, char *argv[])
 	rx_freq = ((uint32_t *)(cfg + 4));
 	rx_rate = ((uint32_t *)(cfg + 8));
 	rx_cntr = ((uint16_t *)(sts + 0));
+	rx_engine_init(&rx, seq_config, pulseq_memory, rx_cntr, rx_data, rx_rate);
+	pulseq_mem_init(&seq_mem, pulseq_memory);
+	rx.mem = &seq_mem;
 
 	//tx_rst = ((uint8_t *)(cfg + 1));
 	tx_size = ((uint16_t *)(cfg + 12));
@@ -2372,6 +2126,7 @@ int main(int argc, char *argv[])
     return EXIT_FAILURE;
   }
   printf("%s \n", "Accepted client!");
+  rx.sock_client = sock_client;
 
 
 	while(1) {
@@ -2396,30 +2151,29 @@ int main(int argc, char *argv[])
       /* GUI 1 */
       /********************* FID with frequency modification and shimming *********************/
       printf("*** MRI Lab *** -- FID\n");
-      // update_pulse_sequence(1, pulseq_memory); the old built-in seq, no longer in use
+      // update_pulse_sequence(1, &seq_mem); the old built-in seq, no longer in use
       // receive pulse sequence from the frontend
       printf("%s \n", "Receiving pulse sequence");
       if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
          break;
       }
       size_of_seq = command; // number of bytes (4*num of int_32)
-      if(recv(sock_client, &buffer, size_of_seq, MSG_WAITALL) <= 0) {
-         break;
+      if(size_of_seq > sizeof(buffer)) {
+         // too long to be a sequence, drop the bytes to stay in step with the client
+         if(proto_discard_bulk(sock_client, PROTO_VERSION_1, size_of_seq) < 0) {
+            break;
+         }
+         printf("Sequence of %u bytes too long, the last sequence stays loaded\n", size_of_seq);
       }
-      b = (unsigned char*) buffer;
-      mem_counter = size_of_seq/4 - 1;
-      for (i=size_of_seq-1; i>=0; i-=4) {
-        cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-        pulseq_memory_upload_temp[mem_counter] = cmd;
-        mem_counter -= 1;
+      else if(recv(sock_client, &buffer, size_of_seq, MSG_WAITALL) <= 0) {
+         break;
       }
-      mem_counter = 0;
-      for (i=0; i<size_of_seq; i+=4) {
-        printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-        mem_counter += 1;
+      else if(pulseq_upload_words(pulseq_memory_upload_temp, buffer, size_of_seq) < 0)
+        printf("The last sequence stays loaded\n");
+      else {
+        printf("%s \n", "Pulse sequence loaded");
+        update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
       }
-      printf("%s \n", "Pulse sequence loaded");
-      update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
 
       while(1) {
         if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
@@ -2459,7 +2213,7 @@ int main(int argc, char *argv[])
           printf("%s %d %d %d\n", "Received values", value1, value2, value3);
           switch(value1) {
           case 0:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1:
             printf("Set gradient offsets X %d\n", value3);
@@ -2528,10 +2282,10 @@ int main(int argc, char *argv[])
 	    gradient_offset.gradient_z2 = 0.0;
             break;
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
         }
 
         else {
@@ -2541,19 +2295,10 @@ int main(int argc, char *argv[])
         // turn on gradients with offset currents
         update_gradient_waveform_state(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2,GRAD_OFFSET_ENABLED_OUTPUT,gradient_offset);
         // take spin-echoes with offset currents enabled
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
+        trace_printf("Aquiring data\n");
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+        trace_printf("stop !!\n");
         usleep(500000);
         //usleep(2000000);
       }
@@ -2564,31 +2309,29 @@ int main(int argc, char *argv[])
       /* GUI 2 */
       /********************* Spin Echo with frequency modification and shimming *********************/
       printf("*** MRI Lab *** -- Spin Echo\n");
-      //update_pulse_sequence(2, pulseq_memory); // Spin echo, the old built-in seq, no longer in use
+      //update_pulse_sequence(2, &seq_mem); // Spin echo, the old built-in seq, no longer in use
       // receive pulse sequence from the frontend
       printf("%s \n", "Receiving pulse sequence");
       if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
          break;
       }
       size_of_seq = command; // number of bytes (4*num of int_32)
-      if(recv(sock_client, &buffer, size_of_seq, MSG_WAITALL) <= 0) {
-         break;
+      if(size_of_seq > sizeof(buffer)) {
+         // too long to be a sequence, drop the bytes to stay in step with the client
+         if(proto_discard_bulk(sock_client, PROTO_VERSION_1, size_of_seq) < 0) {
+            break;
+         }
+         printf("Sequence of %u bytes too long, the last sequence stays loaded\n", size_of_seq);
       }
-      b = (unsigned char*) buffer;
-      mem_counter = size_of_seq/4 - 1;
-      for (i=size_of_seq-1; i>=0; i-=4)
-      {
-        cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-        pulseq_memory_upload_temp[mem_counter] = cmd;
-        mem_counter -= 1;
+      else if(recv(sock_client, &buffer, size_of_seq, MSG_WAITALL) <= 0) {
+         break;
       }
-      mem_counter = 0;
-      for (i=0; i<size_of_seq; i+=4) {
-        printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-        mem_counter += 1;
+      else if(pulseq_upload_words(pulseq_memory_upload_temp, buffer, size_of_seq) < 0)
+        printf("The last sequence stays loaded\n");
+      else {
+        printf("%s \n", "Pulse sequence loaded");
+        update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
       }
-      printf("%s \n", "Pulse sequence loaded");
-      update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
 
       while(1) {
         if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
@@ -2628,7 +2371,7 @@ int main(int argc, char *argv[])
           printf("%s %d %d %d\n", "Received values", value1, value2, value3);
           switch(value1) {
           case 0:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1:
             printf("Set gradient offsets X %d\n", value3);
@@ -2700,10 +2443,10 @@ int main(int argc, char *argv[])
 	    gradient_offset.gradient_z2 = 0.0;
             break;
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d, Z2 %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000), (int)(gradient_offset.gradient_z2*1000));
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d, Z2 %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000), (int)(gradient_offset.gradient_z2*1000));
         }
 
         else {
@@ -2713,19 +2456,10 @@ int main(int argc, char *argv[])
         // turn on gradients with offset currents
         update_gradient_waveform_state(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2,GRAD_OFFSET_ENABLED_OUTPUT,gradient_offset);
         // take spin-echoes with offset currents enabled
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
+        trace_printf("Aquiring data\n");
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+        trace_printf("stop !!\n");
         usleep(500000);
       }
       break;
@@ -2763,7 +2497,7 @@ int main(int argc, char *argv[])
           printf("%s %d %d %d\n", "Received values", value1, value2, value3);
           switch(value1) {
           case 0:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1:
             printf("Set gradient offsets X %d\n", value3);
@@ -2816,10 +2550,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;
           default:
-            printf("hahahahaha Acquiring\n");
+            trace_printf("hahahahaha Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
         }
 
         else if( trig == 3 ) { // receive pulse sequence from frontend
@@ -2828,22 +2562,11 @@ int main(int argc, char *argv[])
           printf("%s \n", "Receiving pulse sequence");
           nbytes = read(sock_client, &buffer, sizeof(buffer));
           printf("%s %d \n", "Num bytes received = ", nbytes);
-          b = (unsigned char*) buffer;
-          mem_counter = nbytes/4 - 1;
-          for (i=nbytes-1; i>=0; i-=4)
-          {
-            cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-            pulseq_memory_upload_temp[mem_counter] = cmd;
-            mem_counter -= 1;
-          }
-
-          mem_counter = 0;
-          for (i=0; i<nbytes; i+=4) {
-            printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-            mem_counter += 1;
-          }
-
-          printf("%s \n", "Pulse sequence loaded");
+          uploaded = pulseq_upload_words(pulseq_memory_upload_temp, buffer, nbytes) >= 0;
+          if(!uploaded)
+            printf("The last sequence stays loaded\n");
+          else
+            printf("%s \n", "Pulse sequence loaded");
 
           printf("%s %d\n", "seqType_idx", seqType_idx);
           if (seqType_idx == 0 | seqType_idx == 1 | seqType_idx == 3) {
@@ -2854,7 +2577,8 @@ int main(int argc, char *argv[])
           }
           printf("is_gradient_on: %d\n", is_gradient_on);
 
-          update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+          if(uploaded)
+            update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
 
           continue;  // wait for acquire command
         }
@@ -2871,19 +2595,10 @@ int main(int argc, char *argv[])
           ro = 1.865/2;
           update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro , 0, gradient_offset);
         }
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
+        trace_printf("Aquiring data\n");
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+        trace_printf("stop !!\n");
         usleep(500000);
       }
       break;
@@ -2895,7 +2610,7 @@ int main(int argc, char *argv[])
       /********************* 1 D Projection with frequency modification *********************/
       printf("*** MRI Lab *** -- Projection\n");
 
-      update_pulse_sequence(2, pulseq_memory); // Spin echo
+      update_pulse_sequence(2, &seq_mem); // Spin echo
 
       while(1) {
         if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
@@ -2924,7 +2639,7 @@ int main(int argc, char *argv[])
           printf("%s %d %d %d\n", "Received values", value1, value2, value3);
           switch(value1) {
           case 0:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1:
             printf("Set projection axis to X\n");
@@ -2972,62 +2687,35 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
         }
 
         else if ( trig == 3 ) { // Acquire all three projections
 
           generate_gradient_waveforms_se_proj(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2,1.0,GRAD_AXIS_X,gradient_offset);
-          printf("Aquiring x data\n");
-          seq_config[0] = 0x00000007;
-          usleep(1000000); // sleep 1 second
-          printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-          // Transfer the data to the client
-          // transfer 10 * 5k = 50k samples
-          for(i = 0; i < 10; ++i) {
-            while(*rx_cntr < 10000) usleep(500);
-            for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-            send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-          }
-          printf("stop !!\n");
-          seq_config[0] = 0x00000000;
+          trace_printf("Aquiring x data\n");
+          // start the sequence and send the samples to the client as they arrive
+          rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+          trace_printf("stop !!\n");
           usleep(500000);
           //usleep(2000000);
 
           generate_gradient_waveforms_se_proj(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2,1.0,GRAD_AXIS_Y,gradient_offset);
-          printf("Aquiring y data\n");
-          seq_config[0] = 0x00000007;
-          usleep(1000000); // sleep 1 second
-          printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-          // Transfer the data to the client
-          // transfer 10 * 5k = 50k samples
-          for(i = 0; i < 10; ++i) {
-            while(*rx_cntr < 10000) usleep(500);
-            for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-            send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-          }
-          printf("stop !!\n");
-          seq_config[0] = 0x00000000;
+          trace_printf("Aquiring y data\n");
+          // start the sequence and send the samples to the client as they arrive
+          rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+          trace_printf("stop !!\n");
           usleep(500000);
           //usleep(2000000);
 
           generate_gradient_waveforms_se_proj(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2,1.0,GRAD_AXIS_Z,gradient_offset);
-          printf("Aquiring z data\n");
-          seq_config[0] = 0x00000007;
-          usleep(1000000); // sleep 1 second
-          printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-          // Transfer the data to the client
-          // transfer 10 * 5k = 50k samples
-          for(i = 0; i < 10; ++i) {
-            while(*rx_cntr < 10000) usleep(500);
-            for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-            send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-          }
-          printf("stop !!\n");
-          seq_config[0] = 0x00000000;
+          trace_printf("Aquiring z data\n");
+          // start the sequence and send the samples to the client as they arrive
+          rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+          trace_printf("stop !!\n");
           usleep(500000);
           continue;
         }
@@ -3049,19 +2737,10 @@ int main(int argc, char *argv[])
           break;
         }
 
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-          for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-          send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
+        trace_printf("Aquiring data\n");
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+        trace_printf("stop !!\n");
         usleep(500000);
       }
       break;
@@ -3088,8 +2767,8 @@ int main(int argc, char *argv[])
         if (command == 0) break; // Stop command
 
         trig = command >> 28;
-        printf("Command: %d \n", command);
-        printf("Trig: %d \n", trig);
+        trace_printf("Command: %d \n", command);
+        trace_printf("Trig: %d \n", trig);
 
         if ( trig == 1 ) { // Change center frequency
           value = command & 0xfffffff;
@@ -3108,23 +2787,10 @@ int main(int argc, char *argv[])
           nbytes = read(sock_client, &buffer, sizeof(buffer));
           printf("%s %d \n", "Num bytes received = ", nbytes);
 
-          // Loop over the number of bytes received
-          // This makes b point to the first elt of buffer and recasts buffer to unsigned char
-          b = (unsigned char*) buffer;
-          mem_counter = nbytes/4 - 1;
-          for (i=nbytes-1; i>=0; i-=4) {
-            cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-            pulseq_memory_upload_temp[mem_counter] = cmd;
-            mem_counter -= 1;
-          }
-
-          mem_counter = 0;
-          for (i=0; i<nbytes; i+=4) {
-            printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-            mem_counter += 1;
-          }
-
-          printf("%s \n", "Pulse sequence loaded\n");
+          if(pulseq_upload_words(pulseq_memory_upload_temp, buffer, nbytes) < 0)
+            printf("The last sequence stays loaded\n");
+          else
+            printf("%s \n", "Pulse sequence loaded\n");
         }
 
         else if ( trig == 2 ) { // Change projection axis/load or zero shim
@@ -3146,12 +2812,12 @@ int main(int argc, char *argv[])
 
             switch(seqType_idx) {
             case 0: // Spin Echo
-              // update_pulse_sequence(2, pulseq_memory); // Spin echo
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              // update_pulse_sequence(2, &seq_mem); // Spin echo
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Spin Echo -- npe = %d\n", npe);
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d, Z2 %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000), (int)(gradient_offset.gradient_z2*1000));
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d, Z2 %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000), (int)(gradient_offset.gradient_z2*1000));
               // Phase encoding gradient loop
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
@@ -3159,19 +2825,10 @@ int main(int argc, char *argv[])
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2);
               update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro , pe, gradient_offset);
               for(int reps=0; reps<npe; reps++) {
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+                trace_printf("TR[%d]: go!!\n",reps);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+                trace_printf("stop !!\n");
                 pe = pe+pe_step;
                 update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro, pe, gradient_offset);
                 usleep(4000000); // sleep 4 seconds
@@ -3180,12 +2837,12 @@ int main(int argc, char *argv[])
               break;
 
             case 1: // Gradient Echo
-              // update_pulse_sequence(3, pulseq_memory); // Gradient echo
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              // update_pulse_sequence(3, &seq_mem); // Gradient echo
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Gradient Echo -- npe = %d\n", npe);
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d, Z2 %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000),(int)(gradient_offset.gradient_z2*1000));
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d, Z2 %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000),(int)(gradient_offset.gradient_z2*1000));
               // Phase encoding gradient loop
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
@@ -3193,19 +2850,10 @@ int main(int argc, char *argv[])
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2);
               update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro , pe, gradient_offset);
               for(int reps=0; reps<npe; reps++) {
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+                trace_printf("TR[%d]: go!!\n",reps);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+                trace_printf("stop !!\n");
                 pe = pe+pe_step;
                 update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro, pe, gradient_offset);
                 usleep(500000);
@@ -3214,11 +2862,11 @@ int main(int argc, char *argv[])
               break;
 
             case 2:
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging SE (Slice-selective) -- npe = %d\n", npe);
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
               // Phase encoding gradient loop
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
@@ -3227,19 +2875,10 @@ int main(int argc, char *argv[])
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2);
               update_gradient_waveforms_slice(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro , pe, pe2, gradient_offset);
               for(int reps=0; reps<npe; reps++) {
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+                trace_printf("TR[%d]: go!!\n",reps);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+                trace_printf("stop !!\n");
                 pe = pe+pe_step;
                 update_gradient_waveforms_slice(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro , pe, pe2, gradient_offset);
                 usleep(500000);
@@ -3248,11 +2887,11 @@ int main(int argc, char *argv[])
               break;
 
             case 3: // Slice-selective GRE
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging GRE (Slice-selective) -- npe = %d\n", npe);
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
               // Phase encoding gradient loop
               pe_step = 2.936/44.53/2; //[A]
               pe = -(npe/2-1)*pe_step;
@@ -3261,19 +2900,10 @@ int main(int argc, char *argv[])
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2);
               update_gradient_waveforms_slice(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro , pe, pe2, gradient_offset);
               for(int reps=0; reps<npe; reps++) {
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+                trace_printf("TR[%d]: go!!\n",reps);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+                trace_printf("stop !!\n");
                 pe = pe+pe_step;
                 update_gradient_waveforms_slice(gradient_memory_x,gradient_memory_y,gradient_memory_z, gradient_memory_z2,ro , pe, pe2, gradient_offset);
                 usleep(500000);
@@ -3282,11 +2912,11 @@ int main(int argc, char *argv[])
               break;
 
             case 4: // TSE
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Uploaded Turbo Spin Echo -- npe = %d\n", npe);
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
               etl = 2;
               int k = 0;
               pe_step = 2.936/44.53/2; //[A]
@@ -3296,19 +2926,10 @@ int main(int argc, char *argv[])
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2);
               update_gradient_waveforms_tse_2(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro , pes, gradient_offset);
               for(int reps=0; reps<npe/etl; reps++) {
-                printf("TR[%d]: go!!\n",reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+                trace_printf("TR[%d]: go!!\n",reps);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+                trace_printf("stop !!\n");
                 for(k=0;k<etl;k++) {
                   pes[k] += pe_step*etl;
                 }
@@ -3319,84 +2940,57 @@ int main(int argc, char *argv[])
               break;
 
             case 5: //epi
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Uploaded EPI Sequence\n");
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
               pe_step = 2.936/44.53/2;  //* delta_ky = 800.0 * pe_step *//
               amp_x = 800.0 * pe_step * 64.0 / 300.0;
               amp_y = 800.0 * pe_step / 50.0;
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2);
               update_gradient_waveforms_epi(gradient_memory_x,gradient_memory_y,gradient_memory_z, amp_x, amp_y, gradient_offset, 0);
-              printf("EPI TR[0]: go!!\n");
-              seq_config[0] = 0x00000007;
-              usleep(1000000); // sleep 1 second
-              printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-              // Transfer the data to the client
-              // transfer 10 * 5k = 50k samples
-              for(i = 0; i < 10; ++i) {
-                while(*rx_cntr < 10000) usleep(500);
-                for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-              }
-              printf("stop !!\n");
-              seq_config[0] = 0x00000000;
+              trace_printf("EPI TR[0]: go!!\n");
+              // start the sequence and send the samples to the client as they arrive
+              rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+              trace_printf("stop !!\n");
               usleep(500000);
               printf("*********************************************\n");
               break;
 
             case 6: // epi without y gradients
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Uploaded EPI Sequence Disabling Grad_y\n");
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
               pe_step = 2.936/44.53/2;  //* delta_ky = 800.0 * pe_step *//
               amp_x = 800.0 * pe_step * 64.0 / 300.0;
               amp_y = 800.0 * pe_step / 50.0;
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2);
               update_gradient_waveforms_epi(gradient_memory_x,gradient_memory_y,gradient_memory_z, amp_x, amp_y, gradient_offset, 1);
-              printf("EPI TR[0]: go!!\n");
-              seq_config[0] = 0x00000007;
-              usleep(1000000); // sleep 1 second
-              printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-              // Transfer the data to the client
-              // transfer 10 * 5k = 50k samples
-              for(i = 0; i < 10; ++i) {
-                while(*rx_cntr < 10000) usleep(500);
-                for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-              }
-              printf("stop !!\n");
-              seq_config[0] = 0x00000000;
+              trace_printf("EPI TR[0]: go!!\n");
+              // start the sequence and send the samples to the client as they arrive
+              rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+              trace_printf("stop !!\n");
               usleep(500000);
               printf("*********************************************\n");
               break;
 
             case 7: // spiral
-              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+              update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
               printf("*** MRI Lab *** -- 2D Imaging Uploaded Spiral Sequence\n");
               usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-              printf("Acquiring\n");
-              printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+              trace_printf("Acquiring\n");
+              trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
               a0 = 2.936/44.53/2 * 800 /2/3.14159;
               w0 = 0.01;
               clear_gradient_waveforms(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2);
               update_gradient_waveforms_spiral(gradient_memory_x,gradient_memory_y,gradient_memory_z, a0, w0, gradient_offset);
-              printf("SPIRAL TR[0]: go!!\n");
-              seq_config[0] = 0x00000007;
-              usleep(1000000); // sleep 1 second
-              printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-              // Transfer the data to the client
-              // transfer 10 * 5k = 50k samples
-              for(i = 0; i < 10; ++i) {
-                while(*rx_cntr < 10000) usleep(500);
-                for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-              }
-              printf("stop !!\n");
-              seq_config[0] = 0x00000000;
+              trace_printf("SPIRAL TR[0]: go!!\n");
+              // start the sequence and send the samples to the client as they arrive
+              rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+              trace_printf("stop !!\n");
               usleep(500000);
               printf("*********************************************\n");
               break;
@@ -3406,7 +3000,7 @@ int main(int argc, char *argv[])
             }
 
 
-            printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+            trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
             break;
 
           case 4:
@@ -3443,10 +3037,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
         }
 
         else {
@@ -3505,15 +3099,15 @@ int main(int argc, char *argv[])
             seqType_idx = (command & 0x0000000f);
             switch(seqType_idx) {
             case 0:
-              update_pulse_sequence(2, pulseq_memory); // Spin echo
+              update_pulse_sequence(2, &seq_mem); // Spin echo
               printf("*** MRI Lab *** -- 3D Spin Echo Imaging -- npe = %d, npe2 = %d\n", npe, npe2);
               break;
             case 1:
-              update_pulse_sequence(3, pulseq_memory); // Gradient echo
+              update_pulse_sequence(3, &seq_mem); // Gradient echo
               printf("*** MRI Lab *** -- 3D Gradient Echo Imaging -- npe = %d, npe2 = %d\n", npe, npe2);
               break;
             case 2:
-              //update_pulse_sequence(2, pulseq_memory); // Turbo Spin echo
+              //update_pulse_sequence(2, &seq_mem); // Turbo Spin echo
               printf("*** MRI Lab *** -- 3D Turbo Spin Echo Imaging -- npe = %d, npe2 = %d\n", npe, npe2);
               break;
             default:
@@ -3521,8 +3115,8 @@ int main(int argc, char *argv[])
             }
             usleep(2000000); // sleep 2 second  give enough time to monitor the printout
 
-            printf("Acquiring\n");
-            printf("Gradient offsets(mA): X %d, Y %d, Z %d, Z2 %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000),(int)(gradient_offset.gradient_z2*1000));
+            trace_printf("Acquiring\n");
+            trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d, Z2 %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000),(int)(gradient_offset.gradient_z2*1000));
             // Phase encoding gradient loop
             pe_step = 2.936/44.53/2; //[A]
             pe_step2 = 2.349/44.53;  //[A]
@@ -3532,19 +3126,10 @@ int main(int argc, char *argv[])
             for(int parts = 0; parts<npe2; parts++) { // Phase encoding 2 gradient loop
               update_gradient_waveforms_echo3d(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro , pe, pe2, gradient_offset);
               for(int reps=0; reps<npe; reps++) { // Phase encoding 1 gradient loop
-                printf("TR[%d]: go!!\n",parts*64+reps);
-                seq_config[0] = 0x00000007;
-                usleep(1000000); // sleep 1 second
-                printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-                // Transfer the data to the client
-                // transfer 10 * 5k = 50k samples
-                for(i = 0; i < 10; ++i) {
-                  while(*rx_cntr < 10000) usleep(500);
-                  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-                  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-                }
-                printf("stop !!\n");
-                seq_config[0] = 0x00000000;
+                trace_printf("TR[%d]: go!!\n",parts*64+reps);
+                // start the sequence and send the samples to the client as they arrive
+                rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+                trace_printf("stop !!\n");
                 pe = pe+pe_step;
                 update_gradient_waveforms_echo3d(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro, pe, pe2, gradient_offset);
                 usleep(500000);
@@ -3553,7 +3138,7 @@ int main(int argc, char *argv[])
               pe2 = pe2+pe_step2;
             }
             printf("*********************************************\n");
-            printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+            trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
             break;
 
           case 4:
@@ -3590,10 +3175,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
         }
 
         else {
@@ -3609,8 +3194,8 @@ int main(int argc, char *argv[])
       /********************* 1 D Projection with real-time rotations *********************/
       printf("*** MRI Lab *** -- Real-Time Rotated Projections\n");
 
-      update_pulse_sequence(2, pulseq_memory); // Spin echo
-      // update_pulse_sequence(3, pulseq_memory); // Gradient echo
+      update_pulse_sequence(2, &seq_mem); // Spin echo
+      // update_pulse_sequence(3, &seq_mem); // Gradient echo
 
       while(1) {
         if(recv(sock_client, (char *)&command, 4, MSG_WAITALL) <= 0) {
@@ -3641,7 +3226,7 @@ int main(int argc, char *argv[])
           printf("%s %d %d %d\n", "Received values", value1, value2, value3);
           switch(value1) {
           case 0:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           case 1:
             printf("Set gradient offsets X %d\n", value3);
@@ -3682,10 +3267,10 @@ int main(int argc, char *argv[])
             gradient_offset.gradient_z = 0.0;
             break;
           default:
-            printf("Acquiring\n");
+            trace_printf("Acquiring\n");
             break;
           }
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
 
         }
 
@@ -3700,22 +3285,10 @@ int main(int argc, char *argv[])
             generate_gradient_waveforms_se_proj_rot(gradient_memory_x, gradient_memory_y, gradient_memory_z, 1.0, GRAD_AXIS_X, gradient_offset, theta.val);
             // generate_gradient_waveforms_se_rot(gradient_memory_x, gradient_memory_y, gradient_memory_z, 1.0, GRAD_AXIS_X, gradient_offset, theta.val);
             // printf("Aquiring data\n");
-            printf("Acquiring shot %d\n", avg);
-            seq_config[0] = 0x00000007;
-            // usleep(50000);
-            usleep(800000); // sleep 1 second
-            // printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-
-            // Transfer the data to the client
-            // transfer 10 * 5k = 50k samples
-            for(i = 0; i < 10; ++i) {
-              while(*rx_cntr < 10000) usleep(500);
-              for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-              send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-            } // End data transfer loop
-
-            printf("stop !!\n");
-            seq_config[0] = 0x00000000;
+            trace_printf("Acquiring shot %d\n", avg);
+            // start the sequence and send the samples to the client as they arrive
+            rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+            trace_printf("stop !!\n");
             // usleep(2000000);
 
           } // End averaging loop
@@ -3729,37 +3302,28 @@ int main(int argc, char *argv[])
 
         else if ( trig == 5 ) { // Take a rotated 2D image
           // num_avgs = (command & 0x00ffffff);
-          printf("Angle = %d\n", (command & 0x00ffffff));
+          trace_printf("Angle = %d\n", (command & 0x00ffffff));
           angle_rad = (command & 0x00ffffff) * PI/180.0;
           theta.val = angle_rad;
 
 
-          printf("Acquiring\n");
-          printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
+          trace_printf("Acquiring\n");
+          trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000));
           // // Phase encoding gradient loop
           npe = 64;
           float pe_step = 2.936/44.53/2; //[A]
           float pe = -(npe/2-1)*pe_step;
           float ro = 1.865/2;
           // printf("Pe = %f\n", pe);
-          printf("Pe step  = %f\n", pe_step);
+          trace_printf("Pe step  = %f\n", pe_step);
           update_gradient_waveforms_echo_rot(gradient_memory_x,gradient_memory_y, gradient_memory_z, ro, pe, gradient_offset, theta.val);
           // generate_gradient_waveforms_se_rot_2d(gradient_memory_x,gradient_memory_y, gradient_memory_z, ro, pe, gradient_offset, theta.val);
           for(int reps=0; reps<npe; reps++) {
-            printf("Pe = %f\n", pe);
-            printf("TR[%d]: go!!\n",reps);
-            seq_config[0] = 0x00000007;
-            usleep(1000000); // sleep 1 second
-            // printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-            // Transfer the data to the client
-            // transfer 10 * 5k = 50k samples
-            for(i = 0; i < 10; ++i) {
-              while(*rx_cntr < 10000) usleep(500);
-              for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-              send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-            }
-          printf("stop !!\n");
-          seq_config[0] = 0x00000000;
+            trace_printf("Pe = %f\n", pe);
+            trace_printf("TR[%d]: go!!\n",reps);
+            // start the sequence and send the samples to the client as they arrive
+            rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+          trace_printf("stop !!\n");
           pe = pe+pe_step;
           update_gradient_waveforms_echo_rot(gradient_memory_x,gradient_memory_y, gradient_memory_z, ro, pe, gradient_offset, theta.val);
           // generate_gradient_waveforms_se_rot_2d(gradient_memory_x,gradient_memory_y, gradient_memory_z, ro, pe, gradient_offset, theta.val);
@@ -3825,12 +3389,12 @@ int main(int argc, char *argv[])
 		// kill the gradients
     update_gradient_waveform_state(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2,GRAD_ZERO_DISABLED_OUTPUT,gradient_offset);
 		// the gradient state sequence
-		update_pulse_sequence(100, pulseq_memory);
+		update_pulse_sequence(100, &seq_mem);
 		printf("disabling gradients with service sequence 100\n");
 		seq_config[0] = 0x00000007;
 		usleep(1000000); // sleep 1 second
 		// stop the FPGA again
-		printf("stop !!\n");
+		trace_printf("stop !!\n");
 		seq_config[0] = 0x00000000;
 
 	} // End while loop
@@ -0,0 +1,207 @@
+/*
+  Version 2 of the client protocol: length-prefixed messages.
+
+  In version 1 the client sends bare uint32 commands (opcode nibbles, see
+  mri_lab.c) and the server answers with an unframed stream of samples, so
+  the client has to count bytes to know which TR it is reading. A client
+  switches to version 2 with the idle command 0xC0000002. From then on every
+  message in both directions starts with a proto_hdr_t:
+
+    client -> server
+      PROTO_MSG_COMMAND  uint32 command of version 1 (compatibility shim)
+      PROTO_MSG_BULK     the bytes that follow a command in version 1
+                         (uploaded pulse sequences)
+    server -> client
+      PROTO_MSG_HELLO    proto_hello_t, the answer to the switch
+      PROTO_MSG_DATA     proto_data_t, then the samples of one send chunk in
+                         its encoding (rx_format.h)
+      PROTO_MSG_REPLY    the answer to a command, as in version 1
+
+  The data header names the scan (counted from 1, the TRs that follow one
+  command), the TR within the scan with its phase encoding line, partition
+  and average, the time its drain started, where the chunk starts in the TR
+  and its sample count, so a client can pipeline, reorder or drop blocks.
+  All fields little endian.
+*/
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define PROTO_MAGIC           0x3252434f  // "OCR2"
+#define PROTO_VERSION_1       1           // bare commands, unframed samples
+#define PROTO_VERSION_2       2
+#define PROTO_MAX_DISCARD     65536       // largest unknown message that is skipped
+
+enum {
+  PROTO_MSG_HELLO = 1,
+  PROTO_MSG_COMMAND,
+  PROTO_MSG_BULK,
+  PROTO_MSG_DATA,
+  PROTO_MSG_REPLY
+};
+
+#define PROTO_DATA_LAST       0x1         // last chunk of the TR
+#define PROTO_DATA_TIMEOUT    0x2         // the FIFO timed out, zeros follow
+
+typedef struct {
+  uint32_t magic;
+  uint16_t type;            // PROTO_MSG_*
+  uint16_t version;
+  uint32_t length;          // bytes after the header
+} proto_hdr_t;
+
+typedef struct {
+  proto_hdr_t hdr;
+  uint32_t scan;
+  uint64_t t_us;            // CLOCK_MONOTONIC when the drain of the TR started
+  uint32_t tr;              // TR within the scan
+  uint16_t line;            // phase encoding line
+  uint16_t partition;
+  uint16_t average;
+  uint16_t encoding;        // RX_FORMAT_*
+  uint32_t offset;          // first sample of the chunk within the TR
+  uint32_t nsamples;        // samples in the chunk
+  uint32_t flags;           // PROTO_DATA_*
+} proto_data_t;
+
+typedef struct {
+  proto_hdr_t hdr;
+  uint32_t version;
+  uint32_t samples_per_tr;  // RX_SAMPLES_PER_TR
+  uint32_t formats;         // bit mask of the RX_FORMAT_* the server encodes
+} proto_hello_t;
+
+static inline void proto_hdr(proto_hdr_t *h, uint32_t type, uint32_t length)
+{
+  h->magic = PROTO_MAGIC;
+  h->type = type;
+  h->version = PROTO_VERSION_2;
+  h->length = length;
+}
+
+/*
+  Send a message of a and b; in version 1 without the header, as before
+*/
+static inline ssize_t proto_send(int sock, int version, uint32_t type, const void *a, size_t na, const void *b, size_t nb)
+{
+  proto_hdr_t h;
+  struct iovec iov[3];
+  struct msghdr msg;
+  int n = 0;
+
+  if(version >= PROTO_VERSION_2) {
+    proto_hdr(&h, type, na + nb);
+    iov[n].iov_base = &h;
+    iov[n++].iov_len = sizeof(h);
+  }
+  if(na) {
+    iov[n].iov_base = (void *)a;
+    iov[n++].iov_len = na;
+  }
+  if(nb) {
+    iov[n].iov_base = (void *)b;
+    iov[n++].iov_len = nb;
+  }
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = n;
+  return sendmsg(sock, &msg, MSG_NOSIGNAL);
+}
+
+static inline int proto_skip(int sock, uint32_t n)
+{
+  char scratch[256];
+  uint32_t k;
+
+  for(; n > 0; n -= k) {
+    k = n < sizeof(scratch) ? n : sizeof(scratch);
+    if(recv(sock, scratch, k, MSG_WAITALL) <= 0)
+      return -1;
+  }
+  return 0;
+}
+
+/*
+  Read the header of the next message of type from the client, messages of
+  other types are skipped. Returns the payload length or -1.
+*/
+static inline int64_t proto_recv_hdr(int sock, uint32_t type)
+{
+  proto_hdr_t h;
+
+  while(1) {
+    if(recv(sock, &h, sizeof(h), MSG_WAITALL) <= 0)
+      return -1;
+    if(h.magic != PROTO_MAGIC) {
+      printf("Protocol: bad message magic 0x%08x\n", h.magic);
+      return -1;
+    }
+    if(h.type == type)
+      return h.length;
+    printf("Protocol: skipping message %d of %u bytes\n", h.type, h.length);
+    if(h.length > PROTO_MAX_DISCARD || proto_skip(sock, h.length) < 0)
+      return -1;
+  }
+}
+
+/*
+  Next command of the client. Returns what recv() would: <= 0 when the
+  connection is gone.
+*/
+static inline int proto_recv_command(int sock, int version, uint32_t *command)
+{
+  int64_t n;
+
+  if(version < PROTO_VERSION_2)
+    return recv(sock, (char *)command, 4, MSG_WAITALL);
+  n = proto_recv_hdr(sock, PROTO_MSG_COMMAND);
+  if(n < 4)
+    return -1;
+  if(recv(sock, (char *)command, 4, MSG_WAITALL) <= 0)
+    return -1;
+  if(n > 4 && proto_skip(sock, n-4) < 0)
+    return -1;
+  return 4;
+}
+
+/*
+  The size bytes that follow a command (sequence upload) into dst
+*/
+static inline int proto_recv_bulk(int sock, int version, void *dst, uint32_t size)
+{
+  int64_t n;
+
+  if(version < PROTO_VERSION_2)
+    return recv(sock, dst, size, MSG_WAITALL);
+  n = proto_recv_hdr(sock, PROTO_MSG_BULK);
+  if(n != size) {
+    printf("Protocol: bulk message of %d bytes, %u expected\n", (int)n, size);
+    return -1;
+  }
+  return recv(sock, dst, size, MSG_WAITALL);
+}
+
+/*
+  Drops the size bytes that follow a command when they do not fit where
+  they should go, so the next command is read in step. Returns -1 when the
+  connection is gone or the bytes are too many to read through.
+*/
+static inline int proto_discard_bulk(int sock, int version, uint32_t size)
+{
+  int64_t n = size;
+
+  if(version >= PROTO_VERSION_2 && (n = proto_recv_hdr(sock, PROTO_MSG_BULK)) < 0)
+    return -1;
+  if(n > PROTO_MAX_DISCARD) {
+    printf("Protocol: %u bytes are too many to skip\n", (uint32_t)n);
+    return -1;
+  }
+  return proto_skip(sock, n);
+}
+
+#endif
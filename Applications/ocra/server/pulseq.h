@@ -0,0 +1,191 @@
+/*
+  Pulse sequence memory of the micro sequencer (HDL/cores/micro_sequencer_v1_0).
+
+  The sequence memory holds 64 bit instructions, each one as two 32 bit words
+  in pulseq_memory: word 2k is the lower half, word 2k+1 the upper half.
+    bits 63:58  opcode
+    bits 44:40  register of format B (PR)
+    bits 39:0   delay constant of format B (PR), in sequencer clock cycles
+    bits 36:32  register of format A (LD64, DEC, INC, JNZ)
+    bits  9:0   direct address of format A, or the offset of TXOFFSET/GRADOFFSET
+*/
+#ifndef PULSEQ_H
+#define PULSEQ_H
+
+#include <stdint.h>
+
+#define PULSEQ_CLOCK_MHZ      143.0   // FPGA clock set up by the servers
+#define PULSEQ_MEMORY_WORDS   2048    // 1024 instructions, the direct address is 10 bits
+#define PULSEQ_UPLOAD_WORDS   PULSEQ_MEMORY_WORDS // an upload can fill the BRAM (pulseq_mem.h)
+#define PULSEQ_MAX_STEPS      (1<<22) // give up on programs that do not halt
+
+// opcodes
+#define PULSEQ_NOP            0x00
+#define PULSEQ_DEC            0x01
+#define PULSEQ_INC            0x02
+#define PULSEQ_LD64           0x04
+#define PULSEQ_TXOFFSET       0x08
+#define PULSEQ_GRADOFFSET     0x09
+#define PULSEQ_JNZ            0x10
+#define PULSEQ_BTR            0x14
+#define PULSEQ_RET            0x15
+#define PULSEQ_J              0x17
+#define PULSEQ_HALT           0x19
+#define PULSEQ_PI             0x1C
+#define PULSEQ_PR             0x1D
+
+// pulse bits, see bit_table in assembler.py
+#define PULSEQ_TX_PULSE       0x01
+#define PULSEQ_RX_PULSE       0x02    // inverted: high holds the RX FIFO in reset
+#define PULSEQ_GRAD_PULSE     0x04
+#define PULSEQ_TX_GATE        0x10
+#define PULSEQ_RX_GATE        0x20
+
+// instruction fields, hi and lo are the upper and lower 32 bit word
+#define PULSEQ_OP(hi)         ((hi) >> 26)
+#define PULSEQ_REG_A(hi)      ((hi) & 0x1f)
+#define PULSEQ_REG_B(hi)      (((hi) >> 8) & 0x1f)
+#define PULSEQ_ADDR(lo)       ((lo) & 0x3ff)
+#define PULSEQ_DELAY(hi, lo)  ((((uint64_t)(hi) & 0xff) << 32) | (lo))
+
+// upper words of generated instructions, the lower word is the address or the delay
+#define PULSEQ_HI_A(op, reg)        (((uint32_t)(op) << 26) | ((reg) & 0x1f))
+#define PULSEQ_HI_B(op, reg, delay) (((uint32_t)(op) << 26) | (((reg) & 0x1f) << 8) | (uint32_t)(((delay) >> 32) & 0xff))
+
+// every instruction runs through Fetch .. WriteBack, PR adds delay+1 stall cycles
+#define PULSEQ_INSTR_CYCLES   9
+#define PULSEQ_EXEC_CYCLES    5       // cycles from Fetch to Execute, where PR loads the output register
+#define PULSEQ_OUT_CYCLES     6       // from the Fetch of a PR to the change of the outputs, and of a HALT to Halted
+
+/*
+  A receive window of a program, in sequencer clock cycles from the start.
+  holdoff is the middle of the FIFO reset just before the window, length is the
+  length of the window. open is set when the receiver is still running when the
+  program halts.
+*/
+typedef struct {
+  uint64_t holdoff;
+  uint64_t length;
+  int open;
+} pulseq_rx_window_t;
+
+static inline double pulseq_cycles_to_us(uint64_t cycles)
+{
+  return cycles / PULSEQ_CLOCK_MHZ;
+}
+
+static inline uint64_t pulseq_us_to_cycles(double us)
+{
+  return (uint64_t)(us * PULSEQ_CLOCK_MHZ);
+}
+
+/*
+  Walk the program like the sequencer does and list the windows in which
+  RX_PULSE is low. Every time RX_PULSE goes high the FIFO is reset, so each
+  window starts with an empty FIFO. When there are more than max windows the
+  later ones overwrite win[max-1], which then holds the last window. The number
+  of windows is returned and end is set to the cycle of the HALT.
+  Registers are taken as 0 until loaded. The edges and the HALT are timed
+  PULSEQ_OUT_CYCLES after the Fetch, as in pulseq_emu.h. Returns -1 if the
+  program runs off the memory, hits BTR (hangs the sequencer) or does not halt.
+*/
+static inline int pulseq_rx_windows(const uint32_t *prog, uint32_t nwords, pulseq_rx_window_t *win, int max, uint64_t *end)
+{
+  uint64_t R[32];
+  uint64_t t = 0, t_out, reset_start = 0, window_start = 0;
+  uint32_t pc = 0, hi, lo, addr, steps;
+  int rx_on = 1, n = 0, w = 0, i;   // the receiver runs while the sequencer is halted
+
+  for(i = 0; i < 32; i++)
+    R[i] = 0;
+
+  for(steps = 0; steps < PULSEQ_MAX_STEPS; steps++) {
+    if(2*pc+1 >= nwords)
+      return -1;
+    lo = prog[2*pc];
+    hi = prog[2*pc+1];
+    addr = PULSEQ_ADDR(lo);
+    t_out = t + PULSEQ_OUT_CYCLES;
+
+    switch(PULSEQ_OP(hi)) {
+    case PULSEQ_LD64:
+      R[PULSEQ_REG_A(hi)] = (2*addr+1 < nwords) ? ((uint64_t)prog[2*addr+1] << 32) | prog[2*addr] : 0;
+      pc++;
+      break;
+    case PULSEQ_DEC:
+      R[PULSEQ_REG_A(hi)]--;
+      pc++;
+      break;
+    case PULSEQ_INC:
+      R[PULSEQ_REG_A(hi)]++;
+      pc++;
+      break;
+    case PULSEQ_JNZ:
+      pc = R[PULSEQ_REG_A(hi)] ? addr : pc+1;
+      break;
+    case PULSEQ_J:
+      pc = addr;
+      break;
+    case PULSEQ_BTR:
+      return -1;
+    case PULSEQ_HALT:
+      if(rx_on && n > 0) {
+        win[w].length = t_out - window_start;
+        win[w].open = 1;
+      }
+      if(end)
+        *end = t_out;
+      return n;
+    case PULSEQ_PR:
+      if(rx_on && (R[PULSEQ_REG_B(hi)] & PULSEQ_RX_PULSE)) {
+        rx_on = 0;
+        reset_start = t_out;
+        if(n > 0) {
+          win[w].length = t_out - window_start;
+          win[w].open = 0;
+        }
+      }
+      else if(!rx_on && !(R[PULSEQ_REG_B(hi)] & PULSEQ_RX_PULSE)) {
+        rx_on = 1;
+        window_start = t_out;
+        w = n < max ? n : max-1;
+        win[w].holdoff = (reset_start + window_start)/2;
+        n++;
+      }
+      t += PULSEQ_DELAY(hi, lo) + 1;
+      pc++;
+      break;
+    default: // NOP, TXOFFSET, GRADOFFSET, PI
+      pc++;
+      break;
+    }
+    t += PULSEQ_INSTR_CYCLES;
+  }
+  return -1;
+}
+
+/*
+  The last receive window of the program, the only one whose samples are
+  still in the FIFO when the program halts. A program that never resets the
+  FIFO receives from the start. end (if not NULL) is set to the cycle of
+  the HALT. Returns -1 if the program can not be walked.
+*/
+static inline int pulseq_rx_window(const uint32_t *prog, uint32_t nwords, pulseq_rx_window_t *win, uint64_t *end)
+{
+  uint64_t halt;
+  int n;
+
+  n = pulseq_rx_windows(prog, nwords, win, 1, &halt);
+  if(n < 0)
+    return -1;
+  if(n == 0) {
+    win->holdoff = 0;
+    win->length = halt;
+    win->open = 1;
+  }
+  if(end)
+    *end = halt;
+  return 0;
+}
+
+#endif
@@ -0,0 +1,712 @@
+/*
+  Sequence assembler on the target.
+
+  The clients assemble their sequences with assembler.py and upload the
+  words, so changing one delay (TE, TI) means editing the source, assembling
+  it again and uploading the whole program. This assembler takes the same
+  source and gives the same words: variables first (NAME = 0x1 or
+  NAME = TX_GATE | RX_PULSE), then the instructions NOP, DEC, INC, LD64,
+  TXOFFSET, GRADOFFSET, JNZ, BTR, RET, J, HALT, PI and PR, // comments.
+  Addresses and variable values are hexadecimal as in assembler.py, the other
+  numbers decimal. On top of that the source can name parameters:
+
+    PARAM TE, 10              a parameter and its default value
+    PR 3, TE/2*1000 - 112     the delay of PR (us) and the constant of
+                              TXOFFSET/GRADOFFSET are expressions of numbers
+                              and parameters with + - * / and parentheses
+
+  The client sets the parameters and the server assembles the source again.
+  The images are kept in an LRU cache keyed by a hash of the source and the
+  parameter values, so a sweep over a few values assembles each program once.
+
+  An instruction can have a label, TE_HALF: PR 3, 4888. A label is an
+  address like a variable, and the delay of a labelled PR can be changed in
+  the loaded program without assembling or uploading it again
+  (pulseq_asm_patch_delay()).
+*/
+#ifndef PULSEQ_ASM_H
+#define PULSEQ_ASM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "pulseq.h"
+#include "pulseq_mem.h"
+
+#define PULSEQ_ASM_MAX_SOURCE   65536   // bytes of a source, enough for the 1024 instructions
+#define PULSEQ_ASM_MAX_LINE     256
+#define PULSEQ_ASM_MAX_NAME     32
+#define PULSEQ_ASM_MAX_SYMBOLS  64      // variables, labels and PARAMs of a source
+#define PULSEQ_ASM_MAX_PARAMS   16      // parameters set by the client
+#define PULSEQ_ASM_MAX_LABELS   16
+#define PULSEQ_ASM_MAX_OPERANDS 3
+#define PULSEQ_ASM_CACHE_IMAGES 16
+#define PULSEQ_ASM_US_PER_CYCLE 7e-3    // PR delays are converted as in assembler.py
+#define PULSEQ_ASM_MAX_DELAY    ((1ull << 40) - 1)
+
+enum {
+  PULSEQ_ASM_NONE,          // NOP, HALT
+  PULSEQ_ASM_REG,           // DEC, INC: register
+  PULSEQ_ASM_REG_ADDR,      // LD64, JNZ: register, variable or address
+  PULSEQ_ASM_ADDR,          // BTR, RET, J, PI: address
+  PULSEQ_ASM_DELAY,         // PR: register, delay in us
+  PULSEQ_ASM_CONST          // TXOFFSET, GRADOFFSET: 40 bit constant
+};
+
+typedef struct {
+  const char *name;
+  uint32_t op;
+  int format;
+} pulseq_asm_op_t;
+
+static const pulseq_asm_op_t pulseq_asm_ops[] = {
+  {"NOP", PULSEQ_NOP, PULSEQ_ASM_NONE},
+  {"DEC", PULSEQ_DEC, PULSEQ_ASM_REG},
+  {"INC", PULSEQ_INC, PULSEQ_ASM_REG},
+  {"LD64", PULSEQ_LD64, PULSEQ_ASM_REG_ADDR},
+  {"TXOFFSET", PULSEQ_TXOFFSET, PULSEQ_ASM_CONST},
+  {"GRADOFFSET", PULSEQ_GRADOFFSET, PULSEQ_ASM_CONST},
+  {"JNZ", PULSEQ_JNZ, PULSEQ_ASM_REG_ADDR},
+  {"BTR", PULSEQ_BTR, PULSEQ_ASM_ADDR},
+  {"RET", PULSEQ_RET, PULSEQ_ASM_ADDR},
+  {"J", PULSEQ_J, PULSEQ_ASM_ADDR},
+  {"HALT", PULSEQ_HALT, PULSEQ_ASM_NONE},
+  {"PI", PULSEQ_PI, PULSEQ_ASM_ADDR},
+  {"PR", PULSEQ_PR, PULSEQ_ASM_DELAY}
+};
+
+static const struct {
+  const char *name;
+  uint32_t bits;
+} pulseq_asm_bits[] = {
+  {"TX_PULSE", PULSEQ_TX_PULSE},
+  {"RX_PULSE", PULSEQ_RX_PULSE},
+  {"GRAD_PULSE", PULSEQ_GRAD_PULSE},
+  {"TX_GATE", PULSEQ_TX_GATE},
+  {"RX_GATE", PULSEQ_RX_GATE}
+};
+
+typedef struct {
+  char name[PULSEQ_ASM_MAX_NAME];
+  double value;
+} pulseq_asm_param_t;
+
+typedef struct {
+  pulseq_asm_param_t param[PULSEQ_ASM_MAX_PARAMS];
+  uint32_t n;
+} pulseq_asm_params_t;
+
+typedef struct {
+  char name[PULSEQ_ASM_MAX_NAME];
+  int is_param;             // PARAM, else a variable or label at address value
+  double value;
+} pulseq_asm_symbol_t;
+
+typedef struct {
+  char name[PULSEQ_ASM_MAX_NAME];
+  uint32_t addr;            // instruction
+} pulseq_asm_label_t;
+
+typedef struct {
+  pulseq_asm_label_t label[PULSEQ_ASM_MAX_LABELS];
+  uint32_t n;
+} pulseq_asm_labels_t;
+
+typedef struct {
+  const pulseq_asm_params_t *params;
+  pulseq_asm_labels_t labels;
+  pulseq_asm_symbol_t sym[PULSEQ_ASM_MAX_SYMBOLS];
+  uint32_t nsym;
+  int line;
+} pulseq_asm_t;
+
+typedef struct {
+  uint64_t key;
+  uint64_t used;            // stamp of the last use, 0 for a free slot
+  uint32_t nwords;          // words of the program, the rest of words is 0
+  uint32_t words[PULSEQ_UPLOAD_WORDS];
+  pulseq_asm_labels_t labels;
+} pulseq_asm_image_t;
+
+typedef struct {
+  pulseq_asm_image_t image[PULSEQ_ASM_CACHE_IMAGES];
+  uint64_t stamp;
+  uint32_t hits;
+  uint32_t misses;
+} pulseq_asm_cache_t;
+
+static inline int pulseq_asm_error(pulseq_asm_t *a, const char *what, const char *s)
+{
+  printf("Assembler: line %d: %s %s\n", a->line, what, s);
+  return -1;
+}
+
+static inline char *pulseq_asm_trim(char *s)
+{
+  char *e;
+
+  while(isspace((unsigned char)*s))
+    s++;
+  e = s + strlen(s);
+  while(e > s && isspace((unsigned char)e[-1]))
+    *--e = 0;
+  return s;
+}
+
+static inline int pulseq_asm_is_name(const char *s)
+{
+  if(!isalpha((unsigned char)*s) && *s != '_')
+    return 0;
+  for(s++; *s; s++)
+    if(!isalnum((unsigned char)*s) && *s != '_')
+      return 0;
+  return 1;
+}
+
+/*
+  Set a parameter of the client, it overrides the PARAM of the source
+*/
+static inline int pulseq_asm_set_param(pulseq_asm_params_t *p, const char *name, double value)
+{
+  uint32_t i;
+
+  if(!pulseq_asm_is_name(name) || strlen(name) >= PULSEQ_ASM_MAX_NAME)
+    return -1;
+  for(i = 0; i < p->n; i++)
+    if(strcmp(p->param[i].name, name) == 0)
+      break;
+  if(i == PULSEQ_ASM_MAX_PARAMS)
+    return -1;
+  if(i == p->n) {
+    strcpy(p->param[i].name, name);
+    p->n++;
+  }
+  p->param[i].value = value;
+  return 0;
+}
+
+/*
+  Parameters as text, NAME=value separated by ';', ',' or white space.
+  Returns the number of parameters set or -1.
+*/
+static inline int pulseq_asm_parse_params(pulseq_asm_params_t *p, const char *text, uint32_t len)
+{
+  char buf[PULSEQ_ASM_MAX_LINE], *tok, *eq, *end, *save;
+  int n = 0;
+
+  if(len >= sizeof(buf))
+    return -1;
+  memcpy(buf, text, len);
+  buf[len] = 0;
+  for(tok = strtok_r(buf, ";, \t\r\n", &save); tok; tok = strtok_r(NULL, ";, \t\r\n", &save)) {
+    eq = strchr(tok, '=');
+    if(!eq)
+      return -1;
+    *eq = 0;
+    if(pulseq_asm_set_param(p, tok, strtod(eq+1, &end)) < 0 || end == eq+1 || *end)
+      return -1;
+    n++;
+  }
+  return n;
+}
+
+static inline pulseq_asm_symbol_t *pulseq_asm_symbol(pulseq_asm_t *a, const char *name)
+{
+  uint32_t i;
+
+  for(i = 0; i < a->nsym; i++)
+    if(strcmp(a->sym[i].name, name) == 0)
+      return &a->sym[i];
+  return NULL;
+}
+
+static inline int pulseq_asm_define(pulseq_asm_t *a, const char *name, int is_param, double value)
+{
+  pulseq_asm_symbol_t *s;
+
+  if(!pulseq_asm_is_name(name) || strlen(name) >= PULSEQ_ASM_MAX_NAME)
+    return pulseq_asm_error(a, "bad name", name);
+  if(pulseq_asm_symbol(a, name))
+    return pulseq_asm_error(a, "defined twice:", name);
+  if(a->nsym == PULSEQ_ASM_MAX_SYMBOLS)
+    return pulseq_asm_error(a, "too many names at", name);
+  s = &a->sym[a->nsym++];
+  strcpy(s->name, name);
+  s->is_param = is_param;
+  s->value = value;
+  return 0;
+}
+
+/*
+  Value of a parameter: the client's, else the PARAM of the source
+*/
+static inline int pulseq_asm_param(pulseq_asm_t *a, const char *name, double *v)
+{
+  pulseq_asm_symbol_t *s;
+  uint32_t i;
+
+  for(i = 0; a->params && i < a->params->n; i++)
+    if(strcmp(a->params->param[i].name, name) == 0) {
+      *v = a->params->param[i].value;
+      return 0;
+    }
+  s = pulseq_asm_symbol(a, name);
+  if(!s || !s->is_param)
+    return -1;
+  *v = s->value;
+  return 0;
+}
+
+static inline int pulseq_asm_sum(pulseq_asm_t *a, const char **s, double *v);
+
+static inline int pulseq_asm_factor(pulseq_asm_t *a, const char **s, double *v)
+{
+  char name[PULSEQ_ASM_MAX_NAME];
+  const char *p;
+  char *end;
+  uint32_t n;
+
+  while(isspace((unsigned char)**s))
+    (*s)++;
+  p = *s;
+  if(*p == '-' || *p == '+') {
+    (*s)++;
+    if(pulseq_asm_factor(a, s, v) < 0)
+      return -1;
+    if(*p == '-')
+      *v = -*v;
+    return 0;
+  }
+  if(*p == '(') {
+    (*s)++;
+    if(pulseq_asm_sum(a, s, v) < 0)
+      return -1;
+    while(isspace((unsigned char)**s))
+      (*s)++;
+    if(**s != ')')
+      return pulseq_asm_error(a, "missing ) at", *s);
+    (*s)++;
+    return 0;
+  }
+  if(isalpha((unsigned char)*p) || *p == '_') {
+    for(n = 0; isalnum((unsigned char)p[n]) || p[n] == '_'; n++);
+    if(n >= sizeof(name))
+      return pulseq_asm_error(a, "bad name", p);
+    memcpy(name, p, n);
+    name[n] = 0;
+    *s = p + n;
+    if(pulseq_asm_param(a, name, v) < 0)
+      return pulseq_asm_error(a, "no parameter", name);
+    return 0;
+  }
+  *v = strtod(p, &end);
+  if(end == p)
+    return pulseq_asm_error(a, "expected a number at", p);
+  *s = end;
+  return 0;
+}
+
+static inline int pulseq_asm_product(pulseq_asm_t *a, const char **s, double *v)
+{
+  double r;
+  char op;
+
+  if(pulseq_asm_factor(a, s, v) < 0)
+    return -1;
+  while(1) {
+    while(isspace((unsigned char)**s))
+      (*s)++;
+    op = **s;
+    if(op != '*' && op != '/')
+      return 0;
+    (*s)++;
+    if(pulseq_asm_factor(a, s, &r) < 0)
+      return -1;
+    if(op == '/' && r == 0.0)
+      return pulseq_asm_error(a, "division by zero", "");
+    *v = op == '*' ? *v * r : *v / r;
+  }
+}
+
+static inline int pulseq_asm_sum(pulseq_asm_t *a, const char **s, double *v)
+{
+  double r;
+  char op;
+
+  if(pulseq_asm_product(a, s, v) < 0)
+    return -1;
+  while(1) {
+    while(isspace((unsigned char)**s))
+      (*s)++;
+    op = **s;
+    if(op != '+' && op != '-')
+      return 0;
+    (*s)++;
+    if(pulseq_asm_product(a, s, &r) < 0)
+      return -1;
+    *v = op == '+' ? *v + r : *v - r;
+  }
+}
+
+static inline int pulseq_asm_expr(pulseq_asm_t *a, const char *s, double *v)
+{
+  if(pulseq_asm_sum(a, &s, v) < 0)
+    return -1;
+  if(*s)
+    return pulseq_asm_error(a, "unexpected", s);
+  return 0;
+}
+
+static inline int pulseq_asm_hex(pulseq_asm_t *a, const char *s, uint64_t *v)
+{
+  char *end;
+
+  *v = strtoull(s, &end, 16);
+  if(end == s || *end)
+    return pulseq_asm_error(a, "bad hexadecimal number", s);
+  return 0;
+}
+
+static inline int pulseq_asm_reg(pulseq_asm_t *a, const char *s, uint32_t *reg)
+{
+  char *end;
+  unsigned long r = strtoul(s, &end, 10);
+
+  if(end == s || *end || r > 31)
+    return pulseq_asm_error(a, "bad register", s);
+  *reg = r;
+  return 0;
+}
+
+/*
+  The value of a variable: a hexadecimal number or bit names joined by |
+*/
+static inline int pulseq_asm_var_value(pulseq_asm_t *a, char *s, uint64_t *v)
+{
+  char *tok, *save;
+  uint64_t x;
+  uint32_t i;
+
+  *v = 0;
+  for(tok = strtok_r(s, "|", &save); tok; tok = strtok_r(NULL, "|", &save)) {
+    tok = pulseq_asm_trim(tok);
+    if(strpbrk(tok, "0123456789")) {
+      if(pulseq_asm_hex(a, tok, &x) < 0)
+        return -1;
+      *v |= x;
+      continue;
+    }
+    for(i = 0; i < sizeof(pulseq_asm_bits)/sizeof(pulseq_asm_bits[0]); i++)
+      if(strcmp(tok, pulseq_asm_bits[i].name) == 0)
+        break;
+    if(i == sizeof(pulseq_asm_bits)/sizeof(pulseq_asm_bits[0]))
+      return pulseq_asm_error(a, "unknown bit", tok);
+    *v |= pulseq_asm_bits[i].bits;
+  }
+  return 0;
+}
+
+/*
+  Split the operands at commas, or at white space if there is no comma
+*/
+static inline int pulseq_asm_operands(char *s, char **opnd)
+{
+  const char *sep = strchr(s, ',') ? "," : " \t";
+  char *tok, *save;
+  int n = 0;
+
+  for(tok = strtok_r(s, sep, &save); tok; tok = strtok_r(NULL, sep, &save)) {
+    if(n == PULSEQ_ASM_MAX_OPERANDS)
+      return -1;
+    opnd[n++] = pulseq_asm_trim(tok);
+  }
+  return n;
+}
+
+/*
+  One instruction into words[0..1]
+*/
+static inline int pulseq_asm_instr(pulseq_asm_t *a, char *mnemonic, char *rest, uint32_t *words)
+{
+  const pulseq_asm_op_t *op = NULL;
+  char *opnd[PULSEQ_ASM_MAX_OPERANDS];
+  pulseq_asm_symbol_t *sym;
+  uint32_t i, reg = 0;
+  uint64_t x = 0;
+  double v;
+  int n;
+
+  for(i = 0; i < sizeof(pulseq_asm_ops)/sizeof(pulseq_asm_ops[0]); i++)
+    if(strcmp(mnemonic, pulseq_asm_ops[i].name) == 0)
+      op = &pulseq_asm_ops[i];
+  if(!op)
+    return pulseq_asm_error(a, "unknown opcode", mnemonic);
+  n = pulseq_asm_operands(rest, opnd);
+  switch(op->format) {
+  case PULSEQ_ASM_NONE:
+    break;
+  case PULSEQ_ASM_REG:
+    if(n != 1 || pulseq_asm_reg(a, opnd[0], &reg) < 0)
+      return pulseq_asm_error(a, "expected a register for", mnemonic);
+    break;
+  case PULSEQ_ASM_REG_ADDR:
+    if(n != 2 || pulseq_asm_reg(a, opnd[0], &reg) < 0)
+      return pulseq_asm_error(a, "expected a register and an address for", mnemonic);
+    sym = pulseq_asm_symbol(a, opnd[1]);
+    if(sym && !sym->is_param)
+      x = (uint64_t)sym->value;
+    else if(pulseq_asm_hex(a, opnd[1], &x) < 0)
+      return -1;
+    break;
+  case PULSEQ_ASM_ADDR:
+    if(n != 1 || pulseq_asm_hex(a, opnd[0], &x) < 0)
+      return pulseq_asm_error(a, "expected an address for", mnemonic);
+    break;
+  case PULSEQ_ASM_DELAY:
+    if(n != 2 || pulseq_asm_reg(a, opnd[0], &reg) < 0 || pulseq_asm_expr(a, opnd[1], &v) < 0)
+      return pulseq_asm_error(a, "expected a register and a delay for", mnemonic);
+    v = floor(v * (1/PULSEQ_ASM_US_PER_CYCLE));
+    if(v < 0 || v > PULSEQ_ASM_MAX_DELAY)
+      return pulseq_asm_error(a, "delay out of range:", opnd[1]);
+    x = (uint64_t)v;
+    break;
+  case PULSEQ_ASM_CONST:
+    if(n != 1 || pulseq_asm_expr(a, opnd[0], &v) < 0)
+      return pulseq_asm_error(a, "expected a constant for", mnemonic);
+    v = floor(v);
+    if(v < 0 || v > PULSEQ_ASM_MAX_DELAY)
+      return pulseq_asm_error(a, "constant out of range:", opnd[0]);
+    x = (uint64_t)v;
+    break;
+  }
+  if(op->format == PULSEQ_ASM_DELAY || op->format == PULSEQ_ASM_CONST)
+    words[1] = PULSEQ_HI_B(op->op, reg, x);
+  else
+    words[1] = PULSEQ_HI_A(op->op, reg);
+  words[0] = (uint32_t)x;
+  return 0;
+}
+
+static inline int pulseq_asm_label(pulseq_asm_t *a, const char *name, uint32_t pc)
+{
+  pulseq_asm_label_t *l;
+
+  if(a->labels.n == PULSEQ_ASM_MAX_LABELS)
+    return pulseq_asm_error(a, "too many labels at", name);
+  if(pulseq_asm_define(a, name, 0, pc) < 0)
+    return -1;
+  l = &a->labels.label[a->labels.n++];
+  strcpy(l->name, name);
+  l->addr = pc;
+  return 0;
+}
+
+/*
+  One pass over the source. The first pass (words NULL) collects the
+  variables and PARAMs, the second encodes. Returns the number of words.
+*/
+static inline int pulseq_asm_pass(pulseq_asm_t *a, const char *src, uint32_t len, uint32_t *words, uint32_t max_words)
+{
+  char buf[PULSEQ_ASM_MAX_LINE], *line, *eq, *rest, *opnd[PULSEQ_ASM_MAX_OPERANDS];
+  const char *p = src, *e = src + len, *nl;
+  uint32_t pc = 0, n;
+  uint64_t x;
+  double v;
+
+  for(a->line = 1; p < e; a->line++, p = nl + 1) {
+    nl = memchr(p, '\n', e - p);
+    if(!nl)
+      nl = e;
+    n = nl - p;
+    if(n >= sizeof(buf))
+      return pulseq_asm_error(a, "line too long", "");
+    memcpy(buf, p, n);
+    buf[n] = 0;
+    if((line = strstr(buf, "//")))
+      *line = 0;
+    line = pulseq_asm_trim(buf);
+    if(!*line)
+      continue;
+
+    for(rest = line; *rest && *rest != ':' && *rest != '=' && !isspace((unsigned char)*rest); rest++);
+    if(*rest == ':') {
+      *rest++ = 0;
+      if(!words && pulseq_asm_label(a, line, pc) < 0)
+        return -1;
+      line = pulseq_asm_trim(rest);
+      if(!*line || strchr(line, '='))
+        return pulseq_asm_error(a, "a label has to be on an instruction:", line);
+    }
+
+    if(strncmp(line, "PARAM", 5) == 0 && isspace((unsigned char)line[5])) {
+      if(words)
+        continue;
+      if(pulseq_asm_operands(line + 5, opnd) != 2 || pulseq_asm_expr(a, opnd[1], &v) < 0)
+        return pulseq_asm_error(a, "expected PARAM name, value", "");
+      if(pulseq_asm_define(a, opnd[0], 1, v) < 0)
+        return -1;
+      continue;
+    }
+
+    if(2*pc + 2 > max_words)
+      return pulseq_asm_error(a, "program too long", "");
+    if((eq = strchr(line, '='))) {
+      *eq = 0;
+      if(!words) {
+        if(pulseq_asm_define(a, pulseq_asm_trim(line), 0, pc) < 0)
+          return -1;
+      }
+      else {
+        if(pulseq_asm_var_value(a, eq+1, &x) < 0)
+          return -1;
+        words[2*pc] = (uint32_t)x;
+        words[2*pc+1] = (uint32_t)(x >> 32);
+      }
+    }
+    else if(words) {
+      for(rest = line; *rest && !isspace((unsigned char)*rest); rest++);
+      if(*rest)
+        *rest++ = 0;
+      if(pulseq_asm_instr(a, line, rest, &words[2*pc]) < 0)
+        return -1;
+    }
+    pc++;
+  }
+  return 2*pc;
+}
+
+/*
+  Assemble src with the parameters p (NULL for the PARAM defaults) into
+  words, the rest of words up to max_words is cleared. Returns the number of
+  words of the program, or -1 with *line set to the line of the error.
+  The labels of the program go to labels if it is not NULL.
+*/
+static inline int pulseq_asm_assemble(const char *src, uint32_t len, const pulseq_asm_params_t *p,
+                                      uint32_t *words, uint32_t max_words, pulseq_asm_labels_t *labels, int *line)
+{
+  static pulseq_asm_t a;
+  int n;
+
+  memset(&a, 0, sizeof(a));
+  a.params = p;
+  n = pulseq_asm_pass(&a, src, len, NULL, max_words);
+  if(n >= 0) {
+    memset(words, 0, 4*max_words);
+    n = pulseq_asm_pass(&a, src, len, words, max_words);
+  }
+  if(line)
+    *line = n < 0 ? a.line : 0;
+  if(labels && n >= 0)
+    *labels = a.labels;
+  return n;
+}
+
+static inline uint64_t pulseq_asm_hash(uint64_t h, const void *data, uint32_t len)
+{
+  const uint8_t *b = data;
+  uint32_t i;
+
+  for(i = 0; i < len; i++) {
+    h ^= b[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+static inline uint64_t pulseq_asm_key(const char *src, uint32_t len, const pulseq_asm_params_t *p)
+{
+  uint64_t h = pulseq_asm_hash(0xcbf29ce484222325ull, src, len);
+  uint32_t i;
+
+  for(i = 0; p && i < p->n; i++) {
+    h = pulseq_asm_hash(h, p->param[i].name, strlen(p->param[i].name) + 1);
+    h = pulseq_asm_hash(h, &p->param[i].value, sizeof(p->param[i].value));
+  }
+  return h;
+}
+
+static inline void pulseq_asm_cache_init(pulseq_asm_cache_t *c)
+{
+  memset(c, 0, sizeof(*c));
+}
+
+/*
+  The image of src with the parameters p, assembled unless it is in the
+  cache; the least recently used image makes room for it. Returns NULL with
+  *line set when the source does not assemble.
+*/
+static inline const pulseq_asm_image_t *pulseq_asm_cached(pulseq_asm_cache_t *c, const char *src, uint32_t len,
+                                                          const pulseq_asm_params_t *p, int *line)
+{
+  uint64_t key = pulseq_asm_key(src, len, p);
+  pulseq_asm_image_t *img, *lru = &c->image[0];
+  uint32_t i;
+  int n;
+
+  for(i = 0; i < PULSEQ_ASM_CACHE_IMAGES; i++) {
+    img = &c->image[i];
+    if(img->used && img->key == key) {
+      img->used = ++c->stamp;
+      c->hits++;
+      if(line)
+        *line = 0;
+      return img;
+    }
+    if(img->used < lru->used)
+      lru = img;
+  }
+  c->misses++;
+  n = pulseq_asm_assemble(src, len, p, lru->words, PULSEQ_UPLOAD_WORDS, &lru->labels, line);
+  if(n < 0) {
+    lru->used = 0;
+    return NULL;
+  }
+  lru->key = key;
+  lru->nwords = n;
+  lru->used = ++c->stamp;
+  return lru;
+}
+
+/*
+  Set the delay of the PR labelled name to us in the program, in the upload
+  and in the sequence memory (NULL to leave it), the sequencer has to be
+  stopped. Returns -1 if there is no such PR or the delay is out of range.
+*/
+static inline int pulseq_asm_patch_delay(const pulseq_asm_labels_t *labels, const char *name, double us,
+                                         uint32_t *upload, pulseq_mem_t *seq_mem)
+{
+  uint32_t i, addr, hi;
+  double cycles;
+
+  for(i = 0; i < labels->n; i++)
+    if(strcmp(labels->label[i].name, name) == 0)
+      break;
+  if(i == labels->n) {
+    printf("Assembler: no label %s\n", name);
+    return -1;
+  }
+  addr = labels->label[i].addr;
+  hi = upload[2*addr+1];
+  cycles = floor(us * (1/PULSEQ_ASM_US_PER_CYCLE));
+  if(PULSEQ_OP(hi) != PULSEQ_PR) {
+    printf("Assembler: %s is not a PR\n", name);
+    return -1;
+  }
+  if(cycles < 0 || cycles > PULSEQ_ASM_MAX_DELAY) {
+    printf("Assembler: delay %g us of %s out of range\n", us, name);
+    return -1;
+  }
+  upload[2*addr] = (uint32_t)(uint64_t)cycles;
+  upload[2*addr+1] = PULSEQ_HI_B(PULSEQ_PR, PULSEQ_REG_B(hi), (uint64_t)cycles);
+  if(seq_mem) {
+    pulseq_mem_write(seq_mem, 2*addr, upload[2*addr]);
+    pulseq_mem_write(seq_mem, 2*addr+1, upload[2*addr+1]);
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,281 @@
+/*
+  Cycle-accurate emulator of the micro sequencer.
+
+  Runs a program image the way HDL/cores/micro_sequencer_v1_0 does and lists
+  the edges of the output bits (TX_PULSE, RX_PULSE, GRAD_PULSE, TX_GATE,
+  RX_GATE) and the offset changes in sequencer clock cycles (7 ns), so how
+  long a program runs and how long each gate is open is known without the
+  hardware. The state machine has no pipeline; taken from the Verilog:
+
+    every instruction   Fetch, WaitForFetch, MemAccess3, WaitForFetch2,
+                        Decode, Execute, MemAccess, MemAccess2, WriteBack:
+                        9 cycles, cycle 0 is the Fetch
+    PR                  sets the output register in Execute, the outputs
+                        change at cycle 6; then stalls delay+1 cycles
+    TXOFFSET/GRADOFFSET take bits 15:0 in WriteBack, from cycle 9
+    HALT                Halted from cycle 6, the outputs keep their state
+    BTR                 stays in Execute, the sequencer hangs
+    RET, PI, others     not decoded, they run like NOP
+
+  Time 0 is the first Fetch, one clock after the start bit is seen. The
+  outputs are all 0 from the stop of the last run (RX_PULSE low: the
+  receiver runs), the offsets are 0. Like the hardware the registers other
+  than R0 keep their values from one run to the next. A PR delay is
+  accounted in one step, so a run costs a few ns per instruction whatever
+  its length.
+*/
+#ifndef PULSEQ_EMU_H
+#define PULSEQ_EMU_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "pulseq.h"
+
+#define PULSEQ_EMU_OUTPUTS      8       // output bits 7:0 are followed
+#define PULSEQ_EMU_GATES        (PULSEQ_TX_PULSE | PULSEQ_RX_PULSE | PULSEQ_GRAD_PULSE | PULSEQ_TX_GATE | PULSEQ_RX_GATE)
+#define PULSEQ_EMU_OUT_CYCLE    PULSEQ_OUT_CYCLES   // from the Fetch of a PR to the change of the outputs
+#define PULSEQ_EMU_HALT_CYCLE   PULSEQ_OUT_CYCLES   // from the Fetch of a HALT to the Halted state
+#define PULSEQ_EMU_NEVER        UINT64_MAX          // first_rise of a bit that stayed 0
+#define PULSEQ_EMU_OFFSET_CYCLE 9       // from the Fetch of a TXOFFSET/GRADOFFSET to the new offset
+
+enum {
+  PULSEQ_EMU_HALTED = 0,
+  PULSEQ_EMU_HUNG = -1,                 // BTR
+  PULSEQ_EMU_RUNAWAY = -2               // no HALT within PULSEQ_MAX_STEPS instructions
+};
+
+enum {
+  PULSEQ_EMU_EV_OUTPUTS,                // outputs changed
+  PULSEQ_EMU_EV_TXOFFSET,
+  PULSEQ_EMU_EV_GRADOFFSET,
+  PULSEQ_EMU_EV_HALT
+};
+
+typedef struct {
+  uint64_t cycle;           // from the first Fetch
+  uint16_t pc;              // instruction that caused it
+  uint8_t type;             // PULSEQ_EMU_EV_*
+  uint8_t outputs;          // output bits 7:0 from cycle on
+  uint32_t value;           // the offset of PULSEQ_EMU_EV_*OFFSET
+} pulseq_emu_event_t;
+
+typedef struct {
+  uint64_t R[32];
+  uint64_t pulse;           // output register
+  uint32_t tx_offset;
+  uint32_t grad_offset;
+
+  // last run
+  uint64_t cycles;          // from the first Fetch to the Halted state
+  uint64_t instructions;
+  uint64_t high[PULSEQ_EMU_OUTPUTS];  // cycles each output bit was 1 up to the HALT
+  uint64_t first_rise[PULSEQ_EMU_OUTPUTS];  // cycle each output bit first went to 1
+  uint64_t longest[PULSEQ_EMU_OUTPUTS];     // longest time each output bit stayed 1
+  uint32_t n_events;        // also those that did not fit into the list
+
+  // all runs since pulseq_emu_init()
+  uint32_t runs;
+  uint64_t total_cycles;
+  uint64_t total_high[PULSEQ_EMU_OUTPUTS];
+} pulseq_emu_t;
+
+static inline void pulseq_emu_init(pulseq_emu_t *e)
+{
+  memset(e, 0, sizeof(*e));
+}
+
+static inline void pulseq_emu_event(pulseq_emu_t *e, pulseq_emu_event_t *ev, uint32_t max,
+                                    uint64_t cycle, uint32_t pc, int type, uint32_t value)
+{
+  if(e->n_events < max) {
+    ev[e->n_events].cycle = cycle;
+    ev[e->n_events].pc = (uint16_t)pc;
+    ev[e->n_events].type = (uint8_t)type;
+    ev[e->n_events].outputs = (uint8_t)e->pulse;
+    ev[e->n_events].value = value;
+  }
+  e->n_events++;
+}
+
+// add the time since the last change of the outputs to the high times
+static inline void pulseq_emu_account(pulseq_emu_t *e, uint64_t *since, uint64_t cycle)
+{
+  int b;
+
+  for(b = 0; b < PULSEQ_EMU_OUTPUTS; b++)
+    if((e->pulse >> b) & 1)
+      e->high[b] += cycle - *since;
+  *since = cycle;
+}
+
+// the outputs change to pulse at cycle, rise holds the cycle each bit went to 1
+static inline void pulseq_emu_edges(pulseq_emu_t *e, uint64_t *rise, uint64_t cycle, uint64_t pulse)
+{
+  int b, was, is;
+
+  for(b = 0; b < PULSEQ_EMU_OUTPUTS; b++) {
+    was = (e->pulse >> b) & 1;
+    is = (pulse >> b) & 1;
+    if(!was && is) {
+      rise[b] = cycle;
+      if(e->first_rise[b] == PULSEQ_EMU_NEVER)
+        e->first_rise[b] = cycle;
+    }
+    else if(was && !is && cycle - rise[b] > e->longest[b])
+      e->longest[b] = cycle - rise[b];
+  }
+}
+
+/*
+  Run prog (nwords 32 bit words, the memory past them reads 0) from a start
+  of the sequencer to its HALT. The events go to ev, up to max of them
+  (ev may be NULL with max 0). Returns PULSEQ_EMU_HALTED, PULSEQ_EMU_HUNG or
+  PULSEQ_EMU_RUNAWAY; e->cycles is the length of the run up to there.
+*/
+static inline int pulseq_emu_run(pulseq_emu_t *e, const uint32_t *prog, uint32_t nwords,
+                                 pulseq_emu_event_t *ev, uint32_t max)
+{
+  uint64_t t = 0, since = 0, rise[PULSEQ_EMU_OUTPUTS];
+  uint32_t pc = 0, lo, hi, addr, a, b;
+  int status = PULSEQ_EMU_RUNAWAY;
+  int b_out;
+
+  e->R[0] = 0;
+  e->pulse = 0;
+  e->tx_offset = 0;
+  e->grad_offset = 0;
+  e->instructions = 0;
+  e->n_events = 0;
+  for(b_out = 0; b_out < PULSEQ_EMU_OUTPUTS; b_out++) {
+    e->high[b_out] = 0;
+    e->first_rise[b_out] = PULSEQ_EMU_NEVER;
+    e->longest[b_out] = 0;
+    rise[b_out] = 0;
+  }
+
+  while(e->instructions < PULSEQ_MAX_STEPS) {
+    lo = 2*pc+1 < nwords ? prog[2*pc] : 0;
+    hi = 2*pc+1 < nwords ? prog[2*pc+1] : 0;
+    addr = PULSEQ_ADDR(lo);
+    a = PULSEQ_REG_A(hi);
+    b = PULSEQ_REG_B(hi);
+    e->instructions++;
+
+    switch(PULSEQ_OP(hi)) {
+    case PULSEQ_LD64:
+      e->R[a] = 2*addr+1 < nwords ? ((uint64_t)prog[2*addr+1] << 32) | prog[2*addr] : 0;
+      break;
+    case PULSEQ_DEC:
+      e->R[a]--;
+      break;
+    case PULSEQ_INC:
+      e->R[a]++;
+      break;
+    case PULSEQ_TXOFFSET:
+      e->tx_offset = lo & 0xffff;
+      pulseq_emu_event(e, ev, max, t + PULSEQ_EMU_OFFSET_CYCLE, pc, PULSEQ_EMU_EV_TXOFFSET, e->tx_offset);
+      break;
+    case PULSEQ_GRADOFFSET:
+      e->grad_offset = lo & 0xffff;
+      pulseq_emu_event(e, ev, max, t + PULSEQ_EMU_OFFSET_CYCLE, pc, PULSEQ_EMU_EV_GRADOFFSET, e->grad_offset);
+      break;
+    case PULSEQ_JNZ:
+      if(e->R[a]) {
+        pc = addr;
+        t += PULSEQ_INSTR_CYCLES;
+        continue;
+      }
+      break;
+    case PULSEQ_J:
+      pc = addr;
+      t += PULSEQ_INSTR_CYCLES;
+      continue;
+    case PULSEQ_BTR:
+      t += PULSEQ_EXEC_CYCLES;
+      status = PULSEQ_EMU_HUNG;
+      goto out;
+    case PULSEQ_HALT:
+      t += PULSEQ_EMU_HALT_CYCLE;
+      pulseq_emu_account(e, &since, t);
+      pulseq_emu_edges(e, rise, t, 0);
+      pulseq_emu_event(e, ev, max, t, pc, PULSEQ_EMU_EV_HALT, 0);
+      status = PULSEQ_EMU_HALTED;
+      goto out;
+    case PULSEQ_PR:
+      if((uint8_t)e->R[b] != (uint8_t)e->pulse) {
+        pulseq_emu_account(e, &since, t + PULSEQ_EMU_OUT_CYCLE);
+        pulseq_emu_edges(e, rise, t + PULSEQ_EMU_OUT_CYCLE, e->R[b]);
+        e->pulse = e->R[b];
+        pulseq_emu_event(e, ev, max, t + PULSEQ_EMU_OUT_CYCLE, pc, PULSEQ_EMU_EV_OUTPUTS, 0);
+      }
+      e->pulse = e->R[b];
+      t += PULSEQ_DELAY(hi, lo) + 1;
+      break;
+    default: // NOP, RET, PI and what the sequencer does not decode
+      break;
+    }
+    pc = (pc + 1) & (PULSEQ_MEMORY_WORDS/2 - 1);
+    t += PULSEQ_INSTR_CYCLES;
+  }
+out:
+  if(status != PULSEQ_EMU_HALTED)
+    pulseq_emu_account(e, &since, t);
+  e->cycles = t;
+  e->runs++;
+  e->total_cycles += t;
+  for(b_out = 0; b_out < PULSEQ_EMU_OUTPUTS; b_out++)
+    e->total_high[b_out] += e->high[b_out];
+  return status;
+}
+
+/*
+  Fraction of the last run the output bit (PULSEQ_TX_GATE, ...) was 1
+*/
+static inline double pulseq_emu_duty(const pulseq_emu_t *e, uint32_t bit)
+{
+  int b;
+
+  for(b = 0; b < PULSEQ_EMU_OUTPUTS && !((bit >> b) & 1); b++);
+  if(b == PULSEQ_EMU_OUTPUTS || e->cycles == 0)
+    return 0.0;
+  return (double)e->high[b] / e->cycles;
+}
+
+/*
+  First cycle at which the output bit (PULSEQ_GRAD_PULSE, ...) goes to 1 in
+  a run of prog from a fresh sequencer. Returns -1 if it does not before the
+  HALT, -2 if the run does not halt.
+*/
+static inline int64_t pulseq_emu_first_rise(const uint32_t *prog, uint32_t nwords, uint32_t bit)
+{
+  pulseq_emu_t e;
+  int b;
+
+  for(b = 0; b < PULSEQ_EMU_OUTPUTS && !((bit >> b) & 1); b++);
+  pulseq_emu_init(&e);
+  if(pulseq_emu_run(&e, prog, nwords, NULL, 0) != PULSEQ_EMU_HALTED)
+    return -2;
+  if(b == PULSEQ_EMU_OUTPUTS || e.first_rise[b] == PULSEQ_EMU_NEVER)
+    return -1;
+  return (int64_t)e.first_rise[b];
+}
+
+/*
+  Longest time in cycles the output bit stays 1 in a run of prog from a
+  fresh sequencer, counted up to the HALT; 0 if it never is, -2 if the run
+  does not halt.
+*/
+static inline int64_t pulseq_emu_longest_high(const uint32_t *prog, uint32_t nwords, uint32_t bit)
+{
+  pulseq_emu_t e;
+  int b;
+
+  for(b = 0; b < PULSEQ_EMU_OUTPUTS && !((bit >> b) & 1); b++);
+  pulseq_emu_init(&e);
+  if(pulseq_emu_run(&e, prog, nwords, NULL, 0) != PULSEQ_EMU_HALTED)
+    return -2;
+  return b == PULSEQ_EMU_OUTPUTS ? 0 : (int64_t)e.longest[b];
+}
+
+#endif
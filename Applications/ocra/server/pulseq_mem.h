@@ -0,0 +1,103 @@
+/*
+  Sequence memory with a shadow copy.
+
+  The servers copied a fixed 200 words of the upload into the sequence BRAM
+  on every load, whatever the client sent and whatever the BRAM held. The
+  BRAM holds 1024 instructions (BRAM_ADDR_WIDTH = 10 in micro_sequencer.v),
+  pulseq_mem_t keeps a copy of what it holds and a load writes only the
+  words that differ from the copy: reloading the same program, or one with
+  a delay changed, costs a few writes instead of the whole program.
+
+  Everything that writes the BRAM goes through pulseq_mem_load() or
+  pulseq_mem_write(); code that writes it directly calls
+  pulseq_mem_invalidate(), the next load then writes the whole BRAM.
+*/
+#ifndef PULSEQ_MEM_H
+#define PULSEQ_MEM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pulseq.h"
+
+typedef struct {
+  volatile uint32_t *bram;
+  uint32_t shadow[PULSEQ_MEMORY_WORDS];  // what bram holds, when valid
+  int valid;
+  uint32_t nwords;          // up to the last non-zero word loaded
+  uint32_t written;         // words written by the last load
+} pulseq_mem_t;
+
+static inline void pulseq_mem_init(pulseq_mem_t *m, volatile uint32_t *bram)
+{
+  memset(m, 0, sizeof(*m));
+  m->bram = bram;
+}
+
+static inline void pulseq_mem_invalidate(pulseq_mem_t *m)
+{
+  m->valid = 0;
+}
+
+/*
+  Load the program words[0..nwords), the rest of the BRAM is cleared.
+  Returns the number of words written.
+*/
+static inline uint32_t pulseq_mem_load(pulseq_mem_t *m, const uint32_t *words, uint32_t nwords)
+{
+  uint32_t i, end, w;
+
+  if(nwords > PULSEQ_MEMORY_WORDS)
+    nwords = PULSEQ_MEMORY_WORDS;
+  end = m->valid ? (nwords > m->nwords ? nwords : m->nwords) : PULSEQ_MEMORY_WORDS;
+  m->written = 0;
+  for(i = 0; i < end; i++) {
+    w = i < nwords ? words[i] : 0;
+    if(m->valid && m->shadow[i] == w)
+      continue;
+    m->bram[i] = w;
+    m->shadow[i] = w;
+    m->written++;
+  }
+  while(nwords > 0 && words[nwords-1] == 0)
+    nwords--;
+  m->nwords = nwords;
+  m->valid = 1;
+  return m->written;
+}
+
+static inline uint32_t pulseq_mem_read(pulseq_mem_t *m, uint32_t i)
+{
+  return m->valid ? m->shadow[i] : m->bram[i];
+}
+
+static inline void pulseq_mem_write(pulseq_mem_t *m, uint32_t i, uint32_t w)
+{
+  m->bram[i] = w;
+  m->shadow[i] = w;
+  if(m->valid && w && i >= m->nwords)
+    m->nwords = i+1;
+}
+
+/*
+  The nbytes of an upload (little endian words) into upload, which holds
+  PULSEQ_UPLOAD_WORDS, the rest cleared. An upload that does not fit leaves
+  upload as it was. Returns the number of words or -1.
+*/
+static inline int pulseq_upload_words(uint32_t *upload, const void *bytes, int nbytes)
+{
+  const uint8_t *b = (const uint8_t *)bytes;
+  int i;
+
+  if(nbytes < 0 || nbytes > 4*PULSEQ_UPLOAD_WORDS || (nbytes & 3)) {
+    printf("Sequence upload of %d bytes, at most %d whole words fit\n", nbytes, PULSEQ_UPLOAD_WORDS);
+    return -1;
+  }
+  memset(upload, 0, 4*PULSEQ_UPLOAD_WORDS);
+  for(i = 0; i < nbytes/4; i++)
+    upload[i] = ((uint32_t)b[4*i+3]<<24) | ((uint32_t)b[4*i+2]<<16) | ((uint32_t)b[4*i+1]<<8) | b[4*i];
+  return nbytes/4;
+}
+
+#endif
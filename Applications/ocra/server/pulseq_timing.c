@@ -0,0 +1,178 @@
+/*
+  Offline timing of a pulse sequence.
+
+  Assembles a sequence source (as assembler.py, PARAMs set with -p) and runs
+  it on the emulator of pulseq_emu.h: prints the edges of the gates, the
+  length of one run and how long each gate is open. With -n the sequence is
+  run that many times, one run per TR as the scan loop starts it, and -g adds
+  the time between the HALT and the next start (the TR minus the run); the
+  scan duration and the gate duty cycles over the scan follow.
+
+  e.g.  gcc -O2 -I. pulseq_timing.c -o pulseq_timing -lm
+        ./pulseq_timing -n 4096 -g 300000 ../sequence/sig/se_sig.txt
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "pulseq_asm.h"
+#include "pulseq_emu.h"
+
+#define TIMING_MAX_EVENTS 4096
+
+static const struct {
+  uint32_t bit;
+  const char *name;
+} gates[] = {
+  {PULSEQ_TX_PULSE, "TX_PULSE"},
+  {PULSEQ_RX_PULSE, "RX_PULSE"},
+  {PULSEQ_GRAD_PULSE, "GRAD_PULSE"},
+  {PULSEQ_TX_GATE, "TX_GATE"},
+  {PULSEQ_RX_GATE, "RX_GATE"},
+};
+
+#define N_GATES (sizeof(gates)/sizeof(gates[0]))
+
+static pulseq_emu_event_t events[TIMING_MAX_EVENTS];
+static uint32_t words[PULSEQ_UPLOAD_WORDS];
+
+static double cycles_us(uint64_t cycles)
+{
+  return cycles / PULSEQ_CLOCK_MHZ;
+}
+
+static void print_events(const pulseq_emu_t *e)
+{
+  uint32_t i, g, n = e->n_events < TIMING_MAX_EVENTS ? e->n_events : TIMING_MAX_EVENTS;
+  uint8_t prev = 0, changed;
+
+  printf("%12s %14s %5s  event\n", "cycle", "us", "pc");
+  for(i = 0; i < n; i++) {
+    printf("%12llu %14.3f %5u  ", (unsigned long long)events[i].cycle, cycles_us(events[i].cycle), events[i].pc);
+    switch(events[i].type) {
+    case PULSEQ_EMU_EV_OUTPUTS:
+      changed = events[i].outputs ^ prev;
+      for(g = 0; g < N_GATES; g++)
+        if(changed & gates[g].bit)
+          printf("%s%c ", gates[g].name, events[i].outputs & gates[g].bit ? '+' : '-');
+      if(changed & ~PULSEQ_EMU_GATES)
+        printf("outputs 0x%02x", events[i].outputs);
+      prev = events[i].outputs;
+      break;
+    case PULSEQ_EMU_EV_TXOFFSET:
+      printf("TXOFFSET %u", events[i].value);
+      break;
+    case PULSEQ_EMU_EV_GRADOFFSET:
+      printf("GRADOFFSET %u", events[i].value);
+      break;
+    case PULSEQ_EMU_EV_HALT:
+      printf("HALT");
+      break;
+    }
+    printf("\n");
+  }
+  if(e->n_events > n)
+    printf("... %u more events\n", e->n_events - n);
+}
+
+int main(int argc, char *argv[])
+{
+  pulseq_asm_params_t params;
+  pulseq_asm_labels_t labels;
+  pulseq_emu_t emu;
+  struct timespec t0, t1;
+  uint64_t gap = 0, scan;
+  uint32_t runs = 1, i, g;
+  int opt, quiet = 0, nwords, line = 0, status;
+  char *src;
+  long len;
+  FILE *f;
+  double seconds;
+
+  memset(&params, 0, sizeof(params));
+  while((opt = getopt(argc, argv, "p:n:g:q")) != -1) {
+    switch(opt) {
+    case 'p':
+      if(pulseq_asm_parse_params(&params, optarg, strlen(optarg)) < 0) {
+        printf("Bad parameters \"%s\"\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'n':
+      runs = strtoul(optarg, NULL, 0);
+      break;
+    case 'g':
+      gap = (uint64_t)(atof(optarg) * PULSEQ_CLOCK_MHZ + 0.5);
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      printf("Usage: %s [-p NAME=value;...] [-n runs] [-g us between runs] [-q] sequence.txt\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if(optind >= argc || runs == 0) {
+    printf("Usage: %s [-p NAME=value;...] [-n runs] [-g us between runs] [-q] sequence.txt\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if((f = fopen(argv[optind], "rb")) == NULL) {
+    perror("fopen");
+    return EXIT_FAILURE;
+  }
+  src = malloc(PULSEQ_ASM_MAX_SOURCE);
+  len = fread(src, 1, PULSEQ_ASM_MAX_SOURCE, f);
+  fclose(f);
+  nwords = pulseq_asm_assemble(src, len, &params, words, PULSEQ_UPLOAD_WORDS, &labels, &line);
+  free(src);
+  if(nwords < 0) {
+    printf("%s: assembly failed at line %d\n", argv[optind], line);
+    return EXIT_FAILURE;
+  }
+  printf("%s: %d words\n", argv[optind], nwords);
+
+  pulseq_emu_init(&emu);
+  status = pulseq_emu_run(&emu, words, nwords, events, TIMING_MAX_EVENTS);
+  if(!quiet)
+    print_events(&emu);
+  if(status == PULSEQ_EMU_HUNG)
+    printf("Sequencer hangs at a BTR after %llu cycles\n", (unsigned long long)emu.cycles);
+  else if(status == PULSEQ_EMU_RUNAWAY)
+    printf("No HALT within %d instructions\n", PULSEQ_MAX_STEPS);
+  if(status != PULSEQ_EMU_HALTED)
+    return EXIT_FAILURE;
+
+  printf("Run: %llu cycles, %.3f us, %llu instructions\n",
+         (unsigned long long)emu.cycles, cycles_us(emu.cycles), (unsigned long long)emu.instructions);
+  for(g = 0; g < N_GATES; g++)
+    printf("\t%-10s %12.3f us  %6.2f %%\n", gates[g].name,
+           cycles_us(emu.high[__builtin_ctz(gates[g].bit)]), 100.0 * pulseq_emu_duty(&emu, gates[g].bit));
+
+  if(runs == 1)
+    return EXIT_SUCCESS;
+
+  // the registers persist from run to run, as on the board
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for(i = 1; i < runs; i++)
+    if(pulseq_emu_run(&emu, words, nwords, NULL, 0) != PULSEQ_EMU_HALTED) {
+      printf("Run %u does not halt\n", i);
+      return EXIT_FAILURE;
+    }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+
+  scan = emu.total_cycles + (uint64_t)(runs - 1) * gap;
+  printf("Scan: %u runs, %.6f s (%.3f s in the sequencer)\n", runs,
+         cycles_us(scan) * 1e-6, cycles_us(emu.total_cycles) * 1e-6);
+  for(g = 0; g < N_GATES; g++)
+    printf("\t%-10s %12.6f s  %6.2f %%\n", gates[g].name,
+           cycles_us(emu.total_high[__builtin_ctz(gates[g].bit)]) * 1e-6,
+           100.0 * emu.total_high[__builtin_ctz(gates[g].bit)] / scan);
+  printf("Emulated %u runs in %.3f ms\n", runs - 1, seconds * 1e3);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,600 @@
+/*
+  RX acquisition engine shared by the MRI servers.
+
+  One TR is: start the micro sequencer, drain the RX FIFO while the readout
+  is running and send the samples to the client, then halt the sequencer.
+  The FIFO is drained as soon as samples show up in rx_cntr, so a TR takes
+  as long as the pulse program, not a fixed sleep.
+
+  Before every start the program in pulseq_memory is walked (pulseq.h) to find
+  its receive window: the drain only starts in the FIFO reset just before the
+  window, so samples of earlier windows are not sent, and a TR can transfer
+  just the samples of the window instead of RX_SAMPLES_PER_TR.
+
+  With a stream attached (rx_stream.h) the samples are handed to a network
+  thread instead of being sent by the thread that drains the FIFO. With a
+  decimator attached (rx_decimate.h) a TR of nsamples sends nsamples/factor
+  filtered samples. rx->format selects the wire encoding of the samples
+  (rx_format.h), float32 I and Q by default. In version 2 of the protocol
+  (proto.h) every chunk is sent as a data message whose header describes the
+  TR: the first TR after a command (rx_scan_next()) starts a scan,
+  rx_tag_tr() names the line, partition and average of the next TR (its
+  index in the scan otherwise). The same data messages go to the monitor
+  clients (monitor.h) of rx->monitor.
+
+  With live commands attached (live_ctl.h) every TR starts by taking the
+  live commands that wait on the socket: a new frequency is written to
+  rx_freq before the sequencer starts, the other changes stay for the loop
+  that runs the TRs, which ends the scan when rx_aborted().
+
+  A TR ends when the program does: the micro sequencer reports its state in
+  seq_config[RX_SEQ_STATUS] (slv_reg3, inExe in bit 0 and the FSM state in
+  bits 4:1), and rx_tr_stop() waits for the Halted state before it resets
+  the sequencer, at most RX_HALT_MARGIN_US past the end the program walk
+  predicted.
+
+  NOTE: rx_cntr counts 32 bit FIFO words, one complex sample (I and Q as
+  float) is two words and is popped with a single 64 bit read of rx_data.
+*/
+#ifndef RX_ACQUIRE_H
+#define RX_ACQUIRE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "pulseq.h"
+#include "pulseq_mem.h"
+#include "trace.h"
+#include "rx_stream.h"
+#include "rx_decimate.h"
+#include "rx_format.h"
+#include "proto.h"
+#include "monitor.h"
+#include "live_ctl.h"
+
+#define RX_WORDS_PER_SAMPLE   2
+#define RX_ADC_MHZ            125.0   // sample rate is RX_ADC_MHZ/(2*rx_rate) after CIC and FIR
+#define RX_SAMPLES_WINDOW     0       // nsamples for "the receive window of the program"
+#define RX_SAMPLES_MAX        1000000 // largest window sent in one TR
+#define RX_FILTER_MARGIN      16      // samples lost in the filters when the window ends in a reset
+#define RX_SAMPLES_PER_TR     50000   // what the clients read per TR
+#define RX_SEQ_READ_WORDS     200     // read from the BRAM to find the window when there is no rx->mem
+#define RX_SAMPLES_PER_SEND   5000    // samples per send() call
+#define RX_POLL_US            200     // sleep between polls of an empty FIFO (8192 samples last 32 ms at 250 kHz)
+#define RX_TIMEOUT_US         10000000 // give up when no sample arrived for 10 s
+#define RX_RESET_TIMEOUT_US   10000   // wait at most 10 ms for the program to reset the FIFO
+#define RX_SEQ_STATUS         3       // seq_config word with the state of the micro sequencer
+#define RX_SEQ_HALTED         0x0f    // inExe with state Halted (7), 0 while reset or held
+#define RX_HALT_MARGIN_US     10000   // wait for the HALT at most this long past its predicted time
+#define RX_HALT_SPIN_US       200     // poll the state without sleeping from this long before the HALT
+#define RX_HALT_POLL_US       50      // sleep between polls once the HALT is that late
+#define RX_SERVICE_TIMEOUT_US 1000000 // longest wait for a program that can not be walked
+
+#if RX_SAMPLES_PER_SEND > RX_STREAM_BLOCK_SAMPLES || RX_SAMPLES_PER_SEND > RX_DECIM_CHUNK
+#error "a send chunk does not fit in an RX stream block or decimator chunk"
+#endif
+
+typedef struct {
+  volatile uint32_t *seq_config;
+  volatile uint32_t *pulseq_memory;
+  pulseq_mem_t *mem;        // shadow of pulseq_memory, or NULL
+  volatile uint16_t *rx_cntr;
+  volatile uint64_t *rx_data;
+  volatile uint32_t *rx_rate;
+  int sock_client;
+  rx_stream_t *stream;      // NULL sends from the draining thread
+  rx_decimator_t *decim;    // NULL sends every sample
+  uint32_t format;          // RX_FORMAT_*
+  int proto;                // PROTO_VERSION_*
+  proto_data_t meta;        // header of the data messages of the current TR
+  int tagged;               // meta names the next TR, rx_tag_tr()
+  int scan_next;            // the next TR starts a scan, rx_scan_next()
+  monitor_hub_t *monitor;   // viewers that get a copy of the data messages, or NULL
+  live_ctl_t *live;         // changes pushed by the client during a scan, or NULL
+  volatile uint32_t *rx_freq; // NCO of the receiver, for live frequency changes
+  uint32_t poll_us;
+  uint32_t timeout_us;
+  uint32_t holdoff_us;      // from the start of the program to the start of the drain
+  uint32_t window_samples;  // samples in the receive window of the program
+  uint32_t program_us;      // from the start of the program to its HALT, 0 if unknown
+  uint64_t start_us;        // rx_time_us() of the last start of the sequencer
+} rx_engine_t;
+
+static inline uint64_t rx_time_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000ull + (uint64_t)(ts.tv_nsec/1000);
+}
+
+static inline void rx_engine_init(rx_engine_t *rx, volatile uint32_t *seq_config, volatile uint32_t *pulseq_memory,
+                                  volatile uint16_t *rx_cntr, volatile uint64_t *rx_data, volatile uint32_t *rx_rate)
+{
+  rx->seq_config = seq_config;
+  rx->pulseq_memory = pulseq_memory;
+  rx->rx_cntr = rx_cntr;
+  rx->rx_data = rx_data;
+  rx->rx_rate = rx_rate;
+  rx->sock_client = -1;
+  rx->stream = NULL;
+  rx->decim = NULL;
+  rx->format = RX_FORMAT_FLOAT32;
+  rx->proto = PROTO_VERSION_1;
+  memset(&rx->meta, 0, sizeof(rx->meta));
+  rx->tagged = 0;
+  rx->scan_next = 1;
+  rx->monitor = NULL;
+  rx->live = NULL;
+  rx->mem = NULL;
+  rx->rx_freq = NULL;
+  rx->poll_us = RX_POLL_US;
+  rx->timeout_us = RX_TIMEOUT_US;
+  rx->holdoff_us = 0;
+  rx->window_samples = RX_SAMPLES_PER_TR;
+  rx->program_us = 0;
+  rx->start_us = 0;
+}
+
+/*
+  Number of RX samples in the receive window of a program
+*/
+static inline uint32_t rx_window_samples(const pulseq_rx_window_t *win, uint32_t rx_rate)
+{
+  double n = pulseq_cycles_to_us(win->length) * RX_ADC_MHZ / (2.0*rx_rate);
+  if(!win->open)
+    n -= RX_FILTER_MARGIN;
+  if(n < 0)
+    return 0;
+  if(n > RX_SAMPLES_MAX)
+    return RX_SAMPLES_MAX;
+  return (uint32_t)n;
+}
+
+/*
+  Find the receive window of the program in pulseq_memory, walked in the
+  shadow of rx->mem rather than read back from the BRAM. Programs that can
+  not be walked fall back to draining from the first FIFO reset.
+*/
+static inline void rx_sequence_window(rx_engine_t *rx)
+{
+  uint32_t read[RX_SEQ_READ_WORDS];
+  const uint32_t *prog = read;
+  uint32_t nwords = RX_SEQ_READ_WORDS;
+  pulseq_rx_window_t win = {0};
+  uint64_t end;
+  int i;
+
+  if(rx->mem && rx->mem->valid) {
+    prog = rx->mem->shadow;
+    nwords = PULSEQ_MEMORY_WORDS;
+  }
+  else {
+    for(i = 0; i < RX_SEQ_READ_WORDS; i++)
+      read[i] = rx->pulseq_memory[i];
+  }
+  if(pulseq_rx_window(prog, nwords, &win, &end) < 0) {
+    rx->holdoff_us = 0;
+    rx->window_samples = RX_SAMPLES_PER_TR;
+    rx->program_us = 0;
+    return;
+  }
+  rx->holdoff_us = (uint32_t)pulseq_cycles_to_us(win.holdoff);
+  rx->window_samples = rx_window_samples(&win, *rx->rx_rate);
+  rx->program_us = (uint32_t)pulseq_cycles_to_us(end);
+}
+
+/*
+  TR of the program in pulseq_memory followed by recovery_us (tr_sched.h).
+  A program that can not be walked counts as 0 us.
+*/
+static inline uint32_t rx_tr_period_us(rx_engine_t *rx, uint32_t recovery_us)
+{
+  rx_sequence_window(rx);
+  return rx->program_us + recovery_us;
+}
+
+/*
+  Time from the start of the program in pulseq_memory to the last of the
+  nsamples a TR sends (RX_SAMPLES_WINDOW: its receive window)
+*/
+static inline uint32_t rx_acquire_end_us(rx_engine_t *rx, uint32_t nsamples)
+{
+  rx_sequence_window(rx);
+  if(nsamples == RX_SAMPLES_WINDOW)
+    nsamples = rx->window_samples;
+  return rx->holdoff_us + (uint32_t)(nsamples * 2.0 * *rx->rx_rate / RX_ADC_MHZ);
+}
+
+/*
+  Number of complex samples waiting in the RX FIFO
+*/
+static inline uint32_t rx_fifo_samples(rx_engine_t *rx)
+{
+  return *rx->rx_cntr / RX_WORDS_PER_SAMPLE;
+}
+
+/*
+  Pop n complex samples from the RX FIFO into dst.
+  The AXI reader behind rx_data ignores the address inside its 64 kB window, so
+  the reads walk up the window (n <= 8192 fits) and the NEON path pops four
+  samples with one 32 byte burst instead of four separate 64 bit reads.
+*/
+static inline void rx_fifo_read(volatile uint64_t *rx_data, uint64_t *dst, uint32_t n)
+{
+  volatile uint64_t *src = rx_data;
+  uint32_t j;
+#if defined(__arm__) && defined(__ARM_NEON)
+  for(; n >= 4; n -= 4) {
+    __asm__ __volatile__(
+      "vld1.64 {d16-d19}, [%0]!\n\t"
+      "vst1.64 {d16-d19}, [%1]!\n\t"
+      : "+r"(src), "+r"(dst)
+      :
+      : "d16", "d17", "d18", "d19", "memory");
+  }
+#endif
+  for(j = 0; j < n; ++j) dst[j] = src[j];
+}
+
+/*
+  Take the live commands of the client at a TR boundary and apply the
+  frequency. A client that is gone aborts the scan.
+*/
+static inline void rx_live_poll(rx_engine_t *rx)
+{
+  if(!rx->live)
+    return;
+  if(live_poll(rx->live, rx->sock_client, rx->proto) < 0)
+    rx->live->pending |= LIVE_ABORT;
+  if(rx->rx_freq && live_take(rx->live, LIVE_FREQ)) {
+    *rx->rx_freq = (uint32_t)floor(rx->live->freq_hz / 125.0e6 * (1<<30) + 0.5);
+    trace_log(TRACE_LIVE, LIVE_OP_FREQ, rx->live->freq_hz, rx->meta.tr, 0);
+  }
+}
+
+/*
+  The client asked to stop the scan; checked by the loops before every TR
+*/
+static inline int rx_aborted(rx_engine_t *rx)
+{
+  return rx->live && (rx->live->pending & LIVE_ABORT);
+}
+
+/*
+  Start the pulse program and wait for the FIFO reset before its receive window.
+  The receiver is not held in reset while the sequencer is halted (RX_PULSE is
+  inverted), so the FIFO is full of old samples until the program raises
+  RX_PULSE. Without a known window, wait until the count drops before trusting
+  rx_cntr.
+*/
+static inline void rx_tr_start(rx_engine_t *rx)
+{
+  uint16_t stale;
+  uint64_t t0;
+
+  rx_live_poll(rx);
+  rx_sequence_window(rx);
+  trace_log(TRACE_RX_WINDOW, rx->holdoff_us, rx->window_samples, 0, 0);
+  stale = *rx->rx_cntr;
+  rx->seq_config[0] = 0x00000007;
+  rx->start_us = rx_time_us();
+  if(rx->holdoff_us) {
+    usleep(rx->holdoff_us);
+    return;
+  }
+  if(stale == 0)
+    return;
+  t0 = rx_time_us();
+  while(*rx->rx_cntr >= stale) {
+    if(rx_time_us() - t0 > RX_RESET_TIMEOUT_US) {
+      trace_warn(TRACE_RX_STALE, stale/RX_WORDS_PER_SAMPLE, 0, 0, 0);
+      break;
+    }
+  }
+}
+
+static inline int rx_seq_halted(rx_engine_t *rx)
+{
+  return (rx->seq_config[RX_SEQ_STATUS] & 0x1f) == RX_SEQ_HALTED;
+}
+
+/*
+  Wait until the program started at rx->start_us halts, it should after
+  expect_us. Sleeps until just before that, then polls the state; a HALT
+  that is RX_HALT_SPIN_US late is polled with sleeps, so a program that can
+  not be walked does not keep the CPU at the priority of the TR loop.
+  Returns the time of the HALT from the start, or -1 after timeout_us.
+*/
+static inline int64_t rx_wait_halt(rx_engine_t *rx, uint32_t expect_us, uint32_t timeout_us)
+{
+  uint64_t now = rx_time_us();
+
+  if(rx->start_us + expect_us > now + RX_HALT_SPIN_US)
+    usleep(rx->start_us + expect_us - now - RX_HALT_SPIN_US);
+  while(!rx_seq_halted(rx)) {
+    now = rx_time_us();
+    if(now - rx->start_us > timeout_us)
+      return -1;
+    if(now - rx->start_us > expect_us + RX_HALT_SPIN_US)
+      usleep(RX_HALT_POLL_US);
+  }
+  return (int64_t)(rx_time_us() - rx->start_us);
+}
+
+/*
+  End the TR: let the program run to its HALT, then reset the sequencer.
+  A program that can not be walked is stopped right away, as it may never
+  halt.
+*/
+static inline void rx_tr_stop(rx_engine_t *rx)
+{
+  int64_t t;
+
+  if(rx->program_us) {
+    t = rx_wait_halt(rx, rx->program_us, rx->program_us + RX_HALT_MARGIN_US);
+    if(t < 0)
+      trace_warn(TRACE_SEQ_HALT_TIMEOUT, rx->program_us + RX_HALT_MARGIN_US, rx->program_us, 0, 0);
+    else
+      trace_log(TRACE_SEQ_HALT, (int32_t)t, rx->program_us, 0, 0);
+  }
+  rx->seq_config[0] = 0x00000000;
+}
+
+/*
+  Run the program in pulseq_memory to its HALT without receiving, for the
+  service sequences. Returns -1 if it did not halt in time.
+*/
+static inline int rx_seq_run(rx_engine_t *rx)
+{
+  uint32_t timeout_us;
+  int64_t t;
+
+  rx_sequence_window(rx);
+  timeout_us = rx->program_us ? rx->program_us + RX_HALT_MARGIN_US : RX_SERVICE_TIMEOUT_US;
+  rx->seq_config[0] = 0x00000007;
+  rx->start_us = rx_time_us();
+  t = rx_wait_halt(rx, rx->program_us, timeout_us);
+  rx->seq_config[0] = 0x00000000;
+  if(t < 0) {
+    trace_warn(TRACE_SEQ_HALT_TIMEOUT, timeout_us, rx->program_us, 0, 0);
+    return -1;
+  }
+  trace_log(TRACE_SEQ_HALT, (int32_t)t, rx->program_us, 0, 0);
+  return 0;
+}
+
+/*
+  A command arrived, the next TR starts a new scan. Commands that run no
+  TR (offsets, uploads) therefore do not count as scans.
+*/
+static inline void rx_scan_next(rx_engine_t *rx)
+{
+  rx->scan_next = 1;
+  if(rx->live)
+    live_take(rx->live, LIVE_ABORT);  // an abort between scans stops nothing
+}
+
+/*
+  Start a scan, the TRs that follow are numbered from 0
+*/
+static inline void rx_scan_begin(rx_engine_t *rx)
+{
+  rx->scan_next = 0;
+  rx->meta.scan++;
+  rx->meta.tr = 0;
+}
+
+/*
+  End of a scan that was aborted: in version 2 the client gets a REPLY with
+  the number of TRs that were sent, after their samples. Returns 1 if the
+  scan was aborted.
+*/
+static inline int rx_scan_abort_reply(rx_engine_t *rx)
+{
+  uint32_t trs = rx->meta.tr;
+
+  if(!rx_aborted(rx))
+    return 0;
+  live_take(rx->live, LIVE_ABORT);
+  printf("Scan aborted after %u TRs\n", trs);
+  if(rx->stream)
+    rx_stream_flush(rx->stream);
+  if(rx->proto >= PROTO_VERSION_2)
+    proto_send(rx->sock_client, rx->proto, PROTO_MSG_REPLY, &trs, sizeof(trs), NULL, 0);
+  return 1;
+}
+
+/*
+  Phase encoding line, partition and average of the next TR
+*/
+static inline void rx_tag_tr(rx_engine_t *rx, uint32_t line, uint32_t partition, uint32_t average)
+{
+  rx->meta.line = line;
+  rx->meta.partition = partition;
+  rx->meta.average = average;
+  rx->tagged = 1;
+}
+
+static inline void rx_tr_meta_begin(rx_engine_t *rx)
+{
+  if(rx->scan_next)
+    rx_scan_begin(rx);
+  if(!rx->tagged)
+    rx_tag_tr(rx, rx->meta.tr, 0, 0);
+  rx->meta.t_us = rx_time_us();
+  rx->meta.offset = 0;
+  rx->meta.flags = 0;
+}
+
+static inline void rx_tr_meta_end(rx_engine_t *rx)
+{
+  rx->meta.tr++;
+  rx->tagged = 0;
+}
+
+/*
+  The answer to a switch to version 2 of the protocol, also the first
+  message to a monitor client
+*/
+static inline void rx_hello(proto_hello_t *hello)
+{
+  proto_hdr(&hello->hdr, PROTO_MSG_HELLO, sizeof(*hello) - sizeof(hello->hdr));
+  hello->version = PROTO_VERSION_2;
+  hello->samples_per_tr = RX_SAMPLES_PER_TR;
+  hello->formats = (1 << RX_NUM_FORMATS) - 1;
+}
+
+/*
+  Where the next send chunk is filled: a block of the stream, or buffer
+*/
+static inline uint64_t *rx_chunk_begin(rx_engine_t *rx, uint64_t *buffer)
+{
+  return rx->stream ? rx_stream_block(rx->stream) : buffer;
+}
+
+/*
+  Encode the n samples of the chunk from rx_chunk_begin() in rx->format and
+  send them, more is set when further chunks of the same TR follow
+*/
+static inline void rx_chunk_send(rx_engine_t *rx, uint64_t *chunk, uint32_t n, int more)
+{
+  uint32_t bytes = rx_format_encode(rx->format, chunk, n);
+  proto_data_t *hdr = NULL;
+  struct iovec iov[2];
+  struct msghdr msg;
+
+  proto_hdr(&rx->meta.hdr, PROTO_MSG_DATA, sizeof(proto_data_t) - sizeof(proto_hdr_t) + bytes);
+  rx->meta.encoding = rx->format;
+  rx->meta.nsamples = n;
+  if(!more)
+    rx->meta.flags |= PROTO_DATA_LAST;
+  if(rx->monitor)
+    monitor_publish(rx->monitor, &rx->meta, sizeof(proto_data_t), chunk, bytes);
+  if(rx->proto >= PROTO_VERSION_2)
+    hdr = &rx->meta;
+  if(rx->stream) {
+    rx_stream_commit(rx->stream, hdr, sizeof(proto_data_t), bytes, more ? MSG_MORE : 0);
+  }
+  else {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    if(hdr) {
+      iov[msg.msg_iovlen].iov_base = hdr;
+      iov[msg.msg_iovlen++].iov_len = sizeof(proto_data_t);
+    }
+    iov[msg.msg_iovlen].iov_base = chunk;
+    iov[msg.msg_iovlen++].iov_len = bytes;
+    sendmsg(rx->sock_client, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+  }
+  rx->meta.offset += n;
+}
+
+/*
+  Read nread samples from the RX FIFO and send them to the client as they
+  arrive, followed by zeros up to nsamples.
+  Everything rx_cntr reports is read in one go, up to the end of the current
+  send chunk. buffer must hold RX_SAMPLES_PER_SEND samples, with a stream the
+  chunks are filled in its blocks instead. When the FIFO stays
+  empty for timeout_us the rest of the TR is sent as zeros, so the client stays
+  in step. With a decimator the chunks are filled in buffer and filtered into
+  the chunk that is sent.
+  Returns the number of samples actually read from the FIFO.
+*/
+static inline uint32_t rx_drain_samples(rx_engine_t *rx, uint64_t *buffer, uint32_t nread, uint32_t nsamples)
+{
+  uint32_t sent = 0, fill = 0, received = 0;
+  uint32_t avail, chunk, n;
+  uint64_t *dst = NULL, *out;
+  uint64_t start = rx_time_us(), last = start;
+  int timed_out = 0;
+  int decimate = rx->decim != NULL && rx->decim->cur != NULL;
+
+  if(nread > nsamples)
+    nread = nsamples;
+  if(decimate)
+    rx_decimator_reset(rx->decim);
+  rx_tr_meta_begin(rx);
+  while(sent < nsamples) {
+    chunk = nsamples - sent;
+    if(chunk > RX_SAMPLES_PER_SEND)
+      chunk = RX_SAMPLES_PER_SEND;
+    if(dst == NULL)
+      dst = decimate ? buffer : rx_chunk_begin(rx, buffer);
+
+    if(!timed_out && received < nread) {
+      avail = rx_fifo_samples(rx);
+      if(avail == 0) {
+        if(rx_time_us() - last > rx->timeout_us) {
+          trace_warn(TRACE_RX_TIMEOUT, received, nread, 0, 0);
+          timed_out = 1;
+          rx->meta.flags |= PROTO_DATA_TIMEOUT;
+        }
+        else {
+          usleep(rx->poll_us);
+        }
+        continue;
+      }
+      n = chunk - fill;
+      if(n > nread - received)
+        n = nread - received;
+      if(n > avail)
+        n = avail;
+      rx_fifo_read(rx->rx_data, dst+fill, n);
+      fill += n;
+      received += n;
+      last = rx_time_us();
+    }
+    else {
+      memset(dst+fill, 0, (chunk-fill)*sizeof(uint64_t));
+      fill = chunk;
+    }
+
+    if(fill == chunk) {
+      if(decimate) {
+        out = rx_chunk_begin(rx, buffer);   // buffer itself is filtered in place
+        n = rx_decimate(rx->decim, dst, chunk, out);
+        if(n > 0 || rx->stream || rx->proto >= PROTO_VERSION_2)
+          rx_chunk_send(rx, out, n, sent+chunk < nsamples);
+      }
+      else {
+        rx_chunk_send(rx, dst, chunk, sent+chunk < nsamples);
+      }
+      dst = NULL;
+      sent += chunk;
+      fill = 0;
+    }
+  }
+  rx_tr_meta_end(rx);
+  trace_log(TRACE_RX_DRAIN, received, nread, sent, (int32_t)(rx_time_us() - start));
+  return received;
+}
+
+/*
+  Drain nsamples of the current TR into the client socket,
+  RX_SAMPLES_WINDOW sends the receive window of the program.
+*/
+static inline uint32_t rx_tr_drain(rx_engine_t *rx, uint64_t *buffer, uint32_t nsamples)
+{
+  if(nsamples == RX_SAMPLES_WINDOW)
+    nsamples = rx->window_samples;
+  return rx_drain_samples(rx, buffer, nsamples, nsamples);
+}
+
+/*
+  Run one TR: start the sequence, send nsamples to the client and halt
+*/
+static inline uint32_t rx_acquire_tr(rx_engine_t *rx, uint64_t *buffer, uint32_t nsamples)
+{
+  uint32_t received;
+  rx_tr_start(rx);
+  received = rx_tr_drain(rx, buffer, nsamples);
+  rx_tr_stop(rx);
+  return received;
+}
+
+#endif
@@ -0,0 +1,144 @@
+/*
+  On-board averaging of repeated TRs (NEX).
+
+  Instead of sending every repetition of a line and averaging on the client,
+  the repetitions are drained from the RX FIFO into a float accumulator and
+  only the mean is sent, in the same format as one TR (I and Q as float per
+  sample), so the network carries one line per phase encoding step.
+
+  Each repetition is added with a receiver sign, for phase cycling: a
+  repetition whose echo comes out inverted (e.g. the 180y refocusing pulse of
+  EXORCYCLE) is subtracted, and artefacts that do not follow the cycle cancel.
+*/
+#ifndef RX_AVERAGE_H
+#define RX_AVERAGE_H
+
+#include <stdint.h>
+#include <string.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "rx_acquire.h"
+#include "trace.h"
+
+typedef struct {
+  float acc[2*RX_SAMPLES_PER_TR];   // I, Q per sample
+  uint32_t nsamples;
+  uint32_t count;                   // repetitions accumulated
+} rx_average_t;
+
+static inline void rx_average_clear(rx_average_t *avg, uint32_t nsamples)
+{
+  if(nsamples > RX_SAMPLES_PER_TR)
+    nsamples = RX_SAMPLES_PER_TR;
+  memset(avg->acc, 0, 2*nsamples*sizeof(float));
+  avg->nsamples = nsamples;
+  avg->count = 0;
+}
+
+/*
+  acc += sign*x for n complex samples, sign is +1 or -1
+*/
+static inline void rx_average_add(float *acc, const uint64_t *src, uint32_t n, int sign)
+{
+  const float *x = (const float *)src;
+  uint32_t k = 0;
+
+  n *= 2;
+#if defined(__ARM_NEON)
+  if(sign >= 0) {
+    for(; k+4 <= n; k += 4)
+      vst1q_f32(acc+k, vaddq_f32(vld1q_f32(acc+k), vld1q_f32(x+k)));
+  }
+  else {
+    for(; k+4 <= n; k += 4)
+      vst1q_f32(acc+k, vsubq_f32(vld1q_f32(acc+k), vld1q_f32(x+k)));
+  }
+#endif
+  if(sign >= 0)
+    for(; k < n; k++) acc[k] += x[k];
+  else
+    for(; k < n; k++) acc[k] -= x[k];
+}
+
+/*
+  Drain the samples of the running TR into the accumulator with sign.
+  buffer must hold RX_SAMPLES_PER_SEND samples. Samples that do not arrive
+  within timeout_us add nothing. Returns the number of samples read.
+*/
+static inline uint32_t rx_average_drain(rx_engine_t *rx, rx_average_t *avg, uint64_t *buffer, int sign)
+{
+  uint32_t received = 0, avail, n;
+  uint64_t start = rx_time_us(), last = start;
+
+  while(received < avg->nsamples) {
+    avail = rx_fifo_samples(rx);
+    if(avail == 0) {
+      if(rx_time_us() - last > rx->timeout_us) {
+        trace_warn(TRACE_RX_TIMEOUT, received, avg->nsamples, 0, 0);
+        break;
+      }
+      usleep(rx->poll_us);
+      continue;
+    }
+    n = avg->nsamples - received;
+    if(n > avail)
+      n = avail;
+    if(n > RX_SAMPLES_PER_SEND)
+      n = RX_SAMPLES_PER_SEND;
+    rx_fifo_read(rx->rx_data, buffer, n);
+    rx_average_add(avg->acc + 2*received, buffer, n, sign);
+    received += n;
+    last = rx_time_us();
+  }
+  avg->count++;
+  trace_log(TRACE_RX_AVERAGE, avg->count, received, sign, (int32_t)(rx_time_us() - start));
+  return received;
+}
+
+/*
+  Run one repetition: start the sequence, accumulate it with sign and halt
+*/
+static inline uint32_t rx_average_tr(rx_engine_t *rx, rx_average_t *avg, uint64_t *buffer, int sign)
+{
+  uint32_t received;
+  rx_tr_start(rx);
+  received = rx_average_drain(rx, avg, buffer, sign);
+  rx_tr_stop(rx);
+  return received;
+}
+
+/*
+  Send the mean of the accumulated repetitions to the client
+*/
+static inline void rx_average_send(rx_engine_t *rx, rx_average_t *avg, uint64_t *buffer)
+{
+  float scale = avg->count ? 1.0f/avg->count : 0.0f;
+  uint32_t sent = 0, chunk, k;
+  uint64_t *dst;
+  float *f;
+
+  if(!rx->tagged)
+    rx_tag_tr(rx, rx->meta.tr, 0, avg->count);
+  rx_tr_meta_begin(rx);
+  while(sent < avg->nsamples) {
+    chunk = avg->nsamples - sent;
+    if(chunk > RX_SAMPLES_PER_SEND)
+      chunk = RX_SAMPLES_PER_SEND;
+    dst = rx_chunk_begin(rx, buffer);
+    f = (float *)dst;
+    k = 0;
+#if defined(__ARM_NEON)
+    for(; k+4 <= 2*chunk; k += 4)
+      vst1q_f32(f+k, vmulq_n_f32(vld1q_f32(avg->acc + 2*sent + k), scale));
+#endif
+    for(; k < 2*chunk; k++)
+      f[k] = avg->acc[2*sent + k]*scale;
+    rx_chunk_send(rx, dst, chunk, sent+chunk < avg->nsamples);
+    sent += chunk;
+  }
+  rx_tr_meta_end(rx);
+}
+
+#endif
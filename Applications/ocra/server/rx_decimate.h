@@ -0,0 +1,176 @@
+/*
+  Software decimation of the RX samples before they are sent.
+
+  The CIC and FIR of the RX chain run at a fixed rate (rx_rate 250, 250 kHz),
+  so a readout that needs a few kHz of bandwidth still ships every sample.
+  With a decimator attached to the RX engine, rx_drain_samples() low-pass
+  filters the samples of a TR and sends every factor-th one, nsamples/factor
+  per TR instead of nsamples.
+
+  The filter of every factor is a Blackman windowed sinc of
+  RX_DECIM_TAPS_PER_PHASE*factor taps with its cutoff at RX_DECIM_PASSBAND of
+  the output Nyquist frequency, computed once in rx_decimator_init(). It is
+  evaluated as a polyphase filter: only the kept outputs are computed, each
+  as a dot product of the last taps samples with the taps (real taps, I and
+  Q interleaved, four floats per NEON multiply-accumulate). The filter
+  restarts from zeros with every TR.
+*/
+#ifndef RX_DECIMATE_H
+#define RX_DECIMATE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define RX_DECIM_TAPS_PER_PHASE   8
+#define RX_DECIM_MAX_FACTOR       50
+#define RX_DECIM_MAX_TAPS         (RX_DECIM_TAPS_PER_PHASE*RX_DECIM_MAX_FACTOR)
+#define RX_DECIM_PASSBAND         0.9   // cutoff / output Nyquist frequency
+#define RX_DECIM_CHUNK            5000  // RX_SAMPLES_PER_SEND
+
+// factors with a filter bank, they divide RX_SAMPLES_PER_TR and RX_DECIM_CHUNK
+static const uint32_t rx_decim_factors[] = {2, 4, 5, 8, 10, 20, 25, 50};
+#define RX_DECIM_NUM_FACTORS      (sizeof(rx_decim_factors)/sizeof(rx_decim_factors[0]))
+
+typedef struct {
+  uint32_t factor;
+  uint32_t taps;            // even
+  float h[2*RX_DECIM_MAX_TAPS];  // each tap twice, for I and Q
+} rx_fir_bank_t;
+
+typedef struct {
+  rx_fir_bank_t bank[RX_DECIM_NUM_FACTORS];
+  const rx_fir_bank_t *cur; // selected bank
+  uint32_t phase;           // input samples since the last output
+  float work[2*(RX_DECIM_MAX_TAPS + RX_DECIM_CHUNK)];  // taps-1 samples of history, then the chunk
+} rx_decimator_t;
+
+/*
+  Compute the filter banks of all factors, no decimation selected
+*/
+static inline void rx_decimator_init(rx_decimator_t *d)
+{
+  rx_fir_bank_t *b;
+  double fc, x, w, sum;
+  uint32_t i, k;
+
+  for(i = 0; i < RX_DECIM_NUM_FACTORS; i++) {
+    b = &d->bank[i];
+    b->factor = rx_decim_factors[i];
+    b->taps = RX_DECIM_TAPS_PER_PHASE*b->factor;
+    fc = RX_DECIM_PASSBAND*0.5/b->factor;   // cycles per input sample
+    sum = 0;
+    for(k = 0; k < b->taps; k++) {
+      x = k - 0.5*(b->taps-1);
+      w = 0.42 - 0.5*cos(2.0*M_PI*k/(b->taps-1)) + 0.08*cos(4.0*M_PI*k/(b->taps-1));
+      b->h[2*k] = (float)(w*(x == 0 ? 2.0*fc : sin(2.0*M_PI*fc*x)/(M_PI*x)));
+      sum += b->h[2*k];
+    }
+    for(k = 0; k < b->taps; k++) {
+      b->h[2*k] = (float)(b->h[2*k]/sum);   // unity gain at DC
+      b->h[2*k+1] = b->h[2*k];
+    }
+  }
+  d->cur = NULL;
+  d->phase = 0;
+}
+
+/*
+  Select the decimation factor, 1 turns it off.
+  Returns -1 for a factor without a filter bank.
+*/
+static inline int rx_decimator_select(rx_decimator_t *d, uint32_t factor)
+{
+  uint32_t i;
+
+  if(factor <= 1) {
+    d->cur = NULL;
+    return 0;
+  }
+  for(i = 0; i < RX_DECIM_NUM_FACTORS; i++) {
+    if(d->bank[i].factor == factor) {
+      d->cur = &d->bank[i];
+      return 0;
+    }
+  }
+  printf("RX decimation: no filter for factor %u\n", factor);
+  return -1;
+}
+
+static inline uint32_t rx_decimator_factor(const rx_decimator_t *d)
+{
+  return d->cur ? d->cur->factor : 1;
+}
+
+/*
+  Start a new TR: empty history
+*/
+static inline void rx_decimator_reset(rx_decimator_t *d)
+{
+  if(d->cur)
+    memset(d->work, 0, 2*(d->cur->taps-1)*sizeof(float));
+  d->phase = 0;
+}
+
+/*
+  One output sample: the taps samples from x on with the taps of b
+*/
+static inline uint64_t rx_decimator_dot(const rx_fir_bank_t *b, const float *x)
+{
+  float y[2];
+  uint64_t out;
+  uint32_t k = 0;
+#if defined(__ARM_NEON)
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  float32x2_t s;
+  for(; k < 2*b->taps; k += 4)
+    acc = vmlaq_f32(acc, vld1q_f32(x+k), vld1q_f32(b->h+k));
+  s = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+  vst1_f32(y, s);
+#else
+  float acc[4] = {0, 0, 0, 0};
+  for(; k < 2*b->taps; k += 4) {
+    acc[0] += x[k]*b->h[k];
+    acc[1] += x[k+1]*b->h[k+1];
+    acc[2] += x[k+2]*b->h[k+2];
+    acc[3] += x[k+3]*b->h[k+3];
+  }
+  y[0] = acc[0] + acc[2];
+  y[1] = acc[1] + acc[3];
+#endif
+  memcpy(&out, y, sizeof(out));
+  return out;
+}
+
+/*
+  Filter n samples (n <= RX_DECIM_CHUNK) of src and write every factor-th
+  output to dst. Returns the number of samples written.
+*/
+static inline uint32_t rx_decimate(rx_decimator_t *d, const uint64_t *src, uint32_t n, uint64_t *dst)
+{
+  const rx_fir_bank_t *b = d->cur;
+  uint32_t hist, j, nout = 0;
+
+  if(b == NULL) {
+    memcpy(dst, src, n*sizeof(uint64_t));
+    return n;
+  }
+  if(n > RX_DECIM_CHUNK)
+    n = RX_DECIM_CHUNK;
+  hist = b->taps-1;
+  memcpy(d->work + 2*hist, src, n*sizeof(uint64_t));
+  for(j = 0; j < n; j++) {
+    if(++d->phase == b->factor) {
+      dst[nout++] = rx_decimator_dot(b, d->work + 2*j);
+      d->phase = 0;
+    }
+  }
+  memmove(d->work, d->work + 2*n, 2*hist*sizeof(float));
+  return nout;
+}
+
+#endif
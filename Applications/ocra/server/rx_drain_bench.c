@@ -0,0 +1,75 @@
+/*
+  Microbenchmark of the RX FIFO drain.
+
+  Compares the old per-sample loop (5000 volatile reads of *rx_data) with
+  rx_fifo_read() from rx_acquire.h. Without an argument the reads go to a
+  64 kB block of RAM that stands in for the rx_data register window, so the
+  numbers show the CPU side only. With "-m" the real FIFO at 0x40010000 is
+  mapped; run it on the board with the sequencer halted (receiver running).
+
+  e.g.  ./compile.sh rx_drain_bench.c rx_drain_bench && ./rx_drain_bench -m
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "rx_acquire.h"
+
+#define BENCH_CHUNK   5000
+#define BENCH_ROUNDS  2000
+
+static void drain_loop(volatile uint64_t *rx_data, uint64_t *buffer, uint32_t n)
+{
+  uint32_t j;
+  for(j = 0; j < n; ++j) buffer[j] = *rx_data;
+}
+
+static double bench(const char *name, void (*drain)(volatile uint64_t *, uint64_t *, uint32_t),
+                    volatile uint64_t *rx_data, uint64_t *buffer, int rounds)
+{
+  uint64_t t0, t1;
+  double rate;
+  int r;
+
+  t0 = rx_time_us();
+  for(r = 0; r < rounds; ++r)
+    drain(rx_data, buffer, BENCH_CHUNK);
+  t1 = rx_time_us();
+  rate = (double)rounds*BENCH_CHUNK/((t1-t0)*1e-6);
+  printf("%-14s %10.2f Msamples/s\n", name, rate/1e6);
+  return rate;
+}
+
+int main(int argc, char *argv[])
+{
+  volatile uint64_t *rx_data;
+  uint64_t buffer[8192];
+  uint64_t *window;
+  int i, fd, rounds = BENCH_ROUNDS;
+  double old_rate, new_rate;
+
+  if(argc > 1 && strcmp(argv[1], "-m") == 0) {
+    if((fd = open("/dev/mem", O_RDWR)) < 0) {
+      perror("open");
+      return EXIT_FAILURE;
+    }
+    rx_data = (volatile uint64_t *)mmap(NULL, 16*sysconf(_SC_PAGESIZE), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0x40010000);
+    rounds = 20; // the FIFO runs dry quickly, keep this short
+    printf("Draining the RX FIFO at 0x40010000\n");
+  }
+  else {
+    window = (uint64_t *)malloc(65536);
+    for(i = 0; i < 8192; ++i) window[i] = i;
+    rx_data = window;
+    printf("Draining a simulated 64 kB register window\n");
+  }
+
+  old_rate = bench("per-sample", drain_loop, rx_data, buffer, rounds);
+  new_rate = bench("rx_fifo_read", rx_fifo_read, rx_data, buffer, rounds);
+  printf("speedup %.2fx\n", new_rate/old_rate);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,260 @@
+/*
+  Wire formats of the RX samples.
+
+  The samples leave the FIFO as I and Q float32 (8 bytes per sample, read by
+  the clients with np.frombuffer(..., np.complex64)). A client can ask for a
+  compact encoding instead; every send chunk (RX_SAMPLES_PER_SEND samples, or
+  less at the end of a TR) is encoded on its own:
+
+    RX_FORMAT_FLOAT32  n x (float I, float Q)                        8 B/sample
+    RX_FORMAT_INT16    float scale, n x (int16 I, int16 Q),
+                       value = q*scale, scale = max|I,Q|/32767       4 B/sample
+    RX_FORMAT_FLOAT16  n x (half I, half Q), IEEE 754 binary16       4 B/sample
+    RX_FORMAT_BFP      per group of RX_BFP_GROUP samples: int8 exponent e,
+                       RX_BFP_GROUP x (int8 I, int8 Q), value = m*2^e,
+                       the last group padded with zeros         ~2.06 B/sample
+
+  All little endian, like the float stream. A chunk is encoded in place: the
+  output of a sample (or group) is only written after its input has been
+  read, never ahead of input that is still to come. The encoding is shorter
+  than the float32 samples except for a BFP chunk of less than 5 samples,
+  which still fits in a chunk buffer of RX_SAMPLES_PER_SEND. rx_format_decode() is the reference
+  decoder for the clients.
+*/
+#ifndef RX_FORMAT_H
+#define RX_FORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+enum {
+  RX_FORMAT_FLOAT32 = 0,
+  RX_FORMAT_INT16,
+  RX_FORMAT_FLOAT16,
+  RX_FORMAT_BFP,
+  RX_NUM_FORMATS
+};
+
+#define RX_BFP_GROUP          16
+#define RX_BFP_GROUP_BYTES    (1 + 2*RX_BFP_GROUP)
+
+/*
+  Encoded size of n samples
+*/
+static inline uint32_t rx_format_bytes(uint32_t format, uint32_t n)
+{
+  switch(format) {
+  case RX_FORMAT_INT16:   return sizeof(float) + 4*n;
+  case RX_FORMAT_FLOAT16: return 4*n;
+  case RX_FORMAT_BFP:     return (n + RX_BFP_GROUP-1)/RX_BFP_GROUP*RX_BFP_GROUP_BYTES;
+  default:                return 8*n;
+  }
+}
+
+/*
+  Largest |I| or |Q| of n floats
+*/
+static inline float rx_format_maxabs(const float *x, uint32_t n)
+{
+  float m = 0.0f;
+  uint32_t k = 0;
+#if defined(__ARM_NEON)
+  float32x4_t mv = vdupq_n_f32(0.0f);
+  float32x2_t m2;
+  for(; k+4 <= n; k += 4)
+    mv = vmaxq_f32(mv, vabsq_f32(vld1q_f32(x+k)));
+  m2 = vpmax_f32(vget_low_f32(mv), vget_high_f32(mv));
+  m2 = vpmax_f32(m2, m2);
+  m = vget_lane_f32(m2, 0);
+#endif
+  for(; k < n; k++)
+    if(fabsf(x[k]) > m) m = fabsf(x[k]);
+  return m;
+}
+
+static inline int32_t rx_format_round(float v)
+{
+  return (int32_t)(v < 0 ? v - 0.5f : v + 0.5f);
+}
+
+/*
+  float to IEEE half, round to nearest even, overflow to infinity
+*/
+static inline uint16_t rx_float_to_half(float f)
+{
+  uint32_t x, sign, mant;
+  int32_t e;
+
+  memcpy(&x, &f, sizeof(x));
+  sign = (x >> 16) & 0x8000;
+  e = (int32_t)((x >> 23) & 0xff) - 127 + 15;
+  mant = x & 0x7fffff;
+  if(((x >> 23) & 0xff) == 0xff)                  // inf, nan
+    return sign | 0x7c00 | (mant ? 0x200 : 0);
+  if(e >= 31)
+    return sign | 0x7c00;
+  if(e <= 0) {                                    // subnormal or zero
+    if(e < -10)
+      return sign;
+    mant |= 0x800000;
+    x = mant >> (14 - e);
+    if((mant >> (13 - e)) & 1 && ((mant & ((1u << (13 - e)) - 1)) || (x & 1)))
+      x++;
+    return sign | x;
+  }
+  x = ((uint32_t)e << 10) | (mant >> 13);
+  if((mant & 0x1000) && ((mant & 0x2fff) != 0))   // round, ties to even
+    x++;
+  return sign | x;
+}
+
+static inline float rx_half_to_float(uint16_t h)
+{
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16, e = (h >> 10) & 0x1f, mant = h & 0x3ff, x;
+  float f;
+
+  if(e == 0) {
+    f = ldexpf((float)mant, -24);
+    return sign ? -f : f;
+  }
+  if(e == 31)
+    x = sign | 0x7f800000 | (mant << 13);
+  else
+    x = sign | ((e - 15 + 127) << 23) | (mant << 13);
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+static inline uint32_t rx_encode_int16(float *x, uint32_t n)
+{
+  uint8_t *out = (uint8_t *)x;
+  int16_t *q = (int16_t *)(out + sizeof(float));
+  float scale = rx_format_maxabs(x, 2*n)/32767.0f, inv;
+  float head[2] = {x[0], n ? x[1] : 0.0f};  // q[0] overlaps x[1]
+  uint32_t k = 0;
+
+  if(scale == 0.0f)
+    scale = 1.0f;
+  inv = 1.0f/scale;
+#if defined(__ARM_NEON)
+  for(; k+4 <= 2*n; k += 4) {
+    float32x4_t v = vmulq_n_f32(vld1q_f32(x+k), inv);
+    uint32x4_t neg = vcltq_f32(v, vdupq_n_f32(0.0f));
+    v = vaddq_f32(v, vbslq_f32(neg, vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f)));
+    int16x4_t s = vqmovn_s32(vcvtq_s32_f32(v));
+    vst1_s16(q+k, s);   // bytes 4+2k..12+2k, input from 4k+16 on is unread
+  }
+#endif
+  for(; k < 2*n; k++)
+    q[k] = (int16_t)rx_format_round((k < 2 ? head[k] : x[k])*inv);
+  memcpy(out, &scale, sizeof(scale));  // x[0] was read above
+  return rx_format_bytes(RX_FORMAT_INT16, n);
+}
+
+static inline uint32_t rx_encode_float16(float *x, uint32_t n)
+{
+  uint16_t *h = (uint16_t *)x;
+  uint32_t k = 0;
+#if defined(__ARM_NEON) && defined(__ARM_FP) && (__ARM_FP & 2)
+  for(; k+4 <= 2*n; k += 4)
+    vst1_f16((__fp16 *)(h+k), vcvt_f16_f32(vld1q_f32(x+k)));
+#endif
+  for(; k < 2*n; k++)
+    h[k] = rx_float_to_half(x[k]);
+  return rx_format_bytes(RX_FORMAT_FLOAT16, n);
+}
+
+static inline uint32_t rx_encode_bfp(float *x, uint32_t n)
+{
+  uint8_t *out = (uint8_t *)x;
+  int8_t group[RX_BFP_GROUP_BYTES];
+  uint32_t g, k, m, ngroups = (n + RX_BFP_GROUP-1)/RX_BFP_GROUP;
+  float *xg, maxabs, inv;
+  int e;
+
+  for(g = 0; g < ngroups; g++) {
+    xg = x + 2*g*RX_BFP_GROUP;
+    m = 2*(n - g*RX_BFP_GROUP < RX_BFP_GROUP ? n - g*RX_BFP_GROUP : RX_BFP_GROUP);
+    maxabs = rx_format_maxabs(xg, m);
+    // smallest e with maxabs/2^e <= 127
+    e = maxabs > 0 ? (int)ceilf(log2f(maxabs/127.0f)) : 0;
+    if(e < -128) e = -128;
+    if(e > 127) e = 127;
+    inv = ldexpf(1.0f, -e);
+    memset(group, 0, sizeof(group));
+    group[0] = (int8_t)e;
+    k = 0;
+#if defined(__ARM_NEON)
+    for(; k+8 <= m; k += 8) {
+      float32x4_t a = vmulq_n_f32(vld1q_f32(xg+k), inv), b = vmulq_n_f32(vld1q_f32(xg+k+4), inv);
+      a = vaddq_f32(a, vbslq_f32(vcltq_f32(a, vdupq_n_f32(0.0f)), vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f)));
+      b = vaddq_f32(b, vbslq_f32(vcltq_f32(b, vdupq_n_f32(0.0f)), vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f)));
+      int16x8_t s = vcombine_s16(vqmovn_s32(vcvtq_s32_f32(a)), vqmovn_s32(vcvtq_s32_f32(b)));
+      vst1_s8(group+1+k, vqmovn_s16(s));
+    }
+#endif
+    for(; k < m; k++) {
+      int32_t v = rx_format_round(xg[k]*inv);
+      group[1+k] = (int8_t)(v > 127 ? 127 : (v < -128 ? -128 : v));
+    }
+    memcpy(out + g*RX_BFP_GROUP_BYTES, group, RX_BFP_GROUP_BYTES);
+  }
+  return rx_format_bytes(RX_FORMAT_BFP, n);
+}
+
+/*
+  Encode n samples of chunk in place, returns the number of bytes to send
+*/
+static inline uint32_t rx_format_encode(uint32_t format, uint64_t *chunk, uint32_t n)
+{
+  switch(format) {
+  case RX_FORMAT_INT16:   return rx_encode_int16((float *)chunk, n);
+  case RX_FORMAT_FLOAT16: return rx_encode_float16((float *)chunk, n);
+  case RX_FORMAT_BFP:     return rx_encode_bfp((float *)chunk, n);
+  default:                return rx_format_bytes(RX_FORMAT_FLOAT32, n);
+  }
+}
+
+/*
+  Decode the n samples of an encoded chunk into I, Q float pairs
+*/
+static inline void rx_format_decode(uint32_t format, const void *src, uint32_t n, float *dst)
+{
+  const uint8_t *in = (const uint8_t *)src;
+  uint32_t k, g;
+  float scale;
+  int16_t q;
+  uint16_t h;
+
+  switch(format) {
+  case RX_FORMAT_INT16:
+    memcpy(&scale, in, sizeof(scale));
+    for(k = 0; k < 2*n; k++) {
+      memcpy(&q, in + sizeof(float) + 2*k, sizeof(q));
+      dst[k] = q*scale;
+    }
+    break;
+  case RX_FORMAT_FLOAT16:
+    for(k = 0; k < 2*n; k++) {
+      memcpy(&h, in + 2*k, sizeof(h));
+      dst[k] = rx_half_to_float(h);
+    }
+    break;
+  case RX_FORMAT_BFP:
+    for(k = 0; k < 2*n; k++) {
+      g = k/(2*RX_BFP_GROUP);
+      dst[k] = ldexpf((float)(int8_t)in[g*RX_BFP_GROUP_BYTES + 1 + k%(2*RX_BFP_GROUP)],
+                      (int8_t)in[g*RX_BFP_GROUP_BYTES]);
+    }
+    break;
+  default:
+    memcpy(dst, in, 8*n);
+    break;
+  }
+}
+
+#endif
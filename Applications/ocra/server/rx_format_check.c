@@ -0,0 +1,172 @@
+/*
+  Round trip of the RX wire formats of rx_format.h.
+
+  Encodes chunks of test samples in place with rx_format_encode(), decodes
+  them with rx_format_decode() and checks every sample against the error
+  bound of its format (the int16 and BFP ones plus 2^-22 relative for the
+  float rounding of encoder and decoder):
+
+    RX_FORMAT_FLOAT32  exact
+    RX_FORMAT_INT16    half a step, max|I,Q|/32767/2 of the chunk
+    RX_FORMAT_FLOAT16  2^-11 relative, 2^-25 absolute below the normal
+                       halves; infinity with the sign from 65520 on
+    RX_FORMAT_BFP      half a step of the group, at most max|I,Q|/127 of the
+                       group
+
+  The chunks are an FID (a decaying complex exponential with a bit of
+  noise), the same at the level of the ADC noise floor, zeros, one spike in
+  small samples, and samples beyond the range of float16. They are taken at
+  RX_SAMPLES_PER_SEND samples and at short lengths that end in a part of a
+  NEON step or of a BFP group. Built for ARM with NEON the encoders take
+  their NEON paths, otherwise the scalar ones.
+
+  e.g.  gcc -O2 -I. rx_format_check.c -o rx_format_check -lm && ./rx_format_check
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "rx_acquire.h"
+
+#define CHECK_SHOW        4     // mismatches printed per format and signal
+#define CHECK_HALF_INF    65520.0f
+
+enum {
+  SIGNAL_FID,
+  SIGNAL_NOISE_FLOOR,
+  SIGNAL_ZERO,
+  SIGNAL_SPIKE,
+  SIGNAL_SATURATED,
+  NUM_SIGNALS
+};
+
+static const char *format_names[RX_NUM_FORMATS] = {"float32", "int16", "float16", "bfp"};
+static const char *signal_names[NUM_SIGNALS] = {"fid", "noise floor", "zero", "spike", "saturated"};
+static const uint32_t lengths[] = {RX_SAMPLES_PER_SEND, 1, 2, 3, 5, 15, 17, 33, 1001};
+
+static float noise(void)
+{
+  return (float)rand()/RAND_MAX - 0.5f;
+}
+
+static void make_signal(int signal, float *x, uint32_t n)
+{
+  uint32_t k;
+  float a;
+
+  srand(1234 + signal);
+  for(k = 0; k < n; k++) {
+    switch(signal) {
+    case SIGNAL_FID:
+      a = 0.8f*expf(-(float)k/1500);
+      x[2*k] = a*cosf(0.05f*k) + 1e-4f*noise();
+      x[2*k+1] = a*sinf(0.05f*k) + 1e-4f*noise();
+      break;
+    case SIGNAL_NOISE_FLOOR:
+      x[2*k] = 3e-7f*noise();
+      x[2*k+1] = 3e-7f*noise();
+      break;
+    case SIGNAL_ZERO:
+      x[2*k] = x[2*k+1] = 0.0f;
+      break;
+    case SIGNAL_SPIKE:
+      x[2*k] = k == n/2 ? 1.0f : 1e-3f*noise();
+      x[2*k+1] = k == n/2 ? -1.0f : 1e-3f*noise();
+      break;
+    case SIGNAL_SATURATED:
+      // around the largest half and far beyond it, both signs
+      a = k % 4 == 0 ? 65504.0f : k % 4 == 1 ? 65519.0f : k % 4 == 2 ? CHECK_HALF_INF : 3e9f;
+      x[2*k] = (k & 4) ? -a : a;
+      x[2*k+1] = (k & 8) ? -a*(1 + 1e-6f*(k % 7)) : a*(1 - 1e-6f*(k % 5));
+      break;
+    }
+  }
+}
+
+/*
+  Check the decoded y against x, returns the number of samples out of bound
+*/
+static uint32_t check(uint32_t format, int signal, const float *x, const float *y, uint32_t n)
+{
+  uint32_t k, g, errors = 0;
+  float bound, group_max = 0.0f, chunk_max = rx_format_maxabs(x, 2*n);
+  int ok;
+
+  for(k = 0; k < 2*n; k++) {
+    switch(format) {
+    case RX_FORMAT_INT16:
+      bound = 0.5f*chunk_max/32767.0f + fabsf(x[k])*ldexpf(1.0f, -22);
+      ok = fabsf(y[k] - x[k]) <= bound;
+      break;
+    case RX_FORMAT_FLOAT16:
+      if(fabsf(x[k]) >= CHECK_HALF_INF) {
+        bound = INFINITY;
+        ok = isinf(y[k]) && (y[k] < 0) == (x[k] < 0);
+        break;
+      }
+      bound = fabsf(x[k])*ldexpf(1.0f, -11);
+      if(bound < ldexpf(1.0f, -25))
+        bound = ldexpf(1.0f, -25);
+      ok = fabsf(y[k] - x[k]) <= bound;
+      break;
+    case RX_FORMAT_BFP:
+      if(k % (2*RX_BFP_GROUP) == 0) {
+        g = 2*n - k < 2*RX_BFP_GROUP ? 2*n - k : 2*RX_BFP_GROUP;
+        group_max = rx_format_maxabs(x + k, g);
+      }
+      bound = group_max/127.0f + fabsf(x[k])*ldexpf(1.0f, -22);
+      if(bound < ldexpf(1.0f, -129))
+        bound = ldexpf(1.0f, -129);
+      ok = fabsf(y[k] - x[k]) <= bound;
+      break;
+    default:
+      bound = 0.0f;
+      ok = memcmp(&x[k], &y[k], sizeof(float)) == 0;
+      break;
+    }
+    if(!ok) {
+      if(errors < CHECK_SHOW)
+        printf("  %s %s n=%u: sample %u %s %.9g decoded %.9g, bound %.3g\n", format_names[format],
+               signal_names[signal], n, k/2, k & 1 ? "Q" : "I", x[k], y[k], bound);
+      errors++;
+    }
+  }
+  return errors;
+}
+
+int main(void)
+{
+  static uint64_t chunk[RX_SAMPLES_PER_SEND];
+  static float x[2*RX_SAMPLES_PER_SEND], y[2*RX_SAMPLES_PER_SEND];
+  uint32_t format, l, n, bytes, errors, total = 0;
+  int signal;
+
+#if defined(__ARM_NEON)
+  printf("encoders: NEON path\n");
+#else
+  printf("encoders: scalar path\n");
+#endif
+
+  for(format = 0; format < RX_NUM_FORMATS; format++) {
+    errors = 0;
+    for(signal = 0; signal < NUM_SIGNALS; signal++) {
+      for(l = 0; l < sizeof(lengths)/sizeof(lengths[0]); l++) {
+        n = lengths[l];
+        make_signal(signal, x, n);
+        memcpy(chunk, x, 8*n);
+        bytes = rx_format_encode(format, chunk, n);
+        if(bytes != rx_format_bytes(format, n) || bytes > sizeof(chunk)) {
+          printf("  %s %s n=%u: %u bytes\n", format_names[format], signal_names[signal], n, bytes);
+          errors++;
+        }
+        rx_format_decode(format, chunk, n, y);
+        errors += check(format, signal, x, y, n);
+      }
+    }
+    printf("%-8s %u samples out of bound\n", format_names[format], errors);
+    total += errors;
+  }
+  return total ? 1 : 0;
+}
@@ -0,0 +1,329 @@
+/*
+  RX sample streaming thread.
+
+  Without it the thread that runs the scan also blocks in send(), so a slow
+  client stalls the drain of the RX FIFO (8192 samples, 32 ms at 250 kHz)
+  and the FIFO overflows. With a stream attached to the RX engine the drain
+  copies the FIFO into pre-allocated blocks of a single producer, single
+  consumer ring and a network thread sends them to the client. The scan
+  thread only waits when the ring is full (RX_STREAM_BLOCKS blocks, 25 TRs
+  of RX_SAMPLES_PER_TR).
+
+  The ring indices are only written by one side each and are published with
+  release stores, the two semaphores count free and filled blocks so that
+  either side can sleep.
+
+  The blocks are page aligned and sent with MSG_ZEROCOPY when the socket
+  takes SO_ZEROCOPY, so the kernel transmits from the ring pages instead of
+  copying them. Such a block is pinned until its completion is read from the
+  error queue of the socket, only then it goes back to the producer. Kernels
+  without zero copy, and sockets where the kernel had to copy anyway
+  (SO_EE_CODE_ZEROCOPY_COPIED, e.g. loopback), use plain send().
+
+  Anything else sent to the client has to go through the stream as well, or
+  wait for rx_stream_flush(), to keep the order of the data.
+*/
+#ifndef RX_STREAM_H
+#define RX_STREAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include "trace.h"
+#include "proto.h"
+#include "tr_sched.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY               60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY              0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY     5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+#define RX_STREAM_BLOCKS          256   // power of 2
+#define RX_STREAM_BLOCK_SAMPLES   5000  // RX_SAMPLES_PER_SEND
+#define RX_STREAM_BLOCK_BYTES     ((RX_STREAM_BLOCK_SAMPLES*sizeof(uint64_t) + 4095) & ~(size_t)4095)
+#define RX_STREAM_FLUSH_POLL_US   200
+#define RX_STREAM_REAP_POLL_MS    1     // error queue poll while blocks are pinned
+#define RX_STREAM_REAP_TIMEOUT_MS 2000  // wait for the last completions at the stop
+
+typedef struct {
+  uint64_t *data;           // RX_STREAM_BLOCK_BYTES, page aligned
+  uint32_t bytes;           // encoded samples in the block
+  uint32_t hdr_bytes;       // header sent before the samples, 0 for none
+  proto_data_t hdr;
+  uint32_t flags;           // MSG_MORE
+  uint32_t quit;            // last block, the network thread exits
+  uint32_t zc;              // sent with MSG_ZEROCOPY
+  uint32_t zc_id;           // send counter of the socket for the completion
+} rx_stream_block_t;
+
+typedef struct {
+  rx_stream_block_t block[RX_STREAM_BLOCKS];
+  void *pages;
+  uint32_t head;            // next block the producer fills
+  uint32_t tail;            // next block the network thread sends
+  uint32_t reclaim;         // next block that goes back to the producer
+  sem_t free;
+  sem_t filled;
+  int sock_client;
+  int failed;               // send() failed, the rest is dropped
+  int zerocopy;             // send with MSG_ZEROCOPY
+  uint32_t zc_next;         // zero copy sends so far
+  uint32_t zc_done;         // zero copy sends completed
+  pthread_t thread;
+  int running;
+} rx_stream_t;
+
+/*
+  Read the zero copy completions from the error queue of the socket.
+  Returns the number of completions read.
+*/
+static inline int rx_stream_reap(rx_stream_t *st)
+{
+  char control[128];
+  struct msghdr msg;
+  struct cmsghdr *cm;
+  struct sock_extended_err *ee;
+  int n = 0;
+
+  while(1) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if(recvmsg(st->sock_client, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      return n;
+    for(cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+      if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+           (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+        continue;
+      ee = (struct sock_extended_err *)CMSG_DATA(cm);
+      if(ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+      // [ee_info, ee_data] of the send counter, TCP completes in order
+      if((int32_t)(ee->ee_data + 1 - st->zc_done) > 0)
+        st->zc_done = ee->ee_data + 1;
+      if(ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        st->zerocopy = 0;
+      n++;
+    }
+  }
+}
+
+/*
+  Give the sent blocks whose pages the kernel released back to the producer
+*/
+static inline void rx_stream_release(rx_stream_t *st)
+{
+  rx_stream_block_t *b;
+
+  while(st->reclaim != st->tail) {
+    b = &st->block[st->reclaim & (RX_STREAM_BLOCKS-1)];
+    if(b->zc && (int32_t)(b->zc_id - st->zc_done) >= 0)
+      break;
+    st->reclaim++;
+    sem_post(&st->free);
+  }
+}
+
+static inline int rx_stream_pinned(rx_stream_t *st)
+{
+  return st->reclaim != st->tail;
+}
+
+static inline void rx_stream_send(rx_stream_t *st, rx_stream_block_t *b, uint32_t tail)
+{
+  struct iovec iov[2];
+  struct msghdr msg;
+
+  b->zc = 0;
+  if(st->failed)
+    return;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  if(b->hdr_bytes) {
+    iov[msg.msg_iovlen].iov_base = &b->hdr;
+    iov[msg.msg_iovlen++].iov_len = b->hdr_bytes;
+  }
+  iov[msg.msg_iovlen].iov_base = b->data;
+  iov[msg.msg_iovlen++].iov_len = b->bytes;
+  if(st->zerocopy) {
+    if(sendmsg(st->sock_client, &msg, MSG_NOSIGNAL | MSG_ZEROCOPY | b->flags) >= 0) {
+      b->zc = 1;
+      b->zc_id = st->zc_next++;
+      return;
+    }
+    if(errno != ENOBUFS)
+      st->zerocopy = 0;
+    // ENOBUFS: out of option memory for the notifications, copy this one
+  }
+  if(sendmsg(st->sock_client, &msg, MSG_NOSIGNAL | b->flags) < 0) {
+    st->failed = 1;
+    trace_warn(TRACE_RX_SEND_FAILED, tail, 0, 0, 0);
+  }
+}
+
+static void *rx_stream_thread(void *arg)
+{
+  rx_stream_t *st = (rx_stream_t *)arg;
+  rx_stream_block_t *b;
+  struct pollfd pfd;
+  uint32_t tail;
+
+  pfd.fd = st->sock_client;
+  pfd.events = 0;  // POLLERR is always reported
+  while(1) {
+    // the producer may wait for pinned blocks, keep reaping while idle
+    while(sem_trywait(&st->filled) < 0) {
+      if(!rx_stream_pinned(st)) {
+        while(sem_wait(&st->filled) < 0);
+        break;
+      }
+      poll(&pfd, 1, RX_STREAM_REAP_POLL_MS);
+      rx_stream_reap(st);
+      rx_stream_release(st);
+    }
+    tail = __atomic_load_n(&st->tail, __ATOMIC_RELAXED);
+    b = &st->block[tail & (RX_STREAM_BLOCKS-1)];
+    if(b->quit)
+      break;
+    rx_stream_send(st, b, tail);
+    __atomic_store_n(&st->tail, tail+1, __ATOMIC_RELEASE);
+    if(b->zc)
+      rx_stream_reap(st);
+    rx_stream_release(st);
+  }
+  return NULL;
+}
+
+/*
+  Allocate the ring and start the network thread for the client socket.
+  Returns 0 on success, the caller sends directly otherwise.
+*/
+static inline int rx_stream_start(rx_stream_t *st, int sock_client)
+{
+  int one = 1, i;
+
+  st->pages = mmap(NULL, RX_STREAM_BLOCKS*RX_STREAM_BLOCK_BYTES, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+  if(st->pages == MAP_FAILED) {
+    st->pages = NULL;
+    return -1;
+  }
+  for(i = 0; i < RX_STREAM_BLOCKS; i++)
+    st->block[i].data = (uint64_t *)((char *)st->pages + i*RX_STREAM_BLOCK_BYTES);
+  st->head = 0;
+  st->tail = 0;
+  st->reclaim = 0;
+  st->sock_client = sock_client;
+  st->failed = 0;
+  st->zerocopy = setsockopt(sock_client, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+  st->zc_next = 0;
+  st->zc_done = 0;
+  printf("RX stream: %s\n", st->zerocopy ? "zero copy send" : "send");
+  sem_init(&st->free, 0, RX_STREAM_BLOCKS);
+  sem_init(&st->filled, 0, 0);
+  if(tr_sched_spawn(&st->thread, rx_stream_thread, st) != 0) {
+    munmap(st->pages, RX_STREAM_BLOCKS*RX_STREAM_BLOCK_BYTES);
+    st->pages = NULL;
+    return -1;
+  }
+  st->running = 1;
+  return 0;
+}
+
+/*
+  Next free block to fill, waits while the ring is full
+*/
+static inline uint64_t *rx_stream_block(rx_stream_t *st)
+{
+  if(sem_trywait(&st->free) < 0) {
+    trace_log(TRACE_RX_RING_FULL, st->head, 0, 0, 0);
+    while(sem_wait(&st->free) < 0);
+  }
+  return st->block[st->head & (RX_STREAM_BLOCKS-1)].data;
+}
+
+/*
+  Hand the first bytes of the block from rx_stream_block() to the network
+  thread, after hdr_bytes of hdr (NULL for none). flags are the send() flags
+  (MSG_MORE)
+*/
+static inline void rx_stream_commit(rx_stream_t *st, const proto_data_t *hdr, uint32_t hdr_bytes, uint32_t bytes, uint32_t flags)
+{
+  rx_stream_block_t *b = &st->block[st->head & (RX_STREAM_BLOCKS-1)];
+
+  b->bytes = bytes;
+  b->hdr_bytes = hdr ? hdr_bytes : 0;
+  if(b->hdr_bytes)
+    memcpy(&b->hdr, hdr, hdr_bytes);
+  b->flags = flags;
+  b->quit = 0;
+  __atomic_store_n(&st->head, st->head+1, __ATOMIC_RELEASE);
+  sem_post(&st->filled);
+}
+
+/*
+  Wait until every committed block has been handed to the socket
+*/
+static inline void rx_stream_flush(rx_stream_t *st)
+{
+  while(__atomic_load_n(&st->tail, __ATOMIC_ACQUIRE) != st->head)
+    usleep(RX_STREAM_FLUSH_POLL_US);
+}
+
+/*
+  Send what is left and stop the network thread. The pages are unmapped once
+  the kernel released them; if the completions do not come they are leaked
+  rather than freed under a pending transmit.
+*/
+static inline void rx_stream_stop(rx_stream_t *st)
+{
+  rx_stream_block_t *b;
+  struct pollfd pfd;
+  int ms;
+
+  if(!st->running)
+    return;
+  while(sem_wait(&st->free) < 0);
+  b = &st->block[st->head & (RX_STREAM_BLOCKS-1)];
+  b->quit = 1;
+  __atomic_store_n(&st->head, st->head+1, __ATOMIC_RELEASE);
+  sem_post(&st->filled);
+  pthread_join(st->thread, NULL);
+
+  pfd.fd = st->sock_client;
+  pfd.events = 0;
+  for(ms = 0; rx_stream_pinned(st) && ms < RX_STREAM_REAP_TIMEOUT_MS; ms += RX_STREAM_REAP_POLL_MS) {
+    poll(&pfd, 1, RX_STREAM_REAP_POLL_MS);
+    rx_stream_reap(st);
+    rx_stream_release(st);
+  }
+  if(rx_stream_pinned(st))
+    printf("RX stream: %d blocks still pinned by the kernel, not freed\n", st->tail - st->reclaim);
+  else
+    munmap(st->pages, RX_STREAM_BLOCKS*RX_STREAM_BLOCK_BYTES);
+  st->pages = NULL;
+  sem_destroy(&st->free);
+  sem_destroy(&st->filled);
+  st->running = 0;
+}
+
+#endif
@@ -0,0 +1,117 @@
+/*
+  Scan descriptor: everything a 2D or 3D scan needs in one message.
+
+  Without it a client sets up a scan with a command per parameter: the
+  frequency, the sequence upload, one command per gradient offset, then the
+  acquire command, each parsed on its own and some followed by sleeps. A
+  descriptor carries all of them; the server checks the whole descriptor
+  before it touches anything, applies it and starts the scan, or rejects it
+  and leaves the previous settings in place.
+
+  In the imaging loops of mri_lab (GUI 5 and 6) the command 4<<28 | nbytes
+  is followed by nbytes of scan_desc_t (a BULK message in version 2 of the
+  protocol), nbytes = SCAN_DESC_HEADER_BYTES + 4*nwords. The server answers
+  with a uint32 status, SCAN_DESC_OK or the first check that failed (a REPLY
+  in version 2), and on SCAN_DESC_OK the samples of the scan follow as after
+  the acquire command. All fields little endian.
+*/
+#ifndef SCAN_DESC_H
+#define SCAN_DESC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "pulseq.h"
+#include "proto.h"
+
+#define SCAN_DESC_MAGIC         0x4e414353  // "SCAN"
+#define SCAN_DESC_MAX_FREQ_HZ   60000000
+#define SCAN_DESC_MAX_OFFSET_MA 0xfffff     // 20 bit magnitude of the offset commands
+#define SCAN_DESC_HEADER_BYTES  offsetof(scan_desc_t, words)
+
+#define SCAN_DESC_HW_LOOP       0x1         // phase encoding loop run by the sequencer
+#define SCAN_DESC_RX_WINDOW     0x2         // send the receive window of the program per TR, rx_samples unused
+
+enum {
+  SCAN_DESC_OK = 0,
+  SCAN_DESC_E_SIZE,         // nbytes does not match nwords
+  SCAN_DESC_E_MAGIC,
+  SCAN_DESC_E_SEQ_TYPE,
+  SCAN_DESC_E_FREQ,
+  SCAN_DESC_E_OFFSET,
+  SCAN_DESC_E_NPE,          // npe, npe2 or etl not in the lists of the server (TSE: etl 2 only)
+  SCAN_DESC_E_AVERAGES,
+  SCAN_DESC_E_READOUT
+};
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq_type;        // seqType_idx of the acquire command
+  uint32_t flags;           // SCAN_DESC_*
+  uint32_t freq_hz;         // center frequency, 0 keeps the current one
+  int32_t offset_ma[3];     // gradient offsets X, Y, Z in mA
+  uint32_t npe;
+  uint32_t npe2;            // 3D only
+  uint32_t etl;             // TSE only
+  uint32_t averages;
+  uint32_t rx_samples;      // samples per TR, 0 for RX_SAMPLES_PER_TR, see SCAN_DESC_RX_WINDOW
+  uint32_t nwords;          // sequence words that follow, 0 keeps the uploaded one
+  uint32_t words[PULSEQ_UPLOAD_WORDS];
+} scan_desc_t;
+
+/*
+  Receive the nbytes of a descriptor announced by the command.
+  Returns SCAN_DESC_OK, SCAN_DESC_E_SIZE, or -1 when the connection is gone
+  or the size does not fit, as the client is then out of step.
+*/
+static inline int scan_desc_recv(int sock, int version, uint32_t nbytes, scan_desc_t *d)
+{
+  if(nbytes < SCAN_DESC_HEADER_BYTES || nbytes > sizeof(*d) || (nbytes & 3)) {
+    printf("Scan descriptor: %u bytes\n", nbytes);
+    return -1;
+  }
+  memset(d, 0, sizeof(*d));
+  if(proto_recv_bulk(sock, version, d, nbytes) <= 0)
+    return -1;
+  // bounded first, 4*nwords wraps for a bad count
+  if(d->nwords > PULSEQ_UPLOAD_WORDS || nbytes != SCAN_DESC_HEADER_BYTES + 4*d->nwords) {
+    printf("Scan descriptor: %u bytes for %u sequence words\n", nbytes, d->nwords);
+    return SCAN_DESC_E_SIZE;
+  }
+  return SCAN_DESC_OK;
+}
+
+/*
+  Index of v in list, -1 if it is not there
+*/
+static inline int scan_desc_index(const int32_t *list, uint32_t n, uint32_t v)
+{
+  uint32_t i;
+  for(i = 0; i < n; i++)
+    if(list[i] == (int32_t)v)
+      return i;
+  return -1;
+}
+
+/*
+  The checks that do not depend on the scan type
+*/
+static inline int scan_desc_check(const scan_desc_t *d, uint32_t max_samples)
+{
+  int i;
+
+  if(d->magic != SCAN_DESC_MAGIC)
+    return SCAN_DESC_E_MAGIC;
+  if(d->freq_hz > SCAN_DESC_MAX_FREQ_HZ)
+    return SCAN_DESC_E_FREQ;
+  for(i = 0; i < 3; i++)
+    if(d->offset_ma[i] > SCAN_DESC_MAX_OFFSET_MA || d->offset_ma[i] < -SCAN_DESC_MAX_OFFSET_MA)
+      return SCAN_DESC_E_OFFSET;
+  if(d->rx_samples > max_samples)
+    return SCAN_DESC_E_READOUT;
+  return SCAN_DESC_OK;
+}
+
+#endif
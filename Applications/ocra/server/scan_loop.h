@@ -0,0 +1,297 @@
+/*
+  Hardware-looped 2D scan.
+
+  The gradient waveforms of several phase encoding lines are laid out side by
+  side in the gradient BRAMs, and the uploaded program (one TR) is run once
+  per line by a loop around it: a recovery delay instead of its HALT, then
+  the next line's GRADOFFSET. One start of the sequencer then runs all lines
+  of the table back to back with the TR timed by the sequencer, the CPU only
+  streams the receive windows to the client.
+
+  GRADOFFSET takes an immediate and the sequencer has no indirect jump (RET
+  is not decoded), so the loop can not count a register into the offset.
+  Every line but the first has a stub with its GRADOFFSET that jumps to the
+  program, and after the program a JNZ per line picks the stub to run next:
+  flag register i is loaded with 1 and cleared (DEC) by stub i, so the first
+  flag still set is the next line and a HALT follows when all are clear.
+  The GRADOFFSETs of the program itself are NOPs there.
+
+  A BRAM holds 2048 words, so only 2048/line_words lines fit at a time: the
+  scan runs in blocks of that many lines and the table of the next block is
+  written while the last line of a block is in its recovery delay.
+
+  The DAC sequencer plays from the GRADOFFSET until GRAD_PULSE falls, at
+  most 2000 words (10 us each), whatever the length of the waveform. A slot
+  is therefore as long as the longest GRAD_PULSE of the program, so a line
+  never plays into the waveform of the next one during its receive window.
+  The sequences that keep GRAD_PULSE high to the end of the TR (se.txt,
+  gre.txt) need the whole BRAM per line and are not run hardware-looped:
+  scan_loop_setup() asks for at least two lines per block. se_short_grad.txt
+  and gre_short_grad.txt lower it after the echo waveform, 4 lines a block.
+
+  Looped program for n lines:
+    0: J 3
+    1: SCAN_LOOP_OFF            all off, FIFO in reset
+    2: 1
+    3: LD64 SCAN_LOOP_REG, 1
+       LD64 flag 1 .. n-1, 2
+       GRADOFFSET 0
+    p: the uploaded program, relocated, PR SCAN_LOOP_REG, recovery for its HALT
+       JNZ flag 1 .. n-1, stub 1 .. n-1
+       HALT
+       stub i: DEC flag i, GRADOFFSET i*stride, J p
+*/
+#ifndef SCAN_LOOP_H
+#define SCAN_LOOP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "pulseq.h"
+#include "grad_waveform.h"
+#include "rx_acquire.h"
+
+#define SCAN_LOOP_MAX_LINES   16
+#define SCAN_LOOP_RECOVERY_US 500000  // between two lines, same as TR_SCHED_RECOVERY_US of the CPU driven loops
+#define SCAN_LOOP_REG         31      // register the looped program keeps SCAN_LOOP_OFF in
+#define SCAN_LOOP_FLAG_REG    (SCAN_LOOP_REG - SCAN_LOOP_MAX_LINES + 1) // flag of line 1, line i in the i-1 after it
+#define SCAN_LOOP_OFF         PULSEQ_RX_PULSE
+#define SCAN_LOOP_HEADER      3       // J and the two constants
+#define SCAN_LOOP_STUB        3       // DEC, GRADOFFSET, J
+#define SCAN_LOOP_MIN_LINES   2       // fewer per block gain nothing over the CPU driven loop
+
+typedef struct {
+  uint32_t upload[PULSEQ_UPLOAD_WORDS];
+  uint32_t tr_instr;        // instructions of the uploaded program, HALT included
+  uint32_t stride;          // gradient words per line
+  uint32_t max_lines;       // lines in one BRAM load
+  uint32_t lines;           // lines of the program in prog
+  uint32_t stub;            // instruction of the stub of line 1
+  uint32_t prog[PULSEQ_MEMORY_WORDS];
+  uint32_t nwords;
+  pulseq_rx_window_t win[SCAN_LOOP_MAX_LINES];
+  uint64_t end_us;          // from the start to the HALT
+  uint64_t t0;              // rx_time_us() of the start
+} scan_loop_t;
+
+/*
+  Check that the uploaded program can be looped over: a single HALT as its
+  last instruction, no BTR, GRADOFFSET 0 only and the registers from
+  SCAN_LOOP_FLAG_REG on unused.
+  line_words is the length of the gradient waveform of one line; a slot also
+  covers what the DAC plays while GRAD_PULSE is high.
+  Returns 0 when the scan can run hardware-looped.
+*/
+static inline int scan_loop_setup(scan_loop_t *sl, const uint32_t *upload, uint32_t line_words)
+{
+  uint32_t k, lo, hi, n_halt = 0, n_gradoffset = 0, play_words;
+  int64_t high;
+
+  sl->tr_instr = 0;
+  if(line_words == 0 || line_words > GRAD_BRAM_WORDS/SCAN_LOOP_MIN_LINES)
+    return -1;
+  for(k = 0; k < PULSEQ_UPLOAD_WORDS/2; k++) {
+    lo = upload[2*k];
+    hi = upload[2*k+1];
+    sl->upload[2*k] = lo;
+    sl->upload[2*k+1] = hi;
+    switch(PULSEQ_OP(hi)) {
+    case PULSEQ_HALT:
+      if(n_halt++ == 0)
+        sl->tr_instr = k+1;
+      break;
+    case PULSEQ_BTR:
+      return -1;
+    case PULSEQ_GRADOFFSET:
+      if(lo != 0)
+        return -1;
+      n_gradoffset++;
+      break;
+    case PULSEQ_LD64:
+    case PULSEQ_DEC:
+    case PULSEQ_INC:
+    case PULSEQ_JNZ:
+      if(PULSEQ_REG_A(hi) >= SCAN_LOOP_FLAG_REG)
+        return -1;
+      break;
+    case PULSEQ_PR:
+      if(PULSEQ_REG_B(hi) >= SCAN_LOOP_FLAG_REG)
+        return -1;
+      break;
+    }
+  }
+  // anything after the HALT would be data of the program
+  for(k = sl->tr_instr; k < PULSEQ_UPLOAD_WORDS/2; k++)
+    if(upload[2*k] || upload[2*k+1])
+      return -1;
+  if(n_halt != 1 || n_gradoffset == 0)
+    return -1;
+
+  high = pulseq_emu_longest_high(sl->upload, PULSEQ_UPLOAD_WORDS, PULSEQ_GRAD_PULSE);
+  if(high < 0)
+    return -1;
+  play_words = (uint32_t)ceil(pulseq_cycles_to_us(high) / GRAD_WORD_US);
+  if(play_words > GRAD_PLAY_WORDS)
+    play_words = GRAD_PLAY_WORDS;
+  if(play_words > line_words)
+    line_words = play_words;
+  if(GRAD_BRAM_WORDS / line_words < SCAN_LOOP_MIN_LINES) {
+    printf("No hardware loop: the DAC plays %u words per line, %d lines do not fit\n", play_words, SCAN_LOOP_MIN_LINES);
+    return -1;
+  }
+  sl->max_lines = GRAD_BRAM_WORDS / line_words;
+  if(sl->max_lines > SCAN_LOOP_MAX_LINES)
+    sl->max_lines = SCAN_LOOP_MAX_LINES;
+  sl->stride = GRAD_BRAM_WORDS / sl->max_lines;
+  sl->lines = 0;
+  return 0;
+}
+
+/*
+  Loop the uploaded program over lines lines, line j plays the gradient
+  waveform at j*stride and is followed by recovery_us with everything off.
+  The program is walked to find the receive window of every line, it has to
+  have exactly one per line. Returns 0 when the program is ready.
+*/
+static inline int scan_loop_program(scan_loop_t *sl, uint32_t lines, uint32_t recovery_us)
+{
+  uint64_t recovery = pulseq_us_to_cycles(recovery_us), end;
+  uint32_t i, k, body, ladder, pc, lo, hi, op;
+
+  sl->lines = 0;
+  if(lines == 0 || lines > sl->max_lines || sl->tr_instr == 0)
+    return -1;
+  body = SCAN_LOOP_HEADER + lines + 1;
+  ladder = body + sl->tr_instr;
+  sl->stub = ladder + lines;
+  if(sl->stub + (lines-1)*SCAN_LOOP_STUB > PULSEQ_MEMORY_WORDS/2)
+    return -1;
+
+  sl->prog[0] = SCAN_LOOP_HEADER;
+  sl->prog[1] = PULSEQ_HI_A(PULSEQ_J, 0);
+  sl->prog[2] = SCAN_LOOP_OFF;
+  sl->prog[3] = 0;
+  sl->prog[4] = 1;
+  sl->prog[5] = 0;
+  pc = SCAN_LOOP_HEADER;
+  sl->prog[2*pc] = 1;
+  sl->prog[2*pc+1] = PULSEQ_HI_A(PULSEQ_LD64, SCAN_LOOP_REG);
+  for(i = 1; i < lines; i++) {
+    pc++;
+    sl->prog[2*pc] = 2;
+    sl->prog[2*pc+1] = PULSEQ_HI_A(PULSEQ_LD64, SCAN_LOOP_FLAG_REG + i-1);
+  }
+  pc++;
+  sl->prog[2*pc] = 0;
+  sl->prog[2*pc+1] = PULSEQ_HI_A(PULSEQ_GRADOFFSET, 0);
+
+  for(k = 0; k < sl->tr_instr; k++) {
+    lo = sl->upload[2*k];
+    hi = sl->upload[2*k+1];
+    op = PULSEQ_OP(hi);
+    if(op == PULSEQ_LD64 || op == PULSEQ_JNZ || op == PULSEQ_J) {
+      lo = (lo & ~0x3ff) | (PULSEQ_ADDR(lo) + body);
+    }
+    else if(op == PULSEQ_GRADOFFSET) {
+      lo = 0;
+      hi = PULSEQ_HI_A(PULSEQ_NOP, 0);  // set by the stub of the line
+    }
+    else if(op == PULSEQ_HALT) {
+      lo = (uint32_t)recovery;
+      hi = PULSEQ_HI_B(PULSEQ_PR, SCAN_LOOP_REG, recovery);
+    }
+    sl->prog[2*(body+k)] = lo;
+    sl->prog[2*(body+k)+1] = hi;
+  }
+
+  for(i = 1; i < lines; i++) {
+    pc = ladder + i-1;
+    sl->prog[2*pc] = sl->stub + (i-1)*SCAN_LOOP_STUB;
+    sl->prog[2*pc+1] = PULSEQ_HI_A(PULSEQ_JNZ, SCAN_LOOP_FLAG_REG + i-1);
+    pc = sl->stub + (i-1)*SCAN_LOOP_STUB;
+    sl->prog[2*pc] = 0;
+    sl->prog[2*pc+1] = PULSEQ_HI_A(PULSEQ_DEC, SCAN_LOOP_FLAG_REG + i-1);
+    sl->prog[2*pc+2] = i*sl->stride;
+    sl->prog[2*pc+3] = PULSEQ_HI_A(PULSEQ_GRADOFFSET, 0);
+    sl->prog[2*pc+4] = body;
+    sl->prog[2*pc+5] = PULSEQ_HI_A(PULSEQ_J, 0);
+  }
+  pc = ladder + lines-1;
+  sl->prog[2*pc] = 0;
+  sl->prog[2*pc+1] = PULSEQ_HI_A(PULSEQ_HALT, 0);
+  sl->nwords = 2*(sl->stub + (lines-1)*SCAN_LOOP_STUB);
+
+  if(pulseq_rx_windows(sl->prog, sl->nwords, sl->win, SCAN_LOOP_MAX_LINES, &end) != (int)lines)
+    return -1;
+  sl->end_us = (uint64_t)pulseq_cycles_to_us(end);
+  sl->lines = lines;
+  return 0;
+}
+
+/*
+  Write the line waveform in pp->design to the table slot of line j
+*/
+static inline void scan_loop_commit(scan_loop_t *sl, grad_pingpong_t *pp, uint32_t j)
+{
+  grad_table_commit(pp, j*sl->stride, sl->stride);
+}
+
+/*
+  Load the looped program and start it. Through rx->mem only the first
+  block writes the program, the blocks after it are the same program.
+*/
+static inline void scan_loop_start(scan_loop_t *sl, rx_engine_t *rx)
+{
+  uint32_t i;
+
+  rx_live_poll(rx);  // the block is the TR boundary the CPU sees
+  if(rx->mem)
+    pulseq_mem_load(rx->mem, sl->prog, sl->nwords);
+  else
+    for(i = 0; i < sl->nwords; i++)
+      rx->pulseq_memory[i] = sl->prog[i];
+  rx->seq_config[0] = 0x00000007;
+  sl->t0 = rx_time_us();
+  rx->start_us = sl->t0;
+}
+
+static inline void scan_loop_wait(scan_loop_t *sl, uint64_t t_us)
+{
+  uint64_t now = rx_time_us() - sl->t0;
+  if(now < t_us)
+    usleep(t_us - now);
+}
+
+/*
+  Send the receive window of every line as nsamples to the client. A window
+  is read from the FIFO reset before it, so samples left over from the window
+  before are never sent.
+*/
+static inline void scan_loop_drain(scan_loop_t *sl, rx_engine_t *rx, uint64_t *buffer, uint32_t nsamples)
+{
+  uint32_t j;
+
+  for(j = 0; j < sl->lines; j++) {
+    scan_loop_wait(sl, (uint64_t)pulseq_cycles_to_us(sl->win[j].holdoff));
+    rx_drain_samples(rx, buffer, rx_window_samples(&sl->win[j], *rx->rx_rate), nsamples);
+  }
+}
+
+/*
+  Wait for the HALT after the recovery of the last line and reset the
+  sequencer, the next block can start right away
+*/
+static inline void scan_loop_stop(scan_loop_t *sl, rx_engine_t *rx)
+{
+  int64_t t;
+
+  t = rx_wait_halt(rx, (uint32_t)sl->end_us, (uint32_t)sl->end_us + RX_HALT_MARGIN_US);
+  if(t < 0)
+    trace_warn(TRACE_SEQ_HALT_TIMEOUT, (uint32_t)sl->end_us + RX_HALT_MARGIN_US, (uint32_t)sl->end_us, 0, 0);
+  else
+    trace_log(TRACE_SEQ_HALT, (int32_t)t, (uint32_t)sl->end_us, 0, 0);
+  rx->seq_config[0] = 0x00000000;
+}
+
+#endif
@@ -0,0 +1,182 @@
+/*
+  TR scheduler.
+
+  The CPU driven loops spaced their TRs with a usleep() after every TR, so a
+  TR lasted the program, the drain, the gradient update and the sleep, each
+  with the jitter of the system load. The scheduler puts the TRs on an
+  absolute timeline instead: a TR starts one period after the start of the
+  TR before it, the period being the length of the pulse program plus the
+  recovery time, and tr_sched_wait() sleeps with
+  clock_nanosleep(TIMER_ABSTIME) until then. The work between two TRs
+  (sends, gradient updates) is done within the period instead of adding to
+  it. The first TR of a scan keeps the recovery after the last TR before it
+  but starts as soon as that is over.
+
+  tr_sched_realtime() locks the memory of the server and moves the thread
+  that runs the TRs to SCHED_FIFO, so a wakeup is not delayed by other
+  processes or page faults. The network threads (rx_stream.h, monitor.h)
+  are started with tr_sched_spawn() and keep the default policy, so they do
+  not compete with the TR loop at its priority while it polls the hardware.
+  How late every TR started is recorded, tr_sched_end() prints the figures
+  of the scan.
+*/
+#ifndef TR_SCHED_H
+#define TR_SCHED_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define TR_SCHED_RECOVERY_US  500000  // after the program of a TR, was the usleep(500000) of the loops
+#define TR_SCHED_PRIORITY     80      // SCHED_FIFO, above the kernel threads of the network
+
+typedef struct {
+  uint64_t period_ns;
+  uint64_t next_ns;         // earliest start of the next TR
+  int first;                // the next TR is the first of the scan
+  uint32_t n;               // TRs with a lateness, the first of a scan has none
+  uint32_t overruns;        // TRs that started more than a period late
+  int64_t late_min_ns;
+  int64_t late_max_ns;
+  double late_sum;          // ns
+  double late_sum2;
+} tr_sched_t;
+
+static inline uint64_t tr_sched_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void tr_sched_sleep_until(uint64_t t_ns)
+{
+  struct timespec ts;
+
+  ts.tv_sec = t_ns / 1000000000ull;
+  ts.tv_nsec = t_ns % 1000000000ull;
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/*
+  Lock the memory and run the calling thread with SCHED_FIFO. Returns -1 if
+  either failed, the server then runs as before.
+*/
+static inline int tr_sched_realtime(int priority)
+{
+  struct sched_param param;
+  int status = 0;
+
+  if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+    perror("mlockall");
+    status = -1;
+  }
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = priority;
+  if((errno = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0) {
+    perror("pthread_setschedparam");
+    status = -1;
+  }
+  if(status == 0)
+    printf("TR scheduler: SCHED_FIFO priority %d, memory locked\n", priority);
+  return status;
+}
+
+/*
+  pthread_create() with the default policy whatever the policy of the
+  calling thread
+*/
+static inline int tr_sched_spawn(pthread_t *thread, void *(*start)(void *), void *arg)
+{
+  pthread_attr_t attr;
+  struct sched_param param;
+  int status;
+
+  memset(&param, 0, sizeof(param));
+  pthread_attr_init(&attr);
+  pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+  pthread_attr_setschedparam(&attr, &param);
+  status = pthread_create(thread, &attr, start, arg);
+  pthread_attr_destroy(&attr);
+  return status;
+}
+
+static inline void tr_sched_init(tr_sched_t *s)
+{
+  memset(s, 0, sizeof(*s));
+}
+
+/*
+  Start a scan of TRs period_us apart
+*/
+static inline void tr_sched_begin(tr_sched_t *s, uint32_t period_us)
+{
+  s->period_ns = (uint64_t)period_us*1000ull;
+  s->first = 1;
+  s->n = 0;
+  s->overruns = 0;
+  s->late_min_ns = INT64_MAX;
+  s->late_max_ns = 0;
+  s->late_sum = 0.0;
+  s->late_sum2 = 0.0;
+}
+
+/*
+  Sleep until the start of the next TR. A TR that could not start within a
+  period of its slot is an overrun, the TRs after it are timed from it.
+*/
+static inline void tr_sched_wait(tr_sched_t *s)
+{
+  uint64_t now = tr_sched_now_ns(), start;
+  int64_t late;
+
+  if(now < s->next_ns) {
+    tr_sched_sleep_until(s->next_ns);
+    now = tr_sched_now_ns();
+  }
+  start = s->next_ns;
+  if(s->first) {
+    s->first = 0;
+    start = now;
+  }
+  else {
+    late = (int64_t)(now - start);
+    if(late < s->late_min_ns)
+      s->late_min_ns = late;
+    if(late > s->late_max_ns)
+      s->late_max_ns = late;
+    s->late_sum += late;
+    s->late_sum2 += (double)late*late;
+    s->n++;
+    if(late > (int64_t)s->period_ns) {
+      s->overruns++;
+      start = now;
+    }
+  }
+  s->next_ns = start + s->period_ns;
+}
+
+/*
+  End of the scan: how late its TRs started
+*/
+static inline void tr_sched_end(tr_sched_t *s)
+{
+  double mean, var;
+
+  if(s->n == 0)
+    return;
+  mean = s->late_sum / s->n;
+  var = s->late_sum2 / s->n - mean*mean;
+  printf("TR scheduler: %u TRs of %u us, late min %.1f mean %.1f max %.1f std %.1f us, %u overruns\n",
+         s->n+1, (uint32_t)(s->period_ns/1000), s->late_min_ns/1e3, mean/1e3, s->late_max_ns/1e3,
+         sqrt(var > 0.0 ? var : 0.0)/1e3, s->overruns);
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*
+  Binary trace ring shared by the MRI servers.
+
+  The per-TR printf of the servers goes to a serial or SSH console and
+  stalls the scan. The hot paths log fixed size events (id, time, four int
+  arguments) into an in-memory ring instead, which a client can fetch with
+  the trace command of the server. In verbose mode (trace_set_verbose) an
+  event is also printed with the format of its id, as the printf it replaced.
+
+  Writers claim a slot with an atomic increment of head and publish it by
+  storing its sequence number last, so the ring can be written from more
+  than one thread without a lock. When the ring is full the oldest events
+  are overwritten. A reader takes the events whose sequence number matches
+  their slot, a slot that is being rewritten is skipped.
+*/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_EVENTS          4096  // power of 2, 128 kB
+#define TRACE_ARGS            4
+
+/*
+  Event ids, the formats print the arguments as int
+*/
+#define TRACE_EVENT_LIST(X) \
+  X(TRACE_TR_START,       "TR[%d]: go!!\n") \
+  X(TRACE_TR_STOP,        "stop !!\n") \
+  X(TRACE_RX_WINDOW,      "RX window: holdoff %d us, %d samples\n") \
+  X(TRACE_RX_DRAIN,       "RX drain: %d of %d samples read, %d sent, %d us\n") \
+  X(TRACE_RX_TIMEOUT,     "RX timeout: %d of %d samples received\n") \
+  X(TRACE_SEQ_HALT,       "Sequencer halted after %d us, %d us expected\n") \
+  X(TRACE_SEQ_HALT_TIMEOUT, "Sequencer did not halt within %d us, %d us expected\n") \
+  X(TRACE_RX_STALE,       "RX FIFO was not reset by the sequence, %d old samples\n") \
+  X(TRACE_RX_RING_FULL,   "RX stream: ring full at block %d\n") \
+  X(TRACE_RX_SEND_FAILED, "RX stream: send failed at block %d\n") \
+  X(TRACE_MONITOR_DROP,   "Monitor %d: dropped a message of %d bytes, %d queued, %d dropped\n") \
+  X(TRACE_LIVE,           "Live: operation %d, value %d, applied before TR %d\n") \
+  X(TRACE_RX_AVERAGE,     "RX average: repetition %d, %d samples, sign %d, %d us\n") \
+  X(TRACE_GRAD_COMMIT,    "Gradient commit: %d words at %d, %d us\n") \
+  X(TRACE_SCAN_BLOCK,     "TR[%d-%d]: go!!\n") \
+  X(TRACE_COMMAND,        "Command: %d trig: %d\n")
+
+#define TRACE_ENUM(id, fmt) id,
+#define TRACE_FORMAT(id, fmt) fmt,
+enum {
+  TRACE_NONE = 0,
+  TRACE_EVENT_LIST(TRACE_ENUM)
+  TRACE_NUM_IDS
+};
+
+typedef struct {
+  uint32_t seq;             // index of the event + 1, 0 is empty
+  uint16_t id;
+  uint16_t reserved;
+  uint64_t t_us;            // CLOCK_MONOTONIC
+  int32_t arg[TRACE_ARGS];
+} trace_event_t;
+
+typedef struct {
+  trace_event_t ev[TRACE_EVENTS];
+  uint32_t head;            // events logged since the clear
+  int verbose;              // also print the events
+} trace_ring_t;
+
+static trace_ring_t trace_ring;
+
+static const char *const trace_format[TRACE_NUM_IDS] = {
+  "",
+  TRACE_EVENT_LIST(TRACE_FORMAT)
+};
+
+static inline uint64_t trace_time_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000ull + (uint64_t)(ts.tv_nsec/1000);
+}
+
+static inline void trace_log(uint32_t id, int32_t a0, int32_t a1, int32_t a2, int32_t a3)
+{
+  uint32_t n = __atomic_fetch_add(&trace_ring.head, 1, __ATOMIC_RELAXED);
+  trace_event_t *e = &trace_ring.ev[n & (TRACE_EVENTS-1)];
+
+  __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  e->id = id;
+  e->t_us = trace_time_us();
+  e->arg[0] = a0;
+  e->arg[1] = a1;
+  e->arg[2] = a2;
+  e->arg[3] = a3;
+  __atomic_store_n(&e->seq, n+1, __ATOMIC_RELEASE);
+
+  if(trace_ring.verbose && id < TRACE_NUM_IDS)
+    printf(trace_format[id], a0, a1, a2, a3);
+}
+
+/*
+  Log an event that is always printed, for errors
+*/
+static inline void trace_warn(uint32_t id, int32_t a0, int32_t a1, int32_t a2, int32_t a3)
+{
+  trace_log(id, a0, a1, a2, a3);
+  if(!trace_ring.verbose && id < TRACE_NUM_IDS)
+    printf(trace_format[id], a0, a1, a2, a3);
+}
+
+static inline void trace_set_verbose(int verbose)
+{
+  trace_ring.verbose = verbose;
+}
+
+/*
+  printf in verbose mode only, for the console lines of the per-TR paths
+  that are not events (designer names, offsets, command echoes)
+*/
+static inline void trace_printf(const char *fmt, ...)
+{
+  va_list ap;
+
+  if(!trace_ring.verbose)
+    return;
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+}
+
+static inline void trace_clear(void)
+{
+  memset(trace_ring.ev, 0, sizeof(trace_ring.ev));
+  __atomic_store_n(&trace_ring.head, 0, __ATOMIC_RELEASE);
+}
+
+/*
+  Copy the events still in the ring to dst, oldest first.
+  Returns the number of events copied, at most TRACE_EVENTS. The trace
+  command sends the count (uint32), then the events as trace_event_t.
+*/
+static inline uint32_t trace_snapshot(trace_event_t *dst)
+{
+  uint32_t head = __atomic_load_n(&trace_ring.head, __ATOMIC_ACQUIRE);
+  uint32_t first = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+  uint32_t n, count = 0;
+  const trace_event_t *e;
+
+  for(n = first; n != head; n++) {
+    e = &trace_ring.ev[n & (TRACE_EVENTS-1)];
+    if(__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != n+1)
+      continue;
+    dst[count] = *e;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != n+1)
+      continue;  // rewritten while it was copied
+    count++;
+  }
+  return count;
+}
+
+#endif
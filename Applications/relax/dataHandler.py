@@ -25,6 +25,10 @@ from assembler import Assembler
 #       4:  upload sequence
 #       5:  set gradient offsets
 #       6:  acquire 2D SE image
+#       7:  readout length (0: 50000 samples, 1: receive window of the sequence)
+#       8:  upload sequence source, assembled on the server
+#       9:  set parameters of the sequence source
+#       10: patch labelled delays of the sequence
 
 class data(QObject):
 
@@ -66,6 +70,7 @@ class data(QObject):
             print("TCP socket in state : ", socket.state())
             return socket.state()
 
+        self.sequence_source = None  # the server starts each client without a source
         self.set_at(params.at)
         self.set_freq(params.freq)
 
@@ -89,29 +94,93 @@ class data(QObject):
         self.fid_flag = False
 
         # Variables
-        self.size = 50000  # total data received (defined by the server code)
-        self.buffer = bytearray(8*self.size)
-        self.data = np.frombuffer(self.buffer, np.complex64)
+        self.readout_window = False
+        self.sequence_source = None  # source loaded on the server with command 8
+        self.set_size(50000)  # total data received (defined by the server code)
 
         # Variables
         self.time = 20
         self.freq_range = 250000
+
+    # Function to set the number of samples received per readout
+    def set_size(self, size):
+        self.size = size
+        self.buffer = bytearray(8*self.size)
+        self.data = np.frombuffer(self.buffer, np.complex64)
+
 #_______________________________________________________________________________
 #   Functions for Setting up sequence
 
-    # Function to set default FID sequence
-    def set_FID(self): # Function to init and set FID -- only acquire call is necessary afterwards
-
-        self.assembler = Assembler()
-        byte_array = self.assembler.assemble(self.seq_fid)
-        socket.write(struct.pack('<I', 4 << 28))
+    # Function to upload an assembled sequence, the server answers 0 or -1 (too long, the last sequence
+    # stays loaded), then the readout size in readout window mode
+    def upload_sequence(self, byte_array):
+        socket.write(struct.pack('<I', 4 << 28 | len(byte_array)))
         socket.write(byte_array)
-
+        status = self.read_assembler_status()
+        if status == 0:
+            self.sequence_source = None  # its labels are gone on the server
+        return status
+
+    # Function to upload a sequence source, the server assembles it with the PARAM defaults of the source
+    def upload_sequence_source(self, seq):
+        with open(seq, 'rb') as f:
+            source = f.read()
+        socket.write(struct.pack('<I', 8 << 28 | len(source)))
+        socket.write(source)
+        status = self.read_assembler_status()
+        self.sequence_source = seq if status == 0 else None
+        return status
+
+    # Function to upload a sequence source unless it is the one loaded already, a sweep uploads it once
+    def load_sequence_source(self, seq):
+        if self.sequence_source == seq:
+            return 0
+        return self.upload_sequence_source(seq)
+
+    # Function to set parameters of the uploaded source, e.g. set_sequence_params(TE=20),
+    # the server assembles it again (programs assembled before come from its cache)
+    def set_sequence_params(self, **kwargs):
+        text = ';'.join('{}={}'.format(name, value) for name, value in kwargs.items()).encode()
+        socket.write(struct.pack('<I', 9 << 28 | len(text)))
+        socket.write(text)
+        return self.read_assembler_status()
+
+    # Function to change labelled delays (us) of the uploaded source in place, e.g. patch_delays(TI=100),
+    # for a source with the line TI: PR 3, 14802
+    def patch_delays(self, **kwargs):
+        text = ';'.join('{}={}'.format(name, value) for name, value in kwargs.items()).encode()
+        socket.write(struct.pack('<I', 10 << 28 | len(text)))
+        socket.write(text)
+        return self.read_assembler_status()
+
+    # Function to read the answer to a sequence, source, parameter or delay upload: 0, or the line of the assembler error
+    def read_assembler_status(self):
         while(True): # Wait until bytes written
             if not socket.waitForBytesWritten():
                 break
 
+        while socket.bytesAvailable() < 4:
+            socket.waitForReadyRead()
+        status = struct.unpack('<i', socket.read(4))[0]
+        if status != 0:
+            print("Sequence not changed, server status ", status, "(line of the assembler error, or -1)")
+            return status
+
+        if self.readout_window:
+            while socket.bytesAvailable() < 4:
+                socket.waitForReadyRead()
+            self.set_size(struct.unpack('<I', socket.read(4))[0])
+            print("Readout window : ", self.size, " samples")
+
         socket.setReadBufferSize(8*self.size)
+        return status
+
+    # Function to set default FID sequence
+    def set_FID(self): # Function to init and set FID -- only acquire call is necessary afterwards
+
+        self.assembler = Assembler()
+        byte_array = self.assembler.assemble(self.seq_fid)
+        self.upload_sequence(byte_array)
         self.ir_flag = False
         self.se_flag = False
         self.fid_flag = True
@@ -120,114 +189,42 @@ class data(QObject):
     # Function to set default SE sequence
     def set_SE(self, TE=10): # Function to modify SE -- call whenever acquiring a SE
 
-        # Change TE in sequence and push to server
+        # TE is a PARAM of the source, the server assembles it (a sweep point it had before comes from its cache)
         params.te = TE
-        self.change_TE(params.te)#, REC)
-
-        self.assembler = Assembler()
-        byte_array = self.assembler.assemble(self.seq_se)
-        socket.write(struct.pack('<I', 4 << 28))
-        socket.write(byte_array)
-
-        while(True): # Wait until bytes written
-            if not socket.waitForBytesWritten(): break
-
-        socket.setReadBufferSize(8*self.size)
+        if self.load_sequence_source(self.seq_se) != 0 or self.set_sequence_params(TE=TE) != 0:
+            return
         self.ir_flag = False
         self.se_flag = True
         self.fid_flag = False
         print("\nSE sequence uploaded with TE = ", TE, " ms.")
 
-    # Function to change TE in sequence
-    def change_TE(self, TE): # Function for changing TE value in sequence -- called inside set_SE
-        # Open sequence and read lines
-        f = open(self.seq_se, 'r+')
-        lines = f.readlines()
-        # Modify TE time in the 8th last line
-        lines[-10] = 'PR 3, ' + str(int(TE/2 * 1000 - 112)) + '\t// wait&r\n'
-        lines[-6] = 'PR 3, ' + str(int(TE/2 * 1000 - 112)) + '\t// wait&r\n'
-        # Close and write/save modified sequence
-        f.close()
-        with open(self.seq_se, "w") as out_file:
-            for line in lines:
-                out_file.write(line)
-
     # Function to set default IR sequence
     def set_IR(self, TI=15):#, REC=1000): # Function to modify SE -- call whenever acquiring a SE
 
+        # TI is a labelled delay of the source, the server patches it in the loaded program
         params.ti = TI
-        self.change_IR(params.ti, self.seq_ir)#, REC)
-
-        self.assembler = Assembler()
-        byte_array = self.assembler.assemble(self.seq_ir)
-        socket.write(struct.pack('<I', 4 << 28))
-        socket.write(byte_array)
-
-        while(True): # Wait until bytes written
-            if not socket.waitForBytesWritten(): break
-
-        socket.setReadBufferSize(8*self.size)
+        if self.load_sequence_source(self.seq_ir) != 0 or self.patch_delays(TI=TI * 1000 - 198) != 0:
+            return
         self.ir_flag = True
         self.se_flag = False
         self.fid_flag = False
         print("\nIR sequence uploaded with TI = ", TI, " ms.")#" and REC = ", REC, " ms.")
 
-    # Function to change TI in IR sequence
-    def change_IR(self, TI, seq):
-        f = open(seq, 'r+') # Open sequence and read lines
-        lines = f.readlines()
-        # Modify TI time in the 8th last line
-        lines[-14] = 'PR 3, ' + str(int(TI * 1000 - 198)) + '\t// wait&r\n'
-        f.close() # Close and write/save modified sequence
-        with open(seq, "w") as out_file:
-            for line in lines:
-                out_file.write(line)
-
     # Function to set default SIR sequence
     def set_SIR(self, TI=15):
 
+        # TI is a PARAM of the source, used for both of its inversion delays
         params.ti = TI
-        self.change_SIR(params.ti, self.seq_sir)
-
-        self.assembler = Assembler()
-        byte_array = self.assembler.assemble(self.seq_sir)
-        socket.write(struct.pack('<I', 4 << 28))
-        socket.write(byte_array)
-
-        while(True): # Wait until bytes written
-            if not socket.waitForBytesWritten(): break
-
-        socket.setReadBufferSize(8*self.size)
+        if self.load_sequence_source(self.seq_sir) != 0 or self.set_sequence_params(TI=TI) != 0:
+            return
         print("\nSIR sequence uploaded with TI = ", TI, " ms.")#" and REC = ", REC, " ms.")
 
-    # Function to change TI in SIR sequence
-    def change_SIR(self, TI, seq):
-        f = open(seq, 'r+') # Open sequence and read lines
-        lines = f.readlines()
-        # Modify TI time in the 8th last line
-        #ines[-14] = 'PR 3, ' + str(int(TI * 1000 - 198)) + '\t// wait&r\n'
-        #lines[-18] = 'PR 3, ' + str(int(TI * 1000 - 198)) + '\t// wait&r\n'
-        lines[-9] = 'PR 3, ' + str(int(TI * 1000 - 198)) + '\t// wait&r\n'
-        lines[-13] = 'PR 3, ' + str(int(TI * 1000 - 198)) + '\t// wait&r\n'
-        f.close() # Close and write/save modified sequence
-        with open(seq, "w") as out_file:
-            for line in lines:
-                out_file.write(line)
-
     # Set uploaded sequence
     def set_uploaded_seq(self, seq):
         print("Set uploaded Sequence.")
         self.assembler = Assembler()
         byte_array = self.assembler.assemble(seq)
-        socket.write(struct.pack('<I', 4 << 28))
-        socket.write(byte_array)
-
-        while(True): # Wait until bytes written
-            if not socket.waitForBytesWritten():
-                break
-
-        # Multiple function calls
-        socket.setReadBufferSize(8*self.size)
+        self.upload_sequence(byte_array)
         print(byte_array)
         print("Sequence uploaded to server.")
         self.uploaded.emit(True)
@@ -269,6 +266,14 @@ class data(QObject):
         socket.write(struct.pack('<I', 2 << 28| int(1.0e6 * freq)))
         print("Set frequency!")
 
+    # Function to send only the receive window of the sequence instead of 50000 samples per readout,
+    # takes effect with the next sequence upload
+    def set_readout_window(self, enable):
+        self.readout_window = enable
+        socket.write(struct.pack('<I', 7 << 28 | int(enable)))
+        if not enable: self.set_size(50000)
+        print("Set readout window!")
+
     # Function to set attenuation
     def set_at(self, at):
         params.at = at
@@ -307,7 +312,7 @@ class data(QObject):
     def process_readout(self): # Read buffer part of interest and perform FFT
 
         # Max. data index and crop data
-        self.data_idx = int(self.time * 250)
+        self.data_idx = min(int(self.time * 250), self.size)
         self.dclip = self.data[0:self.data_idx]*1000.0*40.0; # Multiply by 1000 to obtain mV?
         timestamp = datetime.now()
 
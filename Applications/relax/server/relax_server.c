@@ -10,6 +10,10 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "../../ocra/server/rx_acquire.h"
+#include "../../ocra/server/grad_dac.h"
+#include "../../ocra/server/pulseq_asm.h"
+
 // for debugging:
 #include <inttypes.h>
 //-------------------
@@ -37,19 +41,14 @@ typedef enum {
     that it can function. (HW config is as Figure 52 in the datasheet). */
 void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz,volatile uint32_t *gz2,gradient_state_t state, gradient_offset_t offset)
 {
-	uint32_t i;
-	int32_t ival;
-
-	float fLSB = 10.0/((1<<15)-1);
-
 	switch(state) {
 		default:
 		case GRAD_ZERO_DISABLED_OUTPUT:
 			// set the DAC register to zero
-			gx[0] = 0x001fffff & (0 | 0x00100000);
-			gy[0] = 0x001fffff & (0 | 0x00100000);
-			gz[0] = 0x001fffff & (0 | 0x00100000);
-			gz2[0] = 0x001fffff & (0 | 0x00100000);
+			gx[0] = grad_dac_pack(0);
+			gy[0] = grad_dac_pack(0);
+			gz[0] = grad_dac_pack(0);
+			gz2[0] = grad_dac_pack(0);
 			// disable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 1110;
 			gx[1] = 0x0020000e;
@@ -58,10 +57,10 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 			gz2[1] = 0x0020000e;
 			break;
 		case GRAD_ZERO_ENABLED_OUTPUT:
-			gx[0] = 0x001fffff & (0 | 0x00100000);
-			gy[0] = 0x001fffff & (0 | 0x00100000);
-			gz[0] = 0x001fffff & (0 | 0x00100000);
-			gz2[0] = 0x001fffff & (0 | 0x00100000);
+			gx[0] = grad_dac_pack(0);
+			gy[0] = grad_dac_pack(0);
+			gz[0] = grad_dac_pack(0);
+			gz2[0] = grad_dac_pack(0);
 			// enable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0010;
 			gx[1] = 0x00200002;
@@ -70,14 +69,10 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 			gz2[1] = 0x00200002;
 			break;
 		case GRAD_OFFSET_ENABLED_OUTPUT:
-			ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-			gx[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-			gy[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-			gz[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
-			gz2[0] = 0x001fffff & (ival | 0x00100000);
+			gx[0] = grad_dac_word(offset.gradient_x);
+			gy[0] = grad_dac_word(offset.gradient_y);
+			gz[0] = grad_dac_word(offset.gradient_z);
+			gz2[0] = grad_dac_word(offset.gradient_z2);
 			// enable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0010;
 			gx[1] = 0x00200002;
@@ -110,23 +105,15 @@ void clear_gradient_waveforms( volatile uint32_t *gx,volatile uint32_t *gy, vola
     The waveform will play out with a 30us delay.   */
 void update_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy, volatile uint32_t *gz, volatile uint32_t *gz2, float ROamp, float PEamp, gradient_offset_t offset)
 {
-  printf("Designing a gradient waveform -- 2D SE/GRE !\n"); fflush(stdout);
+  trace_printf("Designing a gradient waveform -- 2D SE/GRE !\n");
 
   uint32_t i;
-  int32_t ival;
-
-  float fLSB = 10.0/((1<<15)-1);
-  printf("fLSB = %g Volts\n",fLSB);
 
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
-  gz2[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
+  gz2[0] = grad_dac_word(offset.gradient_z2);
 
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -145,31 +132,25 @@ void update_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy,
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
 
   // Design the Y gradient
@@ -180,49 +161,79 @@ void update_gradient_waveforms_echo(volatile uint32_t *gx,volatile uint32_t *gy,
 
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
   // clear the rest of the buffer
   for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 
   // Z,Z2 shim
   for(int k=2; k<2000; k++)
   {
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[k] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_z2/fLSB)*16;
-    gz2[k] = 0x001fffff & (ival | 0x00100000);
+    gz[k] = grad_dac_word(offset.gradient_z);
+    gz2[k] = grad_dac_word(offset.gradient_z2);
   }
 }
 
 // This function updates the pulse sequence in the memory with the uploaded sequence
-void update_pulse_sequence_from_upload(uint32_t *pulseq_memory_upload, volatile uint32_t *pulseq_memory)
+void update_pulse_sequence_from_upload(uint32_t *pulseq_memory_upload, pulseq_mem_t *seq_mem)
+{
+  // only the words that changed since the last load are written
+  pulseq_mem_load(seq_mem, pulseq_memory_upload, PULSEQ_UPLOAD_WORDS);
+  printf("Sequence memory: %d words written\n", seq_mem->written);
+}
+
+// Receive nbytes of text into text (size bytes), the text of a longer message is dropped.
+// Returns the length, -1 if the text was too long, -2 if the client is gone
+int recv_text(int sock_client, char *text, uint32_t size, uint32_t nbytes)
 {
-  int i;
-  int length = 200;
-  for(i=0; i<length; i++){
-    pulseq_memory[i] = pulseq_memory_upload[i];
+  char drop[256];
+  uint32_t n;
+
+  if (nbytes < size) {
+    if (nbytes > 0 && recv(sock_client, text, nbytes, MSG_WAITALL) <= 0) return -2;
+    text[nbytes] = 0;
+    return nbytes;
+  }
+  while (nbytes > 0) {
+    n = nbytes < sizeof(drop) ? nbytes : sizeof(drop);
+    if (recv(sock_client, drop, n, MSG_WAITALL) <= 0) return -2;
+    nbytes -= n;
   }
+  return -1;
+}
+
+// This function assembles the sequence source with the parameters into the upload (pulseq_asm.h),
+// an image assembled before is taken from the cache, its labels go to labels.
+// Returns 0, or the line of the error (-1 if there is none)
+int assemble_pulse_sequence(pulseq_asm_cache_t *cache, const char *source, uint32_t length, const pulseq_asm_params_t *params, uint32_t *pulseq_memory_upload, pulseq_asm_labels_t *labels)
+{
+  const pulseq_asm_image_t *image;
+  int line;
+
+  if (length == 0) {
+    printf("Assembler: no sequence source\n");
+    return -1;
+  }
+  image = pulseq_asm_cached(cache, source, length, params, &line);
+  if (!image) return line > 0 ? line : -1;
+  memcpy(pulseq_memory_upload, image->words, 4*PULSEQ_UPLOAD_WORDS);
+  *labels = image->labels;
+  printf("Assembler: %d words, cache %d hits %d misses\n", image->nwords, cache->hits, cache->misses);
+  return 0;
 }
 
 int main(int argc, char *argv[])
@@ -234,6 +245,10 @@ int main(int argc, char *argv[])
   volatile uint16_t *rx_cntr, *tx_size;
   //volatile uint8_t *rx_rst, *tx_rst;
   volatile uint64_t *rx_data;
+  rx_engine_t rx;
+  static monitor_hub_t monitor;
+  static pulseq_mem_t seq_mem; // shadow of the sequence BRAM
+  proto_hello_t hello;
   void *tx_data;
   float tx_freq;
   struct sockaddr_in addr;
@@ -256,10 +271,18 @@ int main(int argc, char *argv[])
   gradient_offset.gradient_z = 0.0;
 
   // -- Sequence Upload -- //
-  uint32_t pulseq_memory_upload_temp[200]; // record uploaded sequence
-  unsigned char *b; // for sequence upload
-  unsigned int cmd; // for sequence upload
-  uint32_t mem_counter, nbytes, size_of_seq; // for sequence upload
+  uint32_t pulseq_memory_upload_temp[PULSEQ_UPLOAD_WORDS]; // record uploaded sequence
+  uint32_t nbytes, size_of_seq; // for sequence upload
+  int readout_window = 0; // 0: send 50000 samples per TR, 1: send the receive window of the sequence
+  static char seq_source[PULSEQ_ASM_MAX_SOURCE]; // source of the sequence assembled on the board
+  static pulseq_asm_cache_t seq_cache;
+  pulseq_asm_params_t seq_params;
+  pulseq_asm_labels_t seq_labels; // labelled instructions of the loaded sequence
+  char param_text[PULSEQ_ASM_MAX_LINE];
+  pulseq_asm_params_t patch; // LABEL=us of a delay patch
+  uint32_t pulseq_memory_patch[PULSEQ_UPLOAD_WORDS];
+  uint32_t seq_source_length = 0;
+  int32_t asm_status;
 
   // -- Received Data from Client -- //
   uint32_t trig;  // Trigger (highest 4 bits of command)
@@ -274,11 +297,13 @@ int main(int argc, char *argv[])
   volatile uint32_t *attn_config;
 
 
-  if(argc != 4) {
-    fprintf(stderr,"parameters: RF duration, RF amplitude Attenuation (0-31.75dB)\n");
+  if(argc != 4 && !(argc == 5 && strcmp(argv[4], "-v") == 0)) {
+    fprintf(stderr,"parameters: RF duration, RF amplitude Attenuation (0-31.75dB) [-v]\n");
     fprintf(stderr,"e.g.\t./relax_server 150 32200 20.0\n");
+    fprintf(stderr,"-v prints the per-TR console lines\n");
     return -1;
   }
+  trace_set_verbose(argc == 5);
 
   if((fd = open("/dev/mem", O_RDWR)) < 0) {
     perror("open");
@@ -330,6 +355,12 @@ int main(int argc, char *argv[])
   rx_freq = ((uint32_t *)(cfg + 4));
   rx_rate = ((uint32_t *)(cfg + 8));
   rx_cntr = ((uint16_t *)(sts + 0));
+  rx_engine_init(&rx, seq_config, pulseq_memory, rx_cntr, rx_data, rx_rate);
+  pulseq_mem_init(&seq_mem, pulseq_memory);
+  rx.mem = &seq_mem;
+  pulseq_asm_cache_init(&seq_cache);
+  memset(&seq_params, 0, sizeof(seq_params));
+  memset(&seq_labels, 0, sizeof(seq_labels));
 
   //tx_rst = ((uint8_t *)(cfg + 1));
   tx_size = ((uint16_t *)(cfg + 12));
@@ -429,34 +460,46 @@ int main(int argc, char *argv[])
 
   /************* End of RF pulse *************/
 
-  while(1) {
-  	// Connect to the client
-  	if((sock_server = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-    	perror("socket");
-    	return EXIT_FAILURE;
-  	}
-  	setsockopt(sock_server, SOL_SOCKET, SO_REUSEADDR, (void *)&yes , sizeof(yes));
-
-  	/* setup listening address */
-  	memset(&addr, 0, sizeof(addr));
-  	addr.sin_family = AF_INET;
-  	addr.sin_addr.s_addr = htonl(INADDR_ANY);
-  	addr.sin_port = htons(1001);
-
-  	if(bind(sock_server, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-    	perror("bind");
-    	return EXIT_FAILURE;
-  	}
-
-  	// Start listening
-  	printf("%s \n", "Listening...");
-  	listen(sock_server, 1024);
+  // Connect to the client
+  if((sock_server = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    perror("socket");
+    return EXIT_FAILURE;
+  }
+  setsockopt(sock_server, SOL_SOCKET, SO_REUSEADDR, (void *)&yes , sizeof(yes));
+
+  /* setup listening address */
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(1001);
 
+  if(bind(sock_server, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    return EXIT_FAILURE;
+  }
+
+  // Start listening
+  printf("%s \n", "Listening...");
+  listen(sock_server, 1024);
+
+  // viewers get a copy of the RX data on MONITOR_PORT (monitor.h)
+  rx_hello(&hello);
+  if(monitor_start(&monitor, MONITOR_PORT, &hello) == 0)
+    rx.monitor = &monitor;
+
+  while(1) {
+    // a control client at a time, the next one is accepted when it is gone
     if((sock_client = accept(sock_server, NULL, NULL)) < 0) {
       perror("accept");
-      return EXIT_FAILURE;
+      break;
     }
     printf("%s \n", "Accepted client!");
+    rx.sock_client = sock_client;
+    // nothing of the last client carries over: its readout mode, its source and labels
+    readout_window = 0;
+    seq_source_length = 0;
+    memset(&seq_params, 0, sizeof(seq_params));
+    memset(&seq_labels, 0, sizeof(seq_labels));
 
 
   	while(1) {
@@ -466,7 +509,8 @@ int main(int argc, char *argv[])
         conn_status = recv(sock_client, (char *)&command, 4, MSG_WAITALL);
         if( conn_status <= 0 ) {
           // If status is <= 0 close connection and break -- listen again
-          close(sock_server);
+          printf("Client disconnected, listening...\n");
+          close(sock_client);
         }
         break;
       }
@@ -481,9 +525,22 @@ int main(int argc, char *argv[])
         1: acquire: just print and go on (acquiring at the end of while)
         2: change freq. and continue
         3: change at and continue
-        4: receive pulse sequence and continue
+        4: receive pulse sequence and continue, the lower 28 bits are its length in bytes
+           (0: what a single read returns), up to the 1024 instructions of the sequence memory;
+           with a length it sends back an int32: 0, or -1 if the sequence does not fit and the last stays loaded
         5: break & continue: break current while loop and begin to listen again
         6: break all while loops
+        7: readout length: 0 = 50000 samples per TR, 1 = receive window of the sequence,
+           the number of samples is sent back after every sequence upload
+        8: sequence source: the lower 28 bits are its length, the text follows; it is assembled
+           with the PARAM defaults and loaded
+        9: sequence parameters: the lower 28 bits are the length of "NAME=value;..." that follows;
+           the source is assembled again with them and loaded
+           8 and 9 send back an int32: 0, or the line of the assembler error (-1 if there is none),
+           then the number of samples as for 4 if it is loaded
+        10: patch delays: the lower 28 bits are the length of "LABEL=us;..." that follows; the delay of
+            each labelled PR of the sequence loaded with 8 or 9 is written in place. Sends back an
+            int32 0 or -1 (nothing written then), then the number of samples as for 4
       */
 
       trig = command >> 28;
@@ -495,19 +552,10 @@ int main(int argc, char *argv[])
 
       // Acquire when triggered
       else if (trig == 1) {
-        printf("Aquiring data\n");
-        seq_config[0] = 0x00000007;
-        usleep(1000000); // sleep 1 second
-        printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-        // Transfer the data to the client
-        // transfer 10 * 5k = 50k samples
-        for(i = 0; i < 10; ++i) {
-          while(*rx_cntr < 10000) usleep(500);
-            for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-            send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-        }
-        printf("stop !!\n");
-        seq_config[0] = 0x00000000;
+        trace_printf("Aquiring data\n");
+        // start the sequence and send the samples to the client as they arrive
+        rx_acquire_tr(&rx, buffer, readout_window ? RX_SAMPLES_WINDOW : RX_SAMPLES_PER_TR);
+        trace_printf("stop !!\n");
         usleep(500000);
       }
 
@@ -547,25 +595,34 @@ int main(int argc, char *argv[])
         // seqType_idx = (int)(command & 0x0fffffff);
 
         printf("%s \n", "Receiving pulse sequence");
-        nbytes = read(sock_client, &buffer, sizeof(buffer));
+        nbytes = command & 0x0fffffff;
+        if (nbytes == 0) {
+          nbytes = read(sock_client, &buffer, sizeof(buffer)); // older clients do not send the length
+        }
+        else if (nbytes > sizeof(buffer) || recv(sock_client, buffer, nbytes, MSG_WAITALL) <= 0) {
+          printf("Sequence of %d bytes not received, client disconnected, listening...\n", nbytes);
+          close(sock_client);
+          break;
+        }
         printf("%s %d \n", "Num bytes received = ", nbytes);
-        b = (unsigned char*) buffer;
-
-        mem_counter = nbytes/4 - 1;
-        for (i=nbytes-1; i>=0; i-=4) {
-          cmd = (b[i]<<24) | (b[i-1]<<16)| (b[i-2] <<8) | b[i-3];
-          pulseq_memory_upload_temp[mem_counter] = cmd;
-          mem_counter -= 1;
+        asm_status = pulseq_upload_words(pulseq_memory_upload_temp, buffer, nbytes) < 0 ? -1 : 0;
+        if (asm_status < 0) {
+          printf("The last sequence stays loaded\n"); // and its labels can still be patched
         }
-
-        mem_counter = 0;
-        for (i=0; i<nbytes; i+=4) {
-          printf("\tpulseq_memory[%d] = 0x%08x\n", mem_counter, pulseq_memory_upload_temp[mem_counter]);
-          mem_counter += 1;
+        else {
+          printf("%s \n", "Pulse sequence loaded");
+          update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
+          seq_labels.n = 0; // no source, nothing to patch
+        }
+        if (command & 0x0fffffff) {
+          send(sock_client, &asm_status, 4, MSG_NOSIGNAL); // clients that send the length get the status
+          if (asm_status < 0) continue;
+        }
+        if (readout_window) {
+          rx_sequence_window(&rx);
+          printf("Receive window: %d samples\n", rx.window_samples);
+          send(sock_client, &rx.window_samples, 4, MSG_NOSIGNAL);
         }
-
-        printf("%s \n", "Pulse sequence loaded");
-        update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
         continue;  // wait for acquire command
       }
 
@@ -611,14 +668,14 @@ int main(int argc, char *argv[])
       // Acquire 2D SE
       else if ( trig == 6 ) {
 
-        // update_pulse_sequence(2, pulseq_memory); // Spin echo
-        update_pulse_sequence_from_upload(pulseq_memory_upload_temp, pulseq_memory);
+        // update_pulse_sequence(2, &seq_mem); // Spin echo
+        update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
 
         npe = (command & 0x0000ffff);
 
         printf("_____2D Imaging Spin Echo (npe = %d)_____\n", npe);
         usleep(2000000); // sleep 2 second  give enough time to monitor the printout
-        printf("Acquiring\n");
+        trace_printf("Acquiring\n");
 
         // Phase encoding gradient loop
         pe_step = 2.936/44.53/2; //[A]
@@ -629,37 +686,98 @@ int main(int argc, char *argv[])
         update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro , pe, gradient_offset);
 
         // Print gradient offsets (after waveforms updated!)
-        printf("Gradient offsets(mA): X %d, Y %d, Z %d, Z2 %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000), (int)(gradient_offset.gradient_z2*1000));
+        trace_printf("Gradient offsets(mA): X %d, Y %d, Z %d, Z2 %d mA\n", (int)(gradient_offset.gradient_x*1000), (int)(gradient_offset.gradient_y*1000), (int)(gradient_offset.gradient_z*1000), (int)(gradient_offset.gradient_z2*1000));
         for(int reps=0; reps<npe; reps++) {
-          printf("TR[%d]: go!!\n",reps);
-          seq_config[0] = 0x00000007;
-          usleep(1000000); // sleep 1 second
-          printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-          // Transfer the data to the client
-          // transfer 10 * 5k = 50k samples
-          for(i = 0; i < 10; ++i) {
-            while(*rx_cntr < 10000) usleep(500);
-            for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-              send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-            }
-            printf("stop !!\n");
-            seq_config[0] = 0x00000000;
-            pe = pe+pe_step;
-            update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro, pe, gradient_offset);
-            usleep(4000000); // sleep 4 seconds
-          }
+          trace_printf("TR[%d]: go!!\n",reps);
+          // start the sequence and send the samples to the client as they arrive
+          rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
+          trace_printf("stop !!\n");
+          pe = pe+pe_step;
+          update_gradient_waveforms_echo(gradient_memory_x,gradient_memory_y,gradient_memory_z,gradient_memory_z2, ro, pe, gradient_offset);
+          usleep(4000000); // sleep 4 seconds
+        }
         printf("_________________________________________\n");
       }
+
+      // Readout length per TR
+      else if ( trig == 7 ) {
+        readout_window = command & 0x1;
+        printf("Readout: %s\n", readout_window ? "receive window of the sequence" : "50000 samples per TR");
+      }
+
+      // Assemble a sequence source, or the last source with new parameters
+      else if ( trig == 8 || trig == 9 ) {
+        nbytes = command & 0x0fffffff;
+        if (trig == 8) asm_status = recv_text(sock_client, seq_source, sizeof(seq_source), nbytes);
+        else asm_status = recv_text(sock_client, param_text, sizeof(param_text), nbytes);
+        if (asm_status == -2) {
+          printf("Client disconnected, listening...\n");
+          close(sock_client);
+          break;
+        }
+        if (trig == 8) {
+          printf("Receive sequence source, %d bytes\n", nbytes);
+          seq_source_length = asm_status < 0 ? 0 : asm_status;
+          memset(&seq_params, 0, sizeof(seq_params));
+          if (asm_status < 0) printf("Assembler: source longer than %d bytes\n", (int)sizeof(seq_source) - 1);
+        }
+        else {
+          if (asm_status >= 0) asm_status = pulseq_asm_parse_params(&seq_params, param_text, asm_status);
+          if (asm_status < 0) printf("Assembler: bad parameters\n");
+          else printf("Sequence parameters: %s\n", param_text);
+        }
+        if (asm_status >= 0)
+          asm_status = assemble_pulse_sequence(&seq_cache, seq_source, seq_source_length, &seq_params, pulseq_memory_upload_temp, &seq_labels);
+        send(sock_client, &asm_status, 4, MSG_NOSIGNAL);
+        if (asm_status != 0) continue;
+        update_pulse_sequence_from_upload(pulseq_memory_upload_temp, &seq_mem);
+        if (readout_window) {
+          rx_sequence_window(&rx);
+          printf("Receive window: %d samples\n", rx.window_samples);
+          send(sock_client, &rx.window_samples, 4, MSG_NOSIGNAL);
+        }
+        continue;  // wait for acquire command
+      }
+
+      // Patch labelled delays of the loaded sequence, a sweep point costs two words per delay
+      else if ( trig == 10 ) {
+        nbytes = command & 0x0fffffff;
+        asm_status = recv_text(sock_client, param_text, sizeof(param_text), nbytes);
+        if (asm_status == -2) {
+          printf("Client disconnected, listening...\n");
+          close(sock_client);
+          break;
+        }
+        // the values are checked on a copy of the upload first, so a bad one leaves the sequence as it was
+        memset(&patch, 0, sizeof(patch));
+        if (asm_status >= 0) asm_status = pulseq_asm_parse_params(&patch, param_text, asm_status);
+        memcpy(pulseq_memory_patch, pulseq_memory_upload_temp, sizeof(pulseq_memory_patch));
+        for (i = 0; asm_status >= 0 && i < patch.n; i++)
+          asm_status = pulseq_asm_patch_delay(&seq_labels, patch.param[i].name, patch.param[i].value, pulseq_memory_patch, NULL);
+        if (asm_status >= 0) {
+          for (i = 0; i < patch.n; i++)
+            pulseq_asm_patch_delay(&seq_labels, patch.param[i].name, patch.param[i].value, pulseq_memory_upload_temp, &seq_mem);
+          printf("Delays patched: %s\n", param_text);
+          asm_status = 0;
+        }
+        else printf("Delays not patched\n");
+        send(sock_client, &asm_status, 4, MSG_NOSIGNAL);
+        if (asm_status == 0 && readout_window) {
+          rx_sequence_window(&rx);
+          printf("Receive window: %d samples\n", rx.window_samples);
+          send(sock_client, &rx.window_samples, 4, MSG_NOSIGNAL);
+        }
+        continue;  // wait for acquire command
+      }
     }
   }
 
 
-  seq_config[0] = 0x00000007;
-  usleep(1000000); // sleep 1 second
-  // stop the FPGA again
-  printf("stop !!\n");
-  seq_config[0] = 0x00000000;
+  // run the last sequence to its HALT, then stop the FPGA again
+  rx_seq_run(&rx);
+  trace_printf("stop !!\n");
 
   // Close the socket connection
+  monitor_stop(&monitor);
   close(sock_server);
   return EXIT_SUCCESS; } // End main
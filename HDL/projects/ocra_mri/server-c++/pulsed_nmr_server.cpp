@@ -10,6 +10,10 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "../../../../Applications/ocra/server/rx_acquire.h"
+#include "../../../../Applications/ocra/server/rx_average.h"
+#include "../../../../Applications/ocra/server/grad_dac.h"
+
 typedef union {
   int32_t le_value;
   unsigned char b[4];
@@ -39,6 +43,32 @@ typedef enum {
 	GRAD_AXIS_Z
 } gradient_axis_t;
 
+#define NEX_PROGRAM1            36  // averages of program 1
+#define SEQ4_TXOFFSET_180_WORD  42  // value of the TXOFFSET before the 180 in sequence 4
+#define TX_PULSE_LEAD_IN        64  // int16 entries before a pulse at a TX offset
+
+typedef enum {
+	NEX_STREAM = 0,       // send every repetition
+	NEX_AVERAGE,          // send the mean of the repetitions of a line
+	NEX_AVERAGE_CYCLED    // the mean with the 180 phase cycled
+} nex_mode_t;
+
+/*
+	EXORCYCLE of the refocusing pulse: TX offset of the 180 with phase
+	x, y, -x, -y (see generate_phase_cycled_pulses) and the sign of its echo
+*/
+typedef struct {
+	uint32_t tx_offset;
+	int sign;
+} phase_cycle_t;
+
+static const phase_cycle_t exorcycle[4] = {
+	{100,  1},
+	{200, -1},
+	{300,  1},
+	{400, -1}
+};
+
 /* generate a gradient waveform that just changes a state 
 
 	events like this need a 30us gate time in the sequence
@@ -49,18 +79,14 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 	int32_t vmax_val_1v = vmax_val/10; // Assume a translation of 1A/V
  
 	int32_t ramp_accum;
-	uint32_t i;
-	int32_t ival;
   
-	float fLSB = 10.0/((1<<15)-1);
-	
 	switch(state) {
 		default:
 		case GRAD_ZERO_DISABLED_OUTPUT:
 			// set the DAC register to zero
-			gx[0] = 0x001fffff & (0 | 0x00100000);
-			gy[0] = 0x001fffff & (0 | 0x00100000);
-			gz[0] = 0x001fffff & (0 | 0x00100000);
+			gx[0] = grad_dac_pack(0);
+			gy[0] = grad_dac_pack(0);
+			gz[0] = grad_dac_pack(0);
 			// disable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0000;
 			gx[1] = 0x00200000;
@@ -68,9 +94,9 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 			gz[1] = 0x00200000;
 			break;
 		case GRAD_ZERO_ENABLED_OUTPUT:
-			gx[0] = 0x001fffff & (0 | 0x00100000);
-			gy[0] = 0x001fffff & (0 | 0x00100000);
-			gz[0] = 0x001fffff & (0 | 0x00100000);
+			gx[0] = grad_dac_pack(0);
+			gy[0] = grad_dac_pack(0);
+			gz[0] = grad_dac_pack(0);
 			// enable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0010;
 			gx[1] = 0x00200002;
@@ -78,12 +104,9 @@ void update_gradient_waveform_state(volatile uint32_t *gx,volatile uint32_t *gy,
 			gz[1] = 0x00200002;			
 			break;
 		case GRAD_OFFSET_ENABLED_OUTPUT:
-			ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-			gx[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-			gy[0] = 0x001fffff & (ival | 0x00100000);
-			ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-			gz[0] = 0x001fffff & (ival | 0x00100000);
+			gx[0] = grad_dac_word(offset.gradient_x);
+			gy[0] = grad_dac_word(offset.gradient_y);
+			gz[0] = grad_dac_word(offset.gradient_z);
 			// enable the outputs with 2's completment coding
 			// 24'b0010 0000 0000 0000 0000 0010;
 			gx[1] = 0x00200002;
@@ -118,7 +141,6 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
  
   int32_t ramp_accum;
   uint32_t i;
-  int32_t ival;
 	
   ramp_accum = 0;
   volatile uint32_t *waveform;
@@ -142,12 +164,9 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
   printf("fLSB = %g Volts\n",fLSB);
   
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -158,12 +177,9 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
   // set the offset current for all 3 axis
   for(int k=2; k<2000; k++)
   {
-	  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-	  gx[k] = 0x001fffff & (ival | 0x00100000);
-	  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-	  gy[k] = 0x001fffff & (ival | 0x00100000);
-	  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-	  gz[k] = 0x001fffff & (ival | 0x00100000);
+	  gx[k] = grad_dac_word(offset.gradient_x);
+	  gy[k] = grad_dac_word(offset.gradient_y);
+	  gz[k] = grad_dac_word(offset.gradient_z);
   }
   
   float fROamplitude = ROamp;
@@ -178,32 +194,25 @@ void generate_gradient_waveforms_se_proj(volatile uint32_t *gx,volatile uint32_t
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    waveform[i] = 0x001fffff & (ival | 0x00100000);
+    waveform[i] = grad_dac_word(fRO);
   }
 }
 /* This function makes gradient waveforms for the original SE sequence (4), with the prephaser immediately before the readout,
@@ -222,7 +231,6 @@ void update_gradient_waveforms_se(volatile uint32_t *gx,volatile uint32_t *gy, v
  
   int32_t ramp_accum;
   uint32_t i;
-  int32_t ival;
 
   ramp_accum = 0;
   
@@ -230,12 +238,9 @@ void update_gradient_waveforms_se(volatile uint32_t *gx,volatile uint32_t *gy, v
   printf("fLSB = %g Volts\n",fLSB);
   
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -255,32 +260,25 @@ void update_gradient_waveforms_se(volatile uint32_t *gx,volatile uint32_t *gy, v
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   
   // Design the Y gradient
@@ -291,29 +289,23 @@ void update_gradient_waveforms_se(volatile uint32_t *gx,volatile uint32_t *gy, v
   
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
   // clear the rest of the buffer
   for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
   }
 }
 
@@ -327,7 +319,6 @@ void update_gradient_waveforms_se3d(volatile uint32_t *gx,volatile uint32_t *gy,
  
   int32_t ramp_accum;
   uint32_t i;
-  int32_t ival;
 
   ramp_accum = 0;
   
@@ -335,12 +326,9 @@ void update_gradient_waveforms_se3d(volatile uint32_t *gx,volatile uint32_t *gy,
   printf("fLSB = %g Volts\n",fLSB);
   
   // enable the gradients with the prescribed offset current
-  ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-  gx[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-  gy[0] = 0x001fffff & (ival | 0x00100000);
-  ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-  gz[0] = 0x001fffff & (ival | 0x00100000);
+  gx[0] = grad_dac_word(offset.gradient_x);
+  gy[0] = grad_dac_word(offset.gradient_y);
+  gz[0] = grad_dac_word(offset.gradient_z);
   
   // enable the outputs with 2's completment coding
   // 24'b0010 0000 0000 0000 0000 0010;
@@ -360,32 +348,25 @@ void update_gradient_waveforms_se3d(volatile uint32_t *gx,volatile uint32_t *gy,
   // prephaser 200 us rise time, 3V amplitude
   for(i=2; i<22; i++) {
     fRO += fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    printf("i: %d fRO= %f dec= %d\n",i,fRO,ival);
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=82; i<102; i++) {
     fRO -= fROprestep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=102; i<122; i++) {
     fRO -= fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=122; i<422; i++) {
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   for(i=422; i<442; i++) {
     fRO += fROstep;
-    ival = (int32_t)floor(fRO/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(fRO);
   }
   
   // Design the Y gradient
@@ -396,21 +377,17 @@ void update_gradient_waveforms_se3d(volatile uint32_t *gx,volatile uint32_t *gy,
   
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
+    gy[i] = grad_dac_word(fPE);
   }
 
   // Design the Z gradient
@@ -421,34 +398,46 @@ void update_gradient_waveforms_se3d(volatile uint32_t *gx,volatile uint32_t *gy,
   
   for(i=2; i<22; i++) {
     fPE += fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i=22; i<82; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i=82; i<102; i++) {
     fPE -= fPEstep;
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
   for(i=102; i<442; i++) {
-    ival = (int32_t)floor(fPE/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gz[i] = grad_dac_word(fPE);
   }
 
   // clear the rest of the buffer
   for(i=442; i<2000; i++) {
-    ival = (int32_t)floor(offset.gradient_x/fLSB)*16;
-    gx[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_y/fLSB)*16;
-    gy[i] = 0x001fffff & (ival | 0x00100000);
-    ival = (int32_t)floor(offset.gradient_z/fLSB)*16;
-    gz[i] = 0x001fffff & (ival | 0x00100000);
+    gx[i] = grad_dac_word(offset.gradient_x);
+    gy[i] = grad_dac_word(offset.gradient_y);
+    gz[i] = grad_dac_word(offset.gradient_z);
   }
 }
 
+/*
+	Copies of the 180 at TX offset 100 with the phases of exorcycle[],
+	I in the even and Q in the odd entries of the pulse
+*/
+void generate_phase_cycled_pulses(int16_t *pulse, int16_t amp)
+{
+	int i, k;
+	for(k = 1; k < 4; k++) {
+		int base = 2*exorcycle[k].tx_offset + TX_PULSE_LEAD_IN;
+		for(i = base; i <= base+32; i=i+2) {
+			switch(k) {
+				case 1: pulse[i+1] = amp; break;    // y
+				case 2: pulse[i] = -amp; break;     // -x
+				case 3: pulse[i+1] = -amp; break;   // -y
+			}
+		}
+	}
+}
+
 /*
 	This function updates the pulse sequence in the memory with a chosen one through index
 
@@ -1009,13 +998,16 @@ int main(int argc, char *argv[])
   volatile uint16_t *rx_cntr, *tx_size;
   //volatile uint8_t *rx_rst, *tx_rst;
   volatile uint64_t *rx_data; 
+  rx_engine_t rx;
   void *tx_data;
   float tx_freq;
   struct sockaddr_in addr;
   uint32_t command, value;
   int16_t pulse[32768];
   uint64_t buffer[8192];
-  int i, j, size, yes = 1;
+  int i, size, yes = 1;
+  nex_mode_t nex_mode = NEX_STREAM;
+  static rx_average_t avg;
   swappable_int32_t lv,bv;
   volatile uint32_t *gradient_memory_x;
   volatile uint32_t *gradient_memory_y;
@@ -1027,13 +1019,19 @@ int main(int argc, char *argv[])
   gradient_offset.gradient_y = 0.00;
   gradient_offset.gradient_z = 0.00;
   
-  if(argc != 3) 
+  if(argc == 4 && strcmp(argv[3], "-a") == 0)
+    nex_mode = NEX_AVERAGE;
+  else if(argc == 4 && strcmp(argv[3], "-p") == 0)
+    nex_mode = NEX_AVERAGE_CYCLED;
+  if((argc != 3 && argc != 4) || (argc == 4 && nex_mode == NEX_STREAM))
     {
-      fprintf(stderr,"Usage: pulsed-nmr_planB frequency program\n");
+      fprintf(stderr,"Usage: pulsed-nmr_planB frequency program [-a|-p]\n");
       fprintf(stderr," Available programs:\n");
       fprintf(stderr," 0\t Permanently enable gradient DAC\n");
       fprintf(stderr," 1\t Basic spin-echo, 3 seconds TR\n");
       fprintf(stderr," 2\t Orthogonal projections\n");
+      fprintf(stderr," -a\t program 1 sends the mean of the %d averages per line\n", NEX_PROGRAM1);
+      fprintf(stderr," -p\t as -a, with the 180 phase cycled (EXORCYCLE)\n");
       return -1;
     }
   
@@ -1069,6 +1067,7 @@ int main(int argc, char *argv[])
   rx_freq = ((uint32_t *)(cfg + 4));
   rx_rate = ((uint32_t *)(cfg + 8));
   rx_cntr = ((uint16_t *)(sts + 0));
+  rx_engine_init(&rx, seq_config, pulseq_memory, rx_cntr, rx_data, rx_rate);
 
   //tx_rst = ((uint8_t *)(cfg + 1));
   tx_size = ((uint16_t *)(cfg + 12));
@@ -1125,6 +1124,7 @@ int main(int argc, char *argv[])
   {
     pulse[i] = 14*2300; //(int16_t)floor(8000.0 * sin(i * 2.0 * M_PI * tx_freq / 125.0e6) + 0.5);
   }
+  generate_phase_cycled_pulses(pulse, 14*2300);
 
   /*
   for(i = 16; i < 30; i=i+2)
@@ -1183,11 +1183,34 @@ int main(int argc, char *argv[])
 			return EXIT_FAILURE;
 		}
 		printf("%s \n", "Accepted client");
+		rx.sock_client = sock_client;
 		
 		if(seq_idx == 1) {
 			// Spin echo image, 128 matrix
 			update_pulse_sequence(4, pulseq_memory);
-			for(int avgs=0; avgs<36; avgs++) {
+			if(nex_mode != NEX_STREAM) {
+			// Average the repetitions of each line on the board, one line per phase encoding step
+			float pe_step = 2.936/44.53; //[A]
+			float pe = -63.0*pe_step;
+			update_gradient_waveforms_se(gradient_memory_x,gradient_memory_y,gradient_memory_z, 1.0, pe, gradient_offset);
+			for(int reps=0; reps<128; reps++) {
+				rx_average_clear(&avg, RX_SAMPLES_PER_TR);
+				for(int avgs=0; avgs<NEX_PROGRAM1; avgs++) {
+					const phase_cycle_t *pc = &exorcycle[nex_mode == NEX_AVERAGE_CYCLED ? avgs % 4 : 0];
+					pulseq_memory[SEQ4_TXOFFSET_180_WORD] = pc->tx_offset;
+					printf("TR[%d]: go!! (average %d)\n",reps,avgs);
+					rx_average_tr(&rx, &avg, buffer, pc->sign);
+					printf("stop !!\n");
+					usleep(4000000);
+				}
+				rx_average_send(&rx, &avg, buffer);
+
+				pe = pe+pe_step;
+				update_gradient_waveforms_se(gradient_memory_x,gradient_memory_y,gradient_memory_z, 1.0, pe, gradient_offset);
+			}
+			pulseq_memory[SEQ4_TXOFFSET_180_WORD] = exorcycle[0].tx_offset;
+			} else
+			for(int avgs=0; avgs<NEX_PROGRAM1; avgs++) {
 			// Phase encoding gradient loop
 			float pe_step = 2.936/44.53; //[A]
 			float pe = -63.0*pe_step;
@@ -1196,22 +1219,9 @@ int main(int argc, char *argv[])
 			for(int reps=0; reps<128; reps++) { 
 				printf("TR[%d]: go!!\n",reps);
      
-				seq_config[0] = 0x00000007;
-				usleep(1000000); // sleep 1 second
-
-				printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-      
-				// Transfer the data to the client
-				// transfer 10 * 5k = 50k samples
-				for(i = 0; i < 10; ++i)
-				{
-					while(*rx_cntr < 10000) usleep(500);
-					for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-					send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-				}
-
+				// start the sequence and send the samples to the client as they arrive
+				rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
 				printf("stop !!\n");
-				seq_config[0] = 0x00000000;
 			
 				pe = pe+pe_step;
 				update_gradient_waveforms_se(gradient_memory_x,gradient_memory_y,gradient_memory_z, 1.0, pe, gradient_offset);
@@ -1235,21 +1245,9 @@ int main(int argc, char *argv[])
 						generate_gradient_waveforms_se_proj(gradient_memory_x,gradient_memory_y,gradient_memory_z,1.0,GRAD_AXIS_Z,gradient_offset);
 					break;
 				}
-				seq_config[0] = 0x00000007;
-				usleep(1000000); // sleep 1 second
-
-				printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-      
-				// Transfer the data to the client
-				// transfer 10 * 5k = 50k samples
-				for(i = 0; i < 10; ++i)
-				{
-					while(*rx_cntr < 10000) usleep(500);
-					for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-					send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-				}
+				// start the sequence and send the samples to the client as they arrive
+				rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
 				printf("stop !!\n");
-				seq_config[0] = 0x00000000;
 				usleep(3000000);
 			}
 		} else if(seq_idx == 3) {
@@ -1265,22 +1263,9 @@ int main(int argc, char *argv[])
 		  for(int reps=0; reps<64; reps++) { 
 		    printf("TR[%d]: go!!\n",reps);
      
-		    seq_config[0] = 0x00000007;
-		    usleep(1000000); // sleep 1 second
-		    
-		    printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-		    
-		    // Transfer the data to the client
-		    // transfer 10 * 5k = 50k samples
-		    for(i = 0; i < 10; ++i)
-		      {
-			while(*rx_cntr < 10000) usleep(500);
-			for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-			send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-		      }
-
+		    // start the sequence and send the samples to the client as they arrive
+		    rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
 		    printf("stop !!\n");
-		    seq_config[0] = 0x00000000;
 		    
 		    pe = pe+pe_step;
 		    update_gradient_waveforms_se(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro, pe, gradient_offset);
@@ -1303,22 +1288,9 @@ int main(int argc, char *argv[])
 		    for(int reps=0; reps<64; reps++) { 
 		      printf("TR[%d]: go!!\n",parts*64+reps);
 		      
-		      seq_config[0] = 0x00000007;
-		      usleep(1000000); // sleep 1 second
-		      
-		      printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-		      
-		      // Transfer the data to the client
-		      // transfer 10 * 5k = 50k samples
-		      for(i = 0; i < 10; ++i)
-			{
-			  while(*rx_cntr < 10000) usleep(500);
-			  for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-			  send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-			}
-		      
+		      // start the sequence and send the samples to the client as they arrive
+		      rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
 		      printf("stop !!\n");
-		      seq_config[0] = 0x00000000;
 		      
 		      pe = pe+pe_step;
 		      update_gradient_waveforms_se3d(gradient_memory_x,gradient_memory_y,gradient_memory_z, ro, pe, pe2, gradient_offset);
@@ -1348,22 +1320,9 @@ int main(int argc, char *argv[])
 		  for(int reps=0; reps<1000; reps++) { 
 		    printf("TR[%d]: go!!\n",reps);
 		    
-		    seq_config[0] = 0x00000007;
-		    usleep(1000000); // sleep 1 second
-		    
-		    printf("Number of RX samples in FIFO: %d\n",*rx_cntr);
-		    
-		    // Transfer the data to the client
-		    // transfer 10 * 5k = 50k samples
-		    for(i = 0; i < 10; ++i)
-		      {
-			while(*rx_cntr < 10000) usleep(500);
-			for(j = 0; j < 5000; ++j) buffer[j] = *rx_data;
-			send(sock_client, buffer, 5000*8, MSG_NOSIGNAL | (i<9?MSG_MORE:0));
-		      }
-		    
+		    // start the sequence and send the samples to the client as they arrive
+		    rx_acquire_tr(&rx, buffer, RX_SAMPLES_PER_TR);
 		    printf("stop !!\n");
-		    seq_config[0] = 0x00000000;
 		    usleep(2000000);
 		  }
 		}